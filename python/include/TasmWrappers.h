@@ -58,6 +58,10 @@ public:
         : TASM(indexType, dbPath)
     {}
 
+    PythonTASM(const EnvironmentConfiguration &configuration, SemanticIndex::IndexType indexType)
+        : TASM(configuration, indexType)
+    {}
+
     void addBulkMetadataFromList(boost::python::list metadataInfo) {
         addBulkMetadata(extract<MetadataInfo>(metadataInfo));
     }
@@ -153,19 +157,89 @@ public:
         return activateRegretBasedTilingForVideo(video, metadataIdentifier, threshold);
     }
 
+    void pythonActivateRegretBasedTilingForVideo(const std::string &video,
+                                                 const std::string &metadataIdentifier,
+                                                 double threshold,
+                                                 bool retileInBackground) {
+        return activateRegretBasedTilingForVideo(video, metadataIdentifier, threshold, retileInBackground);
+    }
+
+    std::shared_ptr<QueryPlan> pythonExplain(const std::string &video, const std::string &label) {
+        return explain(video, label);
+    }
+
+    std::shared_ptr<QueryPlan> pythonExplain(const std::string &video, const std::string &label, unsigned int firstFrameInclusive, unsigned int lastFrameExclusive) {
+        return explain(video, label, firstFrameInclusive, lastFrameExclusive);
+    }
+
+    std::shared_ptr<QueryPlan> pythonExplain(const std::string &video, const std::string &label, unsigned int firstFrameInclusive, unsigned int lastFrameExclusive, SelectStrategy strategy) {
+        return explain(video, label, firstFrameInclusive, lastFrameExclusive, strategy);
+    }
+
+    void pythonSetRetilingBudgetForVideo(const std::string &video, double encodeSeconds) {
+        setRetilingBudgetForVideo(video, encodeSeconds);
+    }
+
+    void pythonSetRetilingBudgetForVideo(const std::string &video, double encodeSeconds, unsigned long long bytesWritten) {
+        setRetilingBudgetForVideo(video, encodeSeconds, bytesWritten);
+    }
+
+    void pythonSetRetilingBudgetForVideo(const std::string &video, double encodeSeconds, unsigned long long bytesWritten, double refillIntervalSeconds) {
+        setRetilingBudgetForVideo(video, encodeSeconds, bytesWritten, refillIntervalSeconds);
+    }
+
 };
 
+// Each read is a dict with the tile file, tile number, dimensions, and (first frame, number of frames, byte offset, number of bytes) for each GOP.
+p::list queryPlanTileReads(const QueryPlan &plan) {
+    p::list tileReads;
+    for (const auto &tileRead : plan.tileReads) {
+        p::list gopRanges;
+        for (const auto &range : tileRead.gopRanges)
+            gopRanges.append(p::make_tuple(range.firstFrame, range.numberOfFrames, range.byteOffset, range.numberOfBytes));
+
+        p::dict read;
+        read["file"] = tileRead.filename.string();
+        read["tile"] = tileRead.tileNumber;
+        read["width"] = tileRead.width;
+        read["height"] = tileRead.height;
+        read["gops"] = gopRanges;
+        tileReads.append(read);
+    }
+    return tileReads;
+}
+
+p::list queryPlanTileResolutions(const QueryPlan &plan) {
+    p::list resolutions;
+    for (const auto &resolution : plan.tileResolutions)
+        resolutions.append(p::make_tuple(resolution.first, resolution.second));
+    return resolutions;
+}
+
 PythonTASM *tasmFromWH(const std::string &whDBPath) {
     return new PythonTASM(SemanticIndex::IndexType::LegacyWH, whDBPath);
 }
 
-void configureEnvironment(const boost::python::dict &kwargs) {
+EnvironmentConfiguration environmentFromDict(const boost::python::dict &kwargs) {
     std::unordered_map<std::string, std::string> options;
     if (kwargs.contains("default_db_path"))
         options[EnvironmentConfiguration::DefaultLabelsDB] = boost::python::extract<std::string>(kwargs["default_db_path"]);
     if (kwargs.contains("catalog_path"))
         options[EnvironmentConfiguration::CatalogPath] = boost::python::extract<std::string>(kwargs["catalog_path"]);
-    EnvironmentConfiguration::instance(EnvironmentConfiguration(options));
+    return EnvironmentConfiguration(options);
+}
+
+void configureEnvironment(const boost::python::dict &kwargs) {
+    EnvironmentConfiguration::instance(environmentFromDict(kwargs));
+}
+
+// Unlike configureEnvironment(), only affects the returned instance.
+PythonTASM *tasmWithEnvironment(const boost::python::dict &kwargs, SemanticIndex::IndexType indexType) {
+    return new PythonTASM(environmentFromDict(kwargs), indexType);
+}
+
+PythonTASM *tasmWithEnvironmentAndXYIndex(const boost::python::dict &kwargs) {
+    return tasmWithEnvironment(kwargs, SemanticIndex::IndexType::XY);
 }
 
 } // namespace tasm::python;
@@ -119,7 +119,7 @@ public:
             unsigned int gopLength)
         : gopLength_(gopLength) {
         auto tiledEntry = std::make_shared<TiledEntry>("", resourcesPath, metadataIdentifier);
-        auto tiledVideoManager = std::make_shared<TiledVideoManager>(tiledEntry);
+        auto tiledVideoManager = TiledVideoManagerCache::instance().tiledVideoManager(tiledEntry);
         tileLocationProvider_ = std::make_shared<SingleTileLocationProvider>(tiledVideoManager);
     }
 
@@ -137,7 +137,7 @@ private:
 class PythonWorkloadCostEstimator {
 public:
     static CostElements estimateCostForWorkload(PythonWorkload &workload, PythonTiledVideo &video, TASM &tasm) {
-        auto workloadCostEstimator = WorkloadCostEstimator(video.tileLayoutProvider(), workload.toWorkload(tasm), video.gopLength());
+        auto workloadCostEstimator = WorkloadCostEstimator(video.tileLayoutProvider(), workload.toWorkload(tasm), video.gopLength(), ThreadPool::shared());
         return workloadCostEstimator.estimateCostForWorkload();
     }
 };
@@ -25,6 +25,13 @@ void (tasm::python::PythonTASM::*storeDoNotForceNonUniformLayout)(const std::str
 void (tasm::python::PythonTASM::*activateRegretBasedTilingWithoutMetadataIdentifier)(const std::string&) = &tasm::python::PythonTASM::pythonActivateRegretBasedTilingForVideo;
 void (tasm::python::PythonTASM::*activateRegretBasedTilingWithMetadataIdentifier)(const std::string&, const std::string&) = &tasm::python::PythonTASM::pythonActivateRegretBasedTilingForVideo;
 void (tasm::python::PythonTASM::*activateRegretBasedTilingWithThreshold)(const std::string&, const std::string&, double) = &tasm::python::PythonTASM::pythonActivateRegretBasedTilingForVideo;
+void (tasm::python::PythonTASM::*activateRegretBasedTilingInBackground)(const std::string&, const std::string&, double, bool) = &tasm::python::PythonTASM::pythonActivateRegretBasedTilingForVideo;
+std::shared_ptr<tasm::QueryPlan> (tasm::python::PythonTASM::*explainAll)(const std::string&, const std::string&) = &tasm::python::PythonTASM::pythonExplain;
+std::shared_ptr<tasm::QueryPlan> (tasm::python::PythonTASM::*explainRange)(const std::string&, const std::string&, unsigned int, unsigned int) = &tasm::python::PythonTASM::pythonExplain;
+std::shared_ptr<tasm::QueryPlan> (tasm::python::PythonTASM::*explainRangeWithStrategy)(const std::string&, const std::string&, unsigned int, unsigned int, tasm::SelectStrategy) = &tasm::python::PythonTASM::pythonExplain;
+void (tasm::python::PythonTASM::*setRetilingBudgetInSeconds)(const std::string&, double) = &tasm::python::PythonTASM::pythonSetRetilingBudgetForVideo;
+void (tasm::python::PythonTASM::*setRetilingBudgetInSecondsAndBytes)(const std::string&, double, unsigned long long) = &tasm::python::PythonTASM::pythonSetRetilingBudgetForVideo;
+void (tasm::python::PythonTASM::*setRetilingBudgetWithRefillInterval)(const std::string&, double, unsigned long long, double) = &tasm::python::PythonTASM::pythonSetRetilingBudgetForVideo;
 
 BOOST_PYTHON_MODULE(_tasm) {
     using namespace boost::python;
@@ -54,11 +61,34 @@ BOOST_PYTHON_MODULE(_tasm) {
             .value("XY", tasm::SemanticIndex::IndexType::XY)
             .value("InMemory", tasm::SemanticIndex::IndexType::InMemory);
 
+    enum_<tasm::RegretCostModel>("RegretCostModel")
+            .value("Pixels", tasm::RegretCostModel::Pixels)
+            .value("Bytes", tasm::RegretCostModel::Bytes);
+
+    enum_<tasm::SelectStrategy>("SelectStrategy")
+            .value("Objects", tasm::SelectStrategy::Objects)
+            .value("Tiles", tasm::SelectStrategy::Tiles)
+            .value("Frames", tasm::SelectStrategy::Frames);
+
+    class_<tasm::QueryPlan, std::shared_ptr<tasm::QueryPlan>>("QueryPlan", no_init)
+            .def("tile_reads", &tasm::python::queryPlanTileReads)
+            .def("tile_resolutions", &tasm::python::queryPlanTileResolutions)
+            .def("bytes_to_read", &tasm::QueryPlan::bytesToRead)
+            .def_readonly("decoder_reconfigurations", &tasm::QueryPlan::numberOfDecoderReconfigurations)
+            .def_readonly("estimated_cost", &tasm::QueryPlan::estimatedCost)
+            .def_readonly("untiled_cost", &tasm::QueryPlan::untiledCost)
+            .def_readonly("estimated_decode_seconds", &tasm::QueryPlan::estimatedDecodeSeconds)
+            .def_readonly("untiled_decode_seconds", &tasm::QueryPlan::untiledDecodeSeconds)
+            .def(self_ns::str(self_ns::self));
+
     class_<tasm::TASM, boost::noncopyable>("BaseTASM", no_init);
 
     // Warning: The WH-type of index does not have a "video" column for legacy reasons.
     def("tasm_from_db", &tasm::python::tasmFromWH, return_value_policy<manage_new_object>());
     def("configure_environment", &tasm::python::configureEnvironment);
+    // Takes the same options as configure_environment, but only the returned instance uses them.
+    def("tasm_with_environment", &tasm::python::tasmWithEnvironment, return_value_policy<manage_new_object>());
+    def("tasm_with_environment", &tasm::python::tasmWithEnvironmentAndXYIndex, return_value_policy<manage_new_object>());
 
     class_<tasm::python::PythonTASM, std::shared_ptr<tasm::python::PythonTASM>, bases<tasm::TASM>, boost::noncopyable>("TASM")
         .def(init<>())
@@ -69,6 +99,7 @@ BOOST_PYTHON_MODULE(_tasm) {
         .def("store_with_uniform_layout", &tasm::python::PythonTASM::storeWithUniformLayout)
         .def("store_with_nonuniform_layout", storeForceNonUniformLayout)
         .def("store_with_nonuniform_layout", storeDoNotForceNonUniformLayout)
+        .def("delete_video", &tasm::python::PythonTASM::deleteVideo)
         .def("select", selectRange)
         .def("select", selectEqual)
         .def("select", selectAll)
@@ -82,8 +113,24 @@ BOOST_PYTHON_MODULE(_tasm) {
         .def("activate_regret_based_tiling", activateRegretBasedTilingWithMetadataIdentifier)
         .def("activate_regret_based_tiling", activateRegretBasedTilingWithoutMetadataIdentifier)
         .def("activate_regret_based_tiling", activateRegretBasedTilingWithThreshold)
+        .def("activate_regret_based_tiling", activateRegretBasedTilingInBackground)
         .def("deactivate_regret_based_tiling", &tasm::python::PythonTASM::deactivateRegretBasedTilingForVideo)
-        .def("retile_based_on_regret", &tasm::python::PythonTASM::retileVideoBasedOnRegret);
+        .def("retile_based_on_regret", &tasm::python::PythonTASM::retileVideoBasedOnRegret)
+        .def("retile_based_on_regret_in_background", &tasm::python::PythonTASM::retileVideoBasedOnRegretInBackground)
+        .def("wait_for_background_retiling", &tasm::python::PythonTASM::waitForBackgroundRetiling)
+        .def("set_retiling_budget", setRetilingBudgetInSeconds)
+        .def("set_retiling_budget", setRetilingBudgetInSecondsAndBytes)
+        .def("set_retiling_budget", setRetilingBudgetWithRefillInterval)
+        .def("set_regret_cost_model", &tasm::python::PythonTASM::setRegretCostModelForVideo)
+        .def("explain", explainAll)
+        .def("explain", explainRange)
+        .def("explain", explainRangeWithStrategy)
+        .def("set_regret_decay", &tasm::python::PythonTASM::setRegretDecayForVideo)
+        .def("set_regret_history_length", &tasm::python::PythonTASM::setRegretHistoryLengthForVideo)
+        .def("set_retile_by_stitching", &tasm::python::PythonTASM::setRetileByStitchingForVideo)
+        .def("compact", &tasm::python::PythonTASM::compactVideo)
+        .def("set_compact_after_retiling", &tasm::python::PythonTASM::setCompactAfterRetilingForVideo)
+        .def("set_pack_tiles", &tasm::python::PythonTASM::setPackTilesForVideo);
 
     class_<tasm::python::Query>("Query", init<std::string, std::string, unsigned int, unsigned int>())
         .def(init<std::string, std::string>())
@@ -110,6 +157,7 @@ BOOST_PYTHON_MODULE(_tasm) {
     class_<tasm::CostElements>("CostElements", init<unsigned int, unsigned int>())
         .def_readonly("num_pixels", &tasm::CostElements::numPixels)
         .def_readonly("num_tiles", &tasm::CostElements::numTiles)
+        .def_readonly("num_bytes", &tasm::CostElements::numBytes)
         .def(self_ns::str(self_ns::self))
         .def(self_ns::repr(self_ns::self));
 
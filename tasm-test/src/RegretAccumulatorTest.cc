@@ -0,0 +1,291 @@
+#include "RegretAccumulator.h"
+#include <gtest/gtest.h>
+
+#include "CostModel.pb.h"
+#include "Files.h"
+#include "OnlineCostModel.h"
+#include "RetilingScheduler.h"
+#include "SemanticDataManager.h"
+#include "SemanticIndex.h"
+#include "SemanticSelection.h"
+#include <cassert>
+#include <fstream>
+#include <thread>
+
+using namespace tasm;
+
+class RegretAccumulatorTestFixture : public testing::Test {
+public:
+    RegretAccumulatorTestFixture() {}
+};
+
+static std::shared_ptr<Workload> workloadForObject(std::shared_ptr<SemanticIndex> semanticIndex, const std::string &video, const std::string &object) {
+    return std::make_shared<Workload>(std::make_shared<SemanticDataManager>(semanticIndex, video, std::make_shared<SingleMetadataSelection>(object)));
+}
+
+static std::set<unsigned int> retiledGOPs(RegretAccumulator &accumulator) {
+    std::set<unsigned int> gops;
+    auto layouts = accumulator.getNewGOPLayouts();
+    for (auto it = layouts->begin(); it != layouts->end(); ++it)
+        gops.insert(it->first);
+    return gops;
+}
+
+TEST_F(RegretAccumulatorTestFixture, testRestorePersistedState) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("video");
+    unsigned int gopLength = 10;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    for (auto i = 0u; i < 10 * gopLength; ++i) {
+        semanticIndex->addMetadata(video, "fish", i, 100, 100, 300, 250);
+        if (i < 5 * gopLength)
+            semanticIndex->addMetadata(video, "bird", i, 1200, 600, 1500, 900);
+    }
+
+    auto directory = std::experimental::filesystem::temp_directory_path() / "tasm-regret-test";
+    std::experimental::filesystem::remove_all(directory);
+    std::experimental::filesystem::create_directories(directory);
+
+    auto currentLayout = std::make_shared<SingleTileConfigurationProvider>(width, height);
+    double threshold = 0.5;
+    RegretAccumulator original(semanticIndex, video, width, height, gopLength, threshold);
+    original.persistTo(directory);
+    original.addRegretForQuery(workloadForObject(semanticIndex, video, "fish"), currentLayout);
+    original.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+
+    RegretAccumulator restored(semanticIndex, video, width, height, gopLength, threshold);
+    restored.persistTo(directory);
+
+    // Both accumulators should make the same decisions for the same future queries.
+    original.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    restored.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    auto originalGOPs = retiledGOPs(original);
+    assert(!originalGOPs.empty());
+    assert(originalGOPs == retiledGOPs(restored));
+
+    // Restoring again picks up the retiled GOPs and the dropped queries.
+    RegretAccumulator restoredAfterRetiling(semanticIndex, video, width, height, gopLength, threshold);
+    restoredAfterRetiling.persistTo(directory);
+
+    original.addRegretForQuery(workloadForObject(semanticIndex, video, "fish"), currentLayout);
+    restoredAfterRetiling.addRegretForQuery(workloadForObject(semanticIndex, video, "fish"), currentLayout);
+    assert(retiledGOPs(original) == retiledGOPs(restoredAfterRetiling));
+
+    std::experimental::filesystem::remove_all(directory);
+}
+
+TEST_F(RegretAccumulatorTestFixture, testRetilingSchedulerRespectsBudget) {
+    std::vector<RetilingCandidate> candidates{
+            {3, "fish", 40, 10},
+            {1, "fish", 30, 10},
+            {7, "bird", 20, 10},
+            {2, "bird", 10, 10},
+    };
+    std::unordered_map<unsigned int, unsigned long long> bytesForGOP{{3, 150}, {1, 150}, {7, 100}, {2, 100}};
+    auto bytes = [&](unsigned int gop) { return bytesForGOP.at(gop); };
+
+    RetilingScheduler unlimited;
+    assert(unlimited.candidatesForPass(candidates, bytes).size() == candidates.size());
+
+    RetilingBudget secondsBudget;
+    secondsBudget.encodeSeconds = 25;
+    auto selected = RetilingScheduler(secondsBudget).candidatesForPass(candidates, bytes);
+    assert(selected.size() == 2);
+    assert(selected[0].gop == 3);
+    assert(selected[1].gop == 1);
+
+    // A GOP that doesn't fit in what's left is skipped, but lower-priority ones that do fit are still taken.
+    RetilingBudget bytesBudget;
+    bytesBudget.bytesWritten = 250;
+    selected = RetilingScheduler(bytesBudget).candidatesForPass(candidates, bytes);
+    assert(selected.size() == 2);
+    assert(selected[0].gop == 3);
+    assert(selected[1].gop == 7);
+
+    // A GOP that is larger than the entire budget is still retiled on its own.
+    RetilingBudget tinyBudget;
+    tinyBudget.encodeSeconds = 1;
+    selected = RetilingScheduler(tinyBudget).candidatesForPass(candidates, bytes);
+    assert(selected.size() == 1);
+    assert(selected[0].gop == 3);
+}
+
+TEST_F(RegretAccumulatorTestFixture, testRetilingBudgetRefillsOverTime) {
+    std::vector<RetilingCandidate> candidates{
+            {3, "fish", 40, 10},
+            {1, "fish", 30, 10},
+            {7, "bird", 20, 10},
+    };
+    auto bytes = [](unsigned int) { return 0ull; };
+
+    RetilingBudget budget;
+    budget.encodeSeconds = 25;
+    budget.refillIntervalSeconds = 60;
+    auto start = RetilingScheduler::Clock::now();
+    RetilingScheduler scheduler(budget, start);
+    assert(scheduler.candidatesForPass(candidates, bytes, start).size() == 2);
+
+    // The pass took longer than estimated, so nothing is left until the budget refills.
+    scheduler.charge(30, 0);
+    assert(scheduler.candidatesForPass(candidates, bytes, start).empty());
+
+    // Half an interval refills half of the budget, which leaves 7.5 seconds after paying off the overspending.
+    assert(scheduler.candidatesForPass(candidates, bytes, start + std::chrono::seconds(30)).empty());
+    auto selected = scheduler.candidatesForPass(candidates, bytes, start + std::chrono::seconds(45));
+    assert(selected.size() == 1);
+    assert(selected[0].gop == 3);
+
+    // The budget never refills past its limit, however long retiling is idle.
+    scheduler.charge(10, 0);
+    selected = scheduler.candidatesForPass(candidates, bytes, start + std::chrono::hours(1));
+    assert(selected.size() == 2);
+}
+
+TEST_F(RegretAccumulatorTestFixture, testRecursiveLeastSquaresConvergesToCostWeights) {
+    // Start from weights that are far off to check that observations pull them to the true costs.
+    RecursiveLeastSquares model({10, 10}, 1.0, 0.98);
+    for (auto i = 0u; i < 200; ++i) {
+        double megapixels = 5 + (i * 37) % 50;
+        double tiles = 1 + (i * 11) % 30;
+        model.addObservation({megapixels, tiles}, 2.0 * megapixels + 0.5 * tiles);
+    }
+
+    assert(model.numberOfObservations() == 200);
+    assert(std::abs(model.weights()[0] - 2.0) < 1e-3);
+    assert(std::abs(model.weights()[1] - 0.5) < 1e-3);
+}
+
+TEST_F(RegretAccumulatorTestFixture, testCostModelSavesAreThrottled) {
+    auto directory = std::experimental::filesystem::temp_directory_path() / "tasm-cost-model-test";
+    std::experimental::filesystem::remove_all(directory);
+    std::experimental::filesystem::create_directories(directory);
+
+    auto savedEncodeObservations = [&]() {
+        lightdb::serialization::CostModel saved;
+        std::ifstream input(TileFiles::costModelFilename(directory), std::ios::binary);
+        assert(saved.ParseFromIstream(&input));
+        return saved.encode().numberofobservations();
+    };
+
+    // The first observation is saved right away, and the ones that follow soon after wait for the next save.
+    auto &model = OnlineCostModel::forCatalog(directory);
+    model.addEncodeObservation(2000000, 1, 5);
+    assert(savedEncodeObservations() == 1);
+    model.addEncodeObservation(4000000, 2, 10);
+    assert(savedEncodeObservations() == 1);
+
+    // Saves don't leave temporary files behind.
+    for (const auto &entry : std::experimental::filesystem::directory_iterator(directory))
+        assert(entry.path() == TileFiles::costModelFilename(directory) || entry.path() == TileFiles::catalogLockFilename(directory));
+
+    std::experimental::filesystem::remove_all(directory);
+}
+
+TEST_F(RegretAccumulatorTestFixture, testRegretDecayForgetsOldQueries) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("video");
+    unsigned int gopLength = 10;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    for (auto i = 0u; i < 10 * gopLength; ++i)
+        semanticIndex->addMetadata(video, "bird", i, 1200, 600, 1500, 900);
+    auto currentLayout = std::make_shared<SingleTileConfigurationProvider>(width, height);
+
+    // Without decay, a few queries accumulate enough regret to retile.
+    RegretAccumulator withoutDecay(semanticIndex, video, width, height, gopLength);
+    for (auto i = 0u; i < 3; ++i)
+        withoutDecay.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    assert(!withoutDecay.retilingCandidates().empty());
+
+    // With decay, regret levels off below the threshold no matter how many queries run.
+    auto directory = std::experimental::filesystem::temp_directory_path() / "tasm-regret-decay-test";
+    std::experimental::filesystem::remove_all(directory);
+    std::experimental::filesystem::create_directories(directory);
+
+    RegretAccumulator withDecay(semanticIndex, video, width, height, gopLength);
+    withDecay.persistTo(directory);
+    withDecay.setRegretDecay(0.5);
+    withDecay.setHistoryLength(2);
+    for (auto i = 0u; i < 10; ++i)
+        withDecay.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    assert(withDecay.retilingCandidates().empty());
+
+    // Decay is replayed when the state is restored.
+    RegretAccumulator restored(semanticIndex, video, width, height, gopLength, 0.5);
+    restored.persistTo(directory);
+    RegretAccumulator original(semanticIndex, video, width, height, gopLength, 0.5);
+    for (auto i = 0u; i < 10; ++i)
+        original.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    auto restoredCandidates = restored.retilingCandidates();
+    assert(!restoredCandidates.empty());
+    assert(restoredCandidates.front().regret < original.retilingCandidates().front().regret / 2);
+
+    std::experimental::filesystem::remove_all(directory);
+}
+
+TEST_F(RegretAccumulatorTestFixture, testHistoricalRegretIsDecayedForNewLayouts) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("video");
+    unsigned int gopLength = 10;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    for (auto i = 0u; i < 10 * gopLength; ++i)
+        semanticIndex->addMetadata(video, "bird", i, 1200, 600, 1500, 900);
+    for (auto i = 10 * gopLength; i < 20 * gopLength; ++i)
+        semanticIndex->addMetadata(video, "cat", i, 100, 100, 400, 400);
+    auto currentLayout = std::make_shared<SingleTileConfigurationProvider>(width, height);
+
+    RegretAccumulator accumulator(semanticIndex, video, width, height, gopLength);
+    accumulator.setRegretDecay(0.5);
+    for (auto i = 0u; i < 10; ++i)
+        accumulator.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    assert(accumulator.retilingCandidates().empty());
+
+    // Querying a new object adds a layout for both objects. The bird queries count towards it only as much as they
+    // still count towards the bird layout, so the GOPs stay below the threshold.
+    accumulator.addRegretForQuery(workloadForObject(semanticIndex, video, "cat"), currentLayout);
+    for (const auto &candidate : accumulator.retilingCandidates())
+        assert(candidate.gop >= 10);
+}
+
+TEST_F(RegretAccumulatorTestFixture, testRegretIsKeptUntilRetileIsCommitted) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("video");
+    unsigned int gopLength = 10;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    for (auto i = 0u; i < 10 * gopLength; ++i)
+        semanticIndex->addMetadata(video, "bird", i, 1200, 600, 1500, 900);
+    auto currentLayout = std::make_shared<SingleTileConfigurationProvider>(width, height);
+
+    RegretAccumulator accumulator(semanticIndex, video, width, height, gopLength);
+    for (auto i = 0u; i < 3; ++i)
+        accumulator.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    auto candidates = accumulator.retilingCandidates();
+    assert(!candidates.empty());
+
+    // Queries keep adding regret while a retiling pass picks layouts.
+    std::thread query([&]() {
+        for (auto i = 0u; i < 3; ++i)
+            accumulator.addRegretForQuery(workloadForObject(semanticIndex, video, "bird"), currentLayout);
+    });
+    auto layouts = accumulator.newGOPLayoutsForCandidates(candidates);
+    query.join();
+    assert(layouts->size() == candidates.size());
+
+    // The retile failed, so the GOPs are still candidates.
+    auto remainingCandidates = accumulator.retilingCandidates();
+    assert(remainingCandidates.size() == candidates.size());
+    assert(remainingCandidates.front().regret >= candidates.front().regret);
+
+    std::vector<unsigned int> gops;
+    for (const auto &candidate : candidates)
+        gops.push_back(candidate.gop);
+    accumulator.markGOPsAsRetiled(gops);
+    assert(accumulator.retilingCandidates().empty());
+}
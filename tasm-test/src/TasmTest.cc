@@ -97,3 +97,37 @@ TEST_F(TasmTestFixture, testScanBirdsFullFrame) {
         ++count;
     std::cout << "Tiled vid: retrieved " << count << " frames" << std::endl;
 }
+
+TEST_F(TasmTestFixture, testExplainBirds) {
+    tasm::TASM tasm(SemanticIndex::IndexType::XY, "/home/maureen/home_videos/birds_tasm.db");
+    auto plan = tasm.explain("birds-birds", "bird", 0, 5, SelectStrategy::Objects, "birds");
+    std::cout << *plan << std::endl;
+
+    assert(!plan->tileReads.empty());
+    assert(plan->bytesToRead() > 0);
+    assert(!plan->tileResolutions.empty());
+    assert(plan->estimatedCost.numPixels <= plan->untiledCost.numPixels);
+
+    // Stitching full frames reads every tile but only decodes one resolution.
+    auto framesPlan = tasm.explain("birds-birds", "bird", 0, 5, SelectStrategy::Frames, "birds");
+    assert(framesPlan->tileResolutions.size() == 1);
+    assert(framesPlan->bytesToRead() >= plan->bytesToRead());
+}
+
+TEST_F(TasmTestFixture, testInstancesUseTheirOwnCatalogs) {
+    auto hotCatalog = std::experimental::filesystem::temp_directory_path() / "tasm-hot-catalog";
+    auto coldCatalog = std::experimental::filesystem::temp_directory_path() / "tasm-cold-catalog";
+    std::experimental::filesystem::remove_all(hotCatalog);
+    std::experimental::filesystem::remove_all(coldCatalog);
+
+    tasm::TASM hot(EnvironmentConfiguration({{EnvironmentConfiguration::CatalogPath, hotCatalog}}), SemanticIndex::IndexType::InMemory);
+    tasm::TASM cold(EnvironmentConfiguration({{EnvironmentConfiguration::CatalogPath, coldCatalog}}), SemanticIndex::IndexType::InMemory);
+    hot.setPackTilesForVideo("red10", true);
+
+    assert(std::experimental::filesystem::exists(coldCatalog));
+    assert(std::experimental::filesystem::exists(hotCatalog / "red10"));
+    assert(!std::experimental::filesystem::exists(coldCatalog / "red10"));
+
+    std::experimental::filesystem::remove_all(hotCatalog);
+    std::experimental::filesystem::remove_all(coldCatalog);
+}
@@ -1,9 +1,25 @@
 #include "VideoManager.h"
 #include <gtest/gtest.h>
 
+#include "CatalogStorage.h"
+#include "CompactTiles.h"
+#include "Files.h"
+#include "FrameRunIndex.h"
+#include "Gpac.h"
+#include "MP4Reader.h"
+#include "MP4Writer.h"
+#include "ScanTiledVideoOperator.h"
+#include "SemanticDataManager.h"
 #include "SemanticIndex.h"
+#include "TileLocationProvider.h"
+#include "TileManifest.h"
+#include "TileManifest.pb.h"
+#include "TilePack.h"
+#include "TiledVideoManager.h"
+#include "Transaction.h"
 #include "Video.h"
 #include <cassert>
+#include <fstream>
 
 using namespace tasm;
 
@@ -23,6 +39,719 @@ TEST_F(VideoManagerTestFixture, testLoadVideoConfiguration) {
     assert(vid.configuration().codec == Codec::HEVC);
 }
 
+TEST_F(VideoManagerTestFixture, testCatalogCacheIsInvalidatedByCommit) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-catalog-cache-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("catalog-cache-test", path);
+    TileLayout layout(1, 1, {320}, {240});
+    auto directory = TileFiles::directoryForTilesInFrames(*entry, 0, 9);
+    std::experimental::filesystem::create_directory(directory);
+    gpac::write_tile_configuration(TileFiles::tileMetadataFilename(directory), layout);
+    entry->allocateTileVersion();
+
+    auto &cache = TiledVideoManagerCache::instance();
+    auto manager = cache.tiledVideoManager(entry);
+    assert(cache.tiledVideoManager(entry) == manager);
+    assert(manager->maximumFrame() == 9);
+
+    // Publishing new tiles makes the next lookup re-read the catalog.
+    TileCrackingTransaction(entry, layout, 10, 19).commit();
+    auto updatedManager = cache.tiledVideoManager(entry);
+    assert(updatedManager != manager);
+    assert(updatedManager->maximumFrame() == 19);
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testLoadCatalogFromManifest) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-manifest-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("manifest-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout retiledLayout(1, 1, {320}, {240});
+    TileCrackingTransaction(entry, layout, 0, 29).commit();
+    TileCrackingTransaction(entry, retiledLayout, 0, 9).commit();
+    assert(TileManifest(path).exists());
+
+    // The manifest is the source of truth, so the directories' metadata isn't read.
+    for (auto &dir : std::experimental::filesystem::directory_iterator(path)) {
+        if (std::experimental::filesystem::is_directory(dir.status()))
+            std::experimental::filesystem::remove(TileFiles::tileMetadataFilename(dir.path()));
+    }
+
+    TiledVideoManager manager(entry);
+    assert(manager.maximumFrame() == 29);
+    assert(*manager.tileLayoutForId(manager.tileLayoutIdForFrame(5)) == retiledLayout);
+    assert(*manager.tileLayoutForId(manager.tileLayoutIdForFrame(20)) == layout);
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testTornManifestRecordIsRepairedByNextCommit) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-torn-manifest-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("torn-manifest-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout retiledLayout(1, 1, {320}, {240});
+    TileCrackingTransaction(entry, layout, 0, 29).commit();
+    TileCrackingTransaction(entry, layout, 30, 59).commit();
+
+    // A writer that dies mid-append leaves part of a record at the end of the log.
+    {
+        std::ofstream log(TileFiles::tileManifestLogFilename(path), std::ios::binary | std::ios::app);
+        log << static_cast<char>(100) << "torn";
+    }
+    assert(TiledVideoManager(entry).maximumFrame() == 59);
+
+    TileCrackingTransaction(entry, retiledLayout, 0, 9).commit();
+    TiledVideoManager manager(entry);
+    assert(manager.maximumFrame() == 59);
+    assert(*manager.tileLayoutForId(manager.tileLayoutIdForFrame(5)) == retiledLayout);
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testFrameRunIndexPrefersNewestInterval) {
+    // The original layout covers frames 0-89, GOP 1 was retiled twice, and frames 120-149 are missing.
+    FrameRunIndex index({{0, 89, 0}, {30, 59, 3}, {30, 59, 1}, {60, 89, 2}, {150, 179, 4}});
+
+    assert(index.runs().size() == 4);
+    assert(*index.idForFrame(0) == 0);
+    assert(*index.idForFrame(29) == 0);
+    assert(*index.idForFrame(30) == 3);
+    assert(*index.idForFrame(59) == 3);
+    assert(*index.idForFrame(75) == 2);
+    assert(!index.idForFrame(90).has_value());
+    assert(!index.idForFrame(149).has_value());
+    assert(*index.idForFrame(179) == 4);
+    assert(!index.idForFrame(180).has_value());
+}
+
+TEST_F(VideoManagerTestFixture, testDetectLayoutsThatMergeStoredTiles) {
+    TileLayout stored(3, 2, {320, 320, 320}, {256, 288});
+
+    // Dropping the middle column boundary merges whole tiles.
+    assert(TileLayout(2, 2, {640, 320}, {256, 288}).isCoarseningOf(stored));
+    assert(TileLayout(1, 1, {960}, {544}).isCoarseningOf(stored));
+
+    // A new boundary, a different size, or the same layout can't be produced by merging.
+    assert(!TileLayout(2, 2, {480, 480}, {256, 288}).isCoarseningOf(stored));
+    assert(!TileLayout(1, 1, {960}, {512}).isCoarseningOf(stored));
+    assert(!stored.isCoarseningOf(stored));
+    assert(!stored.isCoarseningOf(TileLayout(1, 1, {960}, {544})));
+}
+
+TEST_F(VideoManagerTestFixture, testConcurrentWritersClaimDifferentVersions) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-version-allocation-test";
+    std::experimental::filesystem::remove_all(path);
+    // Entries opened by separate writers, like ingest workers in different processes, see the same version.
+    auto firstWriter = std::make_shared<TiledEntry>("version-allocation-test", path);
+    auto secondWriter = std::make_shared<TiledEntry>("version-allocation-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout otherLayout(1, 1, {320}, {240});
+    {
+        TileCrackingTransaction first(firstWriter, layout, 0, 9);
+        TileCrackingTransaction second(secondWriter, otherLayout, 0, 9);
+        second.commit();
+        first.commit();
+    }
+
+    TiledVideoManager manager(firstWriter);
+    assert(manager.tileLayoutIdsForFrames(0, 9) == std::vector<int>({1, 0}));
+    assert(*manager.tileLayoutForId(0) == otherLayout);
+    assert(*manager.tileLayoutForId(1) == layout);
+    assert(TiledEntry("version-allocation-test", path).tile_version() == 2);
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testCompactionWaitsForReadersOfRemovedVersions) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-compaction-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("compaction-test", path);
+    TileCrackingTransaction(entry, TileLayout(2, 1, {160, 160}, {240}), 0, 29).commit();
+    auto shadowedDirectory = TileFiles::directoryForTilesInFrames(path, 0, 29, 0);
+    TileLayout retiledLayout(1, 1, {320}, {240});
+    TileCrackingTransaction(entry, retiledLayout, 0, 29).commit();
+
+    auto &cache = TiledVideoManagerCache::instance();
+    auto runningQueryManager = cache.tiledVideoManager(entry);
+
+    // The shadowed version leaves the catalog right away, but its files stay while a query may read them.
+    auto statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(statistics.numberOfRemovedDirectories == 1);
+    assert(!statistics.numberOfDeletedDirectories);
+    assert(std::experimental::filesystem::exists(shadowedDirectory));
+    auto manager = cache.tiledVideoManager(entry);
+    assert(manager != runningQueryManager);
+    assert(*manager->tileLayoutForId(manager->tileLayoutIdForFrame(0)) == retiledLayout);
+
+    runningQueryManager.reset();
+    statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(!statistics.numberOfRemovedDirectories);
+    assert(statistics.numberOfDeletedDirectories == 1);
+    assert(!std::experimental::filesystem::exists(shadowedDirectory));
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testStitchedTilesAreReadAsFullFramesFromTheirSource) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-stitched-source-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("stitched-source-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout stitchedLayout(1, 1, {320}, {240});
+    TileCrackingTransaction(entry, layout, 0, 29).commit();
+    {
+        TileCrackingTransaction transaction(entry, stitchedLayout, 0, 29);
+        transaction.markTilesAsStitched();
+        transaction.commit();
+    }
+
+    // Full frames come from the tiles that were stitched, so compaction keeps them.
+    auto statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(!statistics.numberOfRemovedDirectories);
+    auto manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    assert(*SingleTileLocationProvider(manager).tileLayoutForFrame(5) == stitchedLayout);
+    assert(*FullFrameTileLocationProvider(manager).tileLayoutForFrame(5) == layout);
+    assert(FullFrameTileLocationProvider(manager).locationOfTileForFrame(1, 5) == TileFiles::tileFilename(TileFiles::directoryForTilesInFrames(path, 0, 29, 0), 1));
+
+    // Once the GOP is retiled, neither is read.
+    TileCrackingTransaction(entry, stitchedLayout, 0, 29).commit();
+    statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(statistics.numberOfRemovedDirectories == 2);
+    manager.reset();
+    assert(compactTiles(entry, CompactionPolicy::KeepNewestOnly).numberOfDeletedDirectories == 2);
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testRetilingReadsEveryStoredTileOfTheGOP) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-retile-source-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("retile-source-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout untiledLayout(1, 1, {320}, {240});
+    auto storeGOP = [&](const TileLayout &gopLayout, unsigned int firstFrame) {
+        TileCrackingTransaction transaction(entry, gopLayout, firstFrame, firstFrame + 29);
+        std::vector<unsigned int> tileNumbers;
+        for (auto tile = 0u; tile < gopLayout.numberOfTiles(); ++tile)
+            tileNumbers.push_back(tile);
+        transaction.writeTiles(tileNumbers, [&](unsigned int, OutputStream &output) {
+            for (auto frame = 0u; frame < 30; ++frame) {
+                std::string slice = frame ? std::string("\0\0\0\1\x02\1\x80", 7) : std::string("\0\0\0\1\x26\1\x80", 7);
+                auto sample = std::string("\0\0\0\1\x46\1\x50", 7) + slice + 'x';
+                output.write(sample.data(), sample.size());
+            }
+        });
+    };
+    storeGOP(layout, 0);
+    storeGOP(untiledLayout, 30);
+
+    // Retiling the first GOP reads all of it from every tile it is stored with, and nothing from the second GOP.
+    auto frames = std::make_shared<std::vector<int>>();
+    for (auto frame = 0; frame < 30; ++frame)
+        frames->push_back(frame);
+    auto manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    auto tileReads = ScanFullFramesFromTiledVideoOperator(entry, frames, std::make_shared<FullFrameTileLocationProvider>(manager)).plannedTileReads();
+    assert(tileReads.size() == 2);
+    for (auto tile = 0u; tile < tileReads.size(); ++tile) {
+        assert(tileReads[tile].tileNumber == tile);
+        assert(tileReads[tile].filename == TileFiles::tileFilename(TileFiles::directoryForTilesInFrames(path, 0, 29, 0), tile));
+        assert(tileReads[tile].gopRanges.size() == 1);
+        assert(tileReads[tile].gopRanges.front().firstFrame == 0);
+        assert(tileReads[tile].gopRanges.front().numberOfFrames == 30);
+    }
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testCompactionWaitsForReadersInOtherProcesses) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-pinned-compaction-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("pinned-compaction-test", path);
+    TileCrackingTransaction(entry, TileLayout(2, 1, {160, 160}, {240}), 0, 29).commit();
+    auto shadowedDirectory = TileFiles::directoryForTilesInFrames(path, 0, 29, 0);
+    TileCrackingTransaction(entry, TileLayout(1, 1, {320}, {240}), 0, 29).commit();
+
+    // A manager that didn't come from this process's cache stands in for a query running in another process.
+    auto otherProcessManager = std::make_unique<TiledVideoManager>(std::make_shared<TiledEntry>("pinned-compaction-test", path));
+    auto statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(statistics.numberOfRemovedDirectories == 1);
+    assert(!statistics.numberOfDeletedDirectories);
+    assert(std::experimental::filesystem::exists(shadowedDirectory));
+
+    // Readers that list the catalog after the removal don't keep the directory.
+    TiledVideoManager laterManager(std::make_shared<TiledEntry>("pinned-compaction-test", path));
+    otherProcessManager.reset();
+    assert(TiledVideoManagerCache::instance().collectGarbage() == 1);
+    assert(!std::experimental::filesystem::exists(shadowedDirectory));
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testCachedManagerIsReloadedAfterCommitInOtherProcess) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-other-process-commit-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("other-process-commit-test", path);
+    TileCrackingTransaction(entry, TileLayout(2, 1, {160, 160}, {240}), 0, 29).commit();
+    auto shadowedDirectory = TileFiles::directoryForTilesInFrames(path, 0, 29, 0);
+
+    auto &cache = TiledVideoManagerCache::instance();
+    auto staleManager = cache.tiledVideoManager(entry);
+
+    // Another process publishes through the storage directly, so this process's cache isn't invalidated.
+    TileLayout retiledLayout(1, 1, {320}, {240});
+    auto storage = CatalogStorage::forPath(path);
+    auto stagingDirectory = TileFiles::stagingDirectoryForTilesInFrames(path, 0, 29, "other-process");
+    storage->stageDirectory(stagingDirectory);
+    auto version = storage->allocateTileVersion(path);
+    assert(storage->publish(stagingDirectory, TileFiles::directoryForTilesInFrames(path, 0, 29, version), retiledLayout, false));
+
+    auto manager = cache.tiledVideoManager(entry);
+    assert(manager != staleManager);
+    assert(*manager->tileLayoutForId(manager->tileLayoutIdForFrame(0)) == retiledLayout);
+
+    // Once its last query finishes, the replaced manager no longer pins the listing it was loaded from.
+    assert(storage->hasPinnedListingsBefore(path, version));
+    staleManager.reset();
+    assert(!storage->hasPinnedListingsBefore(path, version));
+
+    manager.reset();
+    auto statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(statistics.numberOfRemovedDirectories == 1);
+    assert(statistics.numberOfDeletedDirectories == 1);
+    assert(!std::experimental::filesystem::exists(shadowedDirectory));
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testMuxAccessUnitsSplitAcrossWrites) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-mux-test.mp4";
+    // An IDR picture with two slice segments, then a trailing picture, each starting with a delimiter.
+    const char data[] = "\0\0\0\1\x46\1\x50"
+                        "\0\0\0\1\x26\1\x80\x11\x11"
+                        "\0\0\1\x26\1\x20\x11"
+                        "\0\0\0\1\x46\1\x50"
+                        "\0\0\0\1\x02\1\x80\x11";
+    std::string stream(data, sizeof(data) - 1);
+
+    MP4Writer writer(path, MP4Writer::DefaultFrameRate);
+    for (auto &byte : stream)
+        writer.write(&byte, 1);
+    writer.close();
+
+    assert(writer.numberOfSamples() == 2);
+    assert(writer.keyframeNumbers() == std::vector<int>{0});
+    assert(std::experimental::filesystem::file_size(path) > stream.size());
+    std::experimental::filesystem::remove(path);
+}
+
+TEST_F(VideoManagerTestFixture, testTilesAreTimedAtTheSourceFrameRate) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-frame-rate-test";
+    auto packedPath = std::experimental::filesystem::temp_directory_path() / "tasm-packed-frame-rate-test";
+    std::experimental::filesystem::remove_all(path);
+    std::experimental::filesystem::remove_all(packedPath);
+    auto entry = std::make_shared<TiledEntry>("frame-rate-test", path);
+    auto packedEntry = std::make_shared<TiledEntry>("packed-frame-rate-test", packedPath);
+    std::ofstream(TileFiles::packTilesMarkerFilename(packedPath));
+
+    std::string stream = std::string("\0\0\0\1\x46\1\x50", 7) + std::string("\0\0\0\1\x26\1\x80", 7) + 'x'
+            + std::string("\0\0\0\1\x46\1\x50", 7) + std::string("\0\0\0\1\x02\1\x80", 7) + 'x';
+    for (const auto &tiledEntry : {entry, packedEntry}) {
+        TileCrackingTransaction transaction(tiledEntry, TileLayout(1, 1, {320}, {240}), 0, 1, 30);
+        transaction.writeTiles({0}, [&](unsigned int, OutputStream &output) {
+            output.write(stream.data(), stream.size());
+        });
+    }
+
+    // mdhd's timescale and stts's sample duration give the frame rate.
+    std::ifstream input(TileFiles::tileFilename(TileFiles::directoryForTilesInFrames(path, 0, 1, 0), 0), std::ios::binary);
+    std::string file((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    auto readU32 = [&](size_t offset) {
+        unsigned int value = 0;
+        for (auto i = 0u; i < 4; ++i)
+            value = (value << 8) | static_cast<unsigned char>(file[offset + i]);
+        return value;
+    };
+    auto timescale = readU32(file.find("mdhd") + 16);
+    auto sampleDuration = readU32(file.find("stts") + 16);
+    assert(readU32(file.find("stts") + 12) == 2);
+    assert(timescale / sampleDuration == 30);
+
+    auto pack = TilePack::openFile(TileFiles::tilePackFilename(TileFiles::directoryForTilesInFrames(packedPath, 0, 1, 0)));
+    assert(pack);
+    assert(pack->frameRate() == 30);
+
+    std::experimental::filesystem::remove_all(path);
+    std::experimental::filesystem::remove_all(packedPath);
+}
+
+TEST_F(VideoManagerTestFixture, testMP4ReaderReadsSampleTableNatively) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-sample-index-test.mp4";
+    // A PPS, an IDR picture with two slice segments, then a trailing picture.
+    const char data[] = "\0\0\0\1\x44\1\xc0"
+                        "\0\0\0\1\x26\1\x80\x11\x11"
+                        "\0\0\1\x26\1\x20\x11"
+                        "\0\0\0\1\x02\1\x80\x11";
+    {
+        MP4Writer writer(path, MP4Writer::DefaultFrameRate);
+        writer.write(data, sizeof(data) - 1);
+        writer.close();
+    }
+
+    MP4Reader reader(path);
+    assert(reader.numberOfSamples() == 2);
+    assert(reader.keyframeNumbers() == std::vector<int>{0});
+    assert(reader.sampleSizes() == std::vector<unsigned int>({17, 8}));
+    assert(reader.byteRangeForSamples(2, 2).second == 8);
+
+    // The parameter set moves to the configuration, and comes back in front of the keyframe.
+    auto samples = reader.dataForSamples(1, 2);
+    std::string expected("\0\0\0\1\x44\1\xc0"
+                         "\0\0\0\1\x26\1\x80\x11\x11"
+                         "\0\0\0\1\x26\1\x20\x11"
+                         "\0\0\0\1\x02\1\x80\x11", 32);
+    assert(std::string(samples->begin(), samples->end()) == expected);
+    auto copy = reader;
+    samples = copy.dataForSamples(2, 2);
+    assert(std::string(samples->begin(), samples->end()) == expected.substr(24));
+    std::experimental::filesystem::remove(path);
+}
+
+TEST_F(VideoManagerTestFixture, testFailedTileWriteLeavesNothingVisible) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-failed-write-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("failed-write-test", path);
+
+    {
+        TileCrackingTransaction transaction(entry, TileLayout(2, 1, {160, 160}, {240}), 0, 29);
+        bool didThrow = false;
+        try {
+            transaction.writeTiles({0, 1}, [](unsigned int tileNumber, OutputStream &) {
+                if (tileNumber == 1)
+                    throw std::runtime_error("Failed to encode tile");
+            });
+        } catch (const std::runtime_error &) {
+            didThrow = true;
+        }
+        assert(didThrow);
+    }
+
+    // Neither the published directory nor the staged tiles remain.
+    for (auto &dir : std::experimental::filesystem::directory_iterator(path))
+        assert(!std::experimental::filesystem::is_directory(dir.status()));
+    assert(!TileManifest(path).exists());
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testRejectedPublishLeavesNothingVisible) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-rejected-publish-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("rejected-publish-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileCrackingTransaction(entry, layout, 0, 29).commit();
+
+    // Compaction rejects a merge this way when another writer published over the merged directories first.
+    TileCrackingTransaction transaction(entry, TileLayout(1, 1, {320}, {240}), 0, 29);
+    unsigned int numberOfOtherDirectories = 0;
+    transaction.publishOnlyIf([&](const std::vector<lightdb::serialization::TileDirectory> &catalog) {
+        numberOfOtherDirectories = catalog.size();
+        return false;
+    });
+    transaction.commit();
+    assert(!transaction.isPublished());
+    assert(numberOfOtherDirectories == 1);
+
+    TiledVideoManager manager(entry);
+    assert(*manager.tileLayoutForId(manager.tileLayoutIdForFrame(5)) == layout);
+    auto numberOfDirectories = 0u;
+    for (auto &dir : std::experimental::filesystem::directory_iterator(path))
+        numberOfDirectories += std::experimental::filesystem::is_directory(dir.status());
+    assert(numberOfDirectories == 1);
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testPackedTilesAreReadFromThePack) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-pack-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("pack-test", path);
+    std::ofstream(TileFiles::packTilesMarkerFilename(path));
+    auto directory = TileFiles::directoryForTilesInFrames(*entry, 0, 29);
+
+    // An IDR picture and a trailing picture, each starting with a delimiter. The tiles' payloads differ.
+    std::vector<std::string> streams;
+    for (char payload : {'\x11', '\x22'}) {
+        std::string delimiter("\0\0\0\1\x46\1\x50", 7);
+        auto stream = delimiter + std::string("\0\0\0\1\x26\1\x80", 7) + payload
+                    + delimiter + std::string("\0\0\0\1\x02\1\x80", 7) + payload;
+        streams.push_back(stream);
+    }
+    {
+        TileCrackingTransaction transaction(entry, TileLayout(2, 1, {160, 160}, {240}), 0, 29);
+        transaction.writeTiles({0, 1}, [&](unsigned int tileNumber, OutputStream &output) {
+            output.write(streams[tileNumber].data(), streams[tileNumber].size());
+        });
+    }
+
+    assert(TileFiles::containsTilePack(directory));
+    assert(!std::experimental::filesystem::exists(TileFiles::tileFilename(directory, 0)));
+    for (auto tile = 0u; tile < 2; ++tile) {
+        MP4Reader reader(TileFiles::tileFilename(directory, tile));
+        assert(reader.pack());
+        assert(reader.numberOfSamples() == 2);
+        assert(reader.keyframeNumbers() == std::vector<int>{0});
+        auto data = reader.dataForSamples(1, 2);
+        assert(std::string(data->begin(), data->end()) == streams[tile]);
+    }
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testIdenticalTilesShareAFile) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-dedup-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("dedup-test", path);
+
+    std::string delimiter("\0\0\0\1\x46\1\x50", 7);
+    auto streamWithPayload = [&](char payload) {
+        return delimiter + std::string("\0\0\0\1\x26\1\x80", 7) + payload;
+    };
+    // The background tile is the same in both versions, and the other tile changes.
+    std::vector<std::vector<std::string>> versions{
+            {streamWithPayload('\x11'), streamWithPayload('\x22')},
+            {streamWithPayload('\x11'), streamWithPayload('\x33')}};
+    std::vector<std::experimental::filesystem::path> directories;
+    for (auto &streams : versions) {
+        directories.push_back(TileFiles::directoryForTilesInFrames(*entry, 0, 0));
+        TileCrackingTransaction transaction(entry, TileLayout(2, 1, {160, 160}, {240}), 0, 0);
+        transaction.writeTiles({0, 1}, [&](unsigned int tileNumber, OutputStream &output) {
+            output.write(streams[tileNumber].data(), streams[tileNumber].size());
+        });
+    }
+
+    assert(std::experimental::filesystem::equivalent(TileFiles::tileFilename(directories[0], 0), TileFiles::tileFilename(directories[1], 0)));
+    assert(!std::experimental::filesystem::equivalent(TileFiles::tileFilename(directories[0], 1), TileFiles::tileFilename(directories[1], 1)));
+
+    // The shared file outlives the version it was first written for.
+    std::experimental::filesystem::remove_all(directories[0]);
+    assert(std::experimental::filesystem::file_size(TileFiles::tileFilename(directories[1], 0)));
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testTornContentIndexRecordIsRepairedByNextCommit) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-torn-contents-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("torn-contents-test", path);
+    TileLayout layout(1, 1, {320}, {240});
+
+    std::string delimiter("\0\0\0\1\x46\1\x50", 7);
+    auto streamWithPayload = [&](char payload) {
+        return delimiter + std::string("\0\0\0\1\x26\1\x80", 7) + payload;
+    };
+    std::vector<std::experimental::filesystem::path> directories;
+    auto commit = [&](char payload) {
+        directories.push_back(TileFiles::directoryForTilesInFrames(*entry, 0, 0));
+        TileCrackingTransaction transaction(entry, layout, 0, 0);
+        auto stream = streamWithPayload(payload);
+        transaction.writeTiles({0}, [&](unsigned int, OutputStream &output) {
+            output.write(stream.data(), stream.size());
+        });
+    };
+
+    commit('\x11');
+    // A writer died partway through appending a record.
+    auto indexPath = TileFiles::tileContentsFilename(path);
+    {
+        std::ofstream log(indexPath, std::ios::binary | std::ios::app);
+        log << char(100) << "torn";
+    }
+    commit('\x22');
+
+    // Replacing the index makes it be read again from the start, like it is by another process.
+    auto copyPath = indexPath;
+    copyPath += ".copy";
+    std::experimental::filesystem::copy_file(indexPath, copyPath);
+    std::experimental::filesystem::rename(copyPath, indexPath);
+    commit('\x22');
+
+    assert(std::experimental::filesystem::equivalent(TileFiles::tileFilename(directories[1], 0), TileFiles::tileFilename(directories[2], 0)));
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testInMemoryCatalogDoesNotTouchTheFilesystem) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-in-memory-test";
+    std::experimental::filesystem::remove_all(path);
+    CatalogStorage::mount(path, std::make_shared<InMemoryCatalogStorage>());
+    auto entry = std::make_shared<TiledEntry>("in-memory-test", path);
+    TileLayout layout(1, 1, {320}, {240});
+    auto directory = TileFiles::directoryForTilesInFrames(*entry, 0, 0);
+
+    std::string stream = std::string("\0\0\0\1\x46\1\x50", 7) + std::string("\0\0\0\1\x26\1\x80", 7) + '\x11';
+    {
+        TileCrackingTransaction transaction(entry, layout, 0, 0);
+        transaction.writeTiles({0}, [&](unsigned int, OutputStream &output) {
+            output.write(stream.data(), stream.size());
+        });
+    }
+    assert(!std::experimental::filesystem::exists(path));
+    assert(TiledEntry("in-memory-test", path).tile_version() == 1);
+
+    auto manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    assert(manager->maximumFrame() == 0);
+    assert(*manager->tileLayoutForId(manager->tileLayoutIdForFrame(0)) == layout);
+    MP4Reader reader(manager->locationOfTileForId(0, 0));
+    assert(reader.pack());
+    auto data = reader.dataForSamples(1, 1);
+    assert(std::string(data->begin(), data->end()) == stream);
+
+    CatalogStorage::unmount(path);
+}
+
+TEST_F(VideoManagerTestFixture, testInMemoryCatalogIsCompactedInMemory) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-in-memory-compaction-test";
+    std::experimental::filesystem::remove_all(path);
+    CatalogStorage::mount(path, std::make_shared<InMemoryCatalogStorage>());
+    auto entry = std::make_shared<TiledEntry>("in-memory-compaction-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout untiledLayout(1, 1, {320}, {240});
+    auto storeGOP = [&](const TileLayout &gopLayout, unsigned int firstFrame) {
+        TileCrackingTransaction transaction(entry, gopLayout, firstFrame, firstFrame + 29);
+        std::vector<unsigned int> tileNumbers;
+        for (auto tile = 0u; tile < gopLayout.numberOfTiles(); ++tile)
+            tileNumbers.push_back(tile);
+        transaction.writeTiles(tileNumbers, [&](unsigned int, OutputStream &output) {
+            for (auto frame = 0u; frame < 30; ++frame) {
+                std::string slice = frame ? std::string("\0\0\0\1\x02\1\x80", 7) : std::string("\0\0\0\1\x26\1\x80", 7);
+                auto sample = std::string("\0\0\0\1\x46\1\x50", 7) + slice + 'x';
+                output.write(sample.data(), sample.size());
+            }
+        });
+    };
+    storeGOP(layout, 0);
+    storeGOP(untiledLayout, 0);
+    storeGOP(untiledLayout, 30);
+
+    // The shadowed GOP and the two that are merged leave the catalog, and nothing refers to them.
+    auto statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(statistics.numberOfMergedDirectories == 2);
+    assert(statistics.numberOfRemovedDirectories == 3);
+    assert(statistics.numberOfDeletedDirectories == 3);
+    assert(!std::experimental::filesystem::exists(path));
+
+    auto manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    assert(manager->directoryIdToTileDirectory_.size() == 1);
+    auto id = manager->tileLayoutIdForFrame(0);
+    assert(manager->tileLayoutIdForFrame(59) == id);
+    assert(*manager->tileLayoutForId(id) == untiledLayout);
+    MP4Reader reader(manager->locationOfTileForId(0, id));
+    assert(reader.pack());
+    assert(reader.numberOfSamples() == 60);
+
+    CatalogStorage::unmount(path);
+}
+
+TEST_F(VideoManagerTestFixture, testVersionsAreFoundAroundSingleFrameDirectory) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-single-frame-directory-test";
+    std::experimental::filesystem::remove_all(path);
+    CatalogStorage::mount(path, std::make_shared<InMemoryCatalogStorage>());
+    auto entry = std::make_shared<TiledEntry>("single-frame-directory-test", path);
+    TileLayout layout(1, 1, {320}, {240});
+    auto storeFrames = [&](unsigned int firstFrame, unsigned int lastFrame) {
+        TileCrackingTransaction transaction(entry, layout, firstFrame, lastFrame);
+        transaction.writeTiles({0}, [&](unsigned int, OutputStream &output) {
+            for (auto frame = firstFrame; frame <= lastFrame; ++frame) {
+                std::string slice = frame == firstFrame ? std::string("\0\0\0\1\x26\1\x80", 7) : std::string("\0\0\0\1\x02\1\x80", 7);
+                auto sample = std::string("\0\0\0\1\x46\1\x50", 7) + slice + 'x';
+                output.write(sample.data(), sample.size());
+            }
+        });
+    };
+    storeFrames(0, 29);
+    storeFrames(30, 59);
+    storeFrames(60, 89);
+    // A single-frame directory doesn't shrink the buckets that the other directories are found through.
+    storeFrames(45, 45);
+
+    auto manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    auto gopVersion = manager->tileLayoutIdForFrame(30);
+    auto frameVersion = manager->tileLayoutIdForFrame(45);
+    assert(frameVersion != gopVersion);
+    assert(manager->tileLayoutIdForFrame(46) == gopVersion);
+    assert(manager->tileLayoutIdsForFrames(30, 59) == std::vector<int>({gopVersion}));
+    assert(manager->tileLayoutIdsForFrames(45, 45) == std::vector<int>({frameVersion, gopVersion}));
+    assert(manager->tileLayoutIdsForFrames(60, 89).size() == 1);
+    assert(manager->tileLayoutIdsForFrames(0, 89).empty());
+
+    CatalogStorage::unmount(path);
+}
+
+TEST_F(VideoManagerTestFixture, testCheapestVersionOfGOPIsRead) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-cost-based-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("cost-based-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout retiledLayout(1, 1, {320}, {240});
+    TileCrackingTransaction(entry, layout, 0, 29).commit();
+    TileCrackingTransaction(entry, retiledLayout, 0, 29).commit();
+
+    auto manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    assert(manager->tileLayoutIdsForFrames(0, 29) == std::vector<int>({1, 0}));
+    assert(manager->tileLayoutIdsForFrames(20, 30).empty());
+
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+    for (auto i = 0u; i < 30; ++i) {
+        semanticIndex->addMetadata("cost-based-test", "car", i, 10, 10, 100, 100);
+        semanticIndex->addMetadata("cost-based-test", "bus", i, 100, 10, 300, 100);
+    }
+
+    // The older version decodes only the left tile for the car.
+    auto car = std::make_shared<SemanticDataManager>(semanticIndex, "cost-based-test", std::make_shared<SingleMetadataSelection>("car"));
+    CostBasedTileLocationProvider carProvider(manager, car, 30);
+    assert(*carProvider.tileLayoutForFrame(5) == layout);
+    assert(carProvider.locationOfTileForFrame(0, 5).parent_path() == TileFiles::directoryForTilesInFrames(path, 0, 29, 0));
+
+    // Both versions decode every pixel for the bus, so the one with fewer tiles is read.
+    auto bus = std::make_shared<SemanticDataManager>(semanticIndex, "cost-based-test", std::make_shared<SingleMetadataSelection>("bus"));
+    CostBasedTileLocationProvider busProvider(manager, bus, 30);
+    assert(*busProvider.tileLayoutForFrame(5) == retiledLayout);
+
+    std::experimental::filesystem::remove_all(path);
+}
+
+TEST_F(VideoManagerTestFixture, testCompactionKeepsVersionsThatCostBasedReadsCanChoose) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-cost-based-compaction-test";
+    std::experimental::filesystem::remove_all(path);
+    auto entry = std::make_shared<TiledEntry>("cost-based-compaction-test", path);
+    TileLayout layout(2, 1, {160, 160}, {240});
+    TileLayout retiledLayout(1, 1, {320}, {240});
+    TileCrackingTransaction(entry, layout, 0, 29).commit();
+    TileCrackingTransaction(entry, retiledLayout, 0, 29).commit();
+    TileCrackingTransaction(entry, retiledLayout, 0, 29).commit();
+
+    // The older retile has the same layout as the newest, so it is never cheaper, but the original layout can be.
+    auto statistics = compactTiles(entry);
+    assert(statistics.numberOfRemovedDirectories == 1);
+    assert(statistics.numberOfDeletedDirectories == 1);
+    auto manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    assert(manager->tileLayoutIdsForFrames(0, 29) == std::vector<int>({2, 0}));
+
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+    for (auto i = 0u; i < 30; ++i)
+        semanticIndex->addMetadata("cost-based-compaction-test", "car", i, 10, 10, 100, 100);
+    auto car = std::make_shared<SemanticDataManager>(semanticIndex, "cost-based-compaction-test", std::make_shared<SingleMetadataSelection>("car"));
+    assert(*CostBasedTileLocationProvider(manager, car, 30).tileLayoutForFrame(5) == layout);
+
+    // Keeping only the newest versions removes the original layout too.
+    manager.reset();
+    statistics = compactTiles(entry, CompactionPolicy::KeepNewestOnly);
+    assert(statistics.numberOfRemovedDirectories == 1);
+    assert(statistics.numberOfDeletedDirectories == 1);
+    manager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    assert(manager->tileLayoutIdsForFrames(0, 29) == std::vector<int>({2}));
+
+    std::experimental::filesystem::remove_all(path);
+}
+
 TEST_F(VideoManagerTestFixture, testScan) {
     VideoManager manager;
     manager.store("/home/maureen/lightdb-wip/cmake-build-debug-remote/test/resources/birdsincage/1-0-stream.mp4", "birdsincage-regret");
@@ -71,3 +800,64 @@ TEST_F(VideoManagerTestFixture, testAccumulateRegret) {
     videoManager.retileVideoBasedOnRegret(video);
 }
 
+
+TEST_F(VideoManagerTestFixture, testReactivateRetilingAfterFirstVersionIsCompactedAway) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("birdsincage-compacted-regret");
+    std::string metadataIdentifier("birdsincage");
+    std::string label("fish");
+    for (auto i = 0u; i < 10; ++i)
+        semanticIndex->addMetadata(metadataIdentifier, label, i, 5, 5, 260, 166);
+    auto metadataSelection = std::make_shared<SingleMetadataSelection>(label);
+    std::shared_ptr<TemporalSelection> temporalSelection;
+
+    VideoManager videoManager;
+    videoManager.store("/home/maureen/lightdb-wip/cmake-build-debug-remote/test/resources/birdsincage/1-0-stream.mp4", video);
+    videoManager.activateRegretBasedRetilingForVideo(video, metadataIdentifier, semanticIndex, 0.5);
+    for (int i = 0; i < 5; ++i)
+        videoManager.select(video, metadataIdentifier, metadataSelection, temporalSelection, semanticIndex);
+    videoManager.retileVideoBasedOnRegret(video);
+    videoManager.compactVideo(video, CompactionPolicy::KeepNewestOnly);
+
+    // The first GOP was retiled, so the directory with version 0 is gone.
+    auto manager = std::make_shared<TiledVideoManager>(std::make_shared<TiledEntry>(video, files::PathForVideo(video)));
+    assert(!manager->directoryIdToTileDirectory_.count(0));
+
+    // Retiling and activating again find the first frame through the versions that remain.
+    for (int i = 0; i < 5; ++i)
+        videoManager.select(video, metadataIdentifier, metadataSelection, temporalSelection, semanticIndex);
+    videoManager.retileVideoBasedOnRegret(video);
+    videoManager.deactivateRegretBasedRetilingForVideo(video);
+    videoManager.activateRegretBasedRetilingForVideo(video, metadataIdentifier, semanticIndex, 0.5);
+    videoManager.deleteVideo(video);
+}
+
+TEST_F(VideoManagerTestFixture, testRetileAndCompactInMemory) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("birdsincage-in-memory");
+    std::string metadataIdentifier("birdsincage");
+    std::string label("fish");
+    for (auto i = 0u; i < 10; ++i)
+        semanticIndex->addMetadata(metadataIdentifier, label, i, 5, 5, 260, 166);
+    auto metadataSelection = std::make_shared<SingleMetadataSelection>(label);
+    std::shared_ptr<TemporalSelection> temporalSelection;
+
+    auto path = files::PathForVideo(video);
+    std::experimental::filesystem::remove_all(path);
+    CatalogStorage::mount(path, std::make_shared<InMemoryCatalogStorage>());
+
+    // Regret, retiling, and compaction keep everything in the storage rather than beside the video's tiles.
+    VideoManager videoManager;
+    videoManager.store("/home/maureen/lightdb-wip/cmake-build-debug-remote/test/resources/birdsincage/1-0-stream.mp4", video);
+    videoManager.activateRegretBasedRetilingForVideo(video, metadataIdentifier, semanticIndex, 0.5);
+    for (int i = 0; i < 5; ++i)
+        videoManager.select(video, metadataIdentifier, metadataSelection, temporalSelection, semanticIndex);
+    videoManager.retileVideoBasedOnRegret(video);
+    videoManager.compactVideo(video);
+    assert(!std::experimental::filesystem::exists(path));
+
+    videoManager.deleteVideo(video);
+    CatalogStorage::unmount(path);
+}
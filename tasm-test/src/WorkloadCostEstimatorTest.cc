@@ -0,0 +1,134 @@
+#include "WorkloadCostEstimator.h"
+#include <gtest/gtest.h>
+
+#include "SemanticDataManager.h"
+#include "SemanticIndex.h"
+#include "SemanticSelection.h"
+#include "StoredTileSizes.h"
+#include "TiledVideoManager.h"
+#include "Transaction.h"
+#include <cassert>
+
+using namespace tasm;
+
+class WorkloadCostEstimatorTestFixture : public testing::Test {
+public:
+    WorkloadCostEstimatorTestFixture() {}
+};
+
+TEST_F(WorkloadCostEstimatorTestFixture, testParallelEstimateMatchesSequential) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("video");
+    unsigned int gopLength = 30;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    for (auto i = 0u; i < 20 * gopLength; ++i) {
+        if (i % 7)
+            semanticIndex->addMetadata(video, "fish", i, (i * 13) % 1500, (i * 11) % 800, (i * 13) % 1500 + 200, (i * 11) % 800 + 150);
+        if (i % 3)
+            semanticIndex->addMetadata(video, "bird", i, 50, 50, 400, 300);
+    }
+
+    auto fish = std::make_shared<SemanticDataManager>(semanticIndex, video, std::make_shared<SingleMetadataSelection>("fish"));
+    auto bird = std::make_shared<SemanticDataManager>(semanticIndex, video, std::make_shared<SingleMetadataSelection>("bird"));
+    auto workload = std::make_shared<Workload>(std::vector<std::shared_ptr<SemanticDataManager>>{fish, bird}, std::vector<unsigned int>{2, 3});
+    auto layoutProvider = std::make_shared<FineGrainedTileConfigurationProvider>(gopLength, fish, width, height);
+
+    WorkloadCostEstimator sequentialEstimator(layoutProvider, workload, gopLength);
+    WorkloadCostEstimator parallelEstimator(layoutProvider, workload, gopLength, std::make_shared<ThreadPool>(4));
+
+    auto sequentialCost = sequentialEstimator.estimateCostForWorkload();
+    auto parallelCost = parallelEstimator.estimateCostForWorkload();
+    assert(sequentialCost.numPixels);
+    assert(sequentialCost.numPixels == parallelCost.numPixels);
+    assert(sequentialCost.numTiles == parallelCost.numTiles);
+
+    std::unordered_map<unsigned int, CostElements> sequentialCostByGOP;
+    std::unordered_map<unsigned int, CostElements> parallelCostByGOP;
+    sequentialEstimator.estimateCostForQuery(0, &sequentialCostByGOP);
+    parallelEstimator.estimateCostForQuery(0, &parallelCostByGOP);
+    assert(sequentialCostByGOP.size() == 20);
+    assert(sequentialCostByGOP.size() == parallelCostByGOP.size());
+    for (auto &gopAndCost : sequentialCostByGOP) {
+        assert(gopAndCost.second.numPixels == parallelCostByGOP.at(gopAndCost.first).numPixels);
+        assert(gopAndCost.second.numTiles == parallelCostByGOP.at(gopAndCost.first).numTiles);
+    }
+}
+
+TEST_F(WorkloadCostEstimatorTestFixture, testEstimateOnlySpecifiedGOPs) {
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+
+    std::string video("video");
+    unsigned int gopLength = 10;
+    for (auto i = 0u; i < 5 * gopLength; ++i)
+        semanticIndex->addMetadata(video, "fish", i, 0, 0, 100, 100);
+
+    auto fish = std::make_shared<SemanticDataManager>(semanticIndex, video, std::make_shared<SingleMetadataSelection>("fish"));
+    auto workload = std::make_shared<Workload>(fish);
+    WorkloadCostEstimator estimator(std::make_shared<SingleTileConfigurationProvider>(320, 240), workload, gopLength);
+
+    std::unordered_set<unsigned int> gopsToEstimate{1, 3};
+    std::unordered_map<unsigned int, CostElements> costByGOP;
+    auto cost = estimator.estimateCostForQuery(0, &costByGOP, &gopsToEstimate);
+    assert(costByGOP.size() == 2);
+    assert(costByGOP.count(1) && costByGOP.count(3));
+    assert(cost.numTiles == 2 * gopLength);
+    assert(cost.numPixels == 2 * gopLength * 320 * 240);
+}
+
+TEST_F(WorkloadCostEstimatorTestFixture, testBytesAreSummedFromStoredSampleSizes) {
+    auto path = std::experimental::filesystem::temp_directory_path() / "tasm-stored-sizes-test";
+    std::experimental::filesystem::remove_all(path);
+    std::string video("stored-sizes-test");
+    auto entry = std::make_shared<TiledEntry>(video, path);
+    unsigned int gopLength = 10;
+    TileLayout layout(2, 1, {160, 160}, {240});
+
+    // Every sample is one slice, so its size is the length prefix, the slice header, and the payload.
+    auto payloadSize = [](unsigned int tile, unsigned int frame) { return 10 * (tile + 1) + frame; };
+    auto sampleSize = [&](unsigned int tile, unsigned int frame) { return 4 + 3 + payloadSize(tile, frame); };
+    {
+        TileCrackingTransaction transaction(entry, layout, 0, 2 * gopLength - 1);
+        transaction.writeTiles({0, 1}, [&](unsigned int tile, OutputStream &output) {
+            for (auto frame = 0u; frame < 2 * gopLength; ++frame) {
+                std::string slice = frame % gopLength ? std::string("\0\0\0\1\x02\1\x80", 7) : std::string("\0\0\0\1\x26\1\x80", 7);
+                auto sample = std::string("\0\0\0\1\x46\1\x50", 7) + slice + std::string(payloadSize(tile, frame), 'x');
+                output.write(sample.data(), sample.size());
+            }
+        });
+    }
+
+    // The car is only in the left tile, last in frame 3 of the first GOP and frame 15 of the second.
+    auto semanticIndex = SemanticIndexFactory::createInMemory();
+    for (auto frame : {1, 3, 12, 15})
+        semanticIndex->addMetadata(video, "car", frame, 10, 10, 100, 100);
+    auto car = std::make_shared<SemanticDataManager>(semanticIndex, video, std::make_shared<SingleMetadataSelection>("car"));
+    auto workload = std::make_shared<Workload>(car);
+
+    auto locations = std::make_shared<SingleTileLocationProvider>(TiledVideoManagerCache::instance().tiledVideoManager(entry));
+    auto storedTileSizes = std::make_shared<StoredTileSizes>(locations);
+    auto bytesForFrames = [&](std::vector<unsigned int> tiles, unsigned int firstFrame, unsigned int lastFrame) {
+        unsigned long long bytes = 0;
+        for (auto tile : tiles) {
+            for (auto frame = firstFrame; frame <= lastFrame; ++frame)
+                bytes += sampleSize(tile, frame);
+        }
+        return bytes;
+    };
+
+    // The stored layout is costed with the sizes of the samples that would be read.
+    std::unordered_map<unsigned int, CostElements> costByGOP;
+    auto cost = WorkloadCostEstimator(locations, workload, gopLength, std::make_shared<ThreadPool>(2), storedTileSizes).estimateCostForQuery(0, &costByGOP);
+    assert(costByGOP.at(0).numBytes == bytesForFrames({0}, 0, 3));
+    assert(costByGOP.at(1).numBytes == bytesForFrames({0}, 10, 15));
+    assert(cost.numBytes == costByGOP.at(0).numBytes + costByGOP.at(1).numBytes);
+
+    // A layout that isn't stored is costed from the stored bytes per pixel, which for the whole frame is every tile.
+    std::unordered_map<unsigned int, CostElements> untiledCostByGOP;
+    WorkloadCostEstimator(std::make_shared<SingleTileConfigurationProvider>(320, 240), workload, gopLength, nullptr, storedTileSizes).estimateCostForQuery(0, &untiledCostByGOP);
+    assert(untiledCostByGOP.at(0).numBytes == bytesForFrames({0, 1}, 0, 3));
+    assert(untiledCostByGOP.at(1).numBytes == bytesForFrames({0, 1}, 10, 15));
+
+    std::experimental::filesystem::remove_all(path);
+}
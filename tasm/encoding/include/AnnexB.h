@@ -0,0 +1,76 @@
+#ifndef TASM_ANNEXB_H
+#define TASM_ANNEXB_H
+
+#include <functional>
+#include <string>
+
+// Helpers for HEVC streams in Annex B byte stream format, as produced by the encoders.
+namespace tasm::annexb {
+
+constexpr unsigned int NalUnitVPS = 32;
+constexpr unsigned int NalUnitSPS = 33;
+constexpr unsigned int NalUnitPPS = 34;
+constexpr unsigned int NalUnitAccessUnitDelimiter = 35;
+constexpr unsigned int NalUnitPrefixSEI = 39;
+
+inline unsigned int nalType(const char *nal) {
+    return (static_cast<unsigned char>(nal[0]) >> 1) & 0x3Fu;
+}
+
+inline bool isSlice(unsigned int type) {
+    return type < NalUnitVPS;
+}
+
+inline bool isKeyframeSlice(unsigned int type) {
+    return type >= 16 && type <= 23;
+}
+
+inline bool isParameterSet(unsigned int type) {
+    return type == NalUnitVPS || type == NalUnitSPS || type == NalUnitPPS;
+}
+
+// Whether the NAL unit begins a new access unit, given whether the current one already has a slice (7.4.2.4.4).
+bool startsNewAccessUnit(unsigned int type, const char *nal, bool accessUnitHasSlice);
+
+// The fields of an SPS that containers need to describe the stream (7.3.2.2).
+struct SequenceParameterSetInfo {
+    unsigned int id = 0;
+    unsigned int maxSubLayersMinus1 = 0;
+    bool temporalIdNesting = false;
+    // profile_space through general_level_idc, which hvcC stores as is.
+    std::string generalProfileTierLevel = std::string(12, '\0');
+    unsigned int chromaFormat = 1;
+    unsigned int bitDepthLumaMinus8 = 0;
+    unsigned int bitDepthChromaMinus8 = 0;
+    unsigned int codedWidth = 0;
+    unsigned int codedHeight = 0;
+    unsigned int width = 0;
+    unsigned int height = 0;
+};
+
+SequenceParameterSetInfo parseSequenceParameterSet(const char *nal, size_t size);
+unsigned int parameterSetId(unsigned int type, const char *nal, size_t size);
+
+// Splits a byte stream into NAL units, which may be split across calls to write().
+// NAL units are passed to the handler without their start code.
+class NalUnitSplitter {
+public:
+    explicit NalUnitSplitter(std::function<void(const char *nal, size_t size)> handleNal)
+        : handleNal_(std::move(handleNal))
+    { }
+
+    void write(const char *data, size_t size);
+    // Handles the last NAL unit, which isn't followed by a start code.
+    void flush();
+
+private:
+    void handle(const char *nal, size_t size);
+
+    std::function<void(const char*, size_t)> handleNal_;
+    // Bytes since the last start code that was found.
+    std::string pending_;
+};
+
+} // namespace tasm::annexb
+
+#endif //TASM_ANNEXB_H
@@ -300,6 +300,16 @@ public:
     bool isEos() const { return frameIterator_ == frames_->end(); }
 
     std::optional<GOPReaderPacket> read() {
+        auto samples = nextSamplesToRead();
+        if (!samples)
+            return {};
+
+        return dataForSamples(samples->first, samples->second);
+    }
+
+    // Advances past the next group of frames exactly like read(), but only returns the first and last sample numbers
+    // that read() would return the data for.
+    std::optional<std::pair<unsigned int, unsigned int>> nextSamplesToRead() {
         // If we are reading all of the frames, return the frames for the next GOP.
         if (frameIterator_ == frames_->end())
             return {};
@@ -367,9 +377,12 @@ public:
         }
 
         numberOfSamplesRead_ += lastSampleToRead - firstSampleToRead + 1;
-        return dataForSamples(firstSampleToRead, lastSampleToRead);
+        return {{firstSampleToRead, lastSampleToRead}};
     }
 
+    const MP4Reader &mp4Reader() const { return mp4Reader_; }
+    int frameOffsetInFile() const { return frameOffsetInFile_; }
+
 //    ~EncodedFrameReader() {
 //        std::cout << "Number of samples read: " << numberOfSamplesRead_ << std::endl;
 //    }
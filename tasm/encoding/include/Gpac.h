@@ -5,7 +5,6 @@
 #include <experimental/filesystem>
 
 namespace tasm::gpac {
-void mux_media(const std::experimental::filesystem::path &source, const std::experimental::filesystem::path &destination);
 void write_tile_configuration(const std::experimental::filesystem::path &metadata_filename, const TileLayout &tileLayouts);
 TileLayout load_tile_configuration(const std::experimental::filesystem::path &metadataFilename);
 } // namespace tasm::gpac
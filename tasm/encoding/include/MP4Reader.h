@@ -4,17 +4,37 @@
 #include "gpac/isomedia.h"
 #include "gpac/internal/isomedia_dev.h"
 #include "gpac/list.h"
+#include "Files.h"
+#include "MP4SampleIndex.h"
+#include "TilePack.h"
 #include <experimental/filesystem>
 
 class MP4Reader {
 public:
     explicit MP4Reader(const std::experimental::filesystem::path &filename)
             : filename_(filename),
+              file_(NULL),
               invalidFile_(false)
     {
         if (filename_.extension() != ".mp4") {
             invalidFile_ = true;
-            file_ = NULL;
+            return;
+        }
+
+        // Packed tiles don't have a file of their own, so their samples are read from the directory's pack.
+        if (setUpPack()) {
+            const auto &tile = pack_->tile(tileNumber_);
+            // Like a sample table without stss, an empty list means every frame is a keyframe.
+            if (tile.keyframeNumbers.size() != tile.sampleSizes.size())
+                keyframeNumbers_ = tile.keyframeNumbers;
+            numberOfSamples_ = tile.sampleSizes.size();
+            return;
+        }
+
+        // Most tiles' sample tables can be read without opening the file with GPAC.
+        if (setUpSampleIndex()) {
+            keyframeNumbers_ = sampleIndex_->keyframeNumbers();
+            numberOfSamples_ = sampleIndex_->numberOfSamples();
             return;
         }
 
@@ -39,10 +59,13 @@ public:
               keyframeNumbers_(other.keyframeNumbers_),
               numberOfSamples_(other.numberOfSamples_),
               numberOfSamplesRead_(other.numberOfSamplesRead_),
-              invalidFile_(other.invalidFile_)
+              invalidFile_(other.invalidFile_),
+              pack_(other.pack_),
+              tileNumber_(other.tileNumber_),
+              sampleIndex_(other.sampleIndex_)
     {
         other.closeFile();
-        if (invalidFile_)
+        if (invalidFile_ || pack_ || sampleIndex_)
             file_ = NULL;
         else
             setUpGFIsomFile();
@@ -65,6 +88,14 @@ public:
     void setNewFileWithSameKeyframes(const std::experimental::filesystem::path &filename) {
         closeFile();
         filename_ = filename;
+        if (setUpPack()) {
+            numberOfSamples_ = pack_->tile(tileNumber_).sampleSizes.size();
+            return;
+        }
+        if (setUpSampleIndex()) {
+            numberOfSamples_ = sampleIndex_->numberOfSamples();
+            return;
+        }
         setUpGFIsomFile();
 
         numberOfSamples_ = gf_isom_get_sample_count(file_, trackNumber_);
@@ -91,8 +122,32 @@ public:
     }
 
     std::unique_ptr<std::vector<char>> dataForSamples(unsigned int firstSampleToRead, unsigned int lastSampleToRead) const;
+    // Compressed size of each sample, indexed by frame number. Only reads the sample table.
+    std::vector<unsigned int> sampleSizes() const;
+    // File offset of firstSample and the total size of samples [firstSample, lastSample]. Only reads the sample table.
+    std::pair<unsigned long long, unsigned long long> byteRangeForSamples(unsigned int firstSample, unsigned int lastSample) const;
+
+    // Set when the tile is stored in its directory's pack.
+    const std::shared_ptr<const tasm::TilePack> &pack() const { return pack_; }
+    unsigned int tileNumber() const { return tileNumber_; }
 
 private:
+    bool setUpPack() {
+        pack_.reset();
+        if (std::experimental::filesystem::exists(filename_))
+            return false;
+        pack_ = tasm::TilePack::packContainingTile(filename_);
+        if (!pack_)
+            return false;
+        tileNumber_ = tasm::TileFiles::tileNumberFromFilename(filename_);
+        return true;
+    }
+
+    bool setUpSampleIndex() {
+        sampleIndex_ = tasm::MP4SampleIndex::open(filename_);
+        return sampleIndex_ != nullptr;
+    }
+
     void setUpGFIsomFile() {
         file_ = gf_isom_open(filename_.c_str(), GF_ISOM_OPEN_READ, nullptr);
         u32 flags = GF_ISOM_NALU_EXTRACT_INBAND_PS_FLAG | GF_ISOM_NALU_EXTRACT_ANNEXB_FLAG;
@@ -122,6 +177,10 @@ private:
     unsigned int numberOfSamples_;
     unsigned int numberOfSamplesRead_ = 0;
     bool invalidFile_;
+    std::shared_ptr<const tasm::TilePack> pack_;
+    unsigned int tileNumber_ = 0;
+    // Set when the sample table was read natively, in which case the file isn't opened with GPAC.
+    std::shared_ptr<const tasm::MP4SampleIndex> sampleIndex_;
 };
 
 #endif //TASM_MP4READER_H
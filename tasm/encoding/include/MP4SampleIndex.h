@@ -0,0 +1,55 @@
+#ifndef TASM_MP4SAMPLEINDEX_H
+#define TASM_MP4SAMPLEINDEX_H
+
+#include <experimental/filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tasm {
+
+// The sample table of an HEVC mp4, like the ones MP4Writer and GPAC's importer produce, parsed once into flat arrays
+// so samples can be read with pread instead of through GPAC.
+// Samples are returned the way MP4Reader extracts them with GPAC: in Annex B format, with the configuration's
+// parameter sets before each keyframe.
+class MP4SampleIndex {
+public:
+    ~MP4SampleIndex();
+    MP4SampleIndex(const MP4SampleIndex&) = delete;
+
+    // The index of the mp4 at path, or nullptr if its sample table can't be read natively.
+    // Opened indexes are cached, so each file's sample table is only parsed once.
+    static std::shared_ptr<const MP4SampleIndex> open(const std::experimental::filesystem::path &path);
+
+    unsigned int numberOfSamples() const { return sampleSizes_.size(); }
+    // Indexed by frame number.
+    const std::vector<unsigned int> &sampleSizes() const { return sampleSizes_; }
+    // Zero-based. Empty when every sample is a keyframe, like a sample table without stss.
+    const std::vector<int> &keyframeNumbers() const { return keyframeNumbers_; }
+
+    // Sample numbers are one-based, like MP4Reader's.
+    std::pair<unsigned long long, unsigned long long> byteRangeForSamples(unsigned int firstSample, unsigned int lastSample) const;
+    // Samples that are contiguous in the file are read straight into the returned buffer with a single pread.
+    std::unique_ptr<std::vector<char>> dataForSamples(unsigned int firstSample, unsigned int lastSample) const;
+
+private:
+    explicit MP4SampleIndex(const std::experimental::filesystem::path &filename);
+    void readSampleTable();
+    std::string readMovieBox() const;
+    bool isKeyframe(unsigned int frame) const;
+    void readInto(char *destination, unsigned long long offset, unsigned long long size) const;
+
+    std::experimental::filesystem::path filename_;
+    // Reads use pread, so one descriptor is shared by every reader of the file.
+    int fileDescriptor_;
+    std::vector<unsigned long long> sampleOffsets_;
+    std::vector<unsigned int> sampleSizes_;
+    std::vector<int> keyframeNumbers_;
+    unsigned int nalLengthSize_;
+    // The parameter sets from hvcC, each preceded by a start code.
+    std::string parameterSets_;
+};
+
+} // namespace tasm
+
+#endif //TASM_MP4SAMPLEINDEX_H
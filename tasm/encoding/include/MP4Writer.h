@@ -0,0 +1,70 @@
+#ifndef TASM_MP4WRITER_H
+#define TASM_MP4WRITER_H
+
+#include "AnnexB.h"
+#include <experimental/filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Muxes an Annex B HEVC stream into an mp4 as it is written, without going through an intermediate file.
+// Samples are appended to mdat as they are parsed, and the sample table is written in moov on close.
+// Parameter sets go in the hvcC configuration like GPAC's importer does, so MP4Reader reads the file the same way.
+class MP4Writer {
+public:
+    // Raw streams have no timing, so writers that don't know the source's frame rate get GPAC's default.
+    static const unsigned int DefaultFrameRate = 25;
+
+    // Samples are timed at frameRate, which is what readers of the file report as its frame rate.
+    MP4Writer(const std::experimental::filesystem::path &filename, unsigned int frameRate);
+    // The splitter calls back into the writer.
+    MP4Writer(const MP4Writer&) = delete;
+    MP4Writer(MP4Writer&&) = delete;
+
+    // Access units and NAL units can be split across writes.
+    void write(const char *data, size_t size);
+    void close();
+
+    unsigned int numberOfSamples() const { return sampleSizes_.size(); }
+    // Zero-based, like MP4Reader::keyframeNumbers().
+    const std::vector<int> &keyframeNumbers() const { return keyframeNumbers_; }
+
+private:
+    struct ParameterSet {
+        unsigned int type;
+        unsigned int id;
+        std::string data;
+    };
+
+    void writeFileHeader();
+    void writeMovieBox();
+    void processNal(const char *nal, size_t size);
+    // Returns whether the parameter set is carried by the configuration rather than the sample.
+    bool addParameterSet(unsigned int type, const char *nal, size_t size);
+    void writeNalToSample(const char *nal, size_t size);
+    void finishSample();
+    std::string hevcConfiguration() const;
+
+    std::experimental::filesystem::path filename_;
+    const unsigned int frameRate_;
+    std::ofstream output_;
+    bool isClosed_;
+
+    tasm::annexb::NalUnitSplitter splitter_;
+
+    unsigned long long mdatOffset_;
+    unsigned long long mdatSize_;
+    std::vector<unsigned int> sampleSizes_;
+    std::vector<int> keyframeNumbers_;
+    unsigned int currentSampleSize_;
+    bool currentSampleHasSlice_;
+    bool currentSampleIsKeyframe_;
+
+    std::vector<ParameterSet> parameterSets_;
+    // Set when a parameter set is replaced mid-stream, so it has to stay in the samples.
+    bool hasInBandParameterSets_;
+    unsigned int width_;
+    unsigned int height_;
+};
+
+#endif //TASM_MP4WRITER_H
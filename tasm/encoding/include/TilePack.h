@@ -0,0 +1,111 @@
+#ifndef TASM_TILEPACK_H
+#define TASM_TILEPACK_H
+
+#include "AnnexB.h"
+#include <array>
+#include <experimental/filesystem>
+#include <iosfwd>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace tasm {
+
+// Collects one tile's samples in memory until its transaction writes the pack.
+class PackedTileBuffer {
+public:
+    explicit PackedTileBuffer(unsigned int tileNumber);
+    // The splitter calls back into the buffer.
+    PackedTileBuffer(const PackedTileBuffer&) = delete;
+    PackedTileBuffer(PackedTileBuffer&&) = delete;
+
+    // Access units and NAL units can be split across writes.
+    void write(const char *data, size_t size);
+    void close();
+
+    unsigned int tileNumber() const { return tileNumber_; }
+    const std::string &data() const { return data_; }
+    const std::vector<unsigned int> &sampleSizes() const { return sampleSizes_; }
+    const std::vector<int> &keyframeNumbers() const { return keyframeNumbers_; }
+    const annexb::SequenceParameterSetInfo &sequenceParameterSet() const { return sequenceParameterSet_; }
+
+private:
+    void processNal(const char *nal, size_t size);
+    void finishSample();
+
+    unsigned int tileNumber_;
+    annexb::NalUnitSplitter splitter_;
+    std::string data_;
+    std::vector<unsigned int> sampleSizes_;
+    std::vector<int> keyframeNumbers_;
+    std::string currentSample_;
+    bool currentSampleHasSlice_;
+    bool currentSampleIsKeyframe_;
+    bool currentSampleHasParameterSets_;
+    // The most recent VPS, SPS, and PPS.
+    std::array<std::string, 3> parameterSets_;
+    bool sawSequenceParameterSet_;
+    annexb::SequenceParameterSetInfo sequenceParameterSet_;
+};
+
+// Writes the tiles' samples and a single index for all of them into one file. GOPs are interleaved across tiles,
+// so reading the same GOP of neighboring tiles touches one region of the file.
+void writeTilePack(const std::experimental::filesystem::path &filename, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate);
+void writeTilePack(std::ostream &output, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate);
+
+// Every tile of one tile directory, stored in a single file with a shared sample index.
+// Samples are stored in Annex B format with their parameter sets, like MP4Reader extracts them.
+class TilePack {
+public:
+    struct Tile {
+        unsigned int width;
+        unsigned int height;
+        unsigned int codedWidth;
+        unsigned int codedHeight;
+        std::vector<unsigned long long> sampleOffsets;
+        std::vector<unsigned int> sampleSizes;
+        std::vector<int> keyframeNumbers;
+    };
+
+    ~TilePack();
+    TilePack(const TilePack&) = delete;
+
+    // The pack that holds the tile at tilePath, or nullptr if the tile is in a file of its own.
+    // Asks the catalog storage that holds the tile.
+    static std::shared_ptr<const TilePack> packContainingTile(const std::experimental::filesystem::path &tilePath);
+    // The pack file at packPath, or nullptr if there isn't one. Opened packs are cached, so their index is only parsed once.
+    static std::shared_ptr<const TilePack> openFile(const std::experimental::filesystem::path &packPath);
+    // A pack that is held in memory rather than in a file. filename is only used to describe it.
+    static std::shared_ptr<const TilePack> fromContents(const std::experimental::filesystem::path &filename, std::string contents);
+
+    const std::experimental::filesystem::path &filename() const { return filename_; }
+    unsigned int frameRate() const { return frameRate_; }
+    const Tile &tile(unsigned int tileNumber) const { return tiles_.at(tileNumber); }
+    bool containsTile(unsigned int tileNumber) const { return tiles_.count(tileNumber); }
+    unsigned long long tileSize(unsigned int tileNumber) const;
+
+    // Sample numbers are one-based, like MP4Reader's. A tile's samples are only contiguous within a GOP.
+    std::pair<unsigned long long, unsigned long long> byteRangeForSamples(unsigned int tileNumber, unsigned int firstSample, unsigned int lastSample) const;
+    std::unique_ptr<std::vector<char>> dataForSamples(unsigned int tileNumber, unsigned int firstSample, unsigned int lastSample) const;
+
+    // Reads each (offset, size) range, merging ranges that are close together into a single read.
+    std::vector<std::unique_ptr<std::vector<char>>> read(const std::vector<std::pair<unsigned long long, unsigned long long>> &byteRanges) const;
+
+private:
+    explicit TilePack(const std::experimental::filesystem::path &filename);
+    TilePack(const std::experimental::filesystem::path &filename, std::string contents);
+    void readIndex();
+    unsigned long long size() const;
+    void readInto(char *destination, unsigned long long offset, unsigned long long size) const;
+
+    std::experimental::filesystem::path filename_;
+    // Reads use pread, so one descriptor is shared by every reader of the pack. -1 when the pack is in memory.
+    int fileDescriptor_;
+    const std::string contents_;
+    unsigned int frameRate_;
+    std::unordered_map<unsigned int, Tile> tiles_;
+};
+
+} // namespace tasm
+
+#endif //TASM_TILEPACK_H
@@ -0,0 +1,151 @@
+#include "AnnexB.h"
+
+#include <vector>
+
+namespace tasm::annexb {
+
+static const std::string StartCode("\0\0\1", 3);
+
+// Reads the RBSP of a NAL unit, skipping emulation prevention bytes.
+class BitReader {
+public:
+    BitReader(const char *data, size_t size)
+        : position_(0)
+    {
+        rbsp_.reserve(size);
+        unsigned int numberOfZeros = 0;
+        for (auto i = 0u; i < size; ++i) {
+            auto byte = static_cast<unsigned char>(data[i]);
+            if (numberOfZeros >= 2 && byte == 3) {
+                numberOfZeros = 0;
+                continue;
+            }
+            rbsp_.push_back(byte);
+            numberOfZeros = byte ? 0 : numberOfZeros + 1;
+        }
+    }
+
+    unsigned long long bits(unsigned int numberOfBits) {
+        unsigned long long value = 0;
+        for (auto i = 0u; i < numberOfBits; ++i, ++position_) {
+            auto byte = position_ / 8 < rbsp_.size() ? rbsp_[position_ / 8] : 0;
+            value = (value << 1) | ((byte >> (7 - position_ % 8)) & 1u);
+        }
+        return value;
+    }
+
+    unsigned long golomb() {
+        auto numberOfLeadingZeros = 0u;
+        while (!bits(1) && numberOfLeadingZeros < 32)
+            ++numberOfLeadingZeros;
+        return (1ul << numberOfLeadingZeros) - 1 + bits(numberOfLeadingZeros);
+    }
+
+private:
+    std::vector<unsigned char> rbsp_;
+    size_t position_;
+};
+
+bool startsNewAccessUnit(unsigned int type, const char *nal, bool accessUnitHasSlice) {
+    if (!accessUnitHasSlice)
+        return false;
+
+    // first_slice_segment_in_pic_flag.
+    if (isSlice(type))
+        return static_cast<unsigned char>(nal[2]) & 0x80u;
+    return (type >= NalUnitVPS && type <= NalUnitAccessUnitDelimiter)
+            || type == NalUnitPrefixSEI
+            || (type >= 41 && type <= 44)
+            || (type >= 48 && type <= 55);
+}
+
+SequenceParameterSetInfo parseSequenceParameterSet(const char *nal, size_t size) {
+    SequenceParameterSetInfo info;
+    BitReader reader(nal + 2, size - 2);
+    reader.bits(4); // sps_video_parameter_set_id
+    info.maxSubLayersMinus1 = reader.bits(3);
+    info.temporalIdNesting = reader.bits(1);
+
+    for (auto &byte : info.generalProfileTierLevel)
+        byte = static_cast<char>(reader.bits(8));
+
+    std::vector<std::pair<bool, bool>> subLayerProfileAndLevelPresent(info.maxSubLayersMinus1);
+    for (auto &present : subLayerProfileAndLevelPresent) {
+        present.first = reader.bits(1);
+        present.second = reader.bits(1);
+    }
+    if (info.maxSubLayersMinus1)
+        reader.bits(2 * (8 - info.maxSubLayersMinus1));
+    for (const auto &present : subLayerProfileAndLevelPresent) {
+        if (present.first) {
+            reader.bits(44);
+            reader.bits(44);
+        }
+        if (present.second)
+            reader.bits(8);
+    }
+
+    info.id = reader.golomb();
+    info.chromaFormat = reader.golomb();
+    if (info.chromaFormat == 3)
+        reader.bits(1); // separate_colour_plane_flag
+    info.codedWidth = reader.golomb();
+    info.codedHeight = reader.golomb();
+    unsigned long left = 0, right = 0, top = 0, bottom = 0;
+    if (reader.bits(1)) {
+        left = reader.golomb();
+        right = reader.golomb();
+        top = reader.golomb();
+        bottom = reader.golomb();
+    }
+    auto subWidth = info.chromaFormat == 1 || info.chromaFormat == 2 ? 2 : 1;
+    auto subHeight = info.chromaFormat == 1 ? 2 : 1;
+    info.width = info.codedWidth - subWidth * (left + right);
+    info.height = info.codedHeight - subHeight * (top + bottom);
+    info.bitDepthLumaMinus8 = reader.golomb();
+    info.bitDepthChromaMinus8 = reader.golomb();
+    return info;
+}
+
+unsigned int parameterSetId(unsigned int type, const char *nal, size_t size) {
+    if (type == NalUnitSPS)
+        return parseSequenceParameterSet(nal, size).id;
+
+    BitReader reader(nal + 2, size - 2);
+    return type == NalUnitVPS ? reader.bits(4) : reader.golomb();
+}
+
+void NalUnitSplitter::write(const char *data, size_t size) {
+    pending_.append(data, size);
+
+    // A NAL unit is complete once the next start code is seen.
+    auto nalStart = pending_.find(StartCode);
+    if (nalStart == std::string::npos)
+        return;
+    for (auto nextStart = pending_.find(StartCode, nalStart + StartCode.size());
+         nextStart != std::string::npos;
+         nextStart = pending_.find(StartCode, nalStart + StartCode.size())) {
+        handle(pending_.data() + nalStart + StartCode.size(), nextStart - nalStart - StartCode.size());
+        nalStart = nextStart;
+    }
+    pending_.erase(0, nalStart);
+}
+
+void NalUnitSplitter::flush() {
+    auto nalStart = pending_.find(StartCode);
+    if (nalStart != std::string::npos)
+        handle(pending_.data() + nalStart + StartCode.size(), pending_.size() - nalStart - StartCode.size());
+    pending_.clear();
+}
+
+void NalUnitSplitter::handle(const char *nal, size_t size) {
+    // Drop the leading zero of a following four-byte start code.
+    while (size && !nal[size - 1])
+        --size;
+    // Every NAL unit that matters has a two-byte header and at least one byte of payload.
+    if (size < 3)
+        return;
+    handleNal_(nal, size);
+}
+
+} // namespace tasm::annexb
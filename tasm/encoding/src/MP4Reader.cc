@@ -1,6 +1,11 @@
 #include "MP4Reader.h"
 
 std::unique_ptr<std::vector<char>> MP4Reader::dataForSamples(unsigned int firstSampleToRead, unsigned int lastSampleToRead) const {
+    if (pack_)
+        return pack_->dataForSamples(tileNumber_, firstSampleToRead, lastSampleToRead);
+    if (sampleIndex_)
+        return sampleIndex_->dataForSamples(firstSampleToRead, lastSampleToRead);
+
     unsigned long size = 0;
 
     // First read to get sizes.
@@ -20,4 +25,33 @@ std::unique_ptr<std::vector<char>> MP4Reader::dataForSamples(unsigned int firstS
     }
 
     return videoData;
-}
\ No newline at end of file
+}
+
+std::vector<unsigned int> MP4Reader::sampleSizes() const {
+    if (pack_)
+        return pack_->tile(tileNumber_).sampleSizes;
+    if (sampleIndex_)
+        return sampleIndex_->sampleSizes();
+
+    std::vector<unsigned int> sizes(numberOfSamples_);
+    for (auto i = 0u; i < numberOfSamples_; ++i)
+        sizes[i] = gf_isom_get_sample_size(file_, trackNumber_, frameNumberToSampleNumber(i));
+    return sizes;
+}
+
+std::pair<unsigned long long, unsigned long long> MP4Reader::byteRangeForSamples(unsigned int firstSample, unsigned int lastSample) const {
+    if (pack_)
+        return pack_->byteRangeForSamples(tileNumber_, firstSample, lastSample);
+    if (sampleIndex_)
+        return sampleIndex_->byteRangeForSamples(firstSample, lastSample);
+
+    u32 sampleDescriptionIndex;
+    u64 offset = 0;
+    GF_ISOSample *sample = gf_isom_get_sample_info(file_, trackNumber_, firstSample, &sampleDescriptionIndex, &offset);
+    gf_isom_sample_del(&sample);
+
+    unsigned long long size = 0;
+    for (auto i = firstSample; i <= lastSample; ++i)
+        size += gf_isom_get_sample_size(file_, trackNumber_, i);
+    return std::make_pair(offset, size);
+}
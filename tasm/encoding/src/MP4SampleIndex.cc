@@ -0,0 +1,391 @@
+#include "MP4SampleIndex.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tasm {
+
+static const std::string FourByteStartCode("\0\0\0\1", 4);
+static const unsigned int MaximumNumberOfCachedIndexes = 256;
+// Matches GPAC, which MP4Reader uses for every track.
+static const unsigned int TrackId = 1;
+// The fields of a VisualSampleEntry before its child boxes.
+static const unsigned int VisualSampleEntrySize = 78;
+
+namespace {
+
+// Reads big-endian fields, throwing if the data ends first.
+class ByteReader {
+public:
+    ByteReader(const char *data, size_t size)
+        : data_(data), size_(size), position_(0)
+    { }
+
+    unsigned long long read(unsigned int numberOfBytes) {
+        skip(numberOfBytes);
+        unsigned long long value = 0;
+        for (auto i = position_ - numberOfBytes; i < position_; ++i)
+            value = (value << 8) | static_cast<unsigned char>(data_[i]);
+        return value;
+    }
+
+    // Reads a 32-bit entry count, checking that the entries fit in the rest of the data.
+    unsigned long long readCount(unsigned int entrySize) {
+        auto count = read(4);
+        if (count > remaining() / entrySize)
+            throw std::runtime_error("Truncated box");
+        return count;
+    }
+
+    void skip(size_t numberOfBytes) {
+        if (numberOfBytes > size_ - position_)
+            throw std::runtime_error("Truncated box");
+        position_ += numberOfBytes;
+    }
+
+    const char *current() const { return data_ + position_; }
+    size_t remaining() const { return size_ - position_; }
+
+private:
+    const char *data_;
+    size_t size_;
+    size_t position_;
+};
+
+struct Box {
+    std::string type;
+    const char *payload;
+    size_t size;
+};
+
+std::vector<Box> childBoxes(const char *data, size_t size) {
+    std::vector<Box> boxes;
+    ByteReader reader(data, size);
+    while (reader.remaining() >= 8) {
+        auto start = reader.current();
+        unsigned long long boxSize = reader.read(4);
+        std::string type(reader.current(), 4);
+        reader.skip(4);
+        if (boxSize == 1)
+            boxSize = reader.read(8);
+        else if (!boxSize)
+            boxSize = reader.remaining() + (reader.current() - start);
+
+        auto headerSize = static_cast<size_t>(reader.current() - start);
+        if (boxSize < headerSize)
+            throw std::runtime_error("Malformed box " + type);
+        boxes.push_back({type, reader.current(), static_cast<size_t>(boxSize - headerSize)});
+        reader.skip(boxSize - headerSize);
+    }
+    return boxes;
+}
+
+std::optional<Box> childBox(const char *data, size_t size, const char *type) {
+    for (const auto &box : childBoxes(data, size)) {
+        if (box.type == type)
+            return box;
+    }
+    return std::nullopt;
+}
+
+Box requiredChildBox(const Box &parent, const char *type) {
+    auto box = childBox(parent.payload, parent.size, type);
+    if (!box)
+        throw std::runtime_error("Missing " + std::string(type) + " in " + parent.type);
+    return *box;
+}
+
+// Replaces each NAL unit's length with a start code. Lengths are almost always four bytes like the start code,
+// in which case the samples are converted where they were read.
+void convertToAnnexB(std::vector<char> &data, size_t start, unsigned int nalLengthSize) {
+    if (nalLengthSize == FourByteStartCode.size()) {
+        for (auto position = start; position < data.size();) {
+            ByteReader reader(data.data() + position, data.size() - position);
+            auto length = reader.read(nalLengthSize);
+            reader.skip(length);
+            std::memcpy(data.data() + position, FourByteStartCode.data(), FourByteStartCode.size());
+            position += nalLengthSize + length;
+        }
+        return;
+    }
+
+    std::vector<char> converted;
+    ByteReader reader(data.data() + start, data.size() - start);
+    while (reader.remaining()) {
+        auto length = reader.read(nalLengthSize);
+        auto nal = reader.current();
+        reader.skip(length);
+        converted.insert(converted.end(), FourByteStartCode.begin(), FourByteStartCode.end());
+        converted.insert(converted.end(), nal, nal + length);
+    }
+    data.resize(start);
+    data.insert(data.end(), converted.begin(), converted.end());
+}
+
+} // namespace
+
+MP4SampleIndex::MP4SampleIndex(const std::experimental::filesystem::path &filename)
+    : filename_(filename),
+    fileDescriptor_(::open(filename.c_str(), O_RDONLY | O_CLOEXEC)),
+    nalLengthSize_(4)
+{
+    if (fileDescriptor_ < 0)
+        throw std::runtime_error("Failed to open " + filename_.string());
+
+    try {
+        readSampleTable();
+    } catch (...) {
+        ::close(fileDescriptor_);
+        throw;
+    }
+}
+
+MP4SampleIndex::~MP4SampleIndex() {
+    ::close(fileDescriptor_);
+}
+
+std::shared_ptr<const MP4SampleIndex> MP4SampleIndex::open(const std::experimental::filesystem::path &path) {
+    struct stat status;
+    if (stat(path.c_str(), &status))
+        return nullptr;
+
+    // Tile files are only replaced by renaming a new directory into place, so the inode and size identify a version.
+    struct CachedIndex {
+        std::experimental::filesystem::path path;
+        ino_t inode;
+        off_t size;
+        std::shared_ptr<const MP4SampleIndex> index;
+    };
+    static std::mutex mutex;
+    static std::list<CachedIndex> cache;
+
+    std::scoped_lock lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->path != path)
+            continue;
+        if (it->inode == status.st_ino && it->size == status.st_size) {
+            cache.splice(cache.begin(), cache, it);
+            return cache.front().index;
+        }
+        cache.erase(it);
+        break;
+    }
+
+    std::shared_ptr<const MP4SampleIndex> index;
+    try {
+        index.reset(new MP4SampleIndex(path));
+    } catch (const std::exception &) {
+        // The caller falls back to GPAC, which handles every layout of the sample table.
+        return nullptr;
+    }
+    cache.push_front({path, status.st_ino, status.st_size, index});
+    if (cache.size() > MaximumNumberOfCachedIndexes)
+        cache.pop_back();
+    return index;
+}
+
+std::string MP4SampleIndex::readMovieBox() const {
+    struct stat status;
+    if (fstat(fileDescriptor_, &status))
+        throw std::runtime_error("Failed to stat " + filename_.string());
+    unsigned long long fileSize = status.st_size;
+
+    // Only moov is read. mdat can come before it and be arbitrarily large.
+    unsigned long long offset = 0;
+    while (offset + 8 <= fileSize) {
+        char header[16];
+        auto headerSize = std::min<unsigned long long>(sizeof(header), fileSize - offset);
+        readInto(header, offset, headerSize);
+        ByteReader reader(header, headerSize);
+        unsigned long long boxSize = reader.read(4);
+        std::string type(reader.current(), 4);
+        reader.skip(4);
+        if (boxSize == 1)
+            boxSize = reader.read(8);
+        else if (!boxSize)
+            boxSize = fileSize - offset;
+
+        auto boxHeaderSize = headerSize - reader.remaining();
+        if (boxSize < boxHeaderSize || boxSize > fileSize - offset)
+            throw std::runtime_error("Malformed mp4 " + filename_.string());
+        if (type == "moov") {
+            std::string moov(boxSize - boxHeaderSize, '\0');
+            readInto(moov.data(), offset + boxHeaderSize, moov.size());
+            return moov;
+        }
+        offset += boxSize;
+    }
+    throw std::runtime_error("No moov in " + filename_.string());
+}
+
+void MP4SampleIndex::readSampleTable() {
+    auto moov = readMovieBox();
+    std::optional<Box> sampleTable;
+    for (const auto &trak : childBoxes(moov.data(), moov.size())) {
+        if (trak.type != "trak")
+            continue;
+
+        auto tkhd = requiredChildBox(trak, "tkhd");
+        ByteReader tkhdReader(tkhd.payload, tkhd.size);
+        auto version = tkhdReader.read(1);
+        tkhdReader.skip(version == 1 ? 3 + 16 : 3 + 8); // flags, creation and modification time
+        if (tkhdReader.read(4) != TrackId)
+            continue;
+
+        sampleTable = requiredChildBox(requiredChildBox(requiredChildBox(trak, "mdia"), "minf"), "stbl");
+        break;
+    }
+    if (!sampleTable)
+        throw std::runtime_error("No track in " + filename_.string());
+
+    // Find the HEVC configuration to get the NAL length size and the parameter sets.
+    auto stsd = requiredChildBox(*sampleTable, "stsd");
+    ByteReader stsdReader(stsd.payload, stsd.size);
+    stsdReader.skip(8); // version, flags, and entry_count
+    auto sampleEntries = childBoxes(stsdReader.current(), stsdReader.remaining());
+    if (sampleEntries.empty() || (sampleEntries.front().type != "hvc1" && sampleEntries.front().type != "hev1"))
+        throw std::runtime_error("Unsupported sample entry in " + filename_.string());
+    ByteReader sampleEntryReader(sampleEntries.front().payload, sampleEntries.front().size);
+    sampleEntryReader.skip(VisualSampleEntrySize);
+    auto hvcC = childBox(sampleEntryReader.current(), sampleEntryReader.remaining(), "hvcC");
+    if (!hvcC)
+        throw std::runtime_error("Missing hvcC in " + filename_.string());
+
+    ByteReader configuration(hvcC->payload, hvcC->size);
+    configuration.skip(21);
+    nalLengthSize_ = (configuration.read(1) & 3u) + 1;
+    auto numberOfArrays = configuration.read(1);
+    for (auto i = 0u; i < numberOfArrays; ++i) {
+        configuration.skip(1); // array_completeness and NAL_unit_type
+        auto numberOfNals = configuration.read(2);
+        for (auto j = 0u; j < numberOfNals; ++j) {
+            auto length = configuration.read(2);
+            auto nal = configuration.current();
+            configuration.skip(length);
+            parameterSets_.append(FourByteStartCode);
+            parameterSets_.append(nal, length);
+        }
+    }
+
+    auto stsz = requiredChildBox(*sampleTable, "stsz");
+    ByteReader sizes(stsz.payload, stsz.size);
+    sizes.skip(4);
+    auto constantSize = sizes.read(4);
+    auto numberOfSamples = sizes.read(4);
+    if (!constantSize && numberOfSamples > sizes.remaining() / 4)
+        throw std::runtime_error("Truncated stsz in " + filename_.string());
+    sampleSizes_.resize(numberOfSamples);
+    for (auto &size : sampleSizes_)
+        size = constantSize ? constantSize : sizes.read(4);
+
+    std::vector<unsigned long long> chunkOffsets;
+    auto chunkOffsetBox = childBox(sampleTable->payload, sampleTable->size, "stco");
+    auto offsetSize = 4u;
+    if (!chunkOffsetBox) {
+        chunkOffsetBox = requiredChildBox(*sampleTable, "co64");
+        offsetSize = 8;
+    }
+    ByteReader offsets(chunkOffsetBox->payload, chunkOffsetBox->size);
+    offsets.skip(4);
+    chunkOffsets.resize(offsets.readCount(offsetSize));
+    for (auto &offset : chunkOffsets)
+        offset = offsets.read(offsetSize);
+
+    // Each entry gives the number of samples in every chunk from its first chunk up to the next entry's.
+    auto stsc = requiredChildBox(*sampleTable, "stsc");
+    ByteReader chunks(stsc.payload, stsc.size);
+    chunks.skip(4);
+    std::vector<std::pair<unsigned long long, unsigned long long>> firstChunkAndSamplesPerChunk(chunks.readCount(12));
+    for (auto &entry : firstChunkAndSamplesPerChunk) {
+        entry.first = chunks.read(4);
+        entry.second = chunks.read(4);
+        chunks.skip(4); // sample_description_index
+    }
+
+    sampleOffsets_.resize(numberOfSamples);
+    auto sample = 0u;
+    auto entry = firstChunkAndSamplesPerChunk.begin();
+    for (auto chunk = 0u; entry != firstChunkAndSamplesPerChunk.end() && chunk < chunkOffsets.size() && sample < numberOfSamples; ++chunk) {
+        while (std::next(entry) != firstChunkAndSamplesPerChunk.end() && std::next(entry)->first <= chunk + 1)
+            ++entry;
+
+        auto offset = chunkOffsets[chunk];
+        for (auto i = 0u; i < entry->second && sample < numberOfSamples; ++i, ++sample) {
+            sampleOffsets_[sample] = offset;
+            offset += sampleSizes_[sample];
+        }
+    }
+    if (sample != numberOfSamples)
+        throw std::runtime_error("Chunks don't cover every sample in " + filename_.string());
+
+    if (auto stss = childBox(sampleTable->payload, sampleTable->size, "stss")) {
+        ByteReader syncSamples(stss->payload, stss->size);
+        syncSamples.skip(4);
+        keyframeNumbers_.resize(syncSamples.readCount(4));
+        for (auto &keyframe : keyframeNumbers_)
+            keyframe = syncSamples.read(4) - 1;
+    }
+}
+
+bool MP4SampleIndex::isKeyframe(unsigned int frame) const {
+    return keyframeNumbers_.empty() || std::binary_search(keyframeNumbers_.begin(), keyframeNumbers_.end(), static_cast<int>(frame));
+}
+
+std::pair<unsigned long long, unsigned long long> MP4SampleIndex::byteRangeForSamples(unsigned int firstSample, unsigned int lastSample) const {
+    if (!firstSample || lastSample > sampleSizes_.size() || firstSample > lastSample)
+        throw std::runtime_error("Samples out of range in " + filename_.string());
+
+    unsigned long long size = 0;
+    for (auto i = firstSample - 1; i < lastSample; ++i)
+        size += sampleSizes_[i];
+    return std::make_pair(sampleOffsets_[firstSample - 1], size);
+}
+
+std::unique_ptr<std::vector<char>> MP4SampleIndex::dataForSamples(unsigned int firstSample, unsigned int lastSample) const {
+    auto numberOfBytes = byteRangeForSamples(firstSample, lastSample).second;
+    std::unique_ptr<std::vector<char>> data(new std::vector<char>);
+    data->reserve(numberOfBytes + parameterSets_.size());
+
+    for (auto frame = firstSample - 1; frame < lastSample;) {
+        // Each keyframe starts a new read so that the parameter sets can go in front of it.
+        if (isKeyframe(frame))
+            data->insert(data->end(), parameterSets_.begin(), parameterSets_.end());
+
+        auto offset = sampleOffsets_[frame];
+        unsigned long long size = sampleSizes_[frame];
+        auto end = frame + 1;
+        for (; end < lastSample && !isKeyframe(end) && sampleOffsets_[end] == offset + size; ++end)
+            size += sampleSizes_[end];
+
+        auto start = data->size();
+        data->resize(start + size);
+        readInto(data->data() + start, offset, size);
+        convertToAnnexB(*data, start, nalLengthSize_);
+        frame = end;
+    }
+    return data;
+}
+
+void MP4SampleIndex::readInto(char *destination, unsigned long long offset, unsigned long long size) const {
+    while (size) {
+        auto numberRead = pread(fileDescriptor_, destination, size, offset);
+        if (numberRead <= 0) {
+            if (numberRead < 0 && errno == EINTR)
+                continue;
+            throw std::runtime_error("Failed to read " + filename_.string());
+        }
+        destination += numberRead;
+        offset += numberRead;
+        size -= numberRead;
+    }
+}
+
+} // namespace tasm
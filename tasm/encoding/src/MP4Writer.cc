@@ -0,0 +1,362 @@
+#include "MP4Writer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+using namespace tasm::annexb;
+
+namespace {
+
+// Every sample lasts SampleDuration in a media timescale of frameRate * SampleDuration, like GPAC's importer writes.
+// Readers address samples by number.
+constexpr unsigned int MovieTimescale = 1000;
+constexpr unsigned int SampleDuration = 1000;
+
+constexpr unsigned int FileTypeBoxSize = 24;
+constexpr unsigned int MediaDataHeaderSize = 16;
+
+// Builds big-endian boxes in memory.
+class BoxBuffer {
+public:
+    void u8(unsigned int value) { data_.push_back(static_cast<char>(value)); }
+    void u16(unsigned int value) { u8(value >> 8); u8(value); }
+    void u32(unsigned int value) { u16(value >> 16); u16(value); }
+    void u64(unsigned long long value) { u32(value >> 32); u32(value); }
+    void zeros(size_t count) { data_.append(count, '\0'); }
+    void append(const std::string &data) { data_.append(data); }
+    void fourcc(const char *type) { data_.append(type, 4); }
+
+    size_t beginBox(const char *type) {
+        auto start = data_.size();
+        u32(0);
+        fourcc(type);
+        return start;
+    }
+
+    size_t beginFullBox(const char *type, unsigned int version, unsigned int flags) {
+        auto start = beginBox(type);
+        u32((version << 24) | flags);
+        return start;
+    }
+
+    void endBox(size_t start) {
+        auto size = data_.size() - start;
+        for (auto i = 0u; i < 4; ++i)
+            data_[start + i] = static_cast<char>(size >> (24 - 8 * i));
+    }
+
+    void matrix() {
+        for (auto value : {0x00010000u, 0u, 0u, 0u, 0x00010000u, 0u, 0u, 0u, 0x40000000u})
+            u32(value);
+    }
+
+    const std::string &data() const { return data_; }
+
+private:
+    std::string data_;
+};
+
+} // namespace
+
+MP4Writer::MP4Writer(const std::experimental::filesystem::path &filename, unsigned int frameRate)
+    : filename_(filename),
+    frameRate_(frameRate),
+    output_(filename, std::ios::binary | std::ios::trunc),
+    isClosed_(false),
+    splitter_([this](const char *nal, size_t size) { processNal(nal, size); }),
+    mdatOffset_(0),
+    mdatSize_(0),
+    currentSampleSize_(0),
+    currentSampleHasSlice_(false),
+    currentSampleIsKeyframe_(false),
+    hasInBandParameterSets_(false),
+    width_(0),
+    height_(0)
+{
+    if (!frameRate_)
+        throw std::runtime_error("Failed to open " + filename_.string() + ": the frame rate must be positive");
+    if (!output_)
+        throw std::runtime_error("Failed to open " + filename_.string());
+    writeFileHeader();
+}
+
+void MP4Writer::write(const char *data, size_t size) {
+    splitter_.write(data, size);
+}
+
+void MP4Writer::close() {
+    if (isClosed_)
+        return;
+    isClosed_ = true;
+
+    splitter_.flush();
+    finishSample();
+
+    // mdat's size is only known once every sample is written.
+    BoxBuffer size;
+    size.u64(mdatSize_);
+    output_.seekp(mdatOffset_ + 8);
+    output_.write(size.data().data(), size.data().size());
+    output_.seekp(0, std::ios::end);
+
+    writeMovieBox();
+    output_.close();
+    if (!output_)
+        throw std::runtime_error("Failed to write " + filename_.string());
+}
+
+void MP4Writer::writeFileHeader() {
+    BoxBuffer header;
+    auto ftyp = header.beginBox("ftyp");
+    header.fourcc("iso4");
+    header.u32(1);
+    header.fourcc("iso4");
+    header.fourcc("isom");
+    header.endBox(ftyp);
+    assert(header.data().size() == FileTypeBoxSize);
+
+    // Use a 64-bit size so it can be filled in for any amount of data.
+    mdatOffset_ = header.data().size();
+    mdatSize_ = MediaDataHeaderSize;
+    header.u32(1);
+    header.fourcc("mdat");
+    header.u64(0);
+
+    output_.write(header.data().data(), header.data().size());
+}
+
+void MP4Writer::processNal(const char *nal, size_t size) {
+    auto type = nalType(nal);
+    if (startsNewAccessUnit(type, nal, currentSampleHasSlice_))
+        finishSample();
+
+    // GPAC's importer drops delimiters too. Decoders find access unit boundaries without them.
+    if (type == NalUnitAccessUnitDelimiter)
+        return;
+    if (isParameterSet(type) && addParameterSet(type, nal, size))
+        return;
+
+    if (isSlice(type)) {
+        currentSampleHasSlice_ = true;
+        currentSampleIsKeyframe_ |= isKeyframeSlice(type);
+    }
+    writeNalToSample(nal, size);
+}
+
+bool MP4Writer::addParameterSet(unsigned int type, const char *nal, size_t size) {
+    std::string data(nal, size);
+    auto id = parameterSetId(type, nal, size);
+    auto existing = std::find_if(parameterSets_.begin(), parameterSets_.end(), [&](const auto &parameterSet) {
+        return parameterSet.type == type && parameterSet.id == id;
+    });
+
+    if (existing == parameterSets_.end()) {
+        // The first SPS describes the track.
+        if (type == NalUnitSPS && !width_) {
+            auto info = parseSequenceParameterSet(nal, size);
+            width_ = info.width;
+            height_ = info.height;
+        }
+        parameterSets_.push_back({type, id, std::move(data)});
+    } else if (existing->data != data) {
+        // Samples after this point depend on the replacement, so every later parameter set stays in band.
+        hasInBandParameterSets_ = true;
+    }
+
+    return !hasInBandParameterSets_;
+}
+
+void MP4Writer::writeNalToSample(const char *nal, size_t size) {
+    BoxBuffer length;
+    length.u32(size);
+    output_.write(length.data().data(), length.data().size());
+    output_.write(nal, size);
+
+    currentSampleSize_ += length.data().size() + size;
+    mdatSize_ += length.data().size() + size;
+}
+
+void MP4Writer::finishSample() {
+    if (!currentSampleSize_)
+        return;
+
+    if (currentSampleIsKeyframe_)
+        keyframeNumbers_.push_back(sampleSizes_.size());
+    sampleSizes_.push_back(currentSampleSize_);
+
+    currentSampleSize_ = 0;
+    currentSampleHasSlice_ = false;
+    currentSampleIsKeyframe_ = false;
+}
+
+std::string MP4Writer::hevcConfiguration() const {
+    SequenceParameterSetInfo info;
+    auto sps = std::find_if(parameterSets_.begin(), parameterSets_.end(), [](const auto &parameterSet) {
+        return parameterSet.type == NalUnitSPS;
+    });
+    if (sps != parameterSets_.end())
+        info = parseSequenceParameterSet(sps->data.data(), sps->data.size());
+
+    BoxBuffer configuration;
+    configuration.u8(1);
+    configuration.append(info.generalProfileTierLevel);
+    configuration.u16(0xF000); // min_spatial_segmentation_idc
+    configuration.u8(0xFC); // parallelismType
+    configuration.u8(0xFC | info.chromaFormat);
+    configuration.u8(0xF8 | info.bitDepthLumaMinus8);
+    configuration.u8(0xF8 | info.bitDepthChromaMinus8);
+    configuration.u16(0); // avgFrameRate
+    configuration.u8(((info.maxSubLayersMinus1 + 1) << 3) | (info.temporalIdNesting << 2) | 3); // 4-byte NAL lengths
+
+    std::vector<unsigned int> types;
+    for (auto type : {NalUnitVPS, NalUnitSPS, NalUnitPPS}) {
+        if (std::any_of(parameterSets_.begin(), parameterSets_.end(), [&](const auto &parameterSet) { return parameterSet.type == type; }))
+            types.push_back(type);
+    }
+    configuration.u8(types.size());
+    for (auto type : types) {
+        auto arrayIsComplete = !hasInBandParameterSets_;
+        configuration.u8((arrayIsComplete << 7) | type);
+        configuration.u16(std::count_if(parameterSets_.begin(), parameterSets_.end(), [&](const auto &parameterSet) { return parameterSet.type == type; }));
+        for (const auto &parameterSet : parameterSets_) {
+            if (parameterSet.type != type)
+                continue;
+            configuration.u16(parameterSet.data.size());
+            configuration.append(parameterSet.data);
+        }
+    }
+    return configuration.data();
+}
+
+void MP4Writer::writeMovieBox() {
+    unsigned int numberOfSamples = sampleSizes_.size();
+    unsigned long long mediaDuration = static_cast<unsigned long long>(numberOfSamples) * SampleDuration;
+    unsigned long long mediaTimescale = static_cast<unsigned long long>(frameRate_) * SampleDuration;
+    unsigned long long movieDuration = mediaDuration * MovieTimescale / mediaTimescale;
+
+    BoxBuffer moov;
+    auto moovStart = moov.beginBox("moov");
+
+    auto mvhd = moov.beginFullBox("mvhd", 0, 0);
+    moov.zeros(8); // creation and modification time
+    moov.u32(MovieTimescale);
+    moov.u32(movieDuration);
+    moov.u32(0x00010000); // rate
+    moov.u16(0x0100); // volume
+    moov.zeros(10);
+    moov.matrix();
+    moov.zeros(24);
+    moov.u32(2); // next_track_ID
+    moov.endBox(mvhd);
+
+    auto trak = moov.beginBox("trak");
+    auto tkhd = moov.beginFullBox("tkhd", 0, 3); // enabled and in movie
+    moov.zeros(8);
+    moov.u32(1); // track_ID
+    moov.zeros(4);
+    moov.u32(movieDuration);
+    moov.zeros(16); // reserved, layer, alternate_group, volume, reserved
+    moov.matrix();
+    moov.u32(width_ << 16);
+    moov.u32(height_ << 16);
+    moov.endBox(tkhd);
+
+    auto mdia = moov.beginBox("mdia");
+    auto mdhd = moov.beginFullBox("mdhd", 0, 0);
+    moov.zeros(8);
+    moov.u32(mediaTimescale);
+    moov.u32(mediaDuration);
+    moov.u16(0x55C4); // "und"
+    moov.u16(0);
+    moov.endBox(mdhd);
+
+    auto hdlr = moov.beginFullBox("hdlr", 0, 0);
+    moov.u32(0);
+    moov.fourcc("vide");
+    moov.zeros(12);
+    moov.append(std::string("VideoHandler", 13));
+    moov.endBox(hdlr);
+
+    auto minf = moov.beginBox("minf");
+    auto vmhd = moov.beginFullBox("vmhd", 0, 1);
+    moov.zeros(8);
+    moov.endBox(vmhd);
+
+    auto dinf = moov.beginBox("dinf");
+    auto dref = moov.beginFullBox("dref", 0, 0);
+    moov.u32(1);
+    moov.endBox(moov.beginFullBox("url ", 0, 1)); // media is in this file
+    moov.endBox(dref);
+    moov.endBox(dinf);
+
+    auto stbl = moov.beginBox("stbl");
+    auto stsd = moov.beginFullBox("stsd", 0, 0);
+    moov.u32(1);
+    auto sampleEntry = moov.beginBox(hasInBandParameterSets_ ? "hev1" : "hvc1");
+    moov.zeros(6);
+    moov.u16(1); // data_reference_index
+    moov.zeros(16);
+    moov.u16(width_);
+    moov.u16(height_);
+    moov.u32(0x00480000); // 72 dpi
+    moov.u32(0x00480000);
+    moov.zeros(4);
+    moov.u16(1); // frame_count
+    moov.zeros(32); // compressorname
+    moov.u16(0x0018); // depth
+    moov.u16(0xFFFF);
+    auto hvcC = moov.beginBox("hvcC");
+    moov.append(hevcConfiguration());
+    moov.endBox(hvcC);
+    moov.endBox(sampleEntry);
+    moov.endBox(stsd);
+
+    auto stts = moov.beginFullBox("stts", 0, 0);
+    moov.u32(numberOfSamples ? 1 : 0);
+    if (numberOfSamples) {
+        moov.u32(numberOfSamples);
+        moov.u32(SampleDuration);
+    }
+    moov.endBox(stts);
+
+    // Without stss every sample is a sync sample.
+    if (keyframeNumbers_.size() != numberOfSamples) {
+        auto stss = moov.beginFullBox("stss", 0, 0);
+        moov.u32(keyframeNumbers_.size());
+        for (auto keyframe : keyframeNumbers_)
+            moov.u32(keyframe + 1);
+        moov.endBox(stss);
+    }
+
+    // The samples are contiguous in mdat, so they form a single chunk.
+    auto stsc = moov.beginFullBox("stsc", 0, 0);
+    moov.u32(numberOfSamples ? 1 : 0);
+    if (numberOfSamples) {
+        moov.u32(1); // first_chunk
+        moov.u32(numberOfSamples);
+        moov.u32(1); // sample_description_index
+    }
+    moov.endBox(stsc);
+
+    auto stsz = moov.beginFullBox("stsz", 0, 0);
+    moov.u32(0);
+    moov.u32(numberOfSamples);
+    for (auto size : sampleSizes_)
+        moov.u32(size);
+    moov.endBox(stsz);
+
+    auto stco = moov.beginFullBox("stco", 0, 0);
+    moov.u32(numberOfSamples ? 1 : 0);
+    if (numberOfSamples)
+        moov.u32(mdatOffset_ + MediaDataHeaderSize);
+    moov.endBox(stco);
+
+    moov.endBox(stbl);
+    moov.endBox(minf);
+    moov.endBox(mdia);
+    moov.endBox(trak);
+    moov.endBox(moovStart);
+
+    output_.write(moov.data().data(), moov.data().size());
+}
@@ -0,0 +1,372 @@
+#include "TilePack.h"
+
+#include "CatalogStorage.h"
+#include "Files.h"
+#include "TilePack.pb.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tasm {
+
+static const std::string FourByteStartCode("\0\0\0\1", 4);
+static const std::string PackMagic("TASMPACK");
+static const unsigned int PackVersion = 1;
+// Ranges closer together than this are read with a single pread.
+static const unsigned long long MaximumGapToCoalesce = 256 * 1024;
+static const unsigned int MaximumNumberOfCachedPacks = 64;
+
+PackedTileBuffer::PackedTileBuffer(unsigned int tileNumber)
+    : tileNumber_(tileNumber),
+    splitter_([this](const char *nal, size_t size) { processNal(nal, size); }),
+    currentSampleHasSlice_(false),
+    currentSampleIsKeyframe_(false),
+    currentSampleHasParameterSets_(false),
+    sawSequenceParameterSet_(false)
+{ }
+
+void PackedTileBuffer::write(const char *data, size_t size) {
+    splitter_.write(data, size);
+}
+
+void PackedTileBuffer::close() {
+    splitter_.flush();
+    finishSample();
+}
+
+void PackedTileBuffer::processNal(const char *nal, size_t size) {
+    auto type = annexb::nalType(nal);
+    if (annexb::startsNewAccessUnit(type, nal, currentSampleHasSlice_))
+        finishSample();
+
+    if (type == annexb::NalUnitSPS && !sawSequenceParameterSet_) {
+        sequenceParameterSet_ = annexb::parseSequenceParameterSet(nal, size);
+        sawSequenceParameterSet_ = true;
+    }
+    if (annexb::isSlice(type)) {
+        currentSampleHasSlice_ = true;
+        currentSampleIsKeyframe_ |= annexb::isKeyframeSlice(type);
+    } else if (annexb::isParameterSet(type)) {
+        currentSampleHasParameterSets_ = true;
+        parameterSets_[type - annexb::NalUnitVPS].assign(nal, size);
+    }
+
+    currentSample_.append(FourByteStartCode);
+    currentSample_.append(nal, size);
+}
+
+void PackedTileBuffer::finishSample() {
+    if (!currentSampleHasSlice_)
+        return;
+
+    auto sampleStart = data_.size();
+    if (currentSampleIsKeyframe_) {
+        keyframeNumbers_.push_back(sampleSizes_.size());
+        // Like MP4Reader's extraction, every keyframe carries the parameter sets so each GOP can be decoded on its own.
+        if (!currentSampleHasParameterSets_) {
+            for (const auto &parameterSet : parameterSets_) {
+                if (parameterSet.empty())
+                    continue;
+                data_.append(FourByteStartCode);
+                data_.append(parameterSet);
+            }
+        }
+    }
+    data_.append(currentSample_);
+    sampleSizes_.push_back(data_.size() - sampleStart);
+    currentSample_.clear();
+    currentSampleHasSlice_ = false;
+    currentSampleHasParameterSets_ = false;
+    currentSampleIsKeyframe_ = false;
+}
+
+void writeTilePack(const std::experimental::filesystem::path &filename, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate) {
+    std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+    if (!output)
+        throw std::runtime_error("Failed to open " + filename.string());
+
+    writeTilePack(output, tiles, frameRate);
+    output.close();
+    if (!output)
+        throw std::runtime_error("Failed to write " + filename.string());
+}
+
+void writeTilePack(std::ostream &output, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate) {
+    lightdb::serialization::TilePackIndex index;
+    index.set_version(PackVersion);
+    index.set_framerate(frameRate);
+
+    // Where each tile's samples start in its buffer, and the samples that begin each of its GOPs.
+    std::vector<std::vector<unsigned long long>> bufferOffsets(tiles.size());
+    std::vector<lightdb::serialization::PackedTile*> packedTiles(tiles.size());
+    auto numberOfGOPs = 0u;
+    for (auto i = 0u; i < tiles.size(); ++i) {
+        auto &tile = *tiles[i];
+        auto &packedTile = *index.add_tiles();
+        packedTile.set_tilenumber(tile.tileNumber());
+        packedTile.set_width(tile.sequenceParameterSet().width);
+        packedTile.set_height(tile.sequenceParameterSet().height);
+        packedTile.set_codedwidth(tile.sequenceParameterSet().codedWidth);
+        packedTile.set_codedheight(tile.sequenceParameterSet().codedHeight);
+        for (auto keyframe : tile.keyframeNumbers())
+            packedTile.add_keyframes(keyframe);
+        packedTiles[i] = &packedTile;
+
+        auto &offsets = bufferOffsets[i];
+        offsets.reserve(tile.sampleSizes().size() + 1);
+        offsets.push_back(0);
+        for (auto size : tile.sampleSizes())
+            offsets.push_back(offsets.back() + size);
+
+        numberOfGOPs = std::max(numberOfGOPs, static_cast<unsigned int>(tile.keyframeNumbers().size()));
+    }
+
+    auto gopBoundary = [&](unsigned int tile, unsigned int gop) -> unsigned int {
+        const auto &keyframes = tiles[tile]->keyframeNumbers();
+        if (gop >= keyframes.size())
+            return tiles[tile]->sampleSizes().size();
+        // Samples before the first keyframe belong to the first GOP.
+        return gop ? keyframes[gop] : 0;
+    };
+
+    unsigned long long offset = 0;
+    for (auto gop = 0u; gop < std::max(numberOfGOPs, 1u); ++gop) {
+        for (auto i = 0u; i < tiles.size(); ++i) {
+            auto first = gopBoundary(i, gop);
+            auto last = gopBoundary(i, gop + 1);
+            if (first >= last)
+                continue;
+
+            auto start = bufferOffsets[i][first];
+            auto size = bufferOffsets[i][last] - start;
+            output.write(tiles[i]->data().data() + start, size);
+            for (auto sample = first; sample < last; ++sample) {
+                packedTiles[i]->add_sampleoffsets(offset + bufferOffsets[i][sample] - start);
+                packedTiles[i]->add_samplesizes(tiles[i]->sampleSizes()[sample]);
+            }
+            offset += size;
+        }
+    }
+
+    std::string serializedIndex;
+    index.SerializeToString(&serializedIndex);
+    unsigned long long indexSize = serializedIndex.size();
+    output.write(serializedIndex.data(), serializedIndex.size());
+    output.write(reinterpret_cast<const char*>(&indexSize), sizeof(indexSize));
+    output.write(PackMagic.data(), PackMagic.size());
+}
+
+TilePack::TilePack(const std::experimental::filesystem::path &filename)
+    : filename_(filename),
+    fileDescriptor_(open(filename.c_str(), O_RDONLY | O_CLOEXEC))
+{
+    if (fileDescriptor_ < 0)
+        throw std::runtime_error("Failed to open " + filename_.string());
+
+    try {
+        readIndex();
+    } catch (...) {
+        ::close(fileDescriptor_);
+        throw;
+    }
+}
+
+TilePack::TilePack(const std::experimental::filesystem::path &filename, std::string contents)
+    : filename_(filename),
+    fileDescriptor_(-1),
+    contents_(std::move(contents))
+{
+    readIndex();
+}
+
+unsigned long long TilePack::size() const {
+    if (fileDescriptor_ < 0)
+        return contents_.size();
+
+    struct stat status;
+    if (fstat(fileDescriptor_, &status))
+        throw std::runtime_error("Failed to stat " + filename_.string());
+    return status.st_size;
+}
+
+void TilePack::readIndex() {
+    auto fileSize = size();
+    unsigned long long trailerSize = sizeof(unsigned long long) + PackMagic.size();
+    if (fileSize < trailerSize)
+        throw std::runtime_error("Truncated tile pack " + filename_.string());
+
+    std::string trailer(trailerSize, '\0');
+    readInto(trailer.data(), fileSize - trailerSize, trailerSize);
+    unsigned long long indexSize;
+    std::memcpy(&indexSize, trailer.data(), sizeof(indexSize));
+    if (trailer.compare(sizeof(indexSize), PackMagic.size(), PackMagic) || indexSize > fileSize - trailerSize)
+        throw std::runtime_error("Malformed tile pack " + filename_.string());
+
+    std::string serializedIndex(indexSize, '\0');
+    readInto(serializedIndex.data(), fileSize - trailerSize - indexSize, indexSize);
+    lightdb::serialization::TilePackIndex index;
+    if (!index.ParseFromString(serializedIndex) || index.version() != PackVersion)
+        throw std::runtime_error("Malformed tile pack " + filename_.string());
+
+    frameRate_ = index.framerate();
+    for (const auto &packedTile : index.tiles()) {
+        auto &tile = tiles_[packedTile.tilenumber()];
+        tile.width = packedTile.width();
+        tile.height = packedTile.height();
+        tile.codedWidth = packedTile.codedwidth();
+        tile.codedHeight = packedTile.codedheight();
+        tile.sampleOffsets.assign(packedTile.sampleoffsets().begin(), packedTile.sampleoffsets().end());
+        tile.sampleSizes.assign(packedTile.samplesizes().begin(), packedTile.samplesizes().end());
+        tile.keyframeNumbers.assign(packedTile.keyframes().begin(), packedTile.keyframes().end());
+    }
+}
+
+TilePack::~TilePack() {
+    if (fileDescriptor_ >= 0)
+        ::close(fileDescriptor_);
+}
+
+std::shared_ptr<const TilePack> TilePack::packContainingTile(const std::experimental::filesystem::path &tilePath) {
+    return CatalogStorage::forPath(tilePath)->openTilePack(tilePath.parent_path());
+}
+
+std::shared_ptr<const TilePack> TilePack::fromContents(const std::experimental::filesystem::path &filename, std::string contents) {
+    return std::shared_ptr<const TilePack>(new TilePack(filename, std::move(contents)));
+}
+
+std::shared_ptr<const TilePack> TilePack::openFile(const std::experimental::filesystem::path &packPath) {
+    struct stat status;
+    if (stat(packPath.c_str(), &status))
+        return nullptr;
+
+    // Packs are only replaced by renaming a new directory into place, so the inode and size identify a version.
+    struct CachedPack {
+        std::experimental::filesystem::path path;
+        ino_t inode;
+        off_t size;
+        std::shared_ptr<const TilePack> pack;
+    };
+    static std::mutex mutex;
+    static std::list<CachedPack> cache;
+
+    std::scoped_lock lock(mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->path != packPath)
+            continue;
+        if (it->inode == status.st_ino && it->size == status.st_size) {
+            cache.splice(cache.begin(), cache, it);
+            return cache.front().pack;
+        }
+        cache.erase(it);
+        break;
+    }
+
+    std::shared_ptr<const TilePack> pack(new TilePack(packPath));
+    cache.push_front({packPath, status.st_ino, status.st_size, pack});
+    if (cache.size() > MaximumNumberOfCachedPacks)
+        cache.pop_back();
+    return pack;
+}
+
+unsigned long long TilePack::tileSize(unsigned int tileNumber) const {
+    unsigned long long size = 0;
+    for (auto sampleSize : tile(tileNumber).sampleSizes)
+        size += sampleSize;
+    return size;
+}
+
+std::pair<unsigned long long, unsigned long long> TilePack::byteRangeForSamples(unsigned int tileNumber, unsigned int firstSample, unsigned int lastSample) const {
+    const auto &packedTile = tile(tileNumber);
+    assert(firstSample >= 1 && lastSample <= packedTile.sampleSizes.size());
+    // A tile's GOPs are interleaved with other tiles', but the samples within a GOP are contiguous.
+    unsigned long long size = 0;
+    for (auto i = firstSample - 1; i < lastSample; ++i)
+        size += packedTile.sampleSizes[i];
+    return std::make_pair(packedTile.sampleOffsets[firstSample - 1], size);
+}
+
+std::unique_ptr<std::vector<char>> TilePack::dataForSamples(unsigned int tileNumber, unsigned int firstSample, unsigned int lastSample) const {
+    const auto &packedTile = tile(tileNumber);
+    std::vector<std::pair<unsigned long long, unsigned long long>> ranges;
+    for (auto i = firstSample - 1; i < lastSample; ++i) {
+        auto offset = packedTile.sampleOffsets[i];
+        if (!ranges.empty() && ranges.back().first + ranges.back().second == offset)
+            ranges.back().second += packedTile.sampleSizes[i];
+        else
+            ranges.emplace_back(offset, packedTile.sampleSizes[i]);
+    }
+
+    std::unique_ptr<std::vector<char>> data(new std::vector<char>);
+    // Within a GOP there is only one range, which can be read without an intermediate buffer.
+    if (ranges.size() == 1) {
+        data->resize(ranges.front().second);
+        readInto(data->data(), ranges.front().first, ranges.front().second);
+        return data;
+    }
+    for (auto &range : read(ranges))
+        data->insert(data->end(), range->begin(), range->end());
+    return data;
+}
+
+std::vector<std::unique_ptr<std::vector<char>>> TilePack::read(const std::vector<std::pair<unsigned long long, unsigned long long>> &byteRanges) const {
+    std::vector<unsigned int> order(byteRanges.size());
+    for (auto i = 0u; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](auto left, auto right) {
+        return byteRanges[left].first < byteRanges[right].first;
+    });
+
+    std::vector<std::unique_ptr<std::vector<char>>> data(byteRanges.size());
+    for (auto groupStart = 0u; groupStart < order.size();) {
+        // Extend the read while the next range starts close to where this one ends.
+        auto start = byteRanges[order[groupStart]].first;
+        auto end = start + byteRanges[order[groupStart]].second;
+        auto groupEnd = groupStart + 1;
+        for (; groupEnd < order.size(); ++groupEnd) {
+            const auto &range = byteRanges[order[groupEnd]];
+            if (range.first > end + MaximumGapToCoalesce)
+                break;
+            end = std::max(end, range.first + range.second);
+        }
+
+        std::vector<char> buffer(end - start);
+        readInto(buffer.data(), start, buffer.size());
+        for (auto i = groupStart; i < groupEnd; ++i) {
+            const auto &range = byteRanges[order[i]];
+            auto begin = buffer.begin() + (range.first - start);
+            data[order[i]].reset(new std::vector<char>(begin, begin + range.second));
+        }
+        groupStart = groupEnd;
+    }
+    return data;
+}
+
+void TilePack::readInto(char *destination, unsigned long long offset, unsigned long long size) const {
+    if (fileDescriptor_ < 0) {
+        if (offset > contents_.size() || size > contents_.size() - offset)
+            throw std::runtime_error("Failed to read " + filename_.string());
+        std::memcpy(destination, contents_.data() + offset, size);
+        return;
+    }
+
+    while (size) {
+        auto numberRead = pread(fileDescriptor_, destination, size, offset);
+        if (numberRead <= 0) {
+            if (numberRead < 0 && errno == EINTR)
+                continue;
+            throw std::runtime_error("Failed to read " + filename_.string());
+        }
+        destination += numberRead;
+        offset += numberRead;
+        size -= numberRead;
+    }
+}
+
+} // namespace tasm
@@ -18,7 +18,17 @@ public:
     {}
 
     TASM(SemanticIndex::IndexType indexType, const std::experimental::filesystem::path &dbPath = EnvironmentConfiguration::instance().defaultLabelsDatabasePath())
-        : semanticIndex_(SemanticIndexFactory::create(indexType, dbPath))
+        : TASM(indexType, dbPath, EnvironmentConfiguration::instance())
+    {}
+
+    // Stores videos in the configuration's catalog and labels in its database, whatever other instances use.
+    explicit TASM(const EnvironmentConfiguration &configuration, SemanticIndex::IndexType indexType = SemanticIndex::IndexType::XY)
+        : TASM(indexType, configuration.defaultLabelsDatabasePath(), configuration)
+    {}
+
+    TASM(SemanticIndex::IndexType indexType, const std::experimental::filesystem::path &dbPath, const EnvironmentConfiguration &configuration)
+        : semanticIndex_(SemanticIndexFactory::create(indexType, dbPath)),
+        videoManager_(configuration)
     {}
 
     TASM(const TASM&) = delete;
@@ -45,6 +55,11 @@ public:
         videoManager_.storeWithNonUniformLayout(videoPath, savedName, metadataIdentifier, std::make_shared<SingleMetadataSelection>(labelToTileAround), semanticIndex_, force);
     }
 
+    // Removes the stored tiles of the video. Its metadata is kept.
+    virtual void deleteVideo(const std::string &video) {
+        videoManager_.deleteVideo(video);
+    }
+
     virtual std::unique_ptr<ImageIterator> select(const std::string &video, const std::string &label, const std::string &metadataIdentifier = "") {
         return select(video, label, std::shared_ptr<TemporalSelection>(), metadataIdentifier);
     }
@@ -89,18 +104,82 @@ public:
         return select(video, label, std::make_shared<RangeTemporalSelection>(firstFrameInclusive, lastFrameExclusive), metadataIdentifier, SelectStrategy::Frames);
     }
 
+    // Describes what the select would read and estimates its cost, without decoding anything.
+    virtual std::unique_ptr<QueryPlan> explain(const std::string &video,
+                                               const std::string &label,
+                                               SelectStrategy strategy = SelectStrategy::Objects,
+                                               const std::string &metadataIdentifier = "") {
+        return explain(video, label, std::shared_ptr<TemporalSelection>(), strategy, metadataIdentifier);
+    }
+
+    virtual std::unique_ptr<QueryPlan> explain(const std::string &video,
+                                               const std::string &label,
+                                               unsigned int firstFrameInclusive,
+                                               unsigned int lastFrameExclusive,
+                                               SelectStrategy strategy = SelectStrategy::Objects,
+                                               const std::string &metadataIdentifier = "") {
+        return explain(video, label, std::make_shared<RangeTemporalSelection>(firstFrameInclusive, lastFrameExclusive), strategy, metadataIdentifier);
+    }
+
     void retileVideoBasedOnRegret(const std::string &video) {
         videoManager_.retileVideoBasedOnRegret(video);
     }
 
-    void activateRegretBasedTilingForVideo(const std::string &video, const std::string &metadataIdentifier = "", double threshold = 0) {
-        videoManager_.activateRegretBasedRetilingForVideo(video, metadataIdentifier.length() ? metadataIdentifier : video, semanticIndex_, threshold);
+    void retileVideoBasedOnRegretInBackground(const std::string &video) {
+        videoManager_.retileVideoBasedOnRegretInBackground(video);
+    }
+
+    void waitForBackgroundRetiling() {
+        videoManager_.waitForBackgroundRetiling();
+    }
+
+    void activateRegretBasedTilingForVideo(const std::string &video, const std::string &metadataIdentifier = "", double threshold = 0, bool retileInBackground = false) {
+        videoManager_.activateRegretBasedRetilingForVideo(video, metadataIdentifier.length() ? metadataIdentifier : video, semanticIndex_, threshold, retileInBackground);
     }
 
     void deactivateRegretBasedTilingForVideo(const std::string &video) {
         videoManager_.deactivateRegretBasedRetilingForVideo(video);
     }
 
+    void setRegretCostModelForVideo(const std::string &video, RegretCostModel costModel) {
+        videoManager_.setRegretCostModelForVideo(video, costModel);
+    }
+
+    void setRegretDecayForVideo(const std::string &video, double decay) {
+        videoManager_.setRegretDecayForVideo(video, decay);
+    }
+
+    void setRegretHistoryLengthForVideo(const std::string &video, unsigned int historyLength) {
+        videoManager_.setRegretHistoryLengthForVideo(video, historyLength);
+    }
+
+    void setRetileByStitchingForVideo(const std::string &video, bool retileByStitching) {
+        videoManager_.setRetileByStitchingForVideo(video, retileByStitching);
+    }
+
+    void compactVideo(const std::string &video) {
+        videoManager_.compactVideo(video);
+    }
+
+    void setCompactAfterRetilingForVideo(const std::string &video, bool compactAfterRetiling) {
+        videoManager_.setCompactAfterRetilingForVideo(video, compactAfterRetiling);
+    }
+
+    void setPackTilesForVideo(const std::string &video, bool packTiles) {
+        videoManager_.setPackTilesForVideo(video, packTiles);
+    }
+
+    // Retiling spends at most this many encode seconds and bytes written per refill interval. Zero means unlimited.
+    void setRetilingBudgetForVideo(const std::string &video, double encodeSeconds, unsigned long long bytesWritten = 0, double refillIntervalSeconds = 60) {
+        RetilingBudget budget;
+        budget.refillIntervalSeconds = refillIntervalSeconds;
+        if (encodeSeconds > 0)
+            budget.encodeSeconds = encodeSeconds;
+        if (bytesWritten)
+            budget.bytesWritten = bytesWritten;
+        videoManager_.setRetilingBudgetForVideo(video, budget);
+    }
+
     virtual ~TASM() = default;
 
     std::shared_ptr<SemanticIndex> semanticIndex() const {
@@ -118,6 +197,16 @@ private:
                 strategy);
     }
 
+    std::unique_ptr<QueryPlan> explain(const std::string &video, const std::string &label, std::shared_ptr<TemporalSelection> temporalSelection, SelectStrategy strategy, const std::string &metadataIdentifier) {
+        return videoManager_.explain(
+                video,
+                metadataIdentifier.length() ? metadataIdentifier : video,
+                std::make_shared<SingleMetadataSelection>(label),
+                temporalSelection,
+                semanticIndex_,
+                strategy);
+    }
+
     std::shared_ptr<SemanticIndex> semanticIndex_;
     VideoManager videoManager_;
 };
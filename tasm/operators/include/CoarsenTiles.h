@@ -0,0 +1,22 @@
+#ifndef TASM_COARSENTILES_H
+#define TASM_COARSENTILES_H
+
+#include "TileLayout.h"
+#include "TileLocationProvider.h"
+#include "Video.h"
+
+namespace tasm {
+
+// Rewrites frames [firstFrame, lastFrame] with a layout whose tiles are each made up of whole stored tiles.
+// Each new tile is produced by stitching the stored tiles it covers, so nothing is decoded or encoded.
+// Stitched tiles contain multiple slice segments per frame, so they can't be stitched again. Full frames are read from
+// the tiles they were stitched from instead, so tileLocationProvider should be a FullFrameTileLocationProvider.
+void coarsenTilesByStitching(std::shared_ptr<TiledEntry> entry,
+                             std::shared_ptr<TileLocationProvider> tileLocationProvider,
+                             const TileLayout &newLayout,
+                             unsigned int firstFrame,
+                             unsigned int lastFrame);
+
+} // namespace tasm
+
+#endif //TASM_COARSENTILES_H
@@ -0,0 +1,40 @@
+#ifndef TASM_COMPACTTILES_H
+#define TASM_COMPACTTILES_H
+
+#include "Video.h"
+
+namespace tasm {
+
+// Which shadowed directories compaction removes.
+enum class CompactionPolicy {
+    // Shadowed directories are kept while a query could still read them. CostBasedTileLocationProvider reads a GOP
+    // from any directory that stores all of it, so a shadowed directory is only removed once a newer one stores all of
+    // its frames with the same layout, which reads no more pixels and wins ties by being newer.
+    KeepAlternativeLayouts,
+    // Only the newest version of each frame is kept, as it is all that reads of the newest layout use.
+    KeepNewestOnly,
+};
+
+struct CompactionStatistics {
+    // Directories that were combined into longer directories.
+    unsigned int numberOfMergedDirectories;
+    // Directories removed from the catalog because newer versions store all of their frames.
+    unsigned int numberOfRemovedDirectories;
+    // Removed directories whose files have been deleted, including ones removed by earlier compactions.
+    unsigned int numberOfDeletedDirectories;
+};
+
+// Merges directories that store consecutive frames with the same layout, without decoding or encoding, and removes
+// directories that are entirely shadowed by newer versions, other than the ones stitched tiles are read from as full
+// frames and, depending on the policy, the ones cost-based reads may still choose. Their files are deleted once no
+// reader that got its catalog from TiledVideoManagerCache, in this process or another, refers to them.
+// A merge is abandoned if another writer publishes over any of its directories before the merged directory is
+// published. Retiles that claimed their version before the merge but publish after it are still shadowed by it, so
+// retiles of the same video should not be committing at the same time.
+CompactionStatistics compactTiles(std::shared_ptr<TiledEntry> entry,
+                                  CompactionPolicy policy = CompactionPolicy::KeepAlternativeLayouts,
+                                  unsigned int maximumFramesPerDirectory = 1800);
+
+} // namespace tasm
+
+#endif //TASM_COMPACTTILES_H
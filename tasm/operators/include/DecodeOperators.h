@@ -4,6 +4,7 @@
 #include "Operator.h"
 
 #include "EncodedData.h"
+#include "QueryTelemetry.h"
 #include "VideoDecoder.h"
 #include "VideoDecoderSession.h"
 
@@ -16,7 +17,8 @@ public:
             std::shared_ptr<GPUContext> context,
             std::shared_ptr<VideoLock> lock,
             unsigned int largestWidth = 0,
-            unsigned int largestHeight = 0)
+            unsigned int largestHeight = 0,
+            std::shared_ptr<QueryTelemetry> telemetry = nullptr)
         : isComplete_(false),
         configuration_(configuration),
         frameNumberQueue_(std::make_shared<spsc_queue<int>>(50000)),
@@ -27,7 +29,9 @@ public:
         largestHeight_(largestHeight ?: configuration_.codedHeight),
         decoder_(configuration_, lock_, frameNumberQueue_, tileNumberQueue_),
         session_(decoder_, scan),
-          numberOfFramesDecoded_(0)
+          numberOfFramesDecoded_(0),
+        telemetry_(telemetry),
+        decodeTime_(0)
     {
         decoder_.preallocateArraysForDecodedFrames(largestWidth_, largestHeight_);
     }
@@ -40,6 +44,7 @@ public:
         if (isComplete_)
             return {};
 
+        auto decodeStart = std::chrono::steady_clock::now();
         auto frames = std::make_unique<std::vector<GPUFramePtr>>();
 
         if (!session_.isComplete() || decoder_.decodedPictureQueue().read_available()) {
@@ -54,9 +59,13 @@ public:
 
         if (!frames->empty() || !session_.isComplete()) {
             numberOfFramesDecoded_ += frames->size();
+            decodeTime_ += std::chrono::steady_clock::now() - decodeStart;
             return {GPUDecodedFrameData(configuration_, std::move(frames))};
         } else {
             std::cout << "Num-frames-from-decoder: " << numberOfFramesDecoded_ << std::endl;
+            decodeTime_ += std::chrono::steady_clock::now() - decodeStart;
+            if (telemetry_)
+                telemetry_->recordDecode(decodeTime_);
             isComplete_ = true;
             return std::nullopt;
         }
@@ -77,6 +86,9 @@ private:
     VideoDecoder decoder_;
     VideoDecoderSession session_;
     int numberOfFramesDecoded_;
+    std::shared_ptr<QueryTelemetry> telemetry_;
+    // Time spent in next(), which excludes time the consumer spends with the decoded frames.
+    std::chrono::steady_clock::duration decodeTime_;
 };
 
 } // namespace tasm
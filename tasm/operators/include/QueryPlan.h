@@ -0,0 +1,55 @@
+#ifndef TASM_QUERYPLAN_H
+#define TASM_QUERYPLAN_H
+
+#include "WorkloadCostEstimator.h"
+#include <experimental/filesystem>
+#include <ostream>
+#include <vector>
+
+namespace tasm {
+
+// Samples that are read together from a tile file, usually one GOP.
+struct GOPByteRange {
+    int firstFrame;
+    unsigned int numberOfFrames;
+    unsigned long long byteOffset;
+    unsigned long long numberOfBytes;
+};
+
+struct TileRead {
+    std::experimental::filesystem::path filename;
+    unsigned int tileNumber;
+    unsigned int width;
+    unsigned int height;
+    std::vector<GOPByteRange> gopRanges;
+};
+
+// What a select would read and what it is estimated to cost, computed without decoding anything.
+struct QueryPlan {
+    QueryPlan()
+        : numberOfDecoderReconfigurations(0),
+        estimatedCost(0, 0), untiledCost(0, 0),
+        estimatedDecodeSeconds(0), untiledDecodeSeconds(0)
+    { }
+
+    // In the order they will be read.
+    std::vector<TileRead> tileReads;
+    std::vector<std::pair<unsigned int, unsigned int>> tileResolutions;
+    // The decoder is reconfigured each time consecutive reads have different resolutions.
+    unsigned int numberOfDecoderReconfigurations;
+
+    CostElements estimatedCost;
+    // The cost of the same select if the video were not tiled.
+    CostElements untiledCost;
+    double estimatedDecodeSeconds;
+    double untiledDecodeSeconds;
+
+    unsigned long long bytesToRead() const;
+    void setTileResolutionsFromReads();
+};
+
+std::ostream &operator<<(std::ostream &ostr, const QueryPlan &plan);
+
+} // namespace tasm
+
+#endif //TASM_QUERYPLAN_H
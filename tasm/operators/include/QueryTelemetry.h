@@ -0,0 +1,38 @@
+#ifndef TASM_QUERYTELEMETRY_H
+#define TASM_QUERYTELEMETRY_H
+
+#include <chrono>
+#include <mutex>
+
+namespace tasm {
+class OnlineCostModel;
+
+// Work done and time spent by one query. The scan records what it read, the decoder records how long it took,
+// and the totals are reported to the online cost model when decoding finishes.
+class QueryTelemetry {
+public:
+    explicit QueryTelemetry(OnlineCostModel &costModel)
+        : costModel_(costModel),
+        numberOfPixels_(0), numberOfTiles_(0), numberOfBytes_(0),
+        readTime_(0), decodeTime_(0), didFinish_(false)
+    { }
+
+    void recordRead(unsigned long long numberOfPixels, unsigned long long numberOfTiles, unsigned long long numberOfBytes,
+            std::chrono::steady_clock::duration readTime);
+    // Decode time includes waiting on the scan, so it covers both stages.
+    void recordDecode(std::chrono::steady_clock::duration decodeTime);
+
+private:
+    OnlineCostModel &costModel_;
+    std::mutex mutex_;
+    unsigned long long numberOfPixels_;
+    unsigned long long numberOfTiles_;
+    unsigned long long numberOfBytes_;
+    std::chrono::steady_clock::duration readTime_;
+    std::chrono::steady_clock::duration decodeTime_;
+    bool didFinish_;
+};
+
+} // namespace tasm
+
+#endif //TASM_QUERYTELEMETRY_H
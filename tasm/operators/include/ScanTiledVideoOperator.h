@@ -4,10 +4,13 @@
 #include "Operator.h"
 
 #include "EncodedData.h"
+#include "QueryPlan.h"
+#include "QueryTelemetry.h"
 #include "Rectangle.h"
 #include "SemanticDataManager.h"
 #include "TileLocationProvider.h"
 #include "StitchContext.h"
+#include <deque>
 
 namespace tasm {
 
@@ -17,13 +20,16 @@ public:
             std::shared_ptr<TiledEntry> entry,
             std::shared_ptr<SemanticDataManager> semanticDataManager,
             std::shared_ptr<TileLocationProvider> tileLocationProvider,
-            bool shouldReadEntireGOPs = false)
+            bool shouldReadEntireGOPs = false,
+            std::shared_ptr<QueryTelemetry> telemetry = nullptr)
             : isComplete_(false), entry_(entry), semanticDataManager_(semanticDataManager),
             tileLocationProvider_(tileLocationProvider),
             shouldReadEntireGOPs_(shouldReadEntireGOPs),
+            telemetry_(telemetry),
             totalVideoWidth_(0), totalVideoHeight_(0),
             totalNumberOfPixels_(0), totalNumberOfFrames_(0),
             totalNumberOfBytes_(0), numberOfTilesRead_(0),
+            readTime_(0),
             didSignalEOS_(false),
             currentTileNumber_(0), currentTileArea_(0)
     {
@@ -33,6 +39,9 @@ public:
     bool isComplete() override { return isComplete_; }
     std::optional<CPUEncodedFrameDataPtr> next() override;
 
+    // The tiles and samples next() will read, in order. Only reads the tile files' sample tables.
+    std::vector<TileRead> plannedTileReads() const;
+
 private:
     void preprocess();
     void setUpNextEncodedFrameReader();
@@ -44,6 +53,7 @@ private:
     std::shared_ptr<SemanticDataManager> semanticDataManager_;
     std::shared_ptr<TileLocationProvider> tileLocationProvider_;
     bool shouldReadEntireGOPs_;
+    std::shared_ptr<QueryTelemetry> telemetry_;
 
     unsigned int totalVideoWidth_;
     unsigned int totalVideoHeight_;
@@ -52,6 +62,7 @@ private:
     unsigned long long int totalNumberOfFrames_;
     unsigned long long int totalNumberOfBytes_;
     unsigned int numberOfTilesRead_;
+    std::chrono::steady_clock::duration readTime_;
     bool didSignalEOS_;
 
     std::shared_ptr<const TileLayout> currentTileLayout_;
@@ -70,7 +81,7 @@ private:
         Rectangle tileRect;
 
         // Considers only dimensions for the purposes of ordering reads.
-        bool operator<(const TileInformation &other) {
+        bool operator<(const TileInformation &other) const {
             if (height < other.height)
                 return true;
             else if (height > other.height)
@@ -82,24 +93,44 @@ private:
         }
     };
 
+    // Reads the GOPs of the packed tiles starting at tileIt that come from the same pack with coalesced reads.
+    void prefetchPackedTiles(std::vector<TileInformation>::const_iterator tileIt);
+
     std::vector<TileInformation> orderedTileInformation_;
     std::vector<TileInformation>::const_iterator orderedTileInformationIt_;
     unsigned int currentTileArea_;
+    // Keyed by position in orderedTileInformation_.
+    std::unordered_map<unsigned int, std::deque<GOPReaderPacket>> prefetchedGOPs_;
+    std::deque<GOPReaderPacket> currentPrefetchedGOPs_;
 };
 
+// The context for stitching one stream per tile of the layout into a single stream.
+std::unique_ptr<stitching::StitchContext> stitchContextForLayout(const TileLayout &layout, unsigned int ppsId);
+
 class ScanFullFramesFromTiledVideoOperator : public Operator<CPUEncodedFrameDataPtr> {
 public:
     ScanFullFramesFromTiledVideoOperator(
             std::shared_ptr<TiledEntry> entry,
             std::shared_ptr<SemanticDataManager> semanticDataManager,
+            std::shared_ptr<TileLocationProvider> tileLocationProvider)
+                : ScanFullFramesFromTiledVideoOperator(
+                        entry,
+                        std::shared_ptr<const std::vector<int>>(semanticDataManager, &semanticDataManager->orderedFrames()),
+                        tileLocationProvider)
+    { }
+
+    // Frames must be sorted. Every tile of each frame is read, regardless of the layout it is stored with.
+    ScanFullFramesFromTiledVideoOperator(
+            std::shared_ptr<TiledEntry> entry,
+            std::shared_ptr<const std::vector<int>> frames,
             std::shared_ptr<TileLocationProvider> tileLocationProvider)
                 : isComplete_(false),
                 entry_(entry),
-                semanticDataManager_(semanticDataManager),
+                frames_(frames),
                 tileLocationProvider_(tileLocationProvider),
                 didSignalEOS_(false),
-                frameIt_(semanticDataManager_->orderedFrames().begin()),
-                endFrameIt_(semanticDataManager_->orderedFrames().end()),
+                frameIt_(frames_->begin()),
+                endFrameIt_(frames_->end()),
                 ppsId_(1),
                   fullFrameConfig_(fullFrameConfig())
     { }
@@ -108,17 +139,20 @@ public:
     std::optional<CPUEncodedFrameDataPtr> next() override;
 
     const Configuration &configuration() { return *fullFrameConfig_; }
+
+    // Every tile of each frame that will be stitched. Only reads the tile files' sample tables.
+    std::vector<TileRead> plannedTileReads() const;
 private:
     void setUpNextEncodedFrameReaders();
     GOPReaderPacket stitchedDataForNextGOP();
-    std::experimental::filesystem::path pathForFrame(int frame) {
+    std::experimental::filesystem::path pathForFrame(int frame) const {
         return tileLocationProvider_->locationOfTileForFrame(0, frame).parent_path();
     }
     std::unique_ptr<Configuration> fullFrameConfig();
 
     bool isComplete_;
     std::shared_ptr<TiledEntry> entry_;
-    std::shared_ptr<SemanticDataManager> semanticDataManager_;
+    std::shared_ptr<const std::vector<int>> frames_;
     std::shared_ptr<TileLocationProvider> tileLocationProvider_;
     bool didSignalEOS_;
     std::vector<int>::const_iterator frameIt_;
@@ -6,8 +6,11 @@
 #include "MultipleEncoderManager.h"
 #include "Operator.h"
 #include "TileConfigurationProvider.h"
+#include "TileLocationProvider.h"
 #include "Video.h"
 
+class OutputStream;
+
 namespace tasm {
 
 class TileOperator : public Operator<GPUDecodedFrameData> {
@@ -15,7 +18,7 @@ public:
     TileOperator(std::shared_ptr<Video> video,
             std::shared_ptr<ConfigurationOperator<GPUDecodedFrameData>> parent,
             std::shared_ptr<TileLayoutProvider> tileConfigurationProvider,
-            std::string outputEntryName,
+            std::shared_ptr<TiledEntry> outputEntry,
             unsigned int layoutDuration,
             std::shared_ptr<GPUContext> context,
             std::shared_ptr<VideoLock> lock)
@@ -23,7 +26,7 @@ public:
             video_(video),
             parent_(parent),
             tileConfigurationProvider_(tileConfigurationProvider),
-          outputEntry_(new TiledEntry(outputEntryName)),
+          outputEntry_(outputEntry),
           layoutDuration_(layoutDuration),
           tileEncodersManager_(EncodeConfiguration(parent->configuration(), NV_ENC_HEVC, layoutDuration), *context, *lock),
           firstFrameInGroup_(-1),
@@ -34,8 +37,16 @@ public:
     bool isComplete() override { return isComplete_; }
     std::optional<GPUDecodedFrameData> next() override;
 
+    // When retiling, tiles whose rectangle is unchanged from the stored tiles are copied rather than re-encoded.
+    // The stored tiles were encoded with the same configuration, so only the layout of the other tiles changes.
+    void reuseUnchangedTilesFrom(std::shared_ptr<TileLocationProvider> storedTiles) { storedTiles_ = storedTiles; }
+
 private:
-    void reconfigureEncodersForNewLayout(std::shared_ptr<const TileLayout> newLayout);
+    void reconfigureEncodersForNewLayout(std::shared_ptr<const TileLayout> newLayout, int firstFrame);
+    // The index of the stored tile covering the same rectangle at frame, if it starts a GOP there.
+    std::optional<unsigned int> unchangedStoredTile(const Rectangle &rect, int frame);
+    std::experimental::filesystem::path storedDirectoryForFrame(int frame) const;
+    void copyStoredTile(unsigned int storedTileNumber, OutputStream &output);
     void saveTileGroupsToDisk();
     void encodeFrameToTiles(GPUFramePtr frame, int frameNumber);
     void readDataFromEncoders(bool shouldFlush);
@@ -53,6 +64,11 @@ private:
     unsigned int frameNumber_;
     std::vector<unsigned int> tilesCurrentlyBeingEncoded_;
 
+    std::shared_ptr<TileLocationProvider> storedTiles_;
+    // The stored directory the current group of frames is read from, and the stored tile copied for each tile.
+    std::experimental::filesystem::path currentStoredDirectory_;
+    std::unordered_map<unsigned int, unsigned int> tilesToStoredTiles_;
+
     std::unordered_map<unsigned int, std::list<std::unique_ptr<std::vector<char>>>> encodedDataForTiles_;
 };
 
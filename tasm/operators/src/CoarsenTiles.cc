@@ -0,0 +1,94 @@
+#include "CoarsenTiles.h"
+
+#include "DecodeReader.h"
+#include "Files.h"
+#include "ScanTiledVideoOperator.h"
+#include "Stitcher.h"
+#include "Transaction.h"
+#include "VideoConfiguration.h"
+#include <numeric>
+
+namespace tasm {
+
+// Indices of the sizes that together cover [start, start + size).
+static std::vector<unsigned int> indicesCoveringRange(const std::vector<unsigned int> &sizes, unsigned int start, unsigned int size) {
+    std::vector<unsigned int> indices;
+    unsigned int offset = 0;
+    for (auto i = 0u; i < sizes.size(); ++i) {
+        if (offset >= start && offset + sizes[i] <= start + size)
+            indices.push_back(i);
+        offset += sizes[i];
+    }
+    return indices;
+}
+
+static std::shared_ptr<std::vector<char>> readTile(const std::experimental::filesystem::path &tilePath,
+                                                   const std::vector<int> &frames,
+                                                   unsigned int frameOffsetInFile) {
+    EncodedFrameReader reader(tilePath, std::make_shared<std::vector<int>>(frames), frameOffsetInFile, false);
+    auto data = std::make_shared<std::vector<char>>();
+    while (!reader.isEos()) {
+        auto gopPacket = reader.read();
+        if (!gopPacket.has_value())
+            break;
+        data->insert(data->end(), gopPacket->data()->begin(), gopPacket->data()->end());
+    }
+    return data;
+}
+
+void coarsenTilesByStitching(std::shared_ptr<TiledEntry> entry,
+                             std::shared_ptr<TileLocationProvider> tileLocationProvider,
+                             const TileLayout &newLayout,
+                             unsigned int firstFrame,
+                             unsigned int lastFrame) {
+    auto currentLayout = tileLocationProvider->tileLayoutForFrame(firstFrame);
+    assert(newLayout.isCoarseningOf(*currentLayout));
+
+    std::vector<int> frames(lastFrame - firstFrame + 1);
+    std::iota(frames.begin(), frames.end(), firstFrame);
+
+    auto frameRate = video::GetConfiguration(tileLocationProvider->locationOfTileForFrame(0, firstFrame))->frameRate;
+    TileCrackingTransaction transaction(entry, newLayout, firstFrame, lastFrame, frameRate);
+    // Tiles that cover a single stored tile are plain copies of it.
+    if (newLayout.numberOfTiles() < currentLayout->numberOfTiles())
+        transaction.markTilesAsStitched();
+    std::vector<unsigned int> tiles(newLayout.numberOfTiles());
+    std::iota(tiles.begin(), tiles.end(), 0);
+    transaction.writeTiles(tiles, [&](unsigned int tile, OutputStream &output) {
+        auto column = tile % newLayout.numberOfColumns();
+        auto row = tile / newLayout.numberOfColumns();
+        auto &newWidths = newLayout.widthsOfColumns();
+        auto &newHeights = newLayout.heightsOfRows();
+        auto columns = indicesCoveringRange(currentLayout->widthsOfColumns(),
+                std::accumulate(newWidths.begin(), newWidths.begin() + column, 0u), newWidths[column]);
+        auto rows = indicesCoveringRange(currentLayout->heightsOfRows(),
+                std::accumulate(newHeights.begin(), newHeights.begin() + row, 0u), newHeights[row]);
+
+        // The stored tiles covered by the new tile, in raster order.
+        std::vector<unsigned int> widthsOfColumns;
+        std::vector<unsigned int> heightsOfRows;
+        std::vector<std::shared_ptr<std::vector<char>>> dataForTiles;
+        for (auto storedColumn : columns)
+            widthsOfColumns.push_back(currentLayout->widthsOfColumns()[storedColumn]);
+        for (auto storedRow : rows) {
+            heightsOfRows.push_back(currentLayout->heightsOfRows()[storedRow]);
+            for (auto storedColumn : columns) {
+                auto storedTile = storedRow * currentLayout->numberOfColumns() + storedColumn;
+                auto tilePath = tileLocationProvider->locationOfTileForFrame(storedTile, firstFrame);
+                dataForTiles.push_back(readTile(tilePath, frames, tileLocationProvider->frameOffsetInTileFile(tilePath)));
+            }
+        }
+
+        if (dataForTiles.size() == 1) {
+            output.write(dataForTiles.front()->data(), dataForTiles.front()->size());
+        } else {
+            TileLayout mergedLayout(columns.size(), rows.size(), widthsOfColumns, heightsOfRows);
+            stitching::Stitcher stitcher(*stitchContextForLayout(mergedLayout, 0), dataForTiles);
+            auto stitchedData = stitcher.GetStitchedSegments();
+            output.write(stitchedData->data(), stitchedData->size());
+        }
+    });
+    transaction.commit();
+}
+
+} // namespace tasm
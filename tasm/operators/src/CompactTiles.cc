@@ -0,0 +1,188 @@
+#include "CompactTiles.h"
+
+#include "CatalogStorage.h"
+#include "DecodeReader.h"
+#include "Files.h"
+#include "FrameRunIndex.h"
+#include "TileManifest.pb.h"
+#include "TiledVideoManager.h"
+#include "Transaction.h"
+#include "VideoConfiguration.h"
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <unordered_map>
+
+namespace tasm {
+
+static TileLayout tileLayoutForDirectory(const lightdb::serialization::TileDirectory &directory) {
+    return TileLayout(directory.numberofcolumns(),
+                      directory.numberofrows(),
+                      std::vector<unsigned int>(directory.widthsofcolumns().begin(), directory.widthsofcolumns().end()),
+                      std::vector<unsigned int>(directory.heightsofrows().begin(), directory.heightsofrows().end()));
+}
+
+static unsigned int numberOfFrames(const lightdb::serialization::TileDirectory &directory) {
+    return directory.lastframe() - directory.firstframe() + 1;
+}
+
+// The number of frames each version is used for.
+static std::unordered_map<int, unsigned int> visibleFramesForVersions(const std::vector<lightdb::serialization::TileDirectory> &directories) {
+    if (directories.empty())
+        return {};
+
+    std::vector<FrameRunIndex::Interval> intervals;
+    for (const auto &directory : directories)
+        intervals.push_back({directory.firstframe(), directory.lastframe(), static_cast<int>(directory.version())});
+
+    FrameRunIndex index(std::move(intervals));
+    std::unordered_map<int, unsigned int> visibleFrames;
+    for (const auto &run : index.runs())
+        visibleFrames[run.id] += run.lastFrame - run.firstFrame + 1;
+    return visibleFrames;
+}
+
+static bool overlaps(const lightdb::serialization::TileDirectory &first, const lightdb::serialization::TileDirectory &second) {
+    return first.firstframe() <= second.lastframe() && second.firstframe() <= first.lastframe();
+}
+
+// Whether each of the directories is still listed and still the newest version of its frames.
+static bool directoriesAreCurrent(const std::vector<lightdb::serialization::TileDirectory> &directories,
+                                  const std::vector<lightdb::serialization::TileDirectory> &catalog) {
+    for (const auto &directory : directories) {
+        bool isListed = false;
+        for (const auto &other : catalog) {
+            if (other.version() == directory.version())
+                isListed = true;
+            else if (other.version() > directory.version() && overlaps(other, directory))
+                return false;
+        }
+        if (!isListed)
+            return false;
+    }
+    return true;
+}
+
+// Whether CostBasedTileLocationProvider could read some GOP from the directory rather than from a newer one.
+static bool canBeChosenByCost(const lightdb::serialization::TileDirectory &directory,
+                              const std::vector<lightdb::serialization::TileDirectory> &catalog) {
+    auto layout = tileLayoutForDirectory(directory);
+    for (const auto &other : catalog) {
+        if (other.version() > directory.version()
+                && other.firstframe() <= directory.firstframe()
+                && other.lastframe() >= directory.lastframe()
+                && tileLayoutForDirectory(other) == layout)
+            return false;
+    }
+    return true;
+}
+
+// Returns false if the directories changed before the merged directory could be published.
+static bool mergeDirectories(std::shared_ptr<TiledEntry> entry, const std::vector<lightdb::serialization::TileDirectory> &directories) {
+    auto firstFrame = directories.front().firstframe();
+    auto lastFrame = directories.back().lastframe();
+    auto layout = tileLayoutForDirectory(directories.front());
+
+    // Each directory starts with a keyframe and carries its parameter sets, so the tiles' samples can be concatenated.
+    auto frameRate = video::GetConfiguration(TileFiles::tileFilename(
+            TileFiles::directoryForTilesInFrames(entry->path(), firstFrame, directories.front().lastframe(), directories.front().version()), 0))->frameRate;
+    TileCrackingTransaction transaction(entry, layout, firstFrame, lastFrame, frameRate);
+    std::vector<unsigned int> tiles(layout.numberOfTiles());
+    std::iota(tiles.begin(), tiles.end(), 0);
+    transaction.writeTiles(tiles, [&](unsigned int tile, OutputStream &output) {
+        for (const auto &directory : directories) {
+            auto frames = std::make_shared<std::vector<int>>(numberOfFrames(directory));
+            std::iota(frames->begin(), frames->end(), directory.firstframe());
+            auto tilePath = TileFiles::tileFilename(
+                    TileFiles::directoryForTilesInFrames(entry->path(), directory.firstframe(), directory.lastframe(), directory.version()),
+                    tile);
+
+            EncodedFrameReader reader(tilePath, frames, directory.firstframe(), false);
+            while (!reader.isEos()) {
+                auto gopPacket = reader.read();
+                if (!gopPacket.has_value())
+                    break;
+                output.write(gopPacket->data()->data(), gopPacket->data()->size());
+            }
+        }
+    });
+
+    // The merged directory gets the newest version, so it would shadow anything another writer published over the
+    // directories since the catalog was read.
+    transaction.publishOnlyIf([&](const std::vector<lightdb::serialization::TileDirectory> &catalog) {
+        return directoriesAreCurrent(directories, catalog);
+    });
+    transaction.commit();
+    return transaction.isPublished();
+}
+
+CompactionStatistics compactTiles(std::shared_ptr<TiledEntry> entry, CompactionPolicy policy, unsigned int maximumFramesPerDirectory) {
+    CompactionStatistics statistics{0, 0, 0};
+    auto storage = CatalogStorage::forPath(entry->path());
+
+    // Merge runs of directories whose frames are all visible, follow each other, and share a layout.
+    auto directories = storage->listTileDirectories(entry->path());
+    auto visibleFrames = visibleFramesForVersions(directories);
+    std::vector<lightdb::serialization::TileDirectory> fullyVisibleDirectories;
+    for (const auto &directory : directories) {
+        auto path = TileFiles::directoryForTilesInFrames(entry->path(), directory.firstframe(), directory.lastframe(), directory.version());
+        // Stitched tiles would lose their marker.
+        if (visibleFrames[directory.version()] == numberOfFrames(directory) && !storage->containsStitchedTiles(path))
+            fullyVisibleDirectories.push_back(directory);
+    }
+    std::sort(fullyVisibleDirectories.begin(), fullyVisibleDirectories.end(), [](const auto &first, const auto &second) {
+        return first.firstframe() < second.firstframe();
+    });
+
+    std::vector<lightdb::serialization::TileDirectory> group;
+    auto mergeGroup = [&]() {
+        if (group.size() > 1 && mergeDirectories(entry, group))
+            statistics.numberOfMergedDirectories += group.size();
+        group.clear();
+    };
+    for (const auto &directory : fullyVisibleDirectories) {
+        bool canExtendGroup = !group.empty()
+                && group.back().lastframe() + 1 == directory.firstframe()
+                && tileLayoutForDirectory(group.back()) == tileLayoutForDirectory(directory)
+                && directory.lastframe() - group.front().firstframe() + 1 <= maximumFramesPerDirectory;
+        if (!canExtendGroup)
+            mergeGroup();
+        group.push_back(directory);
+    }
+    mergeGroup();
+
+    // Remove the directories that no frame is read from, including the ones that were just merged, which the merged
+    // directory stores with the same layout.
+    // Stitched tiles are read as full frames from the directories they were stitched from, so those are kept too.
+    directories = storage->listTileDirectories(entry->path());
+    visibleFrames = visibleFramesForVersions(directories);
+    std::vector<lightdb::serialization::TileDirectory> unstitchedDirectories;
+    std::copy_if(directories.begin(), directories.end(), std::back_inserter(unstitchedDirectories), [&](const auto &directory) {
+        return !storage->containsStitchedTiles(TileFiles::directoryForTilesInFrames(entry->path(), directory.firstframe(), directory.lastframe(), directory.version()));
+    });
+    auto visibleFullFrames = visibleFramesForVersions(unstitchedDirectories);
+    std::vector<lightdb::serialization::TileDirectory> directoriesToRemove;
+    std::vector<std::experimental::filesystem::path> removedDirectories;
+    for (const auto &directory : directories) {
+        if (visibleFrames.count(directory.version()) || visibleFullFrames.count(directory.version()))
+            continue;
+        if (policy == CompactionPolicy::KeepAlternativeLayouts && canBeChosenByCost(directory, directories))
+            continue;
+
+        directoriesToRemove.push_back(directory);
+        removedDirectories.push_back(TileFiles::directoryForTilesInFrames(entry->path(), directory.firstframe(), directory.lastframe(), directory.version()));
+    }
+    if (!directoriesToRemove.empty())
+        storage->removeFromCatalog(entry->path(), directoriesToRemove);
+    statistics.numberOfRemovedDirectories = removedDirectories.size();
+
+    // Readers pin the version they listed the catalog at, so allocating one separates the readers that may still refer
+    // to the removed directories from the ones that can't. No directory is published with it.
+    auto &cache = TiledVideoManagerCache::instance();
+    if (!removedDirectories.empty())
+        cache.deleteWhenUnreferenced(entry->path(), std::move(removedDirectories), entry->allocateTileVersion());
+    statistics.numberOfDeletedDirectories = cache.collectGarbage();
+    return statistics;
+}
+
+} // namespace tasm
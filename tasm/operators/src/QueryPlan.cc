@@ -0,0 +1,52 @@
+#include "QueryPlan.h"
+
+#include <algorithm>
+
+namespace tasm {
+
+unsigned long long QueryPlan::bytesToRead() const {
+    unsigned long long bytes = 0;
+    for (const auto &tileRead : tileReads) {
+        for (const auto &range : tileRead.gopRanges)
+            bytes += range.numberOfBytes;
+    }
+    return bytes;
+}
+
+void QueryPlan::setTileResolutionsFromReads() {
+    tileResolutions.clear();
+    numberOfDecoderReconfigurations = 0;
+
+    std::pair<unsigned int, unsigned int> previousResolution{0, 0};
+    for (const auto &tileRead : tileReads) {
+        std::pair<unsigned int, unsigned int> resolution{tileRead.width, tileRead.height};
+        if (std::find(tileResolutions.begin(), tileResolutions.end(), resolution) == tileResolutions.end())
+            tileResolutions.push_back(resolution);
+        if (previousResolution.first && resolution != previousResolution)
+            ++numberOfDecoderReconfigurations;
+        previousResolution = resolution;
+    }
+}
+
+std::ostream &operator<<(std::ostream &ostr, const QueryPlan &plan) {
+    ostr << "Tile reads: " << plan.tileReads.size() << "\n";
+    for (const auto &tileRead : plan.tileReads) {
+        ostr << "  " << tileRead.filename.string() << " (tile " << tileRead.tileNumber << ", "
+             << tileRead.width << "x" << tileRead.height << ")\n";
+        for (const auto &range : tileRead.gopRanges) {
+            ostr << "    frames " << range.firstFrame << "-" << range.firstFrame + range.numberOfFrames - 1
+                 << ": bytes " << range.byteOffset << "+" << range.numberOfBytes << "\n";
+        }
+    }
+
+    ostr << "Bytes to read: " << plan.bytesToRead() << "\n";
+    ostr << "Tile resolutions:";
+    for (const auto &resolution : plan.tileResolutions)
+        ostr << " " << resolution.first << "x" << resolution.second;
+    ostr << "\nDecoder reconfigurations: " << plan.numberOfDecoderReconfigurations << "\n";
+    ostr << "Estimated cost: " << plan.estimatedCost << ", " << plan.estimatedDecodeSeconds << " s\n";
+    ostr << "Untiled cost: " << plan.untiledCost << ", " << plan.untiledDecodeSeconds << " s";
+    return ostr;
+}
+
+} // namespace tasm
@@ -0,0 +1,35 @@
+#include "QueryTelemetry.h"
+
+#include "OnlineCostModel.h"
+#include <iostream>
+
+namespace tasm {
+
+static double toSeconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+}
+
+void QueryTelemetry::recordRead(unsigned long long numberOfPixels, unsigned long long numberOfTiles,
+                                unsigned long long numberOfBytes, std::chrono::steady_clock::duration readTime) {
+    std::scoped_lock lock(mutex_);
+    numberOfPixels_ = numberOfPixels;
+    numberOfTiles_ = numberOfTiles;
+    numberOfBytes_ = numberOfBytes;
+    readTime_ = readTime;
+}
+
+void QueryTelemetry::recordDecode(std::chrono::steady_clock::duration decodeTime) {
+    std::scoped_lock lock(mutex_);
+    if (didFinish_)
+        return;
+
+    decodeTime_ = decodeTime;
+    didFinish_ = true;
+
+    std::cout << "ANALYSIS: read-seconds " << toSeconds(readTime_) << std::endl;
+    std::cout << "ANALYSIS: decode-seconds " << toSeconds(decodeTime_) << std::endl;
+
+    costModel_.addDecodeObservation(numberOfPixels_, numberOfTiles_, toSeconds(decodeTime_));
+}
+
+} // namespace tasm
@@ -1,12 +1,33 @@
 #include "ScanTiledVideoOperator.h"
 
+#include "CatalogStorage.h"
 #include "VideoConfiguration.h"
 #include "Stitcher.h"
+#include "TilePack.h"
 
 namespace tasm {
 
 static const unsigned int MAX_PPS_ID = 64;
 static const unsigned int ALIGNMENT = 32;
+// Bounds how much of a tile pack is read ahead of the decoder.
+static const unsigned long long MAX_PREFETCH_BYTES = 64 * 1024 * 1024;
+
+static TileRead plannedReadForTile(const std::experimental::filesystem::path &filename, unsigned int tileNumber,
+                                   const Rectangle &tileRect, const std::vector<int> &frames, int frameOffsetInFile,
+                                   bool shouldReadEntireGOPs) {
+    // The reader converts the frames it's given to be relative to the file, so give it a copy.
+    EncodedFrameReader reader(filename, std::make_shared<std::vector<int>>(frames), frameOffsetInFile, shouldReadEntireGOPs);
+    TileRead tileRead{filename, tileNumber, tileRect.width, tileRect.height, {}};
+    while (auto samples = reader.nextSamplesToRead()) {
+        auto byteRange = reader.mp4Reader().byteRangeForSamples(samples->first, samples->second);
+        tileRead.gopRanges.push_back({
+                MP4Reader::sampleNumberToFrameNumber(samples->first + frameOffsetInFile),
+                samples->second - samples->first + 1,
+                byteRange.first,
+                byteRange.second});
+    }
+    return tileRead;
+}
 
 void ScanTiledVideoOperator::preprocess() {
     auto frameIt = semanticDataManager_->orderedFrames().cbegin();
@@ -30,10 +51,22 @@ void ScanTiledVideoOperator::preprocess() {
         }
     }
 
-    std::sort(orderedTileInformation_.begin(), orderedTileInformation_.end());
+    // Keep tiles with the same dimensions in the order of their directories, so packed tiles stay next to each other.
+    std::stable_sort(orderedTileInformation_.begin(), orderedTileInformation_.end());
     orderedTileInformationIt_ = orderedTileInformation_.begin();
 }
 
+std::vector<TileRead> ScanTiledVideoOperator::plannedTileReads() const {
+    std::vector<TileRead> tileReads;
+    tileReads.reserve(orderedTileInformation_.size());
+    for (const auto &tileInformation : orderedTileInformation_) {
+        tileReads.push_back(plannedReadForTile(tileInformation.filename, tileInformation.tileNumber, tileInformation.tileRect,
+                                               *tileInformation.framesToRead, tileInformation.frameOffsetInFile,
+                                               shouldReadEntireGOPs_));
+    }
+    return tileReads;
+}
+
 std::shared_ptr<std::vector<int>> ScanTiledVideoOperator::nextGroupOfFramesWithTheSameLayoutAndFromTheSameFile(std::vector<int>::const_iterator &frameIt, std::vector<int>::const_iterator &endIt) {
     assert(frameIt != endIt);
 
@@ -88,10 +121,63 @@ std::unique_ptr<std::unordered_map<unsigned int, std::shared_ptr<std::vector<int
     return tileNumberToFrames;
 }
 
+void ScanTiledVideoOperator::prefetchPackedTiles(std::vector<TileInformation>::const_iterator tileIt) {
+    auto directory = tileIt->filename.parent_path();
+    std::shared_ptr<const TilePack> pack;
+    // Sample ranges in the pack, and the GOPs they make up for each tile.
+    std::vector<std::pair<unsigned long long, unsigned long long>> byteRanges;
+    std::vector<std::tuple<unsigned int, unsigned int, unsigned int, unsigned int>> gops;
+    unsigned long long plannedBytes = 0;
+
+    auto firstIndex = tileIt - orderedTileInformation_.cbegin();
+    for (auto index = firstIndex; tileIt != orderedTileInformation_.cend() && plannedBytes < MAX_PREFETCH_BYTES; ++tileIt, ++index) {
+        if (tileIt->filename.parent_path() != directory)
+            break;
+
+        // The reader converts the frames it's given to be relative to the file, so give it a copy.
+        EncodedFrameReader reader(tileIt->filename, std::make_shared<std::vector<int>>(*tileIt->framesToRead), tileIt->frameOffsetInFile, shouldReadEntireGOPs_);
+        if (!reader.mp4Reader().pack())
+            return;
+        pack = reader.mp4Reader().pack();
+
+        prefetchedGOPs_[index];
+        while (auto samples = reader.nextSamplesToRead()) {
+            auto firstRange = byteRanges.size();
+            for (auto sample = samples->first; sample <= samples->second; ++sample) {
+                byteRanges.push_back(pack->byteRangeForSamples(tileIt->tileNumber, sample, sample));
+                plannedBytes += byteRanges.back().second;
+            }
+            gops.emplace_back(index, firstRange, byteRanges.size(),
+                              MP4Reader::sampleNumberToFrameNumber(samples->first + tileIt->frameOffsetInFile));
+        }
+    }
+    if (!pack)
+        return;
+
+    // Neighboring tiles' GOPs are next to each other in the pack, so this is a few large reads rather than one per GOP.
+    auto data = pack->read(byteRanges);
+    for (const auto &[index, firstRange, endRange, firstFrame] : gops) {
+        std::unique_ptr<std::vector<char>> gopData(new std::vector<char>);
+        for (auto range = firstRange; range < endRange; ++range)
+            gopData->insert(gopData->end(), data[range]->begin(), data[range]->end());
+        prefetchedGOPs_[index].emplace_back(std::move(gopData), firstFrame, endRange - firstRange);
+    }
+}
+
 void ScanTiledVideoOperator::setUpNextEncodedFrameReader() {
+    currentPrefetchedGOPs_.clear();
     if (orderedTileInformationIt_ == orderedTileInformation_.end()) {
         currentEncodedFrameReader_ = nullptr;
     } else {
+        auto index = orderedTileInformationIt_ - orderedTileInformation_.cbegin();
+        if (!prefetchedGOPs_.count(index))
+            prefetchPackedTiles(orderedTileInformationIt_);
+        auto prefetched = prefetchedGOPs_.find(index);
+        if (prefetched != prefetchedGOPs_.end()) {
+            currentPrefetchedGOPs_ = std::move(prefetched->second);
+            prefetchedGOPs_.erase(prefetched);
+        }
+
         ++numberOfTilesRead_;
         currentEncodedFrameReader_ = std::make_unique<EncodedFrameReader>(
                 orderedTileInformationIt_->filename,
@@ -120,6 +206,7 @@ std::optional<CPUEncodedFrameDataPtr> ScanTiledVideoOperator::next() {
         return {};
     }
 
+    auto readStart = std::chrono::steady_clock::now();
     if (!currentEncodedFrameReader_ || currentEncodedFrameReader_->isEos()) {
         setUpNextEncodedFrameReader();
 
@@ -127,6 +214,10 @@ std::optional<CPUEncodedFrameDataPtr> ScanTiledVideoOperator::next() {
         // Flush the decoder.
         if (!currentEncodedFrameReader_) {
             didSignalEOS_ = true;
+            readTime_ += std::chrono::steady_clock::now() - readStart;
+            if (telemetry_)
+                telemetry_->recordRead(totalNumberOfPixels_, totalNumberOfFrames_, totalNumberOfBytes_, readTime_);
+
             CUVIDSOURCEDATAPACKET packet;
             memset(&packet, 0, sizeof(packet));
             packet.flags = CUVID_PKT_ENDOFSTREAM;
@@ -138,7 +229,14 @@ std::optional<CPUEncodedFrameDataPtr> ScanTiledVideoOperator::next() {
     }
 
     // Otherwise, read and decode frames.
-    auto gopPacket = currentEncodedFrameReader_->read();
+    std::optional<GOPReaderPacket> gopPacket;
+    if (!currentPrefetchedGOPs_.empty()) {
+        // Advance the reader past the GOP so it still knows when the tile is finished.
+        currentEncodedFrameReader_->nextSamplesToRead();
+        gopPacket.emplace(std::move(currentPrefetchedGOPs_.front()));
+        currentPrefetchedGOPs_.pop_front();
+    } else
+        gopPacket = currentEncodedFrameReader_->read();
     assert(gopPacket.has_value());
 
     Configuration configuration;
@@ -158,6 +256,7 @@ std::optional<CPUEncodedFrameDataPtr> ScanTiledVideoOperator::next() {
     data->setFirstFrameIndexAndNumberOfFrames(gopPacket->firstFrameIndex(), gopPacket->numberOfFrames());
     data->setTileNumber(currentTileNumber_);
 
+    readTime_ += std::chrono::steady_clock::now() - readStart;
     return {data};
 }
 
@@ -167,6 +266,20 @@ static std::vector<unsigned int> ToCtbs(const std::vector<unsigned int> &pixelVa
     return ctbs;
 }
 
+std::unique_ptr<stitching::StitchContext> stitchContextForLayout(const TileLayout &layout, unsigned int ppsId) {
+    std::pair<unsigned int, unsigned int> tileDimensions{layout.numberOfRows(), layout.numberOfColumns()};
+    std::pair<unsigned int, unsigned int> videoCodedDimensions{layout.codedHeight(), layout.codedWidth()};
+    std::pair<unsigned int, unsigned int> videoDisplayDimensions{layout.totalHeight(), layout.totalWidth()};
+    bool shouldUseUniformTiles = false;
+    return std::make_unique<stitching::StitchContext>(tileDimensions,
+                                videoCodedDimensions,
+                                videoDisplayDimensions,
+                                shouldUseUniformTiles,
+                                ToCtbs(layout.heightsOfRows()),
+                                ToCtbs(layout.widthsOfColumns()),
+                                ppsId);
+}
+
 void ScanFullFramesFromTiledVideoOperator::setUpNextEncodedFrameReaders() {
     currentEncodedFrameReaders_.clear();
     if (frameIt_ == endFrameIt_)
@@ -179,36 +292,52 @@ void ScanFullFramesFromTiledVideoOperator::setUpNextEncodedFrameReaders() {
     while (frameIt_ != endFrameIt_) {
         if (pathForFrame(*frameIt_) == pathOfNextFrameGroup)
             frames->push_back(*frameIt_++);
+        else
+            break;
     }
 
+    // The stitcher expects one slice segment per tile per frame.
+    if (CatalogStorage::forPath(pathOfNextFrameGroup)->containsStitchedTiles(pathOfNextFrameGroup))
+        throw std::runtime_error("Tiles in " + pathOfNextFrameGroup.string() + " were merged by stitching and cannot be stitched into full frames");
+
     // Create a reader for each tile.
     auto frame = frames->front();
     auto layout = tileLocationProvider_->tileLayoutForFrame(frame);
     for (auto t = 0u; t < layout->numberOfTiles(); ++t) {
         auto tilePath = TileFiles::tileFilename(pathOfNextFrameGroup, t);
+        // Readers offset the frames in place, so each needs its own copy.
         currentEncodedFrameReaders_.push_back(std::make_unique<EncodedFrameReader>(
                 tilePath,
-                frames,
+                std::make_shared<std::vector<int>>(*frames),
                 tileLocationProvider_->frameOffsetInTileFile(tilePath),
                 false));
     }
 
     // Create the context for this layout.
-    std::pair<unsigned int, unsigned int> tileDimensions{layout->numberOfRows(), layout->numberOfColumns()};
-    std::pair<unsigned int, unsigned int> videoCodedDimensions{layout->codedHeight(), layout->codedWidth()};
-    std::pair<unsigned int, unsigned int> videoDisplayDimensions{layout->totalHeight(), layout->totalWidth()};
-    bool shouldUseUniformTiles = false;
-    currentContext_ = std::make_unique<stitching::StitchContext>(tileDimensions,
-                                videoCodedDimensions,
-                                videoDisplayDimensions,
-                                shouldUseUniformTiles,
-                                ToCtbs(layout->heightsOfRows()),
-                                ToCtbs(layout->widthsOfColumns()),
-                                ppsId_++);
+    currentContext_ = stitchContextForLayout(*layout, ppsId_++);
     if (ppsId_ >= MAX_PPS_ID)
         ppsId_ = 1;
 }
 
+std::vector<TileRead> ScanFullFramesFromTiledVideoOperator::plannedTileReads() const {
+    std::vector<TileRead> tileReads;
+    auto frameIt = frameIt_;
+    while (frameIt != endFrameIt_) {
+        std::vector<int> frames{*frameIt};
+        auto pathOfFrameGroup = pathForFrame(*frameIt++);
+        while (frameIt != endFrameIt_ && pathForFrame(*frameIt) == pathOfFrameGroup)
+            frames.push_back(*frameIt++);
+
+        auto layout = tileLocationProvider_->tileLayoutForFrame(frames.front());
+        for (auto t = 0u; t < layout->numberOfTiles(); ++t) {
+            auto tilePath = TileFiles::tileFilename(pathOfFrameGroup, t);
+            tileReads.push_back(plannedReadForTile(tilePath, t, layout->rectangleForTile(t), frames,
+                                                   tileLocationProvider_->frameOffsetInTileFile(tilePath), false));
+        }
+    }
+    return tileReads;
+}
+
 GOPReaderPacket ScanFullFramesFromTiledVideoOperator::stitchedDataForNextGOP() {
     // Load the data for each tile.
     std::vector<std::shared_ptr<std::vector<char>>> dataForGOP;
@@ -1,6 +1,8 @@
 #include "TileOperators.h"
 
+#include "CatalogStorage.h"
 #include "EncodeAPI.h"
+#include "MP4Reader.h"
 #include "Transaction.h"
 
 namespace tasm {
@@ -19,8 +21,10 @@ std::optional<GPUDecodedFrameData> TileOperator::next() {
         frameNumber = frame->getFrameNumber(frameNumber) ? frameNumber : frameNumber_++;
         auto tileLayout = tileConfigurationProvider_->tileLayoutForFrame(frameNumber);
 
-        // Reconfigure the encoders if the layout changed.
-        if (!currentTileLayout_ || *tileLayout != *currentTileLayout_ || frameNumber != lastFrameInGroup_ + 1) {
+        // Reconfigure the encoders if the layout changed. Copied tiles come from one stored directory, so a new
+        // group also starts where the stored directory changes.
+        if (!currentTileLayout_ || *tileLayout != *currentTileLayout_ || frameNumber != lastFrameInGroup_ + 1
+                || (storedTiles_ && storedDirectoryForFrame(frameNumber) != currentStoredDirectory_)) {
             // Read the data that was flushed from the encoders because it has the rest of the frames
             // that were encoded with the last configuration.
             if (currentTileLayout_) {
@@ -29,9 +33,10 @@ std::optional<GPUDecodedFrameData> TileOperator::next() {
                     saveTileGroupsToDisk();
             }
             tilesCurrentlyBeingEncoded_.clear();
+            tilesToStoredTiles_.clear();
 
             // Reconfigure the encoders.
-            reconfigureEncodersForNewLayout(tileLayout);
+            reconfigureEncodersForNewLayout(tileLayout, frameNumber);
 
             currentTileLayout_ = tileLayout;
             firstFrameInGroup_ = frameNumber;
@@ -45,36 +50,91 @@ std::optional<GPUDecodedFrameData> TileOperator::next() {
     return decodedData;
 }
 
-void TileOperator::reconfigureEncodersForNewLayout(std::shared_ptr<const tasm::TileLayout> newLayout) {
+void TileOperator::reconfigureEncodersForNewLayout(std::shared_ptr<const tasm::TileLayout> newLayout, int firstFrame) {
+    if (storedTiles_)
+        currentStoredDirectory_ = storedDirectoryForFrame(firstFrame);
+
     for (auto tileIndex = 0u; tileIndex < newLayout->numberOfTiles(); ++tileIndex) {
         Rectangle rect = newLayout->rectangleForTile(tileIndex);
+        if (auto storedTile = unchangedStoredTile(rect, firstFrame)) {
+            tilesToStoredTiles_[tileIndex] = *storedTile;
+            continue;
+        }
         tileEncodersManager_.createEncoderWithConfiguration(tileIndex, rect.width, rect.height);
         tilesCurrentlyBeingEncoded_.push_back(tileIndex);
     }
 }
 
+std::optional<unsigned int> TileOperator::unchangedStoredTile(const Rectangle &rect, int frame) {
+    // Stitched tiles have a slice segment per merged tile, and retiling is how they are turned back into single tiles.
+    if (!storedTiles_ || CatalogStorage::forPath(currentStoredDirectory_)->containsStitchedTiles(currentStoredDirectory_))
+        return {};
+
+    auto storedLayout = storedTiles_->tileLayoutForFrame(frame);
+    for (auto storedTile = 0u; storedTile < storedLayout->numberOfTiles(); ++storedTile) {
+        auto storedRect = storedLayout->rectangleForTile(storedTile);
+        if (storedRect.x != rect.x || storedRect.y != rect.y || storedRect.width != rect.width || storedRect.height != rect.height)
+            continue;
+
+        // The copy has to start with a keyframe to be decodable on its own.
+        auto storedTilePath = TileFiles::tileFilename(currentStoredDirectory_, storedTile);
+        MP4Reader reader(storedTilePath);
+        auto frameInFile = frame - static_cast<int>(storedTiles_->frameOffsetInTileFile(storedTilePath));
+        const auto &keyframes = reader.keyframeNumbers();
+        if (reader.allFramesAreKeyframes() || std::binary_search(keyframes.begin(), keyframes.end(), frameInFile))
+            return storedTile;
+        return {};
+    }
+    return {};
+}
+
+std::experimental::filesystem::path TileOperator::storedDirectoryForFrame(int frame) const {
+    return storedTiles_->locationOfTileForFrame(0, frame).parent_path();
+}
+
+void TileOperator::copyStoredTile(unsigned int storedTileNumber, OutputStream &output) {
+    auto storedTilePath = TileFiles::tileFilename(currentStoredDirectory_, storedTileNumber);
+    MP4Reader reader(storedTilePath);
+    auto frameOffset = static_cast<int>(storedTiles_->frameOffsetInTileFile(storedTilePath));
+    auto data = reader.dataForSamples(MP4Reader::frameNumberToSampleNumber(firstFrameInGroup_ - frameOffset),
+                                      MP4Reader::frameNumberToSampleNumber(lastFrameInGroup_ - frameOffset));
+    output.write(data->data(), data->size());
+}
+
 void TileOperator::saveTileGroupsToDisk() {
     if (!currentTileLayout_ || *currentTileLayout_ == EmptyTileLayout) {
         return;
     }
 
-    assert(tilesCurrentlyBeingEncoded_.size());
+    assert(tilesCurrentlyBeingEncoded_.size() || tilesToStoredTiles_.size());
     TileCrackingTransaction transaction(outputEntry_,
                                       *currentTileLayout_,
                                       firstFrameInGroup_,
-                                      lastFrameInGroup_);
-
-    // Get the list of tiles that should be involved in the current tile layout.
-    // Create an output for each.
-    for (auto &tileIndex : tilesCurrentlyBeingEncoded_) {
-        auto &output = transaction.write(tileIndex);
+                                      lastFrameInGroup_,
+                                      parent_->configuration().frameRate);
+
+    auto tilesToWrite = tilesCurrentlyBeingEncoded_;
+    for (const auto &tileAndStoredTile : tilesToStoredTiles_)
+        tilesToWrite.push_back(tileAndStoredTile.first);
+    std::sort(tilesToWrite.begin(), tilesToWrite.end());
+
+    // Write the encoded data for each tile involved in the current tile layout to its own output.
+    transaction.writeTiles(tilesToWrite, [&](unsigned int tileIndex, OutputStream &output) {
+        auto storedTile = tilesToStoredTiles_.find(tileIndex);
+        if (storedTile != tilesToStoredTiles_.end()) {
+            copyStoredTile(storedTile->second, output);
+            return;
+        }
 
-        // Write the encoded data for this tile index to the output stream.
-        for (auto &data : encodedDataForTiles_[tileIndex])
-            output.stream().write(data->data(), data->size());
+        // Looked up rather than indexed so the map isn't modified concurrently.
+        auto encodedData = encodedDataForTiles_.find(tileIndex);
+        if (encodedData == encodedDataForTiles_.end())
+            return;
 
-        encodedDataForTiles_[tileIndex].clear();
-    }
+        for (auto &data : encodedData->second)
+            output.write(data->data(), data->size());
+        encodedData->second.clear();
+    });
 
     transaction.commit();
 }
@@ -45,6 +45,8 @@ public:
     }
 
     const std::vector<std::string> &labelsInQuery() const { return metadataSelection_->objects(); }
+    unsigned int maxWidth() const { return maxWidth_; }
+    unsigned int maxHeight() const { return maxHeight_; }
 
 private:
     std::shared_ptr<SemanticIndex> index_;
@@ -0,0 +1,175 @@
+#ifndef TASM_CATALOGSTORAGE_H
+#define TASM_CATALOGSTORAGE_H
+
+#include "TileLayout.h"
+#include <experimental/filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace lightdb::serialization {
+class TileDirectory;
+} // namespace lightdb::serialization
+
+namespace tasm {
+class PackedTileBuffer;
+class TilePack;
+
+// Where videos' tile directories are kept. Transactions stage a directory's tiles and then publish the whole
+// directory at once; readers only ever see published directories.
+// Paths are used as keys whatever the storage, so a video is identified by the same path in every storage.
+class CatalogStorage {
+public:
+    virtual ~CatalogStorage() = default;
+
+    // The storage that holds the video or tile at path. Everything is on the filesystem unless another storage was
+    // mounted at one of path's ancestors.
+    static std::shared_ptr<CatalogStorage> forPath(const std::experimental::filesystem::path &path);
+    static void mount(const std::experimental::filesystem::path &root, std::shared_ptr<CatalogStorage> storage);
+    static void unmount(const std::experimental::filesystem::path &root);
+
+    // Whether what is stored outlives the process. State kept alongside the videos, like accumulated regret and the
+    // cost model, is only saved to storage that does.
+    virtual bool isPersistent() const = 0;
+    virtual void createCatalog(const std::experimental::filesystem::path &catalogPath) = 0;
+    virtual void createVideo(const std::experimental::filesystem::path &videoPath) = 0;
+    virtual void deleteVideo(const std::experimental::filesystem::path &videoPath) = 0;
+    // The version the next tile directory of the video will get.
+    virtual unsigned int tileVersion(const std::experimental::filesystem::path &videoPath) const = 0;
+    // Claims that version, so no other writer, in this process or another, can publish with it.
+    virtual unsigned int allocateTileVersion(const std::experimental::filesystem::path &videoPath) = 0;
+
+    // The published tile directories of the video, ordered by version. If pin is specified, it is set to an object
+    // that keeps the listed directories from being deleted, by any process, for as long as it is held.
+    virtual std::vector<lightdb::serialization::TileDirectory> listTileDirectories(const std::experimental::filesystem::path &videoPath,
+                                                                                  std::shared_ptr<void> *pin = nullptr) const = 0;
+    // Changes whenever a directory is published to or removed from the video's catalog, by any process.
+    virtual std::string catalogRevision(const std::experimental::filesystem::path &videoPath) const = 0;
+    // Whether a reader in any process still holds the pin of a listing taken before version was allocated.
+    virtual bool hasPinnedListingsBefore(const std::experimental::filesystem::path &videoPath, unsigned int version) const = 0;
+
+    // The pack holding the directory's tiles, or nullptr if each tile is a file of its own.
+    virtual std::shared_ptr<const TilePack> openTilePack(const std::experimental::filesystem::path &directoryPath) const = 0;
+    virtual bool containsStitchedTiles(const std::experimental::filesystem::path &directoryPath) const = 0;
+
+    // Whether new tile directories of the video are written as a pack rather than as a file per tile.
+    virtual bool shouldPackTiles(const std::experimental::filesystem::path &videoPath) const = 0;
+
+    virtual void stageDirectory(const std::experimental::filesystem::path &stagingDirectory) = 0;
+    virtual void writeTilePack(const std::experimental::filesystem::path &stagingDirectory, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate) = 0;
+    // Called with the video's other published directories while no other writer can change the catalog.
+    using PublishCondition = std::function<bool(const std::vector<lightdb::serialization::TileDirectory>&)>;
+
+    // Makes the staged tiles visible to readers as directory and records it in the video's catalog.
+    // Throws without publishing anything if the directory can't be published. Returns false without publishing
+    // anything if canPublish is specified and rejects the catalog; the staged tiles are discarded either way.
+    virtual bool publish(const std::experimental::filesystem::path &stagingDirectory,
+                         const std::experimental::filesystem::path &directory,
+                         const TileLayout &tileLayout,
+                         bool tilesAreStitched,
+                         const PublishCondition &canPublish = nullptr) = 0;
+    virtual void discard(const std::experimental::filesystem::path &stagingDirectory) = 0;
+
+    // Removes the directories from the video's catalog, so listings taken from now on don't include them. Their tiles
+    // stay readable until deleteDirectory() is called.
+    virtual void removeFromCatalog(const std::experimental::filesystem::path &videoPath,
+                                   const std::vector<lightdb::serialization::TileDirectory> &directories) = 0;
+    virtual void deleteDirectory(const std::experimental::filesystem::path &directoryPath) = 0;
+};
+
+// Tile directories are directories under the video's path, and the catalog is the video's manifest.
+// Writers hold the video's catalog lock while they allocate versions and update the manifest. A listing is pinned by
+// a shared lock on a file named after the tile version at the time it was taken.
+class FilesystemCatalogStorage : public CatalogStorage {
+public:
+    bool isPersistent() const override { return true; }
+    void createCatalog(const std::experimental::filesystem::path &catalogPath) override;
+    void createVideo(const std::experimental::filesystem::path &videoPath) override;
+    void deleteVideo(const std::experimental::filesystem::path &videoPath) override;
+    unsigned int tileVersion(const std::experimental::filesystem::path &videoPath) const override;
+    unsigned int allocateTileVersion(const std::experimental::filesystem::path &videoPath) override;
+
+    std::vector<lightdb::serialization::TileDirectory> listTileDirectories(const std::experimental::filesystem::path &videoPath,
+                                                                          std::shared_ptr<void> *pin = nullptr) const override;
+    std::string catalogRevision(const std::experimental::filesystem::path &videoPath) const override;
+    bool hasPinnedListingsBefore(const std::experimental::filesystem::path &videoPath, unsigned int version) const override;
+
+    std::shared_ptr<const TilePack> openTilePack(const std::experimental::filesystem::path &directoryPath) const override;
+    bool containsStitchedTiles(const std::experimental::filesystem::path &directoryPath) const override;
+
+    bool shouldPackTiles(const std::experimental::filesystem::path &videoPath) const override;
+
+    void stageDirectory(const std::experimental::filesystem::path &stagingDirectory) override;
+    void writeTilePack(const std::experimental::filesystem::path &stagingDirectory, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate) override;
+    bool publish(const std::experimental::filesystem::path &stagingDirectory,
+                 const std::experimental::filesystem::path &directory,
+                 const TileLayout &tileLayout,
+                 bool tilesAreStitched,
+                 const PublishCondition &canPublish = nullptr) override;
+    void discard(const std::experimental::filesystem::path &stagingDirectory) override;
+
+    void removeFromCatalog(const std::experimental::filesystem::path &videoPath,
+                           const std::vector<lightdb::serialization::TileDirectory> &directories) override;
+    void deleteDirectory(const std::experimental::filesystem::path &directoryPath) override;
+};
+
+// Keeps everything in memory, so storing and reading tiles doesn't touch the filesystem. Tiles are always packed
+// because there is no file to mux them into.
+class InMemoryCatalogStorage : public CatalogStorage {
+public:
+    bool isPersistent() const override { return false; }
+    void createCatalog(const std::experimental::filesystem::path &catalogPath) override {}
+    void createVideo(const std::experimental::filesystem::path &videoPath) override {}
+    void deleteVideo(const std::experimental::filesystem::path &videoPath) override;
+    unsigned int tileVersion(const std::experimental::filesystem::path &videoPath) const override;
+    unsigned int allocateTileVersion(const std::experimental::filesystem::path &videoPath) override;
+
+    std::vector<lightdb::serialization::TileDirectory> listTileDirectories(const std::experimental::filesystem::path &videoPath,
+                                                                          std::shared_ptr<void> *pin = nullptr) const override;
+    std::string catalogRevision(const std::experimental::filesystem::path &videoPath) const override;
+    // Only this process can read the directories, and TiledVideoManagerCache keeps track of its readers.
+    bool hasPinnedListingsBefore(const std::experimental::filesystem::path &videoPath, unsigned int version) const override { return false; }
+
+    std::shared_ptr<const TilePack> openTilePack(const std::experimental::filesystem::path &directoryPath) const override;
+    bool containsStitchedTiles(const std::experimental::filesystem::path &directoryPath) const override;
+
+    bool shouldPackTiles(const std::experimental::filesystem::path &videoPath) const override { return true; }
+
+    void stageDirectory(const std::experimental::filesystem::path &stagingDirectory) override {}
+    void writeTilePack(const std::experimental::filesystem::path &stagingDirectory, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate) override;
+    bool publish(const std::experimental::filesystem::path &stagingDirectory,
+                 const std::experimental::filesystem::path &directory,
+                 const TileLayout &tileLayout,
+                 bool tilesAreStitched,
+                 const PublishCondition &canPublish = nullptr) override;
+    void discard(const std::experimental::filesystem::path &stagingDirectory) override;
+
+    void removeFromCatalog(const std::experimental::filesystem::path &videoPath,
+                           const std::vector<lightdb::serialization::TileDirectory> &directories) override;
+    void deleteDirectory(const std::experimental::filesystem::path &directoryPath) override;
+
+private:
+    struct PublishedDirectory {
+        std::experimental::filesystem::path path;
+        TileLayout tileLayout;
+        std::vector<unsigned long long> tileSizes;
+    };
+
+    std::vector<lightdb::serialization::TileDirectory> listTileDirectoriesWhileLocked(const std::experimental::filesystem::path &videoPath) const;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, unsigned int> videoToTileVersion_;
+    std::unordered_map<std::string, std::vector<PublishedDirectory>> videoToDirectories_;
+    std::unordered_map<std::string, unsigned long> videoToRevision_;
+    // Keyed by directory path, for both staged and published directories.
+    std::unordered_map<std::string, std::shared_ptr<const TilePack>> directoryToPack_;
+    std::unordered_set<std::string> stitchedDirectories_;
+};
+
+} // namespace tasm
+
+#endif //TASM_CATALOGSTORAGE_H
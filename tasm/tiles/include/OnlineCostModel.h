@@ -0,0 +1,91 @@
+#ifndef TASM_ONLINECOSTMODEL_H
+#define TASM_ONLINECOSTMODEL_H
+
+#include <chrono>
+#include <experimental/filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace lightdb::serialization {
+class CostModel;
+class LinearModel;
+} // namespace lightdb::serialization
+
+namespace tasm {
+
+// Linear regression that is updated one observation at a time (recursive least squares).
+// Older observations are discounted by forgettingFactor so the weights follow changes in hardware and load.
+class RecursiveLeastSquares {
+public:
+    RecursiveLeastSquares(std::vector<double> initialWeights, double initialUncertainty, double forgettingFactor);
+
+    void addObservation(const std::vector<double> &features, double target);
+    const std::vector<double> &weights() const { return weights_; }
+    unsigned long long numberOfObservations() const { return numberOfObservations_; }
+
+    void serialize(lightdb::serialization::LinearModel &model) const;
+    // Returns false and keeps the current fit if model has a different number of features.
+    bool restore(const lightdb::serialization::LinearModel &model);
+
+private:
+    unsigned int numberOfFeatures_;
+    std::vector<double> weights_;
+    std::vector<double> covariance_;
+    double forgettingFactor_;
+    double maxCovarianceTrace_;
+    unsigned long long numberOfObservations_;
+};
+
+// Seconds to decode and re-encode tiles, learned from the queries and retiling that actually run.
+// The weights start at the offline fit and are saved in the catalog at most every few seconds. Processes that share a
+// catalog merge their observations into the saved model rather than overwriting each other's.
+class OnlineCostModel {
+public:
+    // Each catalog learns its own weights. Models live as long as the process, so references to them stay valid.
+    // Catalogs in storage that isn't persistent keep their model only in memory.
+    static OnlineCostModel &forCatalog(const std::experimental::filesystem::path &catalogPath);
+
+    double decodeSecondsPerPixel() const;
+    double decodeSecondsPerTile() const;
+    double encodeSecondsPerPixel() const;
+    double encodeSecondsPerGOP() const;
+
+    // tiles counts each tile of each frame that was decoded.
+    void addDecodeObservation(unsigned long long pixels, unsigned long long tiles, double seconds);
+    void addEncodeObservation(unsigned long long pixels, unsigned int numberOfGOPs, double seconds);
+
+    // Saves the observations that are waiting for the next save.
+    ~OnlineCostModel();
+
+private:
+    using Observation = std::pair<std::vector<double>, double>;
+    using Clock = std::chrono::steady_clock;
+
+    explicit OnlineCostModel(const std::experimental::filesystem::path &path);
+    void load();
+    bool readSavedModel(lightdb::serialization::CostModel &model) const;
+    void saveIfDue();
+    // Called with the catalog lock held. Replays the unsaved observations on top of the saved model, so observations
+    // that other processes saved meanwhile are kept.
+    void save();
+
+    // Observations are batched so that recording one doesn't rewrite the model.
+    static constexpr double SaveIntervalSeconds = 5;
+
+    mutable std::mutex mutex_;
+    // Empty if the model isn't saved.
+    std::experimental::filesystem::path path_;
+    // Pixels are in millions so that both features have similar magnitudes.
+    RecursiveLeastSquares decodeModel_;
+    RecursiveLeastSquares encodeModel_;
+    std::vector<Observation> unsavedDecodeObservations_;
+    std::vector<Observation> unsavedEncodeObservations_;
+    std::optional<Clock::time_point> lastSave_;
+};
+
+} // namespace tasm
+
+#endif //TASM_ONLINECOSTMODEL_H
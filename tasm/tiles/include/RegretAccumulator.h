@@ -1,47 +1,111 @@
 #ifndef TASM_REGRETACCUMULATOR_H
 #define TASM_REGRETACCUMULATOR_H
 
+#include "EnvironmentConfiguration.h"
+#include "OnlineCostModel.h"
 #include "TileConfigurationProvider.h"
 #include "WorkloadCostEstimator.h"
+#include <experimental/filesystem>
+#include <mutex>
 #include <unordered_set>
 
+namespace lightdb::serialization {
+class HistoricalQuery;
+class RegretState;
+class RegretUpdate;
+} // namespace lightdb::serialization
+
 namespace tasm {
+class RegretStateStore;
 class SemanticIndex;
+class StoredTileSizes;
+
+enum class RegretCostModel {
+    // Decode cost is proportional to the pixels decoded.
+    Pixels,
+    // Decode cost is proportional to the compressed bytes read, using the stored tiles' sample sizes.
+    // Falls back to pixels for costs that were estimated without them.
+    Bytes,
+};
+
+struct RetilingCandidate {
+    unsigned int gop;
+    std::string layoutIdentifier;
+    double regret;
+    // Estimated seconds to re-encode the GOP.
+    double encodeCost;
 
+    double priority() const { return regret / encodeCost; }
+};
+
+// Queries can add regret while a retiling pass is running, so every public method may be called concurrently.
 class RegretAccumulator {
 public:
+    // Costs are weighted by onlineCostModel, which should be the model of the catalog the video is stored in.
     RegretAccumulator(std::shared_ptr<SemanticIndex> semanticIndex, const std::string &metadataIdentifier,
-            unsigned int width, unsigned int height, unsigned int gopLength, double threshold = 1.0)
-        : semanticIndex_(semanticIndex), metadataIdentifier_(metadataIdentifier),
-        width_(width), height_(height), gopLength_(gopLength), threshold_(threshold),
-        gopSizeInPixels_(width_ * height_ * gopLength_),
-        gopTilingCost_(estimateCostToEncodeGOP(gopSizeInPixels_)),
-        queryIteration_(0),
-        noTilesConfiguration_(new SingleTileConfigurationProvider(width_, height_)) {}
+            unsigned int width, unsigned int height, unsigned int gopLength, double threshold = 1.0,
+            OnlineCostModel &onlineCostModel = OnlineCostModel::forCatalog(EnvironmentConfiguration::instance().catalogPath()));
+    ~RegretAccumulator();
 
     void addRegretForQuery(std::shared_ptr<Workload> workload, std::shared_ptr<TileLayoutProvider> currentLayout);
+    // GOPs whose regret exceeds the threshold, with the most regret per unit of encode cost first.
+    std::vector<RetilingCandidate> retilingCandidates();
+    // The layouts of every candidate. Their regret is reset right away.
     std::unique_ptr<std::unordered_map<unsigned int, std::shared_ptr<TileLayoutProvider>>> getNewGOPLayouts();
+    // The layouts of the specified candidates. Their regret is kept until markGOPsAsRetiled() is called, so GOPs
+    // whose retile fails are candidates again later.
+    std::unique_ptr<std::unordered_map<unsigned int, std::shared_ptr<TileLayoutProvider>>> newGOPLayoutsForCandidates(const std::vector<RetilingCandidate> &candidates);
+    // Called once the GOPs' new layouts are committed.
+    void markGOPsAsRetiled(const std::vector<unsigned int> &gops);
+
+    // Restores any state previously saved in directory, then saves every subsequent change there.
+    // The threshold passed to the constructor takes precedence over the saved one.
+    void persistTo(const std::experimental::filesystem::path &directory);
+
+    void setCostModel(RegretCostModel costModel);
+
+    // Before each query adds its regret, existing regret is multiplied by decay so that old queries count for less.
+    // A decay of 1.0 keeps regret until the GOP is retiled.
+    void setRegretDecay(double decay);
+    // Only the most recent historyLength queries are kept to estimate the regret of layouts added later.
+    void setHistoryLength(unsigned int historyLength);
+
+    static const unsigned int DefaultHistoryLength = 100;
 
 private:
-    bool shouldRetileGOP(unsigned int gop, std::string &layoutIdentifier);
+    bool shouldRetileGOP(unsigned int gop, std::string &layoutIdentifier, double &regret);
     void resetRegretForGOP(unsigned int gop);
     std::shared_ptr<TileLayoutProvider> configurationProviderForIdentifier(const std::string &identifier);
 
     void addRegretForHistoricalQueries(const std::vector<std::string> &objects);
+    void removeHistoricalQueriesForRetiledGOPs();
+    void removeHistoricalQuery(unsigned int iteration);
+    void removeQueriesOutsideHistory();
+    void decayRegret(double decay);
     std::shared_ptr<TileLayoutProvider> tileLayoutForObjects(const std::vector<std::string> &objects);
-    bool costsAreForGOPsThatHaveNotBeenRetiled(unsigned int iteration, std::shared_ptr<std::unordered_map<unsigned int, CostElements>> baselineCosts);
+    std::unordered_set<unsigned int> gopsThatHaveNotBeenRetiled(unsigned int iteration, const std::unordered_map<unsigned int, CostElements> &baselineCosts) const;
     void addRegretForWorkload(
             unsigned int iteration,
             std::shared_ptr<Workload> workload,
             std::shared_ptr<std::unordered_map<unsigned int, CostElements>> baselineCosts,
-            const std::vector<std::string> layouts);
+            std::shared_ptr<std::unordered_map<unsigned int, CostElements>> noTilesCosts,
+            const std::vector<std::string> &layouts,
+            double weight = 1.0);
     void addRegretToGOP(unsigned int gop, double regret, const std::string &layoutIdentifier);
-    double estimateCostToEncodeGOP(long long int sizeInPixels) const {
-        static double pixelCoef = 3.206e-06;
-        static double pixelIntercept = 2.592;
+    void addLayout(const std::string &layoutIdentifier, const std::vector<std::string> &objects);
 
-        return pixelCoef * gopSizeInPixels_ + pixelIntercept;
+    void recordQuery(unsigned int iteration, std::shared_ptr<Workload> workload);
+    void flushPendingUpdate();
+    void restoreState(const lightdb::serialization::RegretState &state);
+    void applyUpdate(const lightdb::serialization::RegretUpdate &update);
+    void restoreQuery(const lightdb::serialization::HistoricalQuery &query);
+    std::unique_ptr<lightdb::serialization::RegretState> currentState() const;
+    // Uses the current weights of the online cost model, so the retiling threshold follows measured encode times.
+    double estimateCostToEncodeGOP(long long int sizeInPixels) const {
+        return onlineCostModel_.encodeSecondsPerPixel() * sizeInPixels + onlineCostModel_.encodeSecondsPerGOP();
     }
+    // Only the tiles of the new layout that differ from the stored ones are encoded; the others are copied.
+    double estimateCostToRetileGOP(unsigned int gop, const std::string &layoutIdentifier);
 
     std::shared_ptr<SemanticIndex> semanticIndex_;
     const std::string metadataIdentifier_;
@@ -53,19 +117,37 @@ private:
     double threshold_;
     std::vector<std::string> labels_;
     std::unordered_map<std::string, std::shared_ptr<TileLayoutProvider>> idToConfig_;
+    std::unordered_map<std::string, std::vector<std::string>> idToObjects_;
 
     long long int gopSizeInPixels_;
-    double gopTilingCost_;
     std::unordered_map<unsigned int, std::unordered_map<std::string, double>> gopToRegret_;
+    double regretDecay_;
+    unsigned int historyLength_;
 
     unsigned int queryIteration_;
     std::unordered_map<unsigned int, unsigned int> gopToClearedIteration_;
     std::unordered_map<unsigned int, std::shared_ptr<Workload>> iterationToWorkload_;
+    // Per-GOP costs are computed once when a query is executed; historical queries reuse them when new layouts are added.
     std::unordered_map<unsigned int, std::shared_ptr<std::unordered_map<unsigned int, CostElements>>> iterationToBaselineCosts_;
+    std::unordered_map<unsigned int, std::shared_ptr<std::unordered_map<unsigned int, CostElements>>> iterationToNoTilesCosts_;
     std::unordered_set<std::string> allObjects_;
     std::unordered_set<std::string> singleObjects_;
 
     std::shared_ptr<SingleTileConfigurationProvider> noTilesConfiguration_;
+    std::shared_ptr<ThreadPool> threadPool_;
+    RegretCostModel costModel_;
+    OnlineCostModel &onlineCostModel_;
+    // Sizes of the tiles the most recent query read. Only used by the Bytes cost model.
+    std::shared_ptr<StoredTileSizes> storedTileSizes_;
+    // The layout the most recent query read, which is what retiling starts from. Not set until a query runs.
+    std::shared_ptr<TileLayoutProvider> currentLayout_;
+
+    // Only set once persistTo() is called. Changes are collected into pendingUpdate_ and appended to the store together.
+    std::unique_ptr<RegretStateStore> stateStore_;
+    std::unique_ptr<lightdb::serialization::RegretUpdate> pendingUpdate_;
+
+    // Recursive because getNewGOPLayouts() is built from the other public methods.
+    std::recursive_mutex mutex_;
 };
 
 } // namespace tasm
@@ -0,0 +1,42 @@
+#ifndef TASM_REGRETSTATESTORE_H
+#define TASM_REGRETSTATESTORE_H
+
+#include <experimental/filesystem>
+#include <fstream>
+#include <vector>
+
+namespace lightdb::serialization {
+class RegretState;
+class RegretUpdate;
+} // namespace lightdb::serialization
+
+namespace tasm {
+
+// Stores a video's regret state as a checkpoint plus a log of the updates made since the checkpoint was written.
+// Appending an update only writes that update, so persisting the state after each query stays cheap.
+class RegretStateStore {
+public:
+    explicit RegretStateStore(const std::experimental::filesystem::path &directory);
+
+    // Returns false if nothing has been saved. Updates that were already folded into the checkpoint are skipped.
+    bool load(lightdb::serialization::RegretState &checkpoint, std::vector<lightdb::serialization::RegretUpdate> &updates);
+    // Assigns the update's sequence number.
+    void append(lightdb::serialization::RegretUpdate &update);
+    // Atomically replaces the checkpoint and truncates the log.
+    void checkpoint(lightdb::serialization::RegretState &state);
+
+    bool shouldCheckpoint() const { return numberOfUpdatesSinceCheckpoint_ >= UpdatesBetweenCheckpoints; }
+
+private:
+    static const unsigned int UpdatesBetweenCheckpoints = 64;
+
+    std::experimental::filesystem::path checkpointPath_;
+    std::experimental::filesystem::path logPath_;
+    unsigned long long nextSequenceNumber_;
+    unsigned int numberOfUpdatesSinceCheckpoint_;
+    std::ofstream log_;
+};
+
+} // namespace tasm
+
+#endif //TASM_REGRETSTATESTORE_H
@@ -0,0 +1,59 @@
+#ifndef TASM_RETILINGSCHEDULER_H
+#define TASM_RETILINGSCHEDULER_H
+
+#include "RegretAccumulator.h"
+#include <chrono>
+#include <functional>
+#include <limits>
+
+namespace tasm {
+
+// Limits on how much work retiling may do over time. Each limit is an allowance that refills completely over
+// refillIntervalSeconds, so a pass can spend at most the limit and passes average at most the limit per interval.
+struct RetilingBudget {
+    // Seconds spent retiling.
+    double encodeSeconds = std::numeric_limits<double>::max();
+    unsigned long long bytesWritten = std::numeric_limits<unsigned long long>::max();
+    double refillIntervalSeconds = 60;
+
+    bool limitsBytesWritten() const { return bytesWritten != std::numeric_limits<unsigned long long>::max(); }
+};
+
+// Picks which candidate GOPs to retile in a pass so that retiling doesn't starve queries.
+// Candidates are picked by their estimated costs, and then the pass is charged what it actually spent. Candidates that
+// don't fit keep their regret, so they are carried forward to later passes.
+class RetilingScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit RetilingScheduler(RetilingBudget budget = RetilingBudget(), Clock::time_point now = Clock::now())
+        : budget_(budget),
+        remainingSeconds_(budget.encodeSeconds),
+        remainingBytes_(static_cast<double>(budget.bytesWritten)),
+        lastRefill_(now)
+    { }
+
+    const RetilingBudget &budget() const { return budget_; }
+    // What is left of the old budget carries over, up to the new limits.
+    void setBudget(RetilingBudget budget, Clock::time_point now = Clock::now());
+
+    // Candidates must be ordered by priority. bytesForGOP is only used when the budget limits the bytes written.
+    std::vector<RetilingCandidate> candidatesForPass(const std::vector<RetilingCandidate> &candidates,
+                                                     std::function<unsigned long long(unsigned int gop)> bytesForGOP,
+                                                     Clock::time_point now = Clock::now());
+    // Called once a pass finishes with what it spent. Overspending delays later passes until the budget refills.
+    void charge(double seconds, unsigned long long bytes);
+
+private:
+    void refill(Clock::time_point now);
+
+    RetilingBudget budget_;
+    // Negative after a pass overspends.
+    double remainingSeconds_;
+    double remainingBytes_;
+    Clock::time_point lastRefill_;
+};
+
+} // namespace tasm
+
+#endif //TASM_RETILINGSCHEDULER_H
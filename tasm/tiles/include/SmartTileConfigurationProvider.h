@@ -17,8 +17,8 @@ public:
             : fineGrainedLayoutProvider_(new FineGrainedTileConfigurationProvider(tileLayoutDuration, semanticDataManager, frameWidth, frameHeight)),
             singleTileLayoutProvider_(new SingleTileConfigurationProvider(frameWidth, frameHeight)),
             workload_(new Workload(semanticDataManager)),
-            fineGrainedWorkloadCostEstimator_(new WorkloadCostEstimator(fineGrainedLayoutProvider_, workload_, tileLayoutDuration)),
-            untiledWorkloadCostEstimator_(new WorkloadCostEstimator(singleTileLayoutProvider_, workload_, tileLayoutDuration)),
+            fineGrainedWorkloadCostEstimator_(new WorkloadCostEstimator(fineGrainedLayoutProvider_, workload_, tileLayoutDuration, ThreadPool::shared())),
+            untiledWorkloadCostEstimator_(new WorkloadCostEstimator(singleTileLayoutProvider_, workload_, tileLayoutDuration, ThreadPool::shared())),
             fineGrainedLayoutCostByGOP_(new std::unordered_map<unsigned int, CostElements>()),
             untiledCostByGOP_(new std::unordered_map<unsigned int, CostElements>()) {
         // TODO: Do this work incrementally rather than in constructor.
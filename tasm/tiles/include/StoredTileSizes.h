@@ -0,0 +1,49 @@
+#ifndef TASM_STOREDTILESIZES_H
+#define TASM_STOREDTILESIZES_H
+
+#include "TileLocationProvider.h"
+#include <mutex>
+#include <unordered_map>
+
+namespace tasm {
+
+// Compressed sizes of a video's stored tiles, read from the tile files' sample tables and cached per file.
+// Locating tiles goes through the location provider, so like layout providers it must only be used by one thread at a
+// time. Reading the sizes of located tiles is thread-safe.
+class StoredTileSizes {
+public:
+    // Where a tile's frames starting at some frame are stored.
+    struct TileFrames {
+        std::experimental::filesystem::path tilePath;
+        unsigned int offsetInFile;
+    };
+
+    explicit StoredTileSizes(std::shared_ptr<TileLocationProvider> tileLocationProvider)
+        : tileLocationProvider_(tileLocationProvider)
+    { }
+
+    std::shared_ptr<TileLayout> tileLayoutForFrame(unsigned int frame) {
+        return tileLocationProvider_->tileLayoutForFrame(frame);
+    }
+
+    // Every tile of the layout stored for firstFrame, in tile order.
+    std::vector<TileFrames> locateTiles(unsigned int firstFrame);
+
+    // Element k is the number of bytes of the tile in frames [firstFrame, firstFrame + k).
+    std::vector<unsigned long long> cumulativeBytesForTile(const TileFrames &tileFrames, unsigned int numberOfFrames);
+
+    // Element k is the number of bytes per pixel of the whole frame, summed over frames [firstFrame, firstFrame + k).
+    // Used to estimate the size of layouts that haven't been stored.
+    std::vector<double> cumulativeBytesPerPixel(const TileLayout &storedLayout, const std::vector<TileFrames> &storedTiles, unsigned int numberOfFrames);
+
+private:
+    const std::vector<unsigned long long> &cumulativeBytesForTileFile(const std::experimental::filesystem::path &tilePath);
+
+    std::shared_ptr<TileLocationProvider> tileLocationProvider_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::vector<unsigned long long>> tilePathToCumulativeBytes_;
+};
+
+} // namespace tasm
+
+#endif //TASM_STOREDTILESIZES_H
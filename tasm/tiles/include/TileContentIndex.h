@@ -0,0 +1,78 @@
+#ifndef TASM_TILECONTENTINDEX_H
+#define TASM_TILECONTENTINDEX_H
+
+#include <experimental/filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace tasm {
+
+// Indexes a video's published tile files by their contents, so a transaction that produces a tile identical to one
+// that is already stored can link to the existing file instead of keeping a second copy.
+class TileContentIndex {
+public:
+    struct Content {
+        // Of the Annex B stream the tile was muxed from. Muxing is deterministic, so identical streams produce
+        // identical files.
+        unsigned long long hash;
+        // Of the tile file.
+        unsigned long long size;
+    };
+
+    // Hashes a tile as it is written, so committing doesn't have to read it back.
+    class Hasher {
+    public:
+        void update(const char *data, size_t size);
+        unsigned long long hash() const { return hash_; }
+
+    private:
+        // FNV-1a. Files with the same hash are compared before they are shared, so it only has to spread them out.
+        unsigned long long hash_ = 14695981039346656037ull;
+    };
+
+    // The video's index, shared by the transactions in the process. Records appended since the last call, by any
+    // process, are read before it is returned.
+    static std::shared_ptr<TileContentIndex> forVideo(const std::experimental::filesystem::path &videoPath);
+
+    // A published tile file with the same bytes as filename, if there is one. Hash matches are compared byte by byte.
+    std::optional<std::experimental::filesystem::path> findIdenticalFile(const Content &content, const std::experimental::filesystem::path &filename) const;
+
+    // Records published tile files, which must be in one of the video's tile directories.
+    void add(const std::vector<std::pair<Content, std::experimental::filesystem::path>> &files);
+
+private:
+    struct Entry {
+        unsigned long long size;
+        std::experimental::filesystem::path path;
+    };
+
+    explicit TileContentIndex(const std::experimental::filesystem::path &videoPath);
+
+    // Reads the records appended since the last refresh, or the whole index if it was rewritten since.
+    void refresh();
+    // Rewrites the index without the files that have been deleted since they were added. Called with the catalog lock
+    // held, right after a refresh, so no other writer's records are lost.
+    void rewrite();
+    void setLengthRead(unsigned long long device, unsigned long long inode, unsigned long long length);
+
+    // Entries aren't checked when they are read, so deleted files are only dropped once the index has doubled in size
+    // since it was last written in full.
+    static const unsigned int MinimumEntriesBeforeRewrite = 256;
+
+    std::experimental::filesystem::path videoPath_;
+    std::experimental::filesystem::path indexPath_;
+    mutable std::mutex mutex_;
+    std::unordered_multimap<unsigned long long, Entry> hashToEntry_;
+    // The file that was read, and how much of it was read intact.
+    unsigned long long device_;
+    unsigned long long inode_;
+    unsigned long long lengthRead_;
+    std::size_t numberOfEntriesWhenWritten_;
+};
+
+} // namespace tasm
+
+#endif //TASM_TILECONTENTINDEX_H
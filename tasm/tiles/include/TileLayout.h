@@ -108,6 +108,16 @@ public:
         return intersectingRectangleIds;
     }
 
+    // True when every tile in this layout is made up of whole tiles from the other layout,
+    // i.e. this layout's column and row boundaries are a subset of the other's.
+    bool isCoarseningOf(const TileLayout &other) const {
+        if (*this == other || totalWidth() != other.totalWidth() || totalHeight() != other.totalHeight())
+            return false;
+
+        return boundariesAreSubset(widthsOfColumns_, other.widthsOfColumns_)
+                && boundariesAreSubset(heightsOfRows_, other.heightsOfRows_);
+    }
+
     unsigned int codedHeight() const {
         return aligned(totalHeight());
     }
@@ -132,6 +142,20 @@ protected:
     mutable unsigned int largestHeight_;
 
 private:
+    static bool boundariesAreSubset(const std::vector<unsigned int> &sizes, const std::vector<unsigned int> &otherSizes) {
+        auto otherIt = otherSizes.begin();
+        unsigned int otherBoundary = 0;
+        unsigned int boundary = 0;
+        for (auto size : sizes) {
+            boundary += size;
+            while (otherBoundary < boundary && otherIt != otherSizes.end())
+                otherBoundary += *otherIt++;
+            if (otherBoundary != boundary)
+                return false;
+        }
+        return true;
+    }
+
     unsigned int aligned(unsigned int val) const {
         if (!(val % alignment_))
             return val;
@@ -4,8 +4,11 @@
 #include "Files.h"
 #include "TileConfigurationProvider.h"
 #include "TiledVideoManager.h"
+#include <mutex>
+#include <unordered_map>
 
 namespace tasm {
+class SemanticDataManager;
 
 class TileLocationProvider : public TileLayoutProvider {
 public:
@@ -31,7 +34,6 @@ public:
     }
 
     std::shared_ptr<TileLayout> tileLayoutForFrame(unsigned int frame) override {
-        std::scoped_lock lock(mutex_);
         return tileLayoutsManager_->tileLayoutForId(layoutIdForFrame(frame));
     }
 
@@ -41,22 +43,75 @@ public:
 
 private:
     int layoutIdForFrame(unsigned int frame) const {
-        std::scoped_lock lock(mutex_);
+        return tileLayoutsManager_->tileLayoutIdForFrame(frame);
+    }
+
+    std::shared_ptr<const TiledVideoManager> tileLayoutsManager_;
+};
+
+// Reads each frame from the newest version of it whose tiles can be stitched into full frames. Tiles that were merged
+// by stitching can't be stitched again, so those frames are read from the version the tiles were stitched from.
+class FullFrameTileLocationProvider : public TileLocationProvider {
+public:
+    FullFrameTileLocationProvider(std::shared_ptr<const TiledVideoManager> tileLayoutsManager)
+            : tileLayoutsManager_(tileLayoutsManager)
+    { }
+
+    std::experimental::filesystem::path locationOfTileForFrame(unsigned int tileNumber, unsigned int frame) const override {
+        return tileLayoutsManager_->locationOfTileForId(tileNumber, layoutIdForFrame(frame));
+    }
+
+    std::shared_ptr<TileLayout> tileLayoutForFrame(unsigned int frame) override {
+        return tileLayoutsManager_->tileLayoutForId(layoutIdForFrame(frame));
+    }
+
+    unsigned int lastFrameWithLayout() const override {
+        return tileLayoutsManager_->maximumFrame();
+    }
+
+private:
+    int layoutIdForFrame(unsigned int frame) const;
+    bool containsStitchedTiles(int id) const;
 
-        if (frameToLayoutId_.count(frame))
-            return frameToLayoutId_.at(frame);
+    std::shared_ptr<const TiledVideoManager> tileLayoutsManager_;
+    // Filled in as directories are first read. Tiles can be located from multiple threads.
+    mutable std::mutex mutex_;
+    mutable std::unordered_map<int, bool> idToContainsStitchedTiles_;
+};
 
-        auto layoutIds = tileLayoutsManager_->tileLayoutIdsForFrame(frame);
-        // Pick the one with the largest value because it's the most recent layout.
-        auto layoutId = *std::max_element(layoutIds.begin(), layoutIds.end());
+// Reads each GOP from whichever stored version of it decodes the fewest pixels for the query's rectangles, rather
+// than always from the newest. Ties are broken by the number of tiles and then by recency.
+class CostBasedTileLocationProvider : public TileLocationProvider {
+public:
+    CostBasedTileLocationProvider(std::shared_ptr<const TiledVideoManager> tileLayoutsManager,
+            std::shared_ptr<SemanticDataManager> semanticDataManager,
+            unsigned int gopLength)
+            : tileLayoutsManager_(tileLayoutsManager),
+            semanticDataManager_(semanticDataManager),
+            gopLength_(gopLength)
+    { }
 
-        frameToLayoutId_[frame] = layoutId;
-        return layoutId;
+    std::experimental::filesystem::path locationOfTileForFrame(unsigned int tileNumber, unsigned int frame) const override {
+        return tileLayoutsManager_->locationOfTileForId(tileNumber, layoutIdForFrame(frame));
     }
 
+    std::shared_ptr<TileLayout> tileLayoutForFrame(unsigned int frame) override {
+        return tileLayoutsManager_->tileLayoutForId(layoutIdForFrame(frame));
+    }
+
+    unsigned int lastFrameWithLayout() const override {
+        return tileLayoutsManager_->maximumFrame();
+    }
+
+private:
+    int layoutIdForFrame(unsigned int frame) const;
+    int cheapestLayoutIdForGOP(unsigned int gop) const;
+
     std::shared_ptr<const TiledVideoManager> tileLayoutsManager_;
-    mutable std::unordered_map<unsigned int, int> frameToLayoutId_;
-    mutable std::recursive_mutex mutex_;
+    std::shared_ptr<SemanticDataManager> semanticDataManager_;
+    unsigned int gopLength_;
+    // Filled in as GOPs are first read.
+    mutable std::unordered_map<unsigned int, int> gopToLayoutId_;
 };
 
 } // namespace tasm
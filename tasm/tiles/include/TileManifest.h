@@ -0,0 +1,65 @@
+#ifndef TASM_TILEMANIFEST_H
+#define TASM_TILEMANIFEST_H
+
+#include "TileLayout.h"
+#include <experimental/filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace lightdb::serialization {
+class TileDirectory;
+} // namespace lightdb::serialization
+
+namespace tasm {
+
+// Lists a video's published tile directories as a checkpoint plus a log of the directories committed since the
+// checkpoint was written, so the catalog can be loaded with sequential reads instead of a directory scan.
+// Readers and writers hold the video's catalog lock, so the manifest can be shared by processes on the host.
+class TileManifest {
+public:
+    explicit TileManifest(const std::experimental::filesystem::path &videoPath);
+
+    // Videos stored before manifests existed don't have one until their next commit.
+    bool exists() const;
+
+    // Ordered by version.
+    std::vector<lightdb::serialization::TileDirectory> load() const;
+    // Changes whenever a directory is appended or removed, by any process. Only stats the files, so it can be checked
+    // before every read to tell whether a loaded catalog is out of date.
+    std::string revision() const;
+
+    // Creates the manifest from the published directories if it doesn't exist yet.
+    // If canAppend is specified, it is called with the other directories under the catalog lock, and nothing is
+    // appended unless it returns true.
+    bool append(const lightdb::serialization::TileDirectory &directory,
+                const std::function<bool(const std::vector<lightdb::serialization::TileDirectory>&)> &canAppend = nullptr);
+    // Removes the directory from the catalog. Its files are left for the caller to delete.
+    void remove(const lightdb::serialization::TileDirectory &directory);
+    // Replaces the manifest with one that lists the published directories.
+    void rebuildFromDirectories();
+
+    // Describes a published tile directory by reading its metadata and tile files.
+    static lightdb::serialization::TileDirectory describeDirectory(const std::experimental::filesystem::path &directoryPath);
+    static lightdb::serialization::TileDirectory describeDirectory(const std::experimental::filesystem::path &directoryPath,
+                                                                   const TileLayout &tileLayout,
+                                                                   const std::vector<unsigned long long> &tileSizes);
+
+private:
+    static const unsigned int DirectoriesBetweenCheckpoints = 64;
+
+    std::vector<lightdb::serialization::TileDirectory> loadWhileLocked() const;
+    void appendToLog(const lightdb::serialization::TileDirectory &directory);
+    std::vector<lightdb::serialization::TileDirectory> scanDirectories() const;
+    // Visits the log's records in order. Returns the length of the records that were read intact.
+    unsigned long long readLog(const std::function<void(lightdb::serialization::TileDirectory &&)> &visitDirectory) const;
+    void checkpoint(const std::vector<lightdb::serialization::TileDirectory> &directories);
+
+    std::experimental::filesystem::path videoPath_;
+    std::experimental::filesystem::path checkpointPath_;
+    std::experimental::filesystem::path logPath_;
+};
+
+} // namespace tasm
+
+#endif //TASM_TILEMANIFEST_H
@@ -1,16 +1,18 @@
 #ifndef TASM_TILEDVIDEOMANAGER_H
 #define TASM_TILEDVIDEOMANAGER_H
 
-#include "IntervalTree.h"
+#include "FrameRunIndex.h"
 #include "TileLayout.h"
 #include "Video.h"
 #include <mutex>
+#include <set>
 
 namespace tasm {
 class TiledVideoManager {
 public:
     TiledVideoManager(std::shared_ptr<TiledEntry> entry)
             : entry_(entry),
+              bucketLength_(1),
               totalWidth_(0),
               totalHeight_(0),
               largestWidth_(0),
@@ -20,29 +22,43 @@ public:
     }
 
     std::shared_ptr<TiledEntry> entry() const { return entry_; }
-    std::vector<int> tileLayoutIdsForFrame(unsigned int frameNumber) const;
+    // The most recent layout that stores the frame.
+    int tileLayoutIdForFrame(unsigned int frameNumber) const;
+    // Every layout that stores all of the frames, most recent first.
+    std::vector<int> tileLayoutIdsForFrames(unsigned int firstFrame, unsigned int lastFrame) const;
     std::shared_ptr<TileLayout> tileLayoutForId(int id) const { return directoryIdToTileLayout_.at(id); }
     std::experimental::filesystem::path locationOfTileForId(unsigned int tileNumber, int id) const;
+    // Sizes of the tile files in bytes, as recorded when they were committed.
+    const std::vector<unsigned long long> &tileSizesForId(int id) const;
 
     unsigned int totalWidth() const { return totalWidth_; }
     unsigned int totalHeight() const { return totalHeight_; }
     unsigned int largestWidth() const { return largestWidth_; }
     unsigned int largestHeight() const { return largestHeight_; }
     unsigned int maximumFrame() const { return maximumFrame_; }
+    // The catalog's revision when it was read. If it has changed since, this manager may be missing directories.
+    const std::string &catalogRevision() const { return catalogRevision_; }
 
 private:
     void loadAllTileConfigurations();
     std::shared_ptr<TiledEntry> entry_;
-    IntervalTree<unsigned int> intervalTree_;
+    FrameRunIndex layoutIndex_;
+    // Each directory's frames, listed in every bucket of frames it overlaps.
+    std::vector<FrameRunIndex::Interval> directoryIntervals_;
+    std::vector<std::vector<unsigned int>> bucketToDirectoryIntervals_;
+    unsigned int bucketLength_;
+    // Keeps the directories this manager refers to from being deleted by compaction in another process.
+    std::shared_ptr<void> catalogPin_;
+    std::string catalogRevision_;
 
 public: // For sake of measuring.
     std::unordered_map<int, std::experimental::filesystem::path> directoryIdToTileDirectory_;
     std::unordered_map<int, std::shared_ptr<TileLayout>> directoryIdToTileLayout_;
+    std::unordered_map<int, std::vector<unsigned long long>> directoryIdToTileSizes_;
     std::unordered_map <TileLayout, std::shared_ptr<TileLayout>> tileLayoutReferences_;
 
 private:
-    mutable std::mutex mutex_;
-
+    // Everything is loaded by the constructor and never modified, so readers don't lock.
     unsigned int totalWidth_;
     unsigned int totalHeight_;
     unsigned int largestWidth_;
@@ -50,6 +66,55 @@ private:
     unsigned int maximumFrame_;
 };
 
+// Tiled video managers shared by every query in the process, so the catalog isn't re-read for each one.
+// A video's manager is rebuilt the first time it is requested after the video's tiles change, whether they were changed
+// by this process or another. The manager it replaces, and the directories it pins, are released once no query uses it.
+// Each query plans and reads with one manager, so it sees the same directories throughout even if tiles are committed
+// while it runs. Readers can keep using their manager after compaction removes directories it refers to: the
+// directories are only deleted once no manager, in this process or another, refers to them.
+class TiledVideoManagerCache {
+public:
+    static TiledVideoManagerCache &instance();
+
+    std::shared_ptr<const TiledVideoManager> tiledVideoManager(std::shared_ptr<TiledEntry> entry);
+    // Called whenever tile directories for the video are added or removed.
+    void invalidate(const std::experimental::filesystem::path &videoPath);
+
+    // Called once the directories have been removed from the video's manifest and a version has been allocated after
+    // that, so managers in other processes that may refer to them are the ones pinned before that version.
+    void deleteWhenUnreferenced(const std::experimental::filesystem::path &videoPath,
+                                std::vector<std::experimental::filesystem::path> directories,
+                                unsigned int versionAllocatedAfterRemoval);
+    // Deletes the removed directories that no manager refers to any more. Returns how many were deleted.
+    unsigned int collectGarbage();
+
+private:
+    TiledVideoManagerCache() = default;
+
+    struct LoadedManager {
+        unsigned long generation;
+        std::weak_ptr<const TiledVideoManager> manager;
+    };
+
+    struct PendingDeletion {
+        std::string key;
+        // Managers loaded before this generation may refer to the directories.
+        unsigned long generation;
+        unsigned int versionAllocatedAfterRemoval;
+        std::vector<std::experimental::filesystem::path> directories;
+    };
+
+    bool isReferencedBeforeGeneration(const std::string &key, unsigned long generation);
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const TiledVideoManager>> pathToManager_;
+    // Bumped by invalidate() so that a manager loaded concurrently with a change isn't cached.
+    std::unordered_map<std::string, unsigned long> pathToGeneration_;
+    std::unordered_map<std::string, std::vector<LoadedManager>> pathToLoadedManagers_;
+    std::unordered_map<std::string, std::multiset<unsigned long>> pathToGenerationsBeingLoaded_;
+    std::vector<PendingDeletion> pendingDeletions_;
+};
+
 } // namespace tasm
 
 #endif //TASM_TILEDVIDEOMANAGER_H
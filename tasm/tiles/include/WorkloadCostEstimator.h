@@ -1,10 +1,15 @@
 #ifndef TASM_WORKLOADCOSTESTIMATOR_H
 #define TASM_WORKLOADCOSTESTIMATOR_H
 
+#include "ThreadPool.h"
 #include "TileConfigurationProvider.h"
+#include <list>
+#include <mutex>
+#include <unordered_set>
 
 namespace tasm {
 class SemanticDataManager;
+class StoredTileSizes;
 
 class Workload {
 public:
@@ -36,52 +41,96 @@ private:
 };
 
 struct CostElements {
-    CostElements(unsigned long long numPixels, unsigned long long numTiles):
+    CostElements(unsigned long long numPixels, unsigned long long numTiles, unsigned long long numBytes = 0):
             numPixels(numPixels),
-            numTiles(numTiles) {}
+            numTiles(numTiles),
+            numBytes(numBytes) {}
 
     void add(const CostElements &other) {
         numPixels += other.numPixels;
         numTiles += other.numTiles;
+        numBytes += other.numBytes;
     }
 
     unsigned long long numPixels;
     unsigned long long numTiles;
+    // Compressed bytes that have to be read and decoded. Only set when the estimator has the stored tile sizes.
+    unsigned long long numBytes;
 };
 
 std::ostream &operator<<(std::ostream &ostr, const CostElements &c);
 
 class WorkloadCostEstimator {
 public:
+    // When a thread pool is specified, GOPs are costed concurrently. Results are identical to the sequential mode.
+    // When the stored tile sizes are specified, costs also include bytes. GOPs that are stored with the layout being
+    // costed use the actual sizes of the samples that would be read; other layouts are estimated from their pixels
+    // and the stored bytes per pixel of each frame.
     WorkloadCostEstimator(std::shared_ptr<TileLayoutProvider> tileLayoutProvider,
             std::shared_ptr<Workload> workload,
-            unsigned int gopLength)
+            unsigned int gopLength,
+            std::shared_ptr<ThreadPool> threadPool = nullptr,
+            std::shared_ptr<StoredTileSizes> storedTileSizes = nullptr)
             : tileLayoutProvider_(tileLayoutProvider),
             workload_(workload),
             gopLength_(gopLength),
-            totalNumberOfPixels_(0),
-            totalNumberOfTiles_(0) {}
+            threadPool_(threadPool),
+            storedTileSizes_(storedTileSizes) {}
 
-    CostElements estimateCostForQuery(unsigned int queryNum, std::unordered_map<unsigned int, CostElements> *costByGOP = nullptr);
+    // If gopsToEstimate is specified, frames in any other GOP are skipped without being costed.
+    CostElements estimateCostForQuery(unsigned int queryNum,
+            std::unordered_map<unsigned int, CostElements> *costByGOP = nullptr,
+            const std::unordered_set<unsigned int> *gopsToEstimate = nullptr);
     CostElements estimateCostForWorkload();
 
     unsigned int gopForFrame(unsigned int frameNum) const {
         return frameNum / gopLength_;
     }
+
+    // For each tile of the layout, the number of frames from the keyframe that have to be decoded to reach the last
+    // of the frames with a rectangle overlapping the tile. Frames must be sorted and in the GOP starting at keyframe.
+    static std::vector<unsigned int> framesDecodedForTiles(const TileLayout &layout,
+            unsigned int keyframe,
+            const std::vector<int> &frames,
+            const std::vector<const std::list<Rectangle> *> &rectanglesForFrames);
 private:
+    // Everything needed to cost a GOP. The frames are split into GOPs on the calling thread, and the rest is gathered
+    // by the batch that costs the GOP.
+    struct FramesInGOP {
+        unsigned int gop;
+        std::shared_ptr<SemanticDataManager> metadataManager;
+        std::vector<int> frames;
+        std::shared_ptr<TileLayout> layout;
+        std::vector<const std::list<Rectangle> *> rectanglesForFrames;
+        // Indexed by frames since the keyframe. Set when the GOP is stored with this layout.
+        std::vector<std::vector<unsigned long long>> cumulativeBytesForTiles;
+        // Indexed by frames since the keyframe. Set when the GOP is stored with a different layout.
+        std::vector<double> cumulativeBytesPerPixel;
+    };
+
     unsigned int keyframeForFrame(unsigned int frameNum) const {
         return gopForFrame(frameNum) * gopLength_;
     }
 
-    std::pair<int, CostElements> estimateCostForNextGOP(std::vector<int>::const_iterator &start,
-                                                        std::vector<int>::const_iterator end,
-                                                        std::shared_ptr<SemanticDataManager> metadataManager);
+    void skipToNextGOP(std::vector<int>::const_iterator &start, std::vector<int>::const_iterator end) const;
+    void framesForQueryByGOP(unsigned int queryNum,
+            const std::unordered_set<unsigned int> *gopsToEstimate,
+            std::vector<FramesInGOP> &framesByGOP);
+    FramesInGOP framesInNextGOP(std::vector<int>::const_iterator &start,
+                                std::vector<int>::const_iterator end,
+                                std::shared_ptr<SemanticDataManager> metadataManager);
+
+    // Thread-safe. Lookups in the layout provider and semantic data manager are serialized.
+    void gatherGOP(FramesInGOP &framesInGOP);
+    std::vector<CostElements> estimateCostForGOPs(std::vector<FramesInGOP> &framesByGOP);
+    CostElements estimateCostForGOP(const FramesInGOP &framesInGOP) const;
 
     std::shared_ptr<TileLayoutProvider> tileLayoutProvider_;
     std::shared_ptr<Workload> workload_;
     unsigned int gopLength_;
-    unsigned int totalNumberOfPixels_;
-    unsigned int totalNumberOfTiles_;
+    std::shared_ptr<ThreadPool> threadPool_;
+    std::shared_ptr<StoredTileSizes> storedTileSizes_;
+    std::mutex gatherMutex_;
 };
 
 } // namespace tasm
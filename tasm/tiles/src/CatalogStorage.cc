@@ -0,0 +1,346 @@
+#include "CatalogStorage.h"
+
+#include "FileLock.h"
+#include "Files.h"
+#include "Gpac.h"
+#include "TileManifest.h"
+#include "TileManifest.pb.h"
+#include "TilePack.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace tasm {
+
+static std::recursive_mutex MountMutex;
+static std::vector<std::pair<std::experimental::filesystem::path, std::shared_ptr<CatalogStorage>>> &mounts() {
+    static std::vector<std::pair<std::experimental::filesystem::path, std::shared_ptr<CatalogStorage>>> mounts;
+    return mounts;
+}
+
+static bool isAncestorOf(const std::experimental::filesystem::path &root, const std::experimental::filesystem::path &path) {
+    auto pathIt = path.begin();
+    for (auto rootIt = root.begin(); rootIt != root.end(); ++rootIt, ++pathIt) {
+        // A trailing separator shows up as an empty element.
+        if (rootIt->empty() && std::next(rootIt) == root.end())
+            return true;
+        if (pathIt == path.end() || *rootIt != *pathIt)
+            return false;
+    }
+    return true;
+}
+
+std::shared_ptr<CatalogStorage> CatalogStorage::forPath(const std::experimental::filesystem::path &path) {
+    static auto filesystem = std::make_shared<FilesystemCatalogStorage>();
+
+    std::scoped_lock lock(MountMutex);
+    for (const auto &rootAndStorage : mounts()) {
+        if (isAncestorOf(rootAndStorage.first, path))
+            return rootAndStorage.second;
+    }
+    return filesystem;
+}
+
+void CatalogStorage::mount(const std::experimental::filesystem::path &root, std::shared_ptr<CatalogStorage> storage) {
+    std::scoped_lock lock(MountMutex);
+    unmount(root);
+    mounts().emplace_back(root, storage);
+}
+
+void CatalogStorage::unmount(const std::experimental::filesystem::path &root) {
+    std::scoped_lock lock(MountMutex);
+    auto &rootsAndStorages = mounts();
+    rootsAndStorages.erase(std::remove_if(rootsAndStorages.begin(), rootsAndStorages.end(), [&](const auto &rootAndStorage) {
+        return rootAndStorage.first == root;
+    }), rootsAndStorages.end());
+}
+
+void FilesystemCatalogStorage::createCatalog(const std::experimental::filesystem::path &catalogPath) {
+    if (!std::experimental::filesystem::exists(catalogPath))
+        std::experimental::filesystem::create_directory(catalogPath);
+}
+
+void FilesystemCatalogStorage::createVideo(const std::experimental::filesystem::path &videoPath) {
+    if (!std::experimental::filesystem::exists(videoPath))
+        std::experimental::filesystem::create_directory(videoPath);
+}
+
+void FilesystemCatalogStorage::deleteVideo(const std::experimental::filesystem::path &videoPath) {
+    std::experimental::filesystem::remove_all(videoPath);
+}
+
+unsigned int FilesystemCatalogStorage::tileVersion(const std::experimental::filesystem::path &videoPath) const {
+    auto versionPath = TileFiles::tileVersionFilename(videoPath);
+    if (!std::experimental::filesystem::exists(versionPath))
+        return 0u;
+
+    std::ifstream f(versionPath);
+    return static_cast<unsigned int>(stoul(std::string(std::istreambuf_iterator<char>(f),
+                                                       std::istreambuf_iterator<char>())));
+}
+
+unsigned int FilesystemCatalogStorage::allocateTileVersion(const std::experimental::filesystem::path &videoPath) {
+    FileLock lock(TileFiles::catalogLockFilename(videoPath));
+    auto version = tileVersion(videoPath);
+
+    // Replace the file so that a reader never sees it partially written.
+    auto versionPath = TileFiles::tileVersionFilename(videoPath);
+    auto temporaryPath = versionPath;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::trunc);
+        output << version + 1;
+        if (!output)
+            throw std::runtime_error("Failed to write " + temporaryPath.string());
+    }
+    std::experimental::filesystem::rename(temporaryPath, versionPath);
+    return version;
+}
+
+std::vector<lightdb::serialization::TileDirectory> FilesystemCatalogStorage::listTileDirectories(const std::experimental::filesystem::path &videoPath,
+                                                                                           std::shared_ptr<void> *pin) const {
+    // The pin is taken before the catalog is read. Compaction removes directories from the manifest before it
+    // allocates a version, so a listing that saw them is pinned with an earlier version.
+    if (pin)
+        *pin = FileLock::lockLinkedFile(TileFiles::snapshotPinFilename(videoPath, tileVersion(videoPath)), FileLock::Mode::Shared);
+
+    // Read the directories from the manifest, or describe each one if the video doesn't have a manifest yet.
+    TileManifest manifest(videoPath);
+    if (manifest.exists())
+        return manifest.load();
+
+    std::vector<lightdb::serialization::TileDirectory> directories;
+    for (auto &dir : std::experimental::filesystem::directory_iterator(videoPath)) {
+        if (!std::experimental::filesystem::is_directory(dir.status()))
+            continue;
+
+        // Tiles that are still being written aren't visible until their directory is renamed.
+        if (TileFiles::isStagingDirectory(dir.path()))
+            continue;
+
+        directories.push_back(TileManifest::describeDirectory(dir.path()));
+    }
+    std::sort(directories.begin(), directories.end(), [](const auto &left, const auto &right) {
+        return left.version() < right.version();
+    });
+    return directories;
+}
+
+std::string FilesystemCatalogStorage::catalogRevision(const std::experimental::filesystem::path &videoPath) const {
+    // Videos without a manifest get one with their next commit, so the catalog can't change without it changing.
+    return TileManifest(videoPath).revision();
+}
+
+bool FilesystemCatalogStorage::hasPinnedListingsBefore(const std::experimental::filesystem::path &videoPath, unsigned int version) const {
+    // Nothing is pinned once the video has been deleted.
+    std::error_code error;
+    std::experimental::filesystem::directory_iterator files(videoPath, error);
+    if (error)
+        return false;
+
+    bool isPinned = false;
+    for (auto &file : files) {
+        if (!TileFiles::isSnapshotPinFilename(file.path()) || TileFiles::tileVersionFromSnapshotPinFilename(file.path()) > version)
+            continue;
+
+        auto lock = FileLock::tryToLock(file.path());
+        if (!lock) {
+            isPinned = true;
+            continue;
+        }
+        // A listing that opens this pin from now on reads the catalog after version was allocated.
+        std::experimental::filesystem::remove(file.path());
+    }
+    return isPinned;
+}
+
+std::shared_ptr<const TilePack> FilesystemCatalogStorage::openTilePack(const std::experimental::filesystem::path &directoryPath) const {
+    return TilePack::openFile(TileFiles::tilePackFilename(directoryPath));
+}
+
+bool FilesystemCatalogStorage::containsStitchedTiles(const std::experimental::filesystem::path &directoryPath) const {
+    return TileFiles::containsStitchedTiles(directoryPath);
+}
+
+bool FilesystemCatalogStorage::shouldPackTiles(const std::experimental::filesystem::path &videoPath) const {
+    return TileFiles::shouldPackTiles(videoPath);
+}
+
+void FilesystemCatalogStorage::stageDirectory(const std::experimental::filesystem::path &stagingDirectory) {
+    std::error_code error;
+    if (!std::experimental::filesystem::create_directory(stagingDirectory, error))
+        std::cerr << "Failed to create tile directory: " << error.message() << std::endl;
+}
+
+void FilesystemCatalogStorage::writeTilePack(const std::experimental::filesystem::path &stagingDirectory, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate) {
+    tasm::writeTilePack(TileFiles::tilePackFilename(stagingDirectory), tiles, frameRate);
+}
+
+bool FilesystemCatalogStorage::publish(const std::experimental::filesystem::path &stagingDirectory,
+                                       const std::experimental::filesystem::path &directory,
+                                       const TileLayout &tileLayout,
+                                       bool tilesAreStitched,
+                                       const PublishCondition &canPublish) {
+    gpac::write_tile_configuration(TileFiles::tileMetadataFilename(stagingDirectory), tileLayout);
+    if (tilesAreStitched)
+        std::ofstream marker(TileFiles::stitchedTilesMarkerFilename(stagingDirectory));
+
+    // Readers only see the tiles once the directory is renamed, so they never observe a partially written GOP.
+    std::error_code error;
+    std::experimental::filesystem::rename(stagingDirectory, directory, error);
+    if (error)
+        throw std::runtime_error("Failed to publish tile directory " + directory.string() + ": " + error.message());
+
+    // The directory is part of the catalog once it is in the manifest. If this is interrupted, the directory is
+    // left unreferenced rather than being listed while incomplete.
+    if (TileManifest(directory.parent_path()).append(TileManifest::describeDirectory(directory), canPublish))
+        return true;
+
+    std::experimental::filesystem::remove_all(directory, error);
+    return false;
+}
+
+void FilesystemCatalogStorage::discard(const std::experimental::filesystem::path &stagingDirectory) {
+    std::experimental::filesystem::remove_all(stagingDirectory);
+}
+
+void FilesystemCatalogStorage::removeFromCatalog(const std::experimental::filesystem::path &videoPath,
+                                                 const std::vector<lightdb::serialization::TileDirectory> &directories) {
+    TileManifest manifest(videoPath);
+    for (const auto &directory : directories)
+        manifest.remove(directory);
+}
+
+void FilesystemCatalogStorage::deleteDirectory(const std::experimental::filesystem::path &directoryPath) {
+    std::experimental::filesystem::remove_all(directoryPath);
+}
+
+unsigned int InMemoryCatalogStorage::tileVersion(const std::experimental::filesystem::path &videoPath) const {
+    std::scoped_lock lock(mutex_);
+    auto version = videoToTileVersion_.find(videoPath.string());
+    return version == videoToTileVersion_.end() ? 0u : version->second;
+}
+
+unsigned int InMemoryCatalogStorage::allocateTileVersion(const std::experimental::filesystem::path &videoPath) {
+    std::scoped_lock lock(mutex_);
+    return videoToTileVersion_[videoPath.string()]++;
+}
+
+std::vector<lightdb::serialization::TileDirectory> InMemoryCatalogStorage::listTileDirectories(const std::experimental::filesystem::path &videoPath,
+                                                                                         std::shared_ptr<void> *pin) const {
+    std::scoped_lock lock(mutex_);
+    return listTileDirectoriesWhileLocked(videoPath);
+}
+
+std::string InMemoryCatalogStorage::catalogRevision(const std::experimental::filesystem::path &videoPath) const {
+    std::scoped_lock lock(mutex_);
+    auto revision = videoToRevision_.find(videoPath.string());
+    return std::to_string(revision == videoToRevision_.end() ? 0 : revision->second);
+}
+
+std::vector<lightdb::serialization::TileDirectory> InMemoryCatalogStorage::listTileDirectoriesWhileLocked(const std::experimental::filesystem::path &videoPath) const {
+    std::vector<lightdb::serialization::TileDirectory> directories;
+    auto publishedDirectories = videoToDirectories_.find(videoPath.string());
+    if (publishedDirectories == videoToDirectories_.end())
+        return directories;
+
+    for (const auto &directory : publishedDirectories->second)
+        directories.push_back(TileManifest::describeDirectory(directory.path, directory.tileLayout, directory.tileSizes));
+    // Concurrent transactions can publish out of version order.
+    std::sort(directories.begin(), directories.end(), [](const auto &left, const auto &right) {
+        return left.version() < right.version();
+    });
+    return directories;
+}
+
+std::shared_ptr<const TilePack> InMemoryCatalogStorage::openTilePack(const std::experimental::filesystem::path &directoryPath) const {
+    std::scoped_lock lock(mutex_);
+    auto pack = directoryToPack_.find(directoryPath.string());
+    return pack == directoryToPack_.end() ? nullptr : pack->second;
+}
+
+bool InMemoryCatalogStorage::containsStitchedTiles(const std::experimental::filesystem::path &directoryPath) const {
+    std::scoped_lock lock(mutex_);
+    return stitchedDirectories_.count(directoryPath.string());
+}
+
+void InMemoryCatalogStorage::writeTilePack(const std::experimental::filesystem::path &stagingDirectory, const std::vector<const PackedTileBuffer*> &tiles, unsigned int frameRate) {
+    std::ostringstream output;
+    tasm::writeTilePack(output, tiles, frameRate);
+    auto pack = TilePack::fromContents(TileFiles::tilePackFilename(stagingDirectory), output.str());
+
+    std::scoped_lock lock(mutex_);
+    directoryToPack_[stagingDirectory.string()] = pack;
+}
+
+bool InMemoryCatalogStorage::publish(const std::experimental::filesystem::path &stagingDirectory,
+                                     const std::experimental::filesystem::path &directory,
+                                     const TileLayout &tileLayout,
+                                     bool tilesAreStitched,
+                                     const PublishCondition &canPublish) {
+    std::scoped_lock lock(mutex_);
+    auto stagedPack = directoryToPack_.find(stagingDirectory.string());
+    if (stagedPack == directoryToPack_.end())
+        throw std::runtime_error("Failed to publish tile directory " + directory.string() + ": nothing was staged");
+
+    if (canPublish && !canPublish(listTileDirectoriesWhileLocked(directory.parent_path()))) {
+        directoryToPack_.erase(stagedPack);
+        return false;
+    }
+
+    std::vector<unsigned long long> tileSizes;
+    for (auto tile = 0u; tile < tileLayout.numberOfTiles(); ++tile)
+        tileSizes.push_back(stagedPack->second->containsTile(tile) ? stagedPack->second->tileSize(tile) : 0);
+
+    // Everything changes under one lock, so readers see all of the directory or none of it.
+    directoryToPack_[directory.string()] = stagedPack->second;
+    directoryToPack_.erase(stagedPack);
+    if (tilesAreStitched)
+        stitchedDirectories_.insert(directory.string());
+    videoToDirectories_[directory.parent_path().string()].push_back({directory, tileLayout, std::move(tileSizes)});
+    ++videoToRevision_[directory.parent_path().string()];
+    return true;
+}
+
+void InMemoryCatalogStorage::discard(const std::experimental::filesystem::path &stagingDirectory) {
+    std::scoped_lock lock(mutex_);
+    directoryToPack_.erase(stagingDirectory.string());
+}
+
+void InMemoryCatalogStorage::deleteVideo(const std::experimental::filesystem::path &videoPath) {
+    std::scoped_lock lock(mutex_);
+    auto key = videoPath.string();
+    auto publishedDirectories = videoToDirectories_.find(key);
+    if (publishedDirectories != videoToDirectories_.end()) {
+        for (const auto &directory : publishedDirectories->second) {
+            directoryToPack_.erase(directory.path.string());
+            stitchedDirectories_.erase(directory.path.string());
+        }
+        videoToDirectories_.erase(publishedDirectories);
+    }
+    videoToTileVersion_.erase(key);
+    // The revision keeps counting, so a manager of the deleted video never looks current.
+    ++videoToRevision_[key];
+}
+
+void InMemoryCatalogStorage::removeFromCatalog(const std::experimental::filesystem::path &videoPath,
+                                               const std::vector<lightdb::serialization::TileDirectory> &directories) {
+    std::scoped_lock lock(mutex_);
+    auto &publishedDirectories = videoToDirectories_[videoPath.string()];
+    publishedDirectories.erase(std::remove_if(publishedDirectories.begin(), publishedDirectories.end(), [&](const auto &published) {
+        auto version = TileFiles::tileVersionFromPath(published.path);
+        return std::any_of(directories.begin(), directories.end(), [&](const auto &directory) {
+            return directory.version() == version;
+        });
+    }), publishedDirectories.end());
+    ++videoToRevision_[videoPath.string()];
+}
+
+void InMemoryCatalogStorage::deleteDirectory(const std::experimental::filesystem::path &directoryPath) {
+    std::scoped_lock lock(mutex_);
+    directoryToPack_.erase(directoryPath.string());
+    stitchedDirectories_.erase(directoryPath.string());
+}
+
+} // namespace tasm
@@ -0,0 +1,258 @@
+#include "OnlineCostModel.h"
+
+#include "CatalogStorage.h"
+#include "CostModel.pb.h"
+#include "FileLock.h"
+#include "Files.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+namespace tasm {
+
+static const unsigned int CostModelVersion = 1;
+static const double PixelsPerMegapixel = 1e6;
+static const double InitialUncertainty = 1.0;
+static const double ForgettingFactor = 0.98;
+
+RecursiveLeastSquares::RecursiveLeastSquares(std::vector<double> initialWeights, double initialUncertainty, double forgettingFactor)
+    : numberOfFeatures_(initialWeights.size()),
+    weights_(std::move(initialWeights)),
+    covariance_(numberOfFeatures_ * numberOfFeatures_, 0),
+    forgettingFactor_(forgettingFactor),
+    maxCovarianceTrace_(numberOfFeatures_ * initialUncertainty),
+    numberOfObservations_(0)
+{
+    for (auto i = 0u; i < numberOfFeatures_; ++i)
+        covariance_[i * numberOfFeatures_ + i] = initialUncertainty;
+}
+
+void RecursiveLeastSquares::addObservation(const std::vector<double> &features, double target) {
+    assert(features.size() == numberOfFeatures_);
+    auto n = numberOfFeatures_;
+
+    std::vector<double> covarianceTimesFeatures(n, 0);
+    for (auto i = 0u; i < n; ++i)
+        for (auto j = 0u; j < n; ++j)
+            covarianceTimesFeatures[i] += covariance_[i * n + j] * features[j];
+
+    double denominator = forgettingFactor_;
+    double prediction = 0;
+    for (auto i = 0u; i < n; ++i) {
+        denominator += features[i] * covarianceTimesFeatures[i];
+        prediction += weights_[i] * features[i];
+    }
+
+    auto error = target - prediction;
+    for (auto i = 0u; i < n; ++i)
+        weights_[i] += covarianceTimesFeatures[i] / denominator * error;
+
+    double trace = 0;
+    for (auto i = 0u; i < n; ++i) {
+        for (auto j = 0u; j < n; ++j) {
+            auto &entry = covariance_[i * n + j];
+            entry = (entry - covarianceTimesFeatures[i] * covarianceTimesFeatures[j] / denominator) / forgettingFactor_;
+        }
+        trace += covariance_[i * n + i];
+    }
+
+    // Without new information in some direction, forgetting grows the covariance without bound.
+    if (trace > maxCovarianceTrace_) {
+        auto scale = maxCovarianceTrace_ / trace;
+        std::transform(covariance_.begin(), covariance_.end(), covariance_.begin(), [&](double v) { return v * scale; });
+    }
+
+    ++numberOfObservations_;
+}
+
+void RecursiveLeastSquares::serialize(lightdb::serialization::LinearModel &model) const {
+    model.mutable_weights()->Add(weights_.begin(), weights_.end());
+    model.mutable_covariance()->Add(covariance_.begin(), covariance_.end());
+    model.set_numberofobservations(numberOfObservations_);
+}
+
+bool RecursiveLeastSquares::restore(const lightdb::serialization::LinearModel &model) {
+    if (static_cast<unsigned int>(model.weights_size()) != numberOfFeatures_
+            || static_cast<unsigned int>(model.covariance_size()) != numberOfFeatures_ * numberOfFeatures_)
+        return false;
+
+    weights_.assign(model.weights().begin(), model.weights().end());
+    covariance_.assign(model.covariance().begin(), model.covariance().end());
+    numberOfObservations_ = model.numberofobservations();
+    return true;
+}
+
+OnlineCostModel &OnlineCostModel::forCatalog(const std::experimental::filesystem::path &catalogPath) {
+    static std::mutex catalogToModelMutex;
+    static std::unordered_map<std::string, std::unique_ptr<OnlineCostModel>> catalogToModel;
+
+    std::scoped_lock lock(catalogToModelMutex);
+    auto &model = catalogToModel[std::experimental::filesystem::absolute(catalogPath).string()];
+    if (!model) {
+        auto isPersistent = CatalogStorage::forPath(catalogPath)->isPersistent();
+        model.reset(new OnlineCostModel(isPersistent ? TileFiles::costModelFilename(catalogPath) : std::experimental::filesystem::path()));
+    }
+    return *model;
+}
+
+OnlineCostModel::OnlineCostModel(const std::experimental::filesystem::path &path)
+    : path_(path),
+    // Priors are the weights that were fit offline.
+    decodeModel_({1.608, 1.703e-01}, InitialUncertainty, ForgettingFactor),
+    encodeModel_({3.206, 2.592}, InitialUncertainty, ForgettingFactor)
+{
+    load();
+}
+
+double OnlineCostModel::decodeSecondsPerPixel() const {
+    std::scoped_lock lock(mutex_);
+    return std::max(0.0, decodeModel_.weights()[0]) / PixelsPerMegapixel;
+}
+
+double OnlineCostModel::decodeSecondsPerTile() const {
+    std::scoped_lock lock(mutex_);
+    return std::max(0.0, decodeModel_.weights()[1]);
+}
+
+double OnlineCostModel::encodeSecondsPerPixel() const {
+    std::scoped_lock lock(mutex_);
+    return std::max(0.0, encodeModel_.weights()[0]) / PixelsPerMegapixel;
+}
+
+double OnlineCostModel::encodeSecondsPerGOP() const {
+    std::scoped_lock lock(mutex_);
+    return std::max(0.0, encodeModel_.weights()[1]);
+}
+
+void OnlineCostModel::addDecodeObservation(unsigned long long pixels, unsigned long long tiles, double seconds) {
+    if (!pixels || !tiles || seconds <= 0)
+        return;
+
+    std::scoped_lock lock(mutex_);
+    std::vector<double> features{pixels / PixelsPerMegapixel, static_cast<double>(tiles)};
+    decodeModel_.addObservation(features, seconds);
+    if (!path_.empty())
+        unsavedDecodeObservations_.emplace_back(std::move(features), seconds);
+    saveIfDue();
+}
+
+void OnlineCostModel::addEncodeObservation(unsigned long long pixels, unsigned int numberOfGOPs, double seconds) {
+    if (!pixels || !numberOfGOPs || seconds <= 0)
+        return;
+
+    std::scoped_lock lock(mutex_);
+    std::vector<double> features{pixels / PixelsPerMegapixel, static_cast<double>(numberOfGOPs)};
+    encodeModel_.addObservation(features, seconds);
+    if (!path_.empty())
+        unsavedEncodeObservations_.emplace_back(std::move(features), seconds);
+    saveIfDue();
+}
+
+OnlineCostModel::~OnlineCostModel() {
+    std::scoped_lock lock(mutex_);
+    if (unsavedDecodeObservations_.empty() && unsavedEncodeObservations_.empty())
+        return;
+
+    try {
+        lastSave_.reset();
+        saveIfDue();
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to save cost model to " << path_ << ": " << e.what() << std::endl;
+    }
+}
+
+bool OnlineCostModel::readSavedModel(lightdb::serialization::CostModel &model) const {
+    if (!std::experimental::filesystem::exists(path_))
+        return false;
+
+    std::ifstream input(path_, std::ios::binary);
+    if (!model.ParseFromIstream(&input) || model.version() != CostModelVersion) {
+        std::cerr << "Ignoring unreadable cost model " << path_ << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void OnlineCostModel::load() {
+    lightdb::serialization::CostModel model;
+    if (path_.empty() || !readSavedModel(model))
+        return;
+
+    if (!decodeModel_.restore(model.decode()) || !encodeModel_.restore(model.encode()))
+        std::cerr << "Ignoring cost model with unexpected features " << path_ << std::endl;
+}
+
+void OnlineCostModel::saveIfDue() {
+    if (path_.empty())
+        return;
+
+    auto now = Clock::now();
+    if (lastSave_ && std::chrono::duration<double>(now - *lastSave_).count() < SaveIntervalSeconds)
+        return;
+
+    // Nothing is saved until the catalog exists, and there is nothing to merge the observations with until then.
+    auto catalogPath = path_.parent_path();
+    if (!std::experimental::filesystem::exists(catalogPath)) {
+        unsavedDecodeObservations_.clear();
+        unsavedEncodeObservations_.clear();
+        return;
+    }
+
+    FileLock lock(TileFiles::catalogLockFilename(catalogPath));
+    save();
+    lastSave_ = now;
+}
+
+static void replayObservations(const std::vector<std::pair<std::vector<double>, double>> &observations, RecursiveLeastSquares &model) {
+    for (const auto &observation : observations)
+        model.addObservation(observation.first, observation.second);
+}
+
+void OnlineCostModel::save() {
+    // The current models already include the unsaved observations, so they are only replayed onto a saved model.
+    lightdb::serialization::CostModel saved;
+    if (readSavedModel(saved)) {
+        auto decodeModel = decodeModel_;
+        auto encodeModel = encodeModel_;
+        if (decodeModel.restore(saved.decode()) && encodeModel.restore(saved.encode())) {
+            replayObservations(unsavedDecodeObservations_, decodeModel);
+            replayObservations(unsavedEncodeObservations_, encodeModel);
+            decodeModel_ = std::move(decodeModel);
+            encodeModel_ = std::move(encodeModel);
+        }
+    }
+    unsavedDecodeObservations_.clear();
+    unsavedEncodeObservations_.clear();
+
+    lightdb::serialization::CostModel model;
+    model.set_version(CostModelVersion);
+    decodeModel_.serialize(*model.mutable_decode());
+    encodeModel_.serialize(*model.mutable_encode());
+
+    // Each save writes its own temporary file, so it can't be renamed into place half-written by another saver.
+    static std::atomic<unsigned long> numberOfSaves(0);
+    auto temporaryPath = path_;
+    temporaryPath += "." + std::to_string(getpid()) + "." + std::to_string(numberOfSaves++) + ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!model.SerializeToOstream(&output)) {
+            std::cerr << "Failed to save cost model to " << temporaryPath << std::endl;
+            output.close();
+            std::error_code error;
+            std::experimental::filesystem::remove(temporaryPath, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::experimental::filesystem::rename(temporaryPath, path_, error);
+    if (error) {
+        std::cerr << "Failed to save cost model to " << path_ << ": " << error.message() << std::endl;
+        std::experimental::filesystem::remove(temporaryPath, error);
+    }
+}
+
+} // namespace tasm
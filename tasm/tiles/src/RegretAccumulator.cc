@@ -1,10 +1,17 @@
 #include "RegretAccumulator.h"
 
+#include "RegretState.pb.h"
+#include "RegretStateStore.h"
 #include "SemanticDataManager.h"
+#include "StoredTileSizes.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 namespace tasm {
 
+static const unsigned int RegretStateVersion = 1;
+
 static std::string combineStrings(const std::vector<std::string> &strings) {
     static const std::string connector = "_";
     std::string combined = "";
@@ -17,38 +24,160 @@ static std::string combineStrings(const std::vector<std::string> &strings) {
     return combined;
 }
 
- void RegretAccumulator::addRegretForQuery(std::shared_ptr<Workload> workload,
+RegretAccumulator::RegretAccumulator(std::shared_ptr<SemanticIndex> semanticIndex, const std::string &metadataIdentifier,
+                                     unsigned int width, unsigned int height, unsigned int gopLength, double threshold,
+                                     OnlineCostModel &onlineCostModel)
+    : semanticIndex_(semanticIndex), metadataIdentifier_(metadataIdentifier),
+    width_(width), height_(height), gopLength_(gopLength), threshold_(threshold),
+    gopSizeInPixels_(width_ * height_ * gopLength_),
+    regretDecay_(1.0),
+    historyLength_(DefaultHistoryLength),
+    queryIteration_(0),
+    noTilesConfiguration_(new SingleTileConfigurationProvider(width_, height_)),
+    threadPool_(ThreadPool::shared()),
+    costModel_(RegretCostModel::Pixels),
+    onlineCostModel_(onlineCostModel)
+{ }
+
+RegretAccumulator::~RegretAccumulator() = default;
+
+void RegretAccumulator::addRegretForQuery(std::shared_ptr<Workload> workload,
                                           std::shared_ptr<TileLayoutProvider> currentLayout) {
+    std::scoped_lock lock(mutex_);
     ++queryIteration_;
     auto &queryObjects = workload->semanticDataManagerForQuery(0)->labelsInQuery();
+    currentLayout_ = currentLayout;
+
+    if (costModel_ == RegretCostModel::Bytes) {
+        auto currentLocations = std::dynamic_pointer_cast<TileLocationProvider>(currentLayout);
+        if (currentLocations)
+            storedTileSizes_ = std::make_shared<StoredTileSizes>(currentLocations);
+    }
+
+    if (regretDecay_ < 1.0) {
+        decayRegret(regretDecay_);
+        if (pendingUpdate_)
+            pendingUpdate_->set_regretdecay(regretDecay_);
+    }
 
     addRegretForHistoricalQueries(queryObjects);
 
     // Generate baseline costs based on the current layout.
-    WorkloadCostEstimator baselineCostEstimator(currentLayout, workload, gopLength_);
+    WorkloadCostEstimator baselineCostEstimator(currentLayout, workload, gopLength_, threadPool_, storedTileSizes_);
     auto baselineCosts = std::make_shared<std::unordered_map<unsigned int, CostElements>>();
     baselineCostEstimator.estimateCostForQuery(0, baselineCosts.get());
 
-    addRegretForWorkload(queryIteration_, workload, baselineCosts, labels_);
+    // The untiled costs don't depend on the proposed layouts, so they only have to be computed once per query.
+    WorkloadCostEstimator noTilesLayoutEstimator(noTilesConfiguration_, workload, gopLength_, threadPool_, storedTileSizes_);
+    auto noTilesCosts = std::make_shared<std::unordered_map<unsigned int, CostElements>>();
+    noTilesLayoutEstimator.estimateCostForQuery(0, noTilesCosts.get());
+
+    addRegretForWorkload(queryIteration_, workload, baselineCosts, noTilesCosts, labels_);
 
     iterationToWorkload_[queryIteration_] = workload;
     iterationToBaselineCosts_[queryIteration_] = baselineCosts;
+    iterationToNoTilesCosts_[queryIteration_] = noTilesCosts;
+
+    recordQuery(queryIteration_, workload);
+    removeQueriesOutsideHistory();
+    flushPendingUpdate();
 }
 
-std::unique_ptr<std::unordered_map<unsigned int, std::shared_ptr<TileLayoutProvider>>> RegretAccumulator::getNewGOPLayouts() {
-    auto newGOPLayouts = std::make_unique<std::unordered_map<unsigned int, std::shared_ptr<TileLayoutProvider>>>();
+void RegretAccumulator::setCostModel(RegretCostModel costModel) {
+    std::scoped_lock lock(mutex_);
+    costModel_ = costModel;
+}
+
+void RegretAccumulator::setRegretDecay(double decay) {
+    std::scoped_lock lock(mutex_);
+    assert(decay > 0 && decay <= 1.0);
+    regretDecay_ = decay;
+}
+
+void RegretAccumulator::setHistoryLength(unsigned int historyLength) {
+    std::scoped_lock lock(mutex_);
+    historyLength_ = historyLength;
+    removeQueriesOutsideHistory();
+    flushPendingUpdate();
+}
+
+std::vector<RetilingCandidate> RegretAccumulator::retilingCandidates() {
+    std::scoped_lock lock(mutex_);
+    std::vector<RetilingCandidate> candidates;
     for (auto it = gopToRegret_.begin(); it != gopToRegret_.end(); ++it) {
         auto gop = it->first;
         std::string idForGOP;
-        if (shouldRetileGOP(gop, idForGOP)) {
-            newGOPLayouts->insert({gop, configurationProviderForIdentifier(idForGOP)});
-            resetRegretForGOP(gop);
-        }
+        double regret;
+        if (shouldRetileGOP(gop, idForGOP, regret))
+            candidates.push_back({gop, idForGOP, regret, estimateCostToRetileGOP(gop, idForGOP)});
+    }
+
+    // Ties are broken by GOP so the order doesn't depend on the hash map.
+    std::sort(candidates.begin(), candidates.end(), [](const RetilingCandidate &a, const RetilingCandidate &b) {
+        return a.priority() > b.priority() || (a.priority() == b.priority() && a.gop < b.gop);
+    });
+    return candidates;
+}
+
+std::unique_ptr<std::unordered_map<unsigned int, std::shared_ptr<TileLayoutProvider>>> RegretAccumulator::getNewGOPLayouts() {
+    std::scoped_lock lock(mutex_);
+    auto newGOPLayouts = newGOPLayoutsForCandidates(retilingCandidates());
+    std::vector<unsigned int> gops;
+    for (const auto &gopAndLayout : *newGOPLayouts)
+        gops.push_back(gopAndLayout.first);
+    markGOPsAsRetiled(gops);
+    return newGOPLayouts;
+}
+
+std::unique_ptr<std::unordered_map<unsigned int, std::shared_ptr<TileLayoutProvider>>> RegretAccumulator::newGOPLayoutsForCandidates(const std::vector<RetilingCandidate> &candidates) {
+    std::scoped_lock lock(mutex_);
+    auto newGOPLayouts = std::make_unique<std::unordered_map<unsigned int, std::shared_ptr<TileLayoutProvider>>>();
+    std::unordered_map<std::string, std::shared_ptr<TileLayoutProvider>> providersForIdentifiers;
+    for (const auto &candidate : candidates) {
+        std::cout << "Retile GOP " << candidate.gop << " to " << candidate.layoutIdentifier << std::endl;
+        if (!providersForIdentifiers.count(candidate.layoutIdentifier))
+            providersForIdentifiers[candidate.layoutIdentifier] = configurationProviderForIdentifier(candidate.layoutIdentifier);
+        newGOPLayouts->insert({candidate.gop, providersForIdentifiers.at(candidate.layoutIdentifier)});
     }
     return newGOPLayouts;
 }
 
-bool RegretAccumulator::shouldRetileGOP(unsigned int gop, std::string &layoutIdentifier) {
+void RegretAccumulator::markGOPsAsRetiled(const std::vector<unsigned int> &gops) {
+    std::scoped_lock lock(mutex_);
+    for (auto gop : gops)
+        resetRegretForGOP(gop);
+
+    // Drop queries that no longer touch any GOPs that can accumulate regret so they aren't revisited for new layouts.
+    if (!gops.empty())
+        removeHistoricalQueriesForRetiledGOPs();
+
+    flushPendingUpdate();
+}
+
+double RegretAccumulator::estimateCostToRetileGOP(unsigned int gop, const std::string &layoutIdentifier) {
+    if (!currentLayout_)
+        return estimateCostToEncodeGOP(gopSizeInPixels_);
+
+    // Like TileOperator, a tile is copied if a stored tile covers exactly the same rectangle.
+    auto firstFrame = gop * gopLength_;
+    auto newLayout = idToConfig_.at(layoutIdentifier)->tileLayoutForFrame(firstFrame);
+    auto storedLayout = currentLayout_->tileLayoutForFrame(firstFrame);
+    long long int pixelsToEncode = 0;
+    for (auto tile = 0u; tile < newLayout->numberOfTiles(); ++tile) {
+        auto rectangle = newLayout->rectangleForTile(tile);
+        bool isStored = false;
+        for (auto storedTile = 0u; storedTile < storedLayout->numberOfTiles() && !isStored; ++storedTile) {
+            auto storedRectangle = storedLayout->rectangleForTile(storedTile);
+            isStored = storedRectangle.x == rectangle.x && storedRectangle.y == rectangle.y
+                    && storedRectangle.width == rectangle.width && storedRectangle.height == rectangle.height;
+        }
+        if (!isStored)
+            pixelsToEncode += static_cast<long long int>(rectangle.width) * rectangle.height * gopLength_;
+    }
+    return estimateCostToEncodeGOP(pixelsToEncode);
+}
+
+bool RegretAccumulator::shouldRetileGOP(unsigned int gop, std::string &layoutIdentifier, double &regret) {
     long long int maxRegret = 0;
     std::string labelWithMaxRegret;
 
@@ -59,9 +188,9 @@ bool RegretAccumulator::shouldRetileGOP(unsigned int gop, std::string &layoutIde
         }
     }
 
-    if (maxRegret > threshold_ * gopTilingCost_) {
+    if (maxRegret > threshold_ * estimateCostToEncodeGOP(gopSizeInPixels_)) {
         layoutIdentifier = labelWithMaxRegret;
-        std::cout << "Retile GOP " << gop << " to " << layoutIdentifier << std::endl;
+        regret = gopToRegret_[gop].at(labelWithMaxRegret);
         return true;
     } else
         return false;
@@ -72,10 +201,17 @@ void RegretAccumulator::resetRegretForGOP(unsigned int gop) {
         it->second = 0;
 
     gopToClearedIteration_[gop] = queryIteration_;
+
+    if (pendingUpdate_) {
+        auto cleared = pendingUpdate_->add_clearedgops();
+        cleared->set_gop(gop);
+        cleared->set_iteration(queryIteration_);
+    }
 }
 
 std::shared_ptr<TileLayoutProvider> RegretAccumulator::configurationProviderForIdentifier(const std::string &identifier) {
-    return idToConfig_.at(identifier);
+    // Layout providers cache lazily, so hand out a separate one that can be used while this one keeps estimating costs.
+    return tileLayoutForObjects(idToObjects_.at(identifier));
 }
 
 void RegretAccumulator::addRegretForHistoricalQueries(const std::vector<std::string> &objects) {
@@ -87,35 +223,67 @@ void RegretAccumulator::addRegretForHistoricalQueries(const std::vector<std::str
     singleObjects_.insert(objects.begin(), objects.end());
 
     // Add a layout for new objects and new combined objects.
-    labels_.push_back(combinedObjects);
-    idToConfig_[combinedObjects] = tileLayoutForObjects(objects);
+    addLayout(combinedObjects, objects);
     std::vector<std::string> newLayouts{combinedObjects};
 
     if (labels_.size() > 1) {
         std::vector<std::string> newAllObjects(singleObjects_.begin(), singleObjects_.end());
         auto newAllObjectsLabel = combineStrings(newAllObjects);
-        labels_.push_back(newAllObjectsLabel);
-        idToConfig_[newAllObjectsLabel] = tileLayoutForObjects(newAllObjects);
+        addLayout(newAllObjectsLabel, newAllObjects);
         newLayouts.push_back(newAllObjectsLabel);
     }
 
-    // Go through historical queries.
-    // If all GOPs affected by a query have been re-tiled, remove these costs from the dictionary.
-    for (auto i = 1u; i < queryIteration_; ++i) {
-        if (!iterationToWorkload_.count(i))
-            continue;
+    // Go through historical queries. Queries whose GOPs have all been re-tiled were already removed by getNewGOPLayouts().
+    // Each one counts as much as if the layouts had existed when it ran, so its regret is decayed once per later query.
+    for (auto it = iterationToWorkload_.begin(); it != iterationToWorkload_.end(); ++it) {
+        auto iteration = it->first;
+        auto weight = std::pow(regretDecay_, queryIteration_ - iteration);
+        addRegretForWorkload(iteration, it->second, iterationToBaselineCosts_.at(iteration), iterationToNoTilesCosts_.at(iteration), newLayouts, weight);
+    }
+}
 
-        if (!costsAreForGOPsThatHaveNotBeenRetiled(i, iterationToBaselineCosts_.at(i))) {
-            iterationToWorkload_.erase(i);
-            iterationToBaselineCosts_.erase(i);
-            continue;
-        }
+void RegretAccumulator::removeHistoricalQueriesForRetiledGOPs() {
+    std::vector<unsigned int> iterationsToRemove;
+    for (auto it = iterationToBaselineCosts_.begin(); it != iterationToBaselineCosts_.end(); ++it) {
+        if (gopsThatHaveNotBeenRetiled(it->first, *it->second).empty())
+            iterationsToRemove.push_back(it->first);
+    }
+
+    for (auto iteration : iterationsToRemove)
+        removeHistoricalQuery(iteration);
+}
+
+void RegretAccumulator::removeQueriesOutsideHistory() {
+    if (iterationToWorkload_.size() <= historyLength_)
+        return;
+
+    std::vector<unsigned int> iterations;
+    iterations.reserve(iterationToWorkload_.size());
+    for (auto it = iterationToWorkload_.begin(); it != iterationToWorkload_.end(); ++it)
+        iterations.push_back(it->first);
+    std::sort(iterations.begin(), iterations.end());
 
-        auto workload = iterationToWorkload_.at(i);
-        addRegretForWorkload(i, workload, iterationToBaselineCosts_.at(i), newLayouts);
+    auto numberToRemove = iterations.size() - historyLength_;
+    for (auto i = 0u; i < numberToRemove; ++i)
+        removeHistoricalQuery(iterations[i]);
+}
+
+void RegretAccumulator::decayRegret(double decay) {
+    for (auto gopIt = gopToRegret_.begin(); gopIt != gopToRegret_.end(); ++gopIt) {
+        for (auto it = gopIt->second.begin(); it != gopIt->second.end(); ++it)
+            it->second *= decay;
     }
 }
 
+void RegretAccumulator::removeHistoricalQuery(unsigned int iteration) {
+    iterationToWorkload_.erase(iteration);
+    iterationToBaselineCosts_.erase(iteration);
+    iterationToNoTilesCosts_.erase(iteration);
+
+    if (pendingUpdate_)
+        pendingUpdate_->add_removediterations(iteration);
+}
+
 std::shared_ptr<TileLayoutProvider> RegretAccumulator::tileLayoutForObjects(const std::vector<std::string> &objects) {
     auto metadataSelection = std::make_shared<OrMetadataSelection>(objects);
     auto semanticDataManager = std::make_shared<SemanticDataManager>(semanticIndex_, metadataIdentifier_, metadataSelection);
@@ -126,49 +294,58 @@ std::shared_ptr<TileLayoutProvider> RegretAccumulator::tileLayoutForObjects(cons
             height_);
 }
 
-bool RegretAccumulator::costsAreForGOPsThatHaveNotBeenRetiled(unsigned int iteration,
-                                                              std::shared_ptr<std::unordered_map<unsigned int, CostElements>> baselineCosts) {
-    for (auto it = baselineCosts->begin(); it != baselineCosts->end(); ++it) {
+std::unordered_set<unsigned int> RegretAccumulator::gopsThatHaveNotBeenRetiled(unsigned int iteration,
+                                                                               const std::unordered_map<unsigned int, CostElements> &baselineCosts) const {
+    std::unordered_set<unsigned int> gops;
+    for (auto it = baselineCosts.begin(); it != baselineCosts.end(); ++it) {
         auto gop = it->first;
-        // If a GOP hasn't been cleared, it's still relevant.
-        if (!gopToClearedIteration_.count(gop))
-            return true;
-
-        // If a GOP was cleared before this query, it's still relevant.
-        if (gopToClearedIteration_.at(gop) < iteration)
-            return true;
+        // If a GOP hasn't been cleared, or if it was cleared before this query, it's still relevant.
+        if (!gopToClearedIteration_.count(gop) || gopToClearedIteration_.at(gop) < iteration)
+            gops.insert(gop);
     }
-    return false;
+    return gops;
 }
 
 void RegretAccumulator::addRegretForWorkload(unsigned int iteration, std::shared_ptr<Workload> workload,
                                              std::shared_ptr<std::unordered_map<unsigned int, CostElements>> baselineCosts,
-                                             const std::vector<std::string> layouts) {
-    static const double pixelCostWeight = 1.608e-06;
-    static const double tileCostWeight = 1.703e-01;
+                                             std::shared_ptr<std::unordered_map<unsigned int, CostElements>> noTilesCosts,
+                                             const std::vector<std::string> &layouts,
+                                             double weight) {
+    auto pixelCostWeight = onlineCostModel_.decodeSecondsPerPixel();
+    auto tileCostWeight = onlineCostModel_.decodeSecondsPerTile();
+
+    // Only estimate costs for the GOPs that haven't been re-tiled since this query ran.
+    auto gopsToEstimate = gopsThatHaveNotBeenRetiled(iteration, *baselineCosts);
+    if (gopsToEstimate.empty())
+        return;
 
-    WorkloadCostEstimator noTilesLayoutEstimator(noTilesConfiguration_, workload, gopLength_);
-    auto noTilesCosts = std::make_unique<std::unordered_map<unsigned int, CostElements>>();
-    noTilesLayoutEstimator.estimateCostForQuery(0, noTilesCosts.get());
-    
     for (const auto &layoutId : layouts) {
-        WorkloadCostEstimator proposedLayoutEstimator(idToConfig_.at(layoutId), workload, gopLength_);
+        WorkloadCostEstimator proposedLayoutEstimator(idToConfig_.at(layoutId), workload, gopLength_, threadPool_, storedTileSizes_);
         auto proposedCosts = std::make_unique<std::unordered_map<unsigned int, CostElements>>();
-        proposedLayoutEstimator.estimateCostForQuery(0, proposedCosts.get());
-        
-        assert(baselineCosts->size() == proposedCosts->size());
-        
-        for (auto curIt = baselineCosts->begin(); curIt != baselineCosts->end(); ++curIt) {
-            auto gop = curIt->first;
-            if (gopToClearedIteration_.count(gop) && gopToClearedIteration_.at(gop) >= iteration)
-                continue;
-            
-            auto curCosts = curIt->second;
-            auto possibleCosts = proposedCosts->at(gop);
-            double regret = pixelCostWeight *
-                    (long long int)(curCosts.numPixels - possibleCosts.numPixels) +
-                    tileCostWeight * (int)(curCosts.numTiles - possibleCosts.numTiles);
-            if (possibleCosts.numPixels >= 0.8 * noTilesCosts->at(gop).numPixels)
+        proposedLayoutEstimator.estimateCostForQuery(0, proposedCosts.get(), &gopsToEstimate);
+
+        assert(gopsToEstimate.size() == proposedCosts->size());
+
+        for (auto gop : gopsToEstimate) {
+            auto &curCosts = baselineCosts->at(gop);
+            auto &possibleCosts = proposedCosts->at(gop);
+            auto &noTilesCostsForGOP = noTilesCosts->at(gop);
+
+            double pixelDifference;
+            bool isCloseToNoTiles;
+            if (costModel_ == RegretCostModel::Bytes && curCosts.numBytes && possibleCosts.numBytes && noTilesCostsForGOP.numBytes) {
+                // The weights were fit to pixels, so convert bytes using the bytes per pixel of decoding entire frames.
+                double pixelsPerByte = static_cast<double>(noTilesCostsForGOP.numPixels) / noTilesCostsForGOP.numBytes;
+                pixelDifference = pixelsPerByte * (static_cast<double>(curCosts.numBytes) - static_cast<double>(possibleCosts.numBytes));
+                isCloseToNoTiles = possibleCosts.numBytes >= 0.8 * noTilesCostsForGOP.numBytes;
+            } else {
+                pixelDifference = (long long int)(curCosts.numPixels - possibleCosts.numPixels);
+                isCloseToNoTiles = possibleCosts.numPixels >= 0.8 * noTilesCostsForGOP.numPixels;
+            }
+
+            double regret = weight * (pixelCostWeight * pixelDifference +
+                    tileCostWeight * (int)(curCosts.numTiles - possibleCosts.numTiles));
+            if (isCloseToNoTiles)
                 regret = std::numeric_limits<double>::lowest();
 
             addRegretToGOP(gop, regret, layoutId);
@@ -181,6 +358,196 @@ void RegretAccumulator::addRegretToGOP(unsigned int gop, double regret, const st
         gopToRegret_[gop][layoutIdentifier] = 0;
 
     gopToRegret_[gop][layoutIdentifier] += regret;
+
+    if (pendingUpdate_) {
+        auto added = pendingUpdate_->add_addedregret();
+        added->set_gop(gop);
+        added->set_layoutidentifier(layoutIdentifier);
+        added->set_regret(regret);
+    }
+}
+
+void RegretAccumulator::addLayout(const std::string &layoutIdentifier, const std::vector<std::string> &objects) {
+    labels_.push_back(layoutIdentifier);
+    idToConfig_[layoutIdentifier] = tileLayoutForObjects(objects);
+    idToObjects_[layoutIdentifier] = objects;
+
+    if (pendingUpdate_) {
+        auto layout = pendingUpdate_->add_newlayouts();
+        layout->set_identifier(layoutIdentifier);
+        layout->mutable_objects()->Add(objects.begin(), objects.end());
+    }
+}
+
+static void serializeCosts(const std::unordered_map<unsigned int, CostElements> &costs,
+                           google::protobuf::RepeatedPtrField<lightdb::serialization::GOPCost> *serialized) {
+    for (auto it = costs.begin(); it != costs.end(); ++it) {
+        auto cost = serialized->Add();
+        cost->set_gop(it->first);
+        cost->set_numpixels(it->second.numPixels);
+        cost->set_numtiles(it->second.numTiles);
+        cost->set_numbytes(it->second.numBytes);
+    }
+}
+
+static std::shared_ptr<std::unordered_map<unsigned int, CostElements>> deserializeCosts(
+        const google::protobuf::RepeatedPtrField<lightdb::serialization::GOPCost> &serialized) {
+    auto costs = std::make_shared<std::unordered_map<unsigned int, CostElements>>();
+    for (const auto &cost : serialized)
+        costs->emplace(cost.gop(), CostElements(cost.numpixels(), cost.numtiles(), cost.numbytes()));
+    return costs;
+}
+
+static void serializeQuery(unsigned int iteration,
+                           std::shared_ptr<Workload> workload,
+                           const std::unordered_map<unsigned int, CostElements> &baselineCosts,
+                           const std::unordered_map<unsigned int, CostElements> &noTilesCosts,
+                           lightdb::serialization::HistoricalQuery *query) {
+    auto semanticDataManager = workload->semanticDataManagerForQuery(0);
+    auto &objects = semanticDataManager->labelsInQuery();
+    auto &frames = semanticDataManager->orderedFrames();
+
+    query->set_iteration(iteration);
+    query->mutable_objects()->Add(objects.begin(), objects.end());
+    // The frames that contain the query's objects fully determine the frames the query touched.
+    query->set_firstframeinclusive(frames.empty() ? 0 : frames.front());
+    query->set_lastframeexclusive(frames.empty() ? 0 : frames.back() + 1);
+    query->set_maxwidth(semanticDataManager->maxWidth());
+    query->set_maxheight(semanticDataManager->maxHeight());
+    serializeCosts(baselineCosts, query->mutable_baselinecosts());
+    serializeCosts(noTilesCosts, query->mutable_notilescosts());
+}
+
+void RegretAccumulator::recordQuery(unsigned int iteration, std::shared_ptr<Workload> workload) {
+    if (!pendingUpdate_)
+        return;
+
+    serializeQuery(iteration, workload, *iterationToBaselineCosts_.at(iteration), *iterationToNoTilesCosts_.at(iteration),
+                   pendingUpdate_->mutable_query());
+}
+
+void RegretAccumulator::flushPendingUpdate() {
+    if (!stateStore_)
+        return;
+
+    stateStore_->append(*pendingUpdate_);
+    if (stateStore_->shouldCheckpoint())
+        stateStore_->checkpoint(*currentState());
+
+    pendingUpdate_ = std::make_unique<lightdb::serialization::RegretUpdate>();
+}
+
+void RegretAccumulator::persistTo(const std::experimental::filesystem::path &directory) {
+    std::scoped_lock lock(mutex_);
+    stateStore_ = std::make_unique<RegretStateStore>(directory);
+
+    lightdb::serialization::RegretState state;
+    std::vector<lightdb::serialization::RegretUpdate> updates;
+    if (stateStore_->load(state, updates)) {
+        if (state.has_version() && (state.version() != RegretStateVersion || state.width() != width_ || state.height() != height_ || state.goplength() != gopLength_)) {
+            std::cerr << "Discarding regret state for " << metadataIdentifier_ << " because the video has changed" << std::endl;
+        } else {
+            if (state.has_version())
+                restoreState(state);
+            for (const auto &update : updates)
+                applyUpdate(update);
+        }
+    }
+
+    // Start from a fresh checkpoint so the log only contains updates made by this process.
+    stateStore_->checkpoint(*currentState());
+    pendingUpdate_ = std::make_unique<lightdb::serialization::RegretUpdate>();
+}
+
+void RegretAccumulator::restoreState(const lightdb::serialization::RegretState &state) {
+    queryIteration_ = state.queryiteration();
+    for (const auto &layout : state.layouts())
+        addLayout(layout.identifier(), {layout.objects().begin(), layout.objects().end()});
+    allObjects_.insert(state.allobjects().begin(), state.allobjects().end());
+    singleObjects_.insert(state.singleobjects().begin(), state.singleobjects().end());
+    for (const auto &regret : state.regret())
+        gopToRegret_[regret.gop()][regret.layoutidentifier()] = regret.regret();
+    for (const auto &cleared : state.clearedgops())
+        gopToClearedIteration_[cleared.gop()] = cleared.iteration();
+    for (const auto &query : state.queries())
+        restoreQuery(query);
+}
+
+void RegretAccumulator::applyUpdate(const lightdb::serialization::RegretUpdate &update) {
+    // Replay the changes in the order they were originally made.
+    if (update.has_regretdecay())
+        decayRegret(update.regretdecay());
+    if (update.has_query()) {
+        std::vector<std::string> objects(update.query().objects().begin(), update.query().objects().end());
+        queryIteration_ = update.query().iteration();
+        allObjects_.insert(combineStrings(objects));
+        singleObjects_.insert(objects.begin(), objects.end());
+    }
+    for (const auto &layout : update.newlayouts())
+        addLayout(layout.identifier(), {layout.objects().begin(), layout.objects().end()});
+    for (const auto &regret : update.addedregret())
+        addRegretToGOP(regret.gop(), regret.regret(), regret.layoutidentifier());
+    if (update.has_query())
+        restoreQuery(update.query());
+    for (const auto &cleared : update.clearedgops()) {
+        for (auto it = gopToRegret_[cleared.gop()].begin(); it != gopToRegret_[cleared.gop()].end(); ++it)
+            it->second = 0;
+        gopToClearedIteration_[cleared.gop()] = cleared.iteration();
+    }
+    for (auto iteration : update.removediterations())
+        removeHistoricalQuery(iteration);
+}
+
+void RegretAccumulator::restoreQuery(const lightdb::serialization::HistoricalQuery &query) {
+    std::vector<std::string> objects(query.objects().begin(), query.objects().end());
+    std::shared_ptr<MetadataSelection> metadataSelection = objects.size() == 1
+            ? std::static_pointer_cast<MetadataSelection>(std::make_shared<SingleMetadataSelection>(objects.front()))
+            : std::static_pointer_cast<MetadataSelection>(std::make_shared<OrMetadataSelection>(objects));
+    auto temporalSelection = std::make_shared<RangeTemporalSelection>(query.firstframeinclusive(), query.lastframeexclusive());
+    auto semanticDataManager = std::make_shared<SemanticDataManager>(semanticIndex_, metadataIdentifier_, metadataSelection,
+                                                                     temporalSelection, query.maxwidth(), query.maxheight());
+
+    iterationToWorkload_[query.iteration()] = std::make_shared<Workload>(semanticDataManager);
+    iterationToBaselineCosts_[query.iteration()] = deserializeCosts(query.baselinecosts());
+    iterationToNoTilesCosts_[query.iteration()] = deserializeCosts(query.notilescosts());
+}
+
+std::unique_ptr<lightdb::serialization::RegretState> RegretAccumulator::currentState() const {
+    auto state = std::make_unique<lightdb::serialization::RegretState>();
+    state->set_version(RegretStateVersion);
+    state->set_width(width_);
+    state->set_height(height_);
+    state->set_goplength(gopLength_);
+    state->set_threshold(threshold_);
+    state->set_queryiteration(queryIteration_);
+
+    for (const auto &label : labels_) {
+        auto layout = state->add_layouts();
+        layout->set_identifier(label);
+        auto &objects = idToObjects_.at(label);
+        layout->mutable_objects()->Add(objects.begin(), objects.end());
+    }
+    state->mutable_allobjects()->Add(allObjects_.begin(), allObjects_.end());
+    state->mutable_singleobjects()->Add(singleObjects_.begin(), singleObjects_.end());
+
+    for (auto gopIt = gopToRegret_.begin(); gopIt != gopToRegret_.end(); ++gopIt) {
+        for (auto it = gopIt->second.begin(); it != gopIt->second.end(); ++it) {
+            auto regret = state->add_regret();
+            regret->set_gop(gopIt->first);
+            regret->set_layoutidentifier(it->first);
+            regret->set_regret(it->second);
+        }
+    }
+    for (auto it = gopToClearedIteration_.begin(); it != gopToClearedIteration_.end(); ++it) {
+        auto cleared = state->add_clearedgops();
+        cleared->set_gop(it->first);
+        cleared->set_iteration(it->second);
+    }
+    for (auto it = iterationToWorkload_.begin(); it != iterationToWorkload_.end(); ++it) {
+        serializeQuery(it->first, it->second, *iterationToBaselineCosts_.at(it->first), *iterationToNoTilesCosts_.at(it->first),
+                       state->add_queries());
+    }
+    return state;
 }
 
 } // namespace tasm
@@ -0,0 +1,82 @@
+#include "RegretStateStore.h"
+
+#include "Files.h"
+#include "RegretState.pb.h"
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+
+namespace tasm {
+
+RegretStateStore::RegretStateStore(const std::experimental::filesystem::path &directory)
+    : checkpointPath_(TileFiles::regretCheckpointFilename(directory)),
+    logPath_(TileFiles::regretLogFilename(directory)),
+    nextSequenceNumber_(1),
+    numberOfUpdatesSinceCheckpoint_(0)
+{ }
+
+bool RegretStateStore::load(lightdb::serialization::RegretState &checkpoint,
+                            std::vector<lightdb::serialization::RegretUpdate> &updates) {
+    bool foundState = false;
+    unsigned long long lastSequenceNumber = 0;
+
+    if (std::experimental::filesystem::exists(checkpointPath_)) {
+        std::ifstream input(checkpointPath_, std::ios::binary);
+        if (!checkpoint.ParseFromIstream(&input))
+            throw std::runtime_error("Failed to parse regret checkpoint " + checkpointPath_.string());
+        foundState = true;
+        lastSequenceNumber = checkpoint.lastsequencenumber();
+    }
+
+    if (std::experimental::filesystem::exists(logPath_)) {
+        std::ifstream input(logPath_, std::ios::binary);
+        google::protobuf::io::IstreamInputStream stream(&input);
+        bool cleanEOF = false;
+        // A torn record at the end of the log was never acknowledged, so reading stops there.
+        while (true) {
+            lightdb::serialization::RegretUpdate update;
+            if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(&update, &stream, &cleanEOF))
+                break;
+            if (update.sequencenumber() > lastSequenceNumber) {
+                lastSequenceNumber = update.sequencenumber();
+                updates.push_back(std::move(update));
+            }
+        }
+        foundState |= !updates.empty();
+    }
+
+    nextSequenceNumber_ = lastSequenceNumber + 1;
+    return foundState;
+}
+
+void RegretStateStore::append(lightdb::serialization::RegretUpdate &update) {
+    update.set_sequencenumber(nextSequenceNumber_++);
+
+    if (!log_.is_open())
+        log_.open(logPath_, std::ios::binary | std::ios::app);
+
+    if (!google::protobuf::util::SerializeDelimitedToOstream(update, &log_))
+        throw std::runtime_error("Failed to append to regret log " + logPath_.string());
+    log_.flush();
+    ++numberOfUpdatesSinceCheckpoint_;
+}
+
+void RegretStateStore::checkpoint(lightdb::serialization::RegretState &state) {
+    state.set_lastsequencenumber(nextSequenceNumber_ - 1);
+
+    auto temporaryPath = checkpointPath_;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!state.SerializeToOstream(&output))
+            throw std::runtime_error("Failed to write regret checkpoint " + temporaryPath.string());
+    }
+    std::experimental::filesystem::rename(temporaryPath, checkpointPath_);
+
+    // Every update in the log is now covered by the checkpoint.
+    if (log_.is_open())
+        log_.close();
+    log_.open(logPath_, std::ios::binary | std::ios::trunc);
+    numberOfUpdatesSinceCheckpoint_ = 0;
+}
+
+} // namespace tasm
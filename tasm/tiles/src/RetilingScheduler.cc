@@ -0,0 +1,63 @@
+#include "RetilingScheduler.h"
+
+#include <algorithm>
+
+namespace tasm {
+
+void RetilingScheduler::setBudget(RetilingBudget budget, Clock::time_point now) {
+    refill(now);
+    budget_ = budget;
+    remainingSeconds_ = std::min(remainingSeconds_, budget_.encodeSeconds);
+    remainingBytes_ = std::min(remainingBytes_, static_cast<double>(budget_.bytesWritten));
+}
+
+void RetilingScheduler::refill(Clock::time_point now) {
+    if (now <= lastRefill_)
+        return;
+
+    std::chrono::duration<double> elapsed = now - lastRefill_;
+    auto fractionRefilled = budget_.refillIntervalSeconds > 0 ? elapsed.count() / budget_.refillIntervalSeconds : 1.0;
+    remainingSeconds_ = std::min(budget_.encodeSeconds, remainingSeconds_ + fractionRefilled * budget_.encodeSeconds);
+    remainingBytes_ = std::min(static_cast<double>(budget_.bytesWritten), remainingBytes_ + fractionRefilled * budget_.bytesWritten);
+    lastRefill_ = now;
+}
+
+std::vector<RetilingCandidate> RetilingScheduler::candidatesForPass(const std::vector<RetilingCandidate> &candidates,
+                                                                   std::function<unsigned long long(unsigned int gop)> bytesForGOP,
+                                                                   Clock::time_point now) {
+    refill(now);
+
+    std::vector<RetilingCandidate> selected;
+    double remainingSeconds = remainingSeconds_;
+    double remainingBytes = remainingBytes_;
+    bool budgetIsFull = remainingSeconds_ >= budget_.encodeSeconds && remainingBytes_ >= budget_.bytesWritten;
+
+    for (const auto &candidate : candidates) {
+        auto bytes = budget_.limitsBytesWritten() ? bytesForGOP(candidate.gop) : 0;
+
+        // A GOP that exceeds the entire budget is still retiled on its own once the budget is full, so that it isn't
+        // deferred forever.
+        bool exceedsEntireBudget = candidate.encodeCost > budget_.encodeSeconds || bytes > budget_.bytesWritten;
+        if (exceedsEntireBudget && selected.empty() && budgetIsFull) {
+            selected.push_back(candidate);
+            break;
+        }
+
+        // Skip candidates that don't fit; a cheaper, lower-priority one may still fit.
+        if (candidate.encodeCost > remainingSeconds || bytes > remainingBytes)
+            continue;
+
+        selected.push_back(candidate);
+        remainingSeconds -= candidate.encodeCost;
+        remainingBytes -= bytes;
+    }
+    return selected;
+}
+
+void RetilingScheduler::charge(double seconds, unsigned long long bytes) {
+    remainingSeconds_ -= seconds;
+    if (budget_.limitsBytesWritten())
+        remainingBytes_ -= bytes;
+}
+
+} // namespace tasm
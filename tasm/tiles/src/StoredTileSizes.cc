@@ -0,0 +1,66 @@
+#include "StoredTileSizes.h"
+
+#include "MP4Reader.h"
+
+namespace tasm {
+
+std::vector<StoredTileSizes::TileFrames> StoredTileSizes::locateTiles(unsigned int firstFrame) {
+    auto layout = tileLocationProvider_->tileLayoutForFrame(firstFrame);
+    std::vector<TileFrames> tiles;
+    for (auto tile = 0u; tile < layout->numberOfTiles(); ++tile) {
+        auto tilePath = tileLocationProvider_->locationOfTileForFrame(tile, firstFrame);
+        auto offset = firstFrame - tileLocationProvider_->frameOffsetInTileFile(tilePath);
+        tiles.push_back({tilePath, offset});
+    }
+    return tiles;
+}
+
+std::vector<unsigned long long> StoredTileSizes::cumulativeBytesForTile(const TileFrames &tileFrames, unsigned int numberOfFrames) {
+    auto &cumulativeBytesInFile = cumulativeBytesForTileFile(tileFrames.tilePath);
+    auto offset = tileFrames.offsetInFile;
+
+    // Frames past the end of the tile file don't add any bytes.
+    std::vector<unsigned long long> cumulativeBytes(numberOfFrames + 1, 0);
+    auto lastIndexInFile = cumulativeBytesInFile.size() - 1;
+    for (auto k = 1u; k <= numberOfFrames; ++k) {
+        auto index = std::min<std::size_t>(offset + k, lastIndexInFile);
+        cumulativeBytes[k] = cumulativeBytesInFile[index] - cumulativeBytesInFile[std::min<std::size_t>(offset, lastIndexInFile)];
+    }
+    return cumulativeBytes;
+}
+
+std::vector<double> StoredTileSizes::cumulativeBytesPerPixel(const TileLayout &storedLayout, const std::vector<TileFrames> &storedTiles, unsigned int numberOfFrames) {
+    std::vector<unsigned long long> bytesPerFrame(numberOfFrames + 1, 0);
+    for (const auto &tileFrames : storedTiles) {
+        auto cumulativeBytes = cumulativeBytesForTile(tileFrames, numberOfFrames);
+        for (auto k = 0u; k <= numberOfFrames; ++k)
+            bytesPerFrame[k] += cumulativeBytes[k];
+    }
+
+    double pixelsPerFrame = static_cast<double>(storedLayout.totalWidth()) * storedLayout.totalHeight();
+    std::vector<double> cumulativeBytesPerPixel(numberOfFrames + 1, 0);
+    for (auto k = 0u; k <= numberOfFrames; ++k)
+        cumulativeBytesPerPixel[k] = bytesPerFrame[k] / pixelsPerFrame;
+    return cumulativeBytesPerPixel;
+}
+
+const std::vector<unsigned long long> &StoredTileSizes::cumulativeBytesForTileFile(const std::experimental::filesystem::path &tilePath) {
+    {
+        std::scoped_lock lock(mutex_);
+        auto existing = tilePathToCumulativeBytes_.find(tilePath.string());
+        if (existing != tilePathToCumulativeBytes_.end())
+            return existing->second;
+    }
+
+    // The sample table is read without holding the lock so that other files can be read meanwhile.
+    auto sampleSizes = MP4Reader(tilePath).sampleSizes();
+    std::vector<unsigned long long> cumulativeBytes(sampleSizes.size() + 1, 0);
+    for (auto i = 0u; i < sampleSizes.size(); ++i)
+        cumulativeBytes[i + 1] = cumulativeBytes[i] + sampleSizes[i];
+
+    // If another thread read the same file meanwhile, its sizes are kept; they are the same.
+    std::scoped_lock lock(mutex_);
+    return tilePathToCumulativeBytes_.emplace(tilePath.string(), std::move(cumulativeBytes)).first->second;
+}
+
+} // namespace tasm
@@ -0,0 +1,219 @@
+#include "TileContentIndex.h"
+
+#include "FileLock.h"
+#include "Files.h"
+#include "TileContents.pb.h"
+#include <fcntl.h>
+#include <fstream>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tasm {
+
+static const unsigned int ReadBufferSize = 1 << 16;
+
+void TileContentIndex::Hasher::update(const char *data, size_t size) {
+    for (auto i = 0u; i < size; ++i) {
+        hash_ ^= static_cast<unsigned char>(data[i]);
+        hash_ *= 1099511628211ull;
+    }
+}
+
+std::shared_ptr<TileContentIndex> TileContentIndex::forVideo(const std::experimental::filesystem::path &videoPath) {
+    static std::mutex pathToIndexMutex;
+    static std::unordered_map<std::string, std::shared_ptr<TileContentIndex>> pathToIndex;
+
+    std::shared_ptr<TileContentIndex> index;
+    {
+        std::scoped_lock lock(pathToIndexMutex);
+        auto &cachedIndex = pathToIndex[videoPath.string()];
+        if (!cachedIndex)
+            cachedIndex.reset(new TileContentIndex(videoPath));
+        index = cachedIndex;
+    }
+
+    std::scoped_lock lock(index->mutex_);
+    index->refresh();
+    return index;
+}
+
+TileContentIndex::TileContentIndex(const std::experimental::filesystem::path &videoPath)
+    : videoPath_(videoPath),
+    indexPath_(TileFiles::tileContentsFilename(videoPath)),
+    device_(0),
+    inode_(0),
+    lengthRead_(0),
+    numberOfEntriesWhenWritten_(0)
+{ }
+
+static bool filesAreIdentical(const std::experimental::filesystem::path &first, const std::experimental::filesystem::path &second) {
+    std::ifstream firstInput(first, std::ios::binary);
+    std::ifstream secondInput(second, std::ios::binary);
+    if (!firstInput || !secondInput)
+        return false;
+
+    std::vector<char> firstBuffer(ReadBufferSize);
+    std::vector<char> secondBuffer(ReadBufferSize);
+    while (true) {
+        firstInput.read(firstBuffer.data(), firstBuffer.size());
+        secondInput.read(secondBuffer.data(), secondBuffer.size());
+        if (firstInput.gcount() != secondInput.gcount())
+            return false;
+        if (!firstInput.gcount())
+            return true;
+        if (!std::equal(firstBuffer.begin(), firstBuffer.begin() + firstInput.gcount(), secondBuffer.begin()))
+            return false;
+    }
+}
+
+std::optional<std::experimental::filesystem::path> TileContentIndex::findIdenticalFile(const Content &content, const std::experimental::filesystem::path &filename) const {
+    // Files are compared without holding the lock, so other transactions can look up their tiles meanwhile.
+    std::vector<std::experimental::filesystem::path> candidates;
+    {
+        std::scoped_lock lock(mutex_);
+        auto hashMatches = hashToEntry_.equal_range(content.hash);
+        for (auto it = hashMatches.first; it != hashMatches.second; ++it) {
+            if (it->second.size == content.size)
+                candidates.push_back(videoPath_ / it->second.path);
+        }
+    }
+
+    for (const auto &candidate : candidates) {
+        // Compaction may have deleted the file since it was added.
+        std::error_code error;
+        if (std::experimental::filesystem::equivalent(candidate, filename, error) || error)
+            continue;
+        if (filesAreIdentical(candidate, filename))
+            return candidate;
+    }
+    return {};
+}
+
+void TileContentIndex::add(const std::vector<std::pair<Content, std::experimental::filesystem::path>> &files) {
+    // Serializes writers, including those in other processes.
+    FileLock lock(TileFiles::catalogLockFilename(videoPath_));
+    std::scoped_lock indexLock(mutex_);
+    refresh();
+
+    // A writer that died mid-append leaves a torn record that reading stops at. Cut it off so the records appended
+    // after it can be read.
+    std::error_code error;
+    auto size = std::experimental::filesystem::file_size(indexPath_, error);
+    if (!error && size > lengthRead_)
+        std::experimental::filesystem::resize_file(indexPath_, lengthRead_);
+
+    {
+        std::ofstream log(indexPath_, std::ios::binary | std::ios::app);
+        for (const auto &contentAndPath : files) {
+            // Tile files are directly inside one of the video's tile directories.
+            auto relativePath = contentAndPath.second.parent_path().filename() / contentAndPath.second.filename();
+            lightdb::serialization::TileContent tile;
+            tile.set_hash(contentAndPath.first.hash);
+            tile.set_size(contentAndPath.first.size);
+            tile.set_path(relativePath.string());
+            if (!google::protobuf::util::SerializeDelimitedToOstream(tile, &log))
+                throw std::runtime_error("Failed to append to tile contents " + indexPath_.string());
+            hashToEntry_.emplace(contentAndPath.first.hash, Entry{contentAndPath.first.size, relativePath});
+        }
+        log.flush();
+        if (!log)
+            throw std::runtime_error("Failed to append to tile contents " + indexPath_.string());
+    }
+
+    // No other writer can append while the lock is held, so everything in the log has been read.
+    struct stat status;
+    if (stat(indexPath_.c_str(), &status))
+        throw std::runtime_error("Failed to stat tile contents " + indexPath_.string());
+    setLengthRead(status.st_dev, status.st_ino, status.st_size);
+
+    if (hashToEntry_.size() >= 2 * std::max<std::size_t>(numberOfEntriesWhenWritten_, MinimumEntriesBeforeRewrite))
+        rewrite();
+}
+
+void TileContentIndex::setLengthRead(unsigned long long device, unsigned long long inode, unsigned long long length) {
+    device_ = device;
+    inode_ = inode;
+    lengthRead_ = length;
+}
+
+void TileContentIndex::refresh() {
+    auto fileDescriptor = open(indexPath_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0) {
+        // Nothing has been published, or the video was deleted.
+        hashToEntry_.clear();
+        setLengthRead(0, 0, 0);
+        numberOfEntriesWhenWritten_ = 0;
+        return;
+    }
+
+    struct stat status;
+    if (fstat(fileDescriptor, &status)) {
+        close(fileDescriptor);
+        throw std::runtime_error("Failed to stat tile contents " + indexPath_.string());
+    }
+
+    // A rewrite replaces the file, so then it is read from the start.
+    bool readFromStart = static_cast<unsigned long long>(status.st_dev) != device_
+            || static_cast<unsigned long long>(status.st_ino) != inode_
+            || static_cast<unsigned long long>(status.st_size) < lengthRead_;
+    if (readFromStart) {
+        hashToEntry_.clear();
+        setLengthRead(status.st_dev, status.st_ino, 0);
+    }
+
+    if (static_cast<unsigned long long>(status.st_size) > lengthRead_ && lseek(fileDescriptor, lengthRead_, SEEK_SET) >= 0) {
+        auto start = lengthRead_;
+        google::protobuf::io::FileInputStream stream(fileDescriptor);
+        bool cleanEOF = false;
+        // A torn record at the end of the log was never acknowledged, so reading stops there.
+        while (true) {
+            lightdb::serialization::TileContent tile;
+            if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(&tile, &stream, &cleanEOF))
+                break;
+            hashToEntry_.emplace(tile.hash(), Entry{tile.size(), tile.path()});
+            lengthRead_ = start + stream.ByteCount();
+        }
+    }
+    close(fileDescriptor);
+
+    if (readFromStart)
+        numberOfEntriesWhenWritten_ = hashToEntry_.size();
+}
+
+void TileContentIndex::rewrite() {
+    // Only here are the files checked, so reading the index doesn't stat every tile.
+    for (auto it = hashToEntry_.begin(); it != hashToEntry_.end();) {
+        if (std::experimental::filesystem::exists(videoPath_ / it->second.path))
+            ++it;
+        else
+            it = hashToEntry_.erase(it);
+    }
+
+    auto temporaryPath = indexPath_;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        for (const auto &hashAndEntry : hashToEntry_) {
+            lightdb::serialization::TileContent tile;
+            tile.set_hash(hashAndEntry.first);
+            tile.set_size(hashAndEntry.second.size);
+            tile.set_path(hashAndEntry.second.path.string());
+            if (!google::protobuf::util::SerializeDelimitedToOstream(tile, &output))
+                throw std::runtime_error("Failed to write tile contents " + temporaryPath.string());
+        }
+        output.flush();
+        if (!output)
+            throw std::runtime_error("Failed to write tile contents " + temporaryPath.string());
+    }
+    std::experimental::filesystem::rename(temporaryPath, indexPath_);
+
+    struct stat status;
+    if (stat(indexPath_.c_str(), &status))
+        throw std::runtime_error("Failed to stat tile contents " + indexPath_.string());
+    setLengthRead(status.st_dev, status.st_ino, status.st_size);
+    numberOfEntriesWhenWritten_ = hashToEntry_.size();
+}
+
+} // namespace tasm
@@ -0,0 +1,83 @@
+#include "TileLocationProvider.h"
+
+#include "CatalogStorage.h"
+#include "SemanticDataManager.h"
+#include "WorkloadCostEstimator.h"
+
+namespace tasm {
+
+int FullFrameTileLocationProvider::layoutIdForFrame(unsigned int frame) const {
+    auto newestId = tileLayoutsManager_->tileLayoutIdForFrame(frame);
+    if (!containsStitchedTiles(newestId))
+        return newestId;
+
+    for (auto id : tileLayoutsManager_->tileLayoutIdsForFrames(frame, frame)) {
+        if (!containsStitchedTiles(id))
+            return id;
+    }
+    // Nothing the tiles were stitched from is left, so the frame can't be read as a full frame.
+    return newestId;
+}
+
+bool FullFrameTileLocationProvider::containsStitchedTiles(int id) const {
+    std::scoped_lock lock(mutex_);
+    auto containsStitchedTiles = idToContainsStitchedTiles_.find(id);
+    if (containsStitchedTiles == idToContainsStitchedTiles_.end()) {
+        auto directory = tileLayoutsManager_->locationOfTileForId(0, id).parent_path();
+        containsStitchedTiles = idToContainsStitchedTiles_.emplace(id, CatalogStorage::forPath(directory)->containsStitchedTiles(directory)).first;
+    }
+    return containsStitchedTiles->second;
+}
+
+int CostBasedTileLocationProvider::layoutIdForFrame(unsigned int frame) const {
+    auto gop = frame / gopLength_;
+    auto layoutId = gopToLayoutId_.find(gop);
+    if (layoutId == gopToLayoutId_.end())
+        layoutId = gopToLayoutId_.emplace(gop, cheapestLayoutIdForGOP(gop)).first;
+
+    // A frame can be missing from the chosen version only if no version stores the entire GOP.
+    return layoutId->second >= 0 ? layoutId->second : tileLayoutsManager_->tileLayoutIdForFrame(frame);
+}
+
+int CostBasedTileLocationProvider::cheapestLayoutIdForGOP(unsigned int gop) const {
+    auto keyframe = gop * gopLength_;
+    auto lastFrame = std::min(keyframe + gopLength_ - 1, tileLayoutsManager_->maximumFrame());
+    auto candidates = tileLayoutsManager_->tileLayoutIdsForFrames(keyframe, lastFrame);
+    if (candidates.empty())
+        return -1;
+    if (candidates.size() == 1)
+        return candidates.front();
+
+    // The query's frames in this GOP.
+    const auto &orderedFrames = semanticDataManager_->orderedFrames();
+    auto firstFrameIt = std::lower_bound(orderedFrames.begin(), orderedFrames.end(), static_cast<int>(keyframe));
+    auto endFrameIt = std::upper_bound(firstFrameIt, orderedFrames.end(), static_cast<int>(lastFrame));
+    if (firstFrameIt == endFrameIt)
+        return candidates.front();
+
+    std::vector<int> frames(firstFrameIt, endFrameIt);
+    std::vector<const std::list<Rectangle> *> rectanglesForFrames;
+    for (auto frame : frames)
+        rectanglesForFrames.push_back(&semanticDataManager_->rectanglesForFrame(frame));
+
+    // Candidates are newest first, so only a strictly cheaper version replaces the current choice.
+    int cheapestId = -1;
+    CostElements cheapestCost(0, 0);
+    for (auto id : candidates) {
+        auto layout = tileLayoutsManager_->tileLayoutForId(id);
+        auto framesDecoded = WorkloadCostEstimator::framesDecodedForTiles(*layout, keyframe, frames, rectanglesForFrames);
+        CostElements cost(0, 0);
+        for (auto i = 0u; i < framesDecoded.size(); ++i)
+            cost.add(CostElements(layout->rectangleForTile(i).area() * static_cast<unsigned long long>(framesDecoded[i]), framesDecoded[i]));
+
+        if (cheapestId < 0
+                || cost.numPixels < cheapestCost.numPixels
+                || (cost.numPixels == cheapestCost.numPixels && cost.numTiles < cheapestCost.numTiles)) {
+            cheapestId = id;
+            cheapestCost = cost;
+        }
+    }
+    return cheapestId;
+}
+
+} // namespace tasm
@@ -0,0 +1,215 @@
+#include "TileManifest.h"
+
+#include "FileLock.h"
+#include "Files.h"
+#include "Gpac.h"
+#include "TileManifest.pb.h"
+#include "TilePack.h"
+#include <algorithm>
+#include <fstream>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+#include <map>
+#include <sys/stat.h>
+
+namespace tasm {
+
+static const unsigned int TileManifestVersion = 1;
+
+TileManifest::TileManifest(const std::experimental::filesystem::path &videoPath)
+    : videoPath_(videoPath),
+    checkpointPath_(TileFiles::tileManifestFilename(videoPath)),
+    logPath_(TileFiles::tileManifestLogFilename(videoPath))
+{ }
+
+bool TileManifest::exists() const {
+    return std::experimental::filesystem::exists(checkpointPath_) || std::experimental::filesystem::exists(logPath_);
+}
+
+std::vector<lightdb::serialization::TileDirectory> TileManifest::load() const {
+    // Writers replace the checkpoint and truncate the log separately, so both are read under the same lock.
+    FileLock lock(TileFiles::catalogLockFilename(videoPath_), FileLock::Mode::Shared);
+    return loadWhileLocked();
+}
+
+static std::string fileRevision(const std::experimental::filesystem::path &path) {
+    struct stat status;
+    if (stat(path.c_str(), &status))
+        return "-";
+    // Checkpoints replace the file, and repairing a torn record can leave the log the same length, so the inode and
+    // modification time are compared along with the size.
+    return std::to_string(status.st_ino) + ":" + std::to_string(status.st_size)
+            + ":" + std::to_string(status.st_mtim.tv_sec) + "." + std::to_string(status.st_mtim.tv_nsec);
+}
+
+std::string TileManifest::revision() const {
+    return fileRevision(checkpointPath_) + "/" + fileRevision(logPath_);
+}
+
+std::vector<lightdb::serialization::TileDirectory> TileManifest::loadWhileLocked() const {
+    // A directory can appear in both the checkpoint and the log if a checkpoint was interrupted before the log was
+    // truncated, so entries are keyed by version.
+    std::map<unsigned int, lightdb::serialization::TileDirectory> versionToDirectory;
+
+    if (std::experimental::filesystem::exists(checkpointPath_)) {
+        lightdb::serialization::TileManifest manifest;
+        std::ifstream input(checkpointPath_, std::ios::binary);
+        if (!manifest.ParseFromIstream(&input) || manifest.version() != TileManifestVersion)
+            throw std::runtime_error("Failed to parse tile manifest " + checkpointPath_.string());
+        for (auto &directory : *manifest.mutable_directories())
+            versionToDirectory[directory.version()] = std::move(directory);
+    }
+
+    readLog([&](lightdb::serialization::TileDirectory &&directory) {
+        if (directory.removed())
+            versionToDirectory.erase(directory.version());
+        else
+            versionToDirectory[directory.version()] = std::move(directory);
+    });
+
+    std::vector<lightdb::serialization::TileDirectory> directories;
+    directories.reserve(versionToDirectory.size());
+    for (auto &versionAndDirectory : versionToDirectory)
+        directories.push_back(std::move(versionAndDirectory.second));
+    return directories;
+}
+
+bool TileManifest::append(const lightdb::serialization::TileDirectory &directory,
+                          const std::function<bool(const std::vector<lightdb::serialization::TileDirectory>&)> &canAppend) {
+    FileLock lock(TileFiles::catalogLockFilename(videoPath_));
+    if (canAppend) {
+        auto otherDirectories = exists() ? loadWhileLocked() : scanDirectories();
+        otherDirectories.erase(std::remove_if(otherDirectories.begin(), otherDirectories.end(), [&](const auto &other) {
+            return other.version() == directory.version();
+        }), otherDirectories.end());
+        if (!canAppend(otherDirectories))
+            return false;
+    }
+
+    // The first commit after upgrading records every directory that is already published, including this one.
+    if (!exists()) {
+        checkpoint(scanDirectories());
+        return true;
+    }
+
+    appendToLog(directory);
+    return true;
+}
+
+void TileManifest::remove(const lightdb::serialization::TileDirectory &directory) {
+    FileLock lock(TileFiles::catalogLockFilename(videoPath_));
+    if (!exists())
+        checkpoint(scanDirectories());
+
+    auto removal = directory;
+    removal.set_removed(true);
+    appendToLog(removal);
+}
+
+void TileManifest::rebuildFromDirectories() {
+    FileLock lock(TileFiles::catalogLockFilename(videoPath_));
+    checkpoint(scanDirectories());
+}
+
+void TileManifest::appendToLog(const lightdb::serialization::TileDirectory &directory) {
+    unsigned int numberOfLoggedDirectories = 0;
+    auto lengthOfIntactRecords = readLog([&](lightdb::serialization::TileDirectory &&) { ++numberOfLoggedDirectories; });
+    // A writer that died mid-append leaves a torn record. Readers stop there, so it is cut off before anything
+    // is appended after it.
+    std::error_code error;
+    auto logSize = std::experimental::filesystem::file_size(logPath_, error);
+    if (!error && logSize > lengthOfIntactRecords)
+        std::experimental::filesystem::resize_file(logPath_, lengthOfIntactRecords);
+
+    {
+        std::ofstream log(logPath_, std::ios::binary | std::ios::app);
+        if (!google::protobuf::util::SerializeDelimitedToOstream(directory, &log) || !log.flush())
+            throw std::runtime_error("Failed to append to tile manifest " + logPath_.string());
+    }
+
+    if (numberOfLoggedDirectories + 1 >= DirectoriesBetweenCheckpoints)
+        checkpoint(loadWhileLocked());
+}
+
+lightdb::serialization::TileDirectory TileManifest::describeDirectory(const std::experimental::filesystem::path &directoryPath) {
+    auto tileLayout = gpac::load_tile_configuration(TileFiles::tileMetadataFilename(directoryPath));
+    auto pack = TilePack::packContainingTile(TileFiles::tileFilename(directoryPath, 0));
+    std::vector<unsigned long long> tileSizes;
+    for (auto tile = 0u; tile < tileLayout.numberOfTiles(); ++tile) {
+        if (pack) {
+            tileSizes.push_back(pack->tileSize(tile));
+            continue;
+        }
+        std::error_code error;
+        auto size = std::experimental::filesystem::file_size(TileFiles::tileFilename(directoryPath, tile), error);
+        tileSizes.push_back(error ? 0 : size);
+    }
+    return describeDirectory(directoryPath, tileLayout, tileSizes);
+}
+
+lightdb::serialization::TileDirectory TileManifest::describeDirectory(const std::experimental::filesystem::path &directoryPath,
+                                                                      const TileLayout &tileLayout,
+                                                                      const std::vector<unsigned long long> &tileSizes) {
+    lightdb::serialization::TileDirectory directory;
+    auto firstAndLastFrame = TileFiles::firstAndLastFramesFromPath(directoryPath);
+    directory.set_firstframe(firstAndLastFrame.first);
+    directory.set_lastframe(firstAndLastFrame.second);
+    directory.set_version(TileFiles::tileVersionFromPath(directoryPath));
+
+    directory.set_numberofcolumns(tileLayout.numberOfColumns());
+    directory.set_numberofrows(tileLayout.numberOfRows());
+    directory.mutable_widthsofcolumns()->Add(tileLayout.widthsOfColumns().begin(), tileLayout.widthsOfColumns().end());
+    directory.mutable_heightsofrows()->Add(tileLayout.heightsOfRows().begin(), tileLayout.heightsOfRows().end());
+    directory.mutable_tilesizes()->Add(tileSizes.begin(), tileSizes.end());
+    return directory;
+}
+
+std::vector<lightdb::serialization::TileDirectory> TileManifest::scanDirectories() const {
+    std::vector<lightdb::serialization::TileDirectory> directories;
+    for (auto &dir : std::experimental::filesystem::directory_iterator(videoPath_)) {
+        if (!std::experimental::filesystem::is_directory(dir.status()) || TileFiles::isStagingDirectory(dir.path()))
+            continue;
+        directories.push_back(describeDirectory(dir.path()));
+    }
+    return directories;
+}
+
+unsigned long long TileManifest::readLog(const std::function<void(lightdb::serialization::TileDirectory &&)> &visitDirectory) const {
+    std::ifstream input(logPath_, std::ios::binary);
+    if (!input)
+        return 0;
+
+    google::protobuf::io::IstreamInputStream stream(&input);
+    bool cleanEOF = false;
+    unsigned long long lengthOfIntactRecords = 0;
+    // A torn record at the end of the log was never acknowledged, so reading stops there.
+    while (true) {
+        lightdb::serialization::TileDirectory directory;
+        if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(&directory, &stream, &cleanEOF))
+            break;
+        lengthOfIntactRecords = stream.ByteCount();
+        visitDirectory(std::move(directory));
+    }
+    return lengthOfIntactRecords;
+}
+
+void TileManifest::checkpoint(const std::vector<lightdb::serialization::TileDirectory> &directories) {
+    lightdb::serialization::TileManifest manifest;
+    manifest.set_version(TileManifestVersion);
+    for (auto &directory : directories)
+        *manifest.add_directories() = directory;
+
+    auto temporaryPath = checkpointPath_;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!manifest.SerializeToOstream(&output))
+            throw std::runtime_error("Failed to write tile manifest " + temporaryPath.string());
+    }
+    std::experimental::filesystem::rename(temporaryPath, checkpointPath_);
+
+    // Every logged directory is now covered by the checkpoint.
+    std::ofstream log(logPath_, std::ios::binary | std::ios::trunc);
+}
+
+} // namespace tasm
@@ -1,43 +1,36 @@
 #include "TiledVideoManager.h"
 
+#include "CatalogStorage.h"
 #include "Files.h"
-#include "Gpac.h"
+#include "TileManifest.pb.h"
+#include <algorithm>
 
 namespace tasm {
 
 void TiledVideoManager::loadAllTileConfigurations() {
-    std::scoped_lock lock(mutex_);
-
     // Get directory path from entry_.
     auto &catalogEntryPath = entry_->path();
 
-    // Read all directory names.
-    int globalDirId = 0;
-    std::vector<IntervalEntry<unsigned int>> directoryIntervals;
-    unsigned int lowerBound = INT32_MAX;
-    unsigned int upperBound = 0;
-
-    for (auto &dir : std::experimental::filesystem::directory_iterator(catalogEntryPath)) {
-//        if (!dir.is_directory())
-        if (!std::experimental::filesystem::is_directory(dir.status()))
-            continue;
+    // The revision is read first, so a change made while listing makes the manager look out of date rather than current.
+    auto storage = CatalogStorage::forPath(catalogEntryPath);
+    catalogRevision_ = storage->catalogRevision(catalogEntryPath);
+    auto directories = storage->listTileDirectories(catalogEntryPath, &catalogPin_);
 
-        auto dirId = globalDirId++;
-        auto tileDirectoryPath = dir.path();
-        // Parse frame range from path.
-        auto firstAndLastFrame = TileFiles::firstAndLastFramesFromPath(tileDirectoryPath);
-        auto tileVersion = TileFiles::tileVersionFromPath(tileDirectoryPath);
-        dirId = tileVersion;
+    std::vector<FrameRunIndex::Interval> directoryIntervals;
+    std::vector<unsigned int> directoryLengths;
 
-        directoryIntervals.emplace_back(firstAndLastFrame.first, firstAndLastFrame.second, dirId);
-        if (firstAndLastFrame.second > maximumFrame_)
-            maximumFrame_ = firstAndLastFrame.second;
+    for (auto &directory : directories) {
+        int dirId = directory.version();
+        directoryIntervals.push_back({directory.firstframe(), directory.lastframe(), dirId});
+        if (directory.lastframe() > maximumFrame_)
+            maximumFrame_ = directory.lastframe();
 
-        lowerBound = std::min(lowerBound, firstAndLastFrame.first);
-        upperBound = std::max(upperBound, firstAndLastFrame.second);
+        directoryLengths.push_back(directory.lastframe() - directory.firstframe() + 1);
 
-        // Find the tile-metadata file in this directory, and load the tile layout from it.
-        TileLayout tileLayout = gpac::load_tile_configuration(TileFiles::tileMetadataFilename(tileDirectoryPath));
+        TileLayout tileLayout(directory.numberofcolumns(),
+                              directory.numberofrows(),
+                              std::vector<unsigned int>(directory.widthsofcolumns().begin(), directory.widthsofcolumns().end()),
+                              std::vector<unsigned int>(directory.heightsofrows().begin(), directory.heightsofrows().end()));
 
         // All of the layouts should have the same total width and total height.
         if (!totalWidth_) {
@@ -52,31 +45,145 @@ void TiledVideoManager::loadAllTileConfigurations() {
             tileLayoutReferences_[tileLayout] = std::make_shared<TileLayout>(tileLayout);
 
         directoryIdToTileLayout_[dirId] = tileLayoutReferences_.at(tileLayout);
-        directoryIdToTileDirectory_[dirId] = tileDirectoryPath;
+        directoryIdToTileDirectory_[dirId] = TileFiles::directoryForTilesInFrames(catalogEntryPath, directory.firstframe(), directory.lastframe(), directory.version());
+        directoryIdToTileSizes_[dirId] = std::vector<unsigned long long>(directory.tilesizes().begin(), directory.tilesizes().end());
     }
 
-    intervalTree_ = IntervalTree<unsigned int>(lowerBound, upperBound, directoryIntervals);
+    layoutIndex_ = FrameRunIndex(directoryIntervals);
+
+    // Every version of a frame is found through the bucket containing it. Buckets are as long as a typical directory,
+    // so a few short directories don't multiply the buckets, and each directory is listed in only a few of them.
+    if (!directoryLengths.empty()) {
+        auto median = directoryLengths.begin() + directoryLengths.size() / 2;
+        std::nth_element(directoryLengths.begin(), median, directoryLengths.end());
+        bucketLength_ = *median;
+    }
+    bucketToDirectoryIntervals_.resize(directoryIntervals.size() ? maximumFrame_ / bucketLength_ + 1 : 0);
+    for (auto i = 0u; i < directoryIntervals.size(); ++i) {
+        for (auto bucket = directoryIntervals[i].firstFrame / bucketLength_; bucket <= directoryIntervals[i].lastFrame / bucketLength_; ++bucket)
+            bucketToDirectoryIntervals_[bucket].push_back(i);
+    }
+    directoryIntervals_ = std::move(directoryIntervals);
 }
 
-std::vector<int> TiledVideoManager::tileLayoutIdsForFrame(unsigned int frameNumber) const {
-    std::scoped_lock lock(mutex_);
+int TiledVideoManager::tileLayoutIdForFrame(unsigned int frameNumber) const {
+    auto layoutId = layoutIndex_.idForFrame(frameNumber);
+    assert(layoutId.has_value());
+    return *layoutId;
+}
 
-    // Find the intervals that contain the frame number, and splice their lists together.
-    std::vector<IntervalEntry<unsigned int>> overlappingIntervals;
-    intervalTree_.query(frameNumber, overlappingIntervals);
+std::vector<int> TiledVideoManager::tileLayoutIdsForFrames(unsigned int firstFrame, unsigned int lastFrame) const {
+    std::vector<int> ids;
+    if (firstFrame / bucketLength_ >= bucketToDirectoryIntervals_.size())
+        return ids;
 
-    std::vector<int> layoutIds(overlappingIntervals.size());
-    std::transform(overlappingIntervals.begin(), overlappingIntervals.end(), layoutIds.begin(), [](const auto &intervalEntry) {
-        return intervalEntry.id();
-    });
+    for (auto i : bucketToDirectoryIntervals_[firstFrame / bucketLength_]) {
+        const auto &interval = directoryIntervals_[i];
+        if (interval.firstFrame <= firstFrame && interval.lastFrame >= lastFrame)
+            ids.push_back(interval.id);
+    }
+    std::sort(ids.begin(), ids.end(), std::greater<>());
+    return ids;
+}
 
-    assert(!layoutIds.empty());
-    return layoutIds;
+const std::vector<unsigned long long> &TiledVideoManager::tileSizesForId(int id) const {
+    return directoryIdToTileSizes_.at(id);
 }
 
 std::experimental::filesystem::path TiledVideoManager::locationOfTileForId(unsigned int tileNumber, int id) const {
-    std::scoped_lock lock(mutex_);
     return TileFiles::tileFilename(directoryIdToTileDirectory_.at(id), tileNumber);
 }
 
-} // namespace tasm
\ No newline at end of file
+TiledVideoManagerCache &TiledVideoManagerCache::instance() {
+    static TiledVideoManagerCache cache;
+    return cache;
+}
+
+std::shared_ptr<const TiledVideoManager> TiledVideoManagerCache::tiledVideoManager(std::shared_ptr<TiledEntry> entry) {
+    auto key = entry->path().string();
+    // Other processes don't invalidate this cache, so the catalog is checked on every lookup. It is read without
+    // holding the lock because it may touch the filesystem.
+    auto revision = CatalogStorage::forPath(entry->path())->catalogRevision(entry->path());
+    unsigned long generation;
+    {
+        std::scoped_lock lock(mutex_);
+        auto cachedManager = pathToManager_.find(key);
+        if (cachedManager != pathToManager_.end()) {
+            if (cachedManager->second->catalogRevision() == revision)
+                return cachedManager->second;
+            pathToManager_.erase(cachedManager);
+            ++pathToGeneration_[key];
+        }
+        generation = pathToGeneration_[key];
+        pathToGenerationsBeingLoaded_[key].insert(generation);
+    }
+
+    // Load without holding the lock so that queries on other videos aren't blocked.
+    std::shared_ptr<const TiledVideoManager> manager;
+    try {
+        manager = std::make_shared<const TiledVideoManager>(entry);
+    } catch (...) {
+        std::scoped_lock lock(mutex_);
+        auto &generationsBeingLoaded = pathToGenerationsBeingLoaded_[key];
+        generationsBeingLoaded.erase(generationsBeingLoaded.find(generation));
+        throw;
+    }
+
+    std::scoped_lock lock(mutex_);
+    auto &generationsBeingLoaded = pathToGenerationsBeingLoaded_[key];
+    generationsBeingLoaded.erase(generationsBeingLoaded.find(generation));
+    pathToLoadedManagers_[key].push_back({generation, manager});
+    if (pathToGeneration_[key] == generation)
+        pathToManager_[key] = manager;
+    return manager;
+}
+
+void TiledVideoManagerCache::invalidate(const std::experimental::filesystem::path &videoPath) {
+    std::scoped_lock lock(mutex_);
+    auto key = videoPath.string();
+    pathToManager_.erase(key);
+    ++pathToGeneration_[key];
+}
+
+void TiledVideoManagerCache::deleteWhenUnreferenced(const std::experimental::filesystem::path &videoPath,
+                                                    std::vector<std::experimental::filesystem::path> directories,
+                                                    unsigned int versionAllocatedAfterRemoval) {
+    std::scoped_lock lock(mutex_);
+    auto key = videoPath.string();
+    pathToManager_.erase(key);
+    auto generation = ++pathToGeneration_[key];
+    pendingDeletions_.push_back({key, generation, versionAllocatedAfterRemoval, std::move(directories)});
+}
+
+bool TiledVideoManagerCache::isReferencedBeforeGeneration(const std::string &key, unsigned long generation) {
+    auto &loadedManagers = pathToLoadedManagers_[key];
+    loadedManagers.erase(std::remove_if(loadedManagers.begin(), loadedManagers.end(), [](const auto &loadedManager) {
+        return loadedManager.manager.expired();
+    }), loadedManagers.end());
+
+    auto &generationsBeingLoaded = pathToGenerationsBeingLoaded_[key];
+    return std::any_of(loadedManagers.begin(), loadedManagers.end(), [&](const auto &loadedManager) {
+        return loadedManager.generation < generation;
+    }) || (!generationsBeingLoaded.empty() && *generationsBeingLoaded.begin() < generation);
+}
+
+unsigned int TiledVideoManagerCache::collectGarbage() {
+    std::vector<std::experimental::filesystem::path> directoriesToDelete;
+    {
+        std::scoped_lock lock(mutex_);
+        auto unreferencedEnd = std::partition(pendingDeletions_.begin(), pendingDeletions_.end(), [&](const auto &pendingDeletion) {
+            return !isReferencedBeforeGeneration(pendingDeletion.key, pendingDeletion.generation)
+                    && !CatalogStorage::forPath(pendingDeletion.key)->hasPinnedListingsBefore(pendingDeletion.key, pendingDeletion.versionAllocatedAfterRemoval);
+        });
+        for (auto it = pendingDeletions_.begin(); it != unreferencedEnd; ++it)
+            directoriesToDelete.insert(directoriesToDelete.end(), it->directories.begin(), it->directories.end());
+        pendingDeletions_.erase(pendingDeletions_.begin(), unreferencedEnd);
+    }
+
+    // Deleting can be slow, so it happens outside of the lock. Nothing can load these directories any more.
+    for (const auto &directory : directoriesToDelete)
+        CatalogStorage::forPath(directory)->deleteDirectory(directory);
+    return directoriesToDelete.size();
+}
+
+} // namespace tasm
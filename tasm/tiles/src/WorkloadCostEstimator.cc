@@ -1,82 +1,206 @@
 #include "WorkloadCostEstimator.h"
 
 #include "SemanticDataManager.h"
+#include "StoredTileSizes.h"
+#include <cmath>
 
 namespace tasm {
 
 
 std::ostream &operator<<(std::ostream &ostr, const CostElements &c) {
-    ostr << "num_pixels: " << c.numPixels << ", num_tiles: " << c.numTiles << "\n";
+    ostr << "num_pixels: " << c.numPixels << ", num_tiles: " << c.numTiles << ", num_bytes: " << c.numBytes << "\n";
     return ostr;
 }
 
-CostElements WorkloadCostEstimator::estimateCostForQuery(unsigned int queryNum, std::unordered_map<unsigned int, CostElements> *costByGOP) {
-    auto semanticDataManager = workload_->semanticDataManagerForQuery(queryNum);
-    auto start = semanticDataManager->orderedFrames().begin();
-    auto end = semanticDataManager->orderedFrames().end();
+CostElements WorkloadCostEstimator::estimateCostForQuery(unsigned int queryNum,
+                                                        std::unordered_map<unsigned int, CostElements> *costByGOP,
+                                                        const std::unordered_set<unsigned int> *gopsToEstimate) {
+    std::vector<FramesInGOP> framesByGOP;
+    framesForQueryByGOP(queryNum, gopsToEstimate, framesByGOP);
+    auto costs = estimateCostForGOPs(framesByGOP);
 
-    unsigned long long totalNumberOfPixels = 0;
-    unsigned long long totalNumberOfTiles = 0;
-
-    while (start != end) {
-        auto costElements = estimateCostForNextGOP(start, end, semanticDataManager);
-        totalNumberOfPixels += costElements.second.numPixels;
-        totalNumberOfTiles += costElements.second.numTiles;
+    // Reduce in GOP order so the totals don't depend on how the work was scheduled.
+    CostElements total(0, 0);
+    for (auto i = 0u; i < costs.size(); ++i) {
+        total.add(costs[i]);
 
         if (costByGOP)
-            costByGOP->emplace(costElements);
+            costByGOP->emplace(framesByGOP[i].gop, costs[i]);
     }
 
     auto multiplier = workload_->numberOfTimesQueryIsExecuted(queryNum);
-    return CostElements(multiplier * totalNumberOfPixels, multiplier * totalNumberOfTiles);
+    return CostElements(multiplier * total.numPixels, multiplier * total.numTiles, multiplier * total.numBytes);
 }
 
 CostElements WorkloadCostEstimator::estimateCostForWorkload() {
+    // Gather the GOPs of every query up front so that GOPs from different queries can be costed together.
+    std::vector<FramesInGOP> framesByGOP;
+    std::vector<unsigned int> firstGOPIndexForQuery(workload_->numberOfQueries() + 1, 0);
+    for (auto i = 0u; i < workload_->numberOfQueries(); ++i) {
+        framesForQueryByGOP(i, nullptr, framesByGOP);
+        firstGOPIndexForQuery[i + 1] = framesByGOP.size();
+    }
+
+    auto costs = estimateCostForGOPs(framesByGOP);
+
     CostElements results(0, 0);
     for (auto i = 0u; i < workload_->numberOfQueries(); ++i) {
-        auto queryResults = estimateCostForQuery(i);
-        results.add(queryResults);
+        CostElements queryResults(0, 0);
+        for (auto gopIndex = firstGOPIndexForQuery[i]; gopIndex < firstGOPIndexForQuery[i + 1]; ++gopIndex)
+            queryResults.add(costs[gopIndex]);
+
+        auto multiplier = workload_->numberOfTimesQueryIsExecuted(i);
+        results.add(CostElements(multiplier * queryResults.numPixels, multiplier * queryResults.numTiles, multiplier * queryResults.numBytes));
     }
     return results;
 }
 
-std::pair<int, CostElements> WorkloadCostEstimator::estimateCostForNextGOP(std::vector<int>::const_iterator &currentFrame,
-                                                                           std::vector<int>::const_iterator end,
-                                                                           std::shared_ptr<SemanticDataManager> metadataManager) {
-    if (currentFrame == end)
-        return std::make_pair(-1, CostElements(0, 0));
+void WorkloadCostEstimator::skipToNextGOP(std::vector<int>::const_iterator &start, std::vector<int>::const_iterator end) const {
+    auto gopNum = gopForFrame(*start);
+    while (start != end && gopForFrame(*start) == gopNum)
+        ++start;
+}
+
+void WorkloadCostEstimator::framesForQueryByGOP(unsigned int queryNum,
+                                                const std::unordered_set<unsigned int> *gopsToEstimate,
+                                                std::vector<FramesInGOP> &framesByGOP) {
+    auto semanticDataManager = workload_->semanticDataManagerForQuery(queryNum);
+    auto start = semanticDataManager->orderedFrames().begin();
+    auto end = semanticDataManager->orderedFrames().end();
+
+    while (start != end) {
+        if (gopsToEstimate && !gopsToEstimate->count(gopForFrame(*start))) {
+            skipToNextGOP(start, end);
+            continue;
+        }
+
+        framesByGOP.push_back(framesInNextGOP(start, end, semanticDataManager));
+    }
+}
+
+WorkloadCostEstimator::FramesInGOP WorkloadCostEstimator::framesInNextGOP(std::vector<int>::const_iterator &currentFrame,
+                                                                          std::vector<int>::const_iterator end,
+                                                                          std::shared_ptr<SemanticDataManager> metadataManager) {
+    assert(currentFrame != end);
+
+    FramesInGOP framesInGOP;
+    framesInGOP.gop = gopForFrame(*currentFrame);
+    framesInGOP.metadataManager = metadataManager;
+    while (currentFrame != end && gopForFrame(*currentFrame) == framesInGOP.gop) {
+        framesInGOP.frames.push_back(*currentFrame);
+        ++currentFrame;
+    }
+    return framesInGOP;
+}
+
+void WorkloadCostEstimator::gatherGOP(FramesInGOP &framesInGOP) {
+    auto keyframe = keyframeForFrame(framesInGOP.frames.front());
+    std::shared_ptr<TileLayout> storedLayout;
+    std::vector<StoredTileSizes::TileFrames> storedTiles;
+    {
+        // Layout providers, semantic data managers, and locating stored tiles cache lazily and are not thread-safe.
+        std::scoped_lock lock(gatherMutex_);
+        framesInGOP.layout = tileLayoutProvider_->tileLayoutForFrame(framesInGOP.frames.front());
+        // The semantic data manager owns the rectangles, so the pointers remain valid after it caches more frames.
+        for (auto frame : framesInGOP.frames)
+            framesInGOP.rectanglesForFrames.push_back(&framesInGOP.metadataManager->rectanglesForFrame(frame));
+
+        if (storedTileSizes_) {
+            storedLayout = storedTileSizes_->tileLayoutForFrame(keyframe);
+            storedTiles = storedTileSizes_->locateTiles(keyframe);
+        }
+    }
+
+    if (!storedTileSizes_)
+        return;
+
+    // Reading the stored tiles' sample tables is the slow part, and it runs concurrently with the other batches.
+    auto numberOfFrames = framesInGOP.frames.back() - keyframe + 1;
+    if (*storedLayout == *framesInGOP.layout) {
+        for (const auto &tileFrames : storedTiles)
+            framesInGOP.cumulativeBytesForTiles.push_back(storedTileSizes_->cumulativeBytesForTile(tileFrames, numberOfFrames));
+    } else {
+        framesInGOP.cumulativeBytesPerPixel = storedTileSizes_->cumulativeBytesPerPixel(*storedLayout, storedTiles, numberOfFrames);
+    }
+}
+
+std::vector<CostElements> WorkloadCostEstimator::estimateCostForGOPs(std::vector<FramesInGOP> &framesByGOP) {
+    std::vector<CostElements> costs(framesByGOP.size(), CostElements(0, 0));
+    if (!threadPool_ || threadPool_->numberOfThreads() < 2 || framesByGOP.size() < 2) {
+        std::transform(framesByGOP.begin(), framesByGOP.end(), costs.begin(), [&](FramesInGOP &framesInGOP) {
+            gatherGOP(framesInGOP);
+            return estimateCostForGOP(framesInGOP);
+        });
+        return costs;
+    }
+
+    // Hand each task a contiguous batch of GOPs to amortize scheduling overhead.
+    static const unsigned int BatchesPerThread = 4;
+    auto numberOfBatches = std::min<std::size_t>(framesByGOP.size(), threadPool_->numberOfThreads() * BatchesPerThread);
+    auto batchSize = (framesByGOP.size() + numberOfBatches - 1) / numberOfBatches;
+
+    std::vector<std::future<void>> batches;
+    for (auto first = 0u; first < framesByGOP.size(); first += batchSize) {
+        auto last = std::min(first + batchSize, framesByGOP.size());
+        batches.push_back(threadPool_->submit([&, first, last]() {
+            for (auto i = first; i < last; ++i) {
+                gatherGOP(framesByGOP[i]);
+                costs[i] = estimateCostForGOP(framesByGOP[i]);
+            }
+        }));
+    }
 
-    auto gopNum = gopForFrame(*currentFrame);
-    auto keyframe = keyframeForFrame(*currentFrame);
-    auto layoutForGOP = tileLayoutProvider_->tileLayoutForFrame(*currentFrame);
+    for (auto &batch : batches)
+        batch.get();
 
+    return costs;
+}
+
+std::vector<unsigned int> WorkloadCostEstimator::framesDecodedForTiles(const TileLayout &layout,
+        unsigned int keyframe,
+        const std::vector<int> &frames,
+        const std::vector<const std::list<Rectangle> *> &rectanglesForFrames) {
     // Find the frames that have an object overlapping the tiles.
-    auto numberOfTiles = layoutForGOP->numberOfTiles();
-    std::vector<int> maxFrameOverlappingTile(numberOfTiles, -1);
-    while (currentFrame != end && gopForFrame(*currentFrame) == gopNum) {
-        auto &rectanglesForFrame = metadataManager->rectanglesForFrame(*currentFrame);
+    auto numberOfTiles = layout.numberOfTiles();
+    std::vector<unsigned int> framesDecoded(numberOfTiles, 0);
+    for (auto frameIndex = 0u; frameIndex < frames.size(); ++frameIndex) {
+        auto &rectanglesForFrame = *rectanglesForFrames[frameIndex];
         for (auto i = 0u; i < numberOfTiles; ++i) {
-            auto tileRect = layoutForGOP->rectangleForTile(i);
+            auto tileRect = layout.rectangleForTile(i);
             bool anyIntersect = std::any_of(rectanglesForFrame.begin(), rectanglesForFrame.end(), [&](auto &rectangle) {
                 return tileRect.intersects(rectangle);
             });
             if (anyIntersect)
-                maxFrameOverlappingTile[i] = *currentFrame;
+                framesDecoded[i] = frames[frameIndex] - keyframe + 1;
         }
-        ++currentFrame;
     }
+    return framesDecoded;
+}
 
-    unsigned int totalNumPixels = 0;
-    unsigned int totalNumTiles = 0;
-    for (auto i = 0u; i < numberOfTiles; ++i) {
-        if (maxFrameOverlappingTile[i] < 0)
+CostElements WorkloadCostEstimator::estimateCostForGOP(const FramesInGOP &framesInGOP) const {
+    auto keyframe = keyframeForFrame(framesInGOP.frames.front());
+    auto &layoutForGOP = framesInGOP.layout;
+    auto framesDecoded = framesDecodedForTiles(*layoutForGOP, keyframe, framesInGOP.frames, framesInGOP.rectanglesForFrames);
+
+    unsigned long long totalNumPixels = 0;
+    unsigned long long totalNumTiles = 0;
+    unsigned long long totalNumBytes = 0;
+    for (auto i = 0u; i < framesDecoded.size(); ++i) {
+        if (!framesDecoded[i])
             continue;
 
-        unsigned int numTiles = maxFrameOverlappingTile[i] - keyframe + 1;
+        unsigned int numTiles = framesDecoded[i];
+        auto tileArea = static_cast<unsigned long long>(layoutForGOP->rectangleForTile(i).area());
         totalNumTiles += numTiles;
-        totalNumPixels += layoutForGOP->rectangleForTile(i).area() * numTiles;
+        totalNumPixels += tileArea * numTiles;
+
+        // Every frame from the keyframe has to be read, so the bytes are a prefix of the GOP.
+        if (!framesInGOP.cumulativeBytesForTiles.empty())
+            totalNumBytes += framesInGOP.cumulativeBytesForTiles[i][numTiles];
+        else if (!framesInGOP.cumulativeBytesPerPixel.empty())
+            totalNumBytes += std::llround(tileArea * framesInGOP.cumulativeBytesPerPixel[numTiles]);
     }
-    return std::make_pair(gopNum, CostElements(totalNumPixels, totalNumTiles));
+    return CostElements(totalNumPixels, totalNumTiles, totalNumBytes);
 }
 
-} // namespace tasm
\ No newline at end of file
+} // namespace tasm
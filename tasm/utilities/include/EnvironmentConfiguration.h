@@ -7,6 +7,8 @@
 
 namespace tasm {
 
+// Where an instance of TASM keeps its catalog and semantic index. Each TASM and VideoManager owns a copy, so one
+// process can serve several catalogs.
 class EnvironmentConfiguration {
 public:
     static constexpr auto DefaultLabelsDB = "default_db_path";
@@ -18,7 +20,9 @@ public:
 
     const std::experimental::filesystem::path &defaultLabelsDatabasePath() const { return labelsDatabasePath_; };
     const std::experimental::filesystem::path &catalogPath() const { return catalogPath_; }
+    std::experimental::filesystem::path pathForVideo(const std::string &video) const { return catalogPath_ / video; }
 
+    // The configuration of instances that aren't given one.
     static const EnvironmentConfiguration & instance() {
         if (instance_.has_value())
             return *instance_;
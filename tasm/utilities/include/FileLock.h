@@ -0,0 +1,36 @@
+#ifndef TASM_FILELOCK_H
+#define TASM_FILELOCK_H
+
+#include <experimental/filesystem>
+#include <memory>
+
+namespace tasm {
+
+// Holds a flock on a file for its lifetime, creating the file if necessary. Each holder opens the file separately,
+// so holders are serialized across threads as well as across processes on the host.
+class FileLock {
+public:
+    enum class Mode {
+        Shared,
+        Exclusive,
+    };
+
+    explicit FileLock(const std::experimental::filesystem::path &lockPath, Mode mode = Mode::Exclusive);
+    FileLock(const FileLock&) = delete;
+    ~FileLock();
+
+    // Returns nullptr instead of waiting if the lock is held by someone else.
+    static std::unique_ptr<FileLock> tryToLock(const std::experimental::filesystem::path &lockPath, Mode mode = Mode::Exclusive);
+    // For lock files that their holders delete. Opening and locking are separate steps, so the file can be deleted
+    // in between; this retries until the locked file is the one at lockPath.
+    static std::unique_ptr<FileLock> lockLinkedFile(const std::experimental::filesystem::path &lockPath, Mode mode = Mode::Exclusive);
+
+private:
+    FileLock(const std::experimental::filesystem::path &lockPath, Mode mode, bool wait);
+
+    int fileDescriptor_;
+};
+
+} // namespace tasm
+
+#endif //TASM_FILELOCK_H
@@ -15,17 +15,98 @@ public:
         return path / tile_metadata_filename_;
     }
 
+    static std::experimental::filesystem::path regretCheckpointFilename(const std::experimental::filesystem::path &path) {
+        return path / regret_checkpoint_filename_;
+    }
+
+    static std::experimental::filesystem::path regretLogFilename(const std::experimental::filesystem::path &path) {
+        return path / regret_log_filename_;
+    }
+
+    // Present in tile directories whose tiles were merged by stitching, so each frame has multiple slice segments.
+    static std::experimental::filesystem::path stitchedTilesMarkerFilename(const std::experimental::filesystem::path &directoryPath) {
+        return directoryPath / stitched_tiles_marker_filename_;
+    }
+
+    static bool containsStitchedTiles(const std::experimental::filesystem::path &directoryPath) {
+        return std::experimental::filesystem::exists(stitchedTilesMarkerFilename(directoryPath));
+    }
+
+    // Holds every tile of the directory when the video's tiles are packed.
+    static std::experimental::filesystem::path tilePackFilename(const std::experimental::filesystem::path &directoryPath) {
+        return directoryPath / tile_pack_filename_;
+    }
+
+    static bool containsTilePack(const std::experimental::filesystem::path &directoryPath) {
+        return std::experimental::filesystem::exists(tilePackFilename(directoryPath));
+    }
+
+    // Present in a video's directory when new tile directories should be written as packs.
+    static std::experimental::filesystem::path packTilesMarkerFilename(const std::experimental::filesystem::path &videoPath) {
+        return videoPath / pack_tiles_marker_filename_;
+    }
+
+    static bool shouldPackTiles(const std::experimental::filesystem::path &videoPath) {
+        return std::experimental::filesystem::exists(packTilesMarkerFilename(videoPath));
+    }
+
+    // Records the contents of the video's published tile files, so identical tiles can share a file.
+    static std::experimental::filesystem::path tileContentsFilename(const std::experimental::filesystem::path &videoPath) {
+        return videoPath / tile_contents_filename_;
+    }
+
+    static std::experimental::filesystem::path costModelFilename(const std::experimental::filesystem::path &catalogPath) {
+        return catalogPath / cost_model_filename_;
+    }
+
+    // Locked by writers of the video's catalog, so allocating versions and publishing is safe across processes.
+    // The catalog's own lock, in its directory, is held by writers of the files its videos share.
+    static std::experimental::filesystem::path catalogLockFilename(const std::experimental::filesystem::path &videoPath) {
+        return videoPath / catalog_lock_filename_;
+    }
+
+    // Held shared by readers whose snapshot of the catalog was taken while the video's tile version was version,
+    // so their directories aren't deleted by another process.
+    static std::experimental::filesystem::path snapshotPinFilename(const std::experimental::filesystem::path &videoPath, unsigned int version) {
+        return videoPath / (snapshot_pin_prefix_ + std::to_string(version) + lock_extension_);
+    }
+
+    static bool isSnapshotPinFilename(const std::experimental::filesystem::path &path) {
+        return path.filename().string().rfind(snapshot_pin_prefix_, 0) == 0 && path.extension() == lock_extension_;
+    }
+
+    static unsigned int tileVersionFromSnapshotPinFilename(const std::experimental::filesystem::path &pinPath) {
+        return std::stoul(pinPath.stem().string().substr(std::string(snapshot_pin_prefix_).length()));
+    }
+
+    static std::experimental::filesystem::path tileManifestFilename(const std::experimental::filesystem::path &path) {
+        return path / tile_manifest_filename_;
+    }
+
+    static std::experimental::filesystem::path tileManifestLogFilename(const std::experimental::filesystem::path &path) {
+        return path / tile_manifest_log_filename_;
+    }
+
     static std::experimental::filesystem::path directoryForTilesInFrames(const TiledEntry &entry, unsigned int firstFrame,
                                                            unsigned int lastFrame) {
-        return entry.path()  / (std::to_string(firstFrame) + separating_string_ + std::to_string(lastFrame) + separating_string_ + std::to_string(entry.tile_version()));
+        return directoryForTilesInFrames(entry.path(), firstFrame, lastFrame, entry.tile_version());
+    }
+
+    static std::experimental::filesystem::path directoryForTilesInFrames(const std::experimental::filesystem::path &videoPath,
+                                                           unsigned int firstFrame, unsigned int lastFrame, unsigned int version) {
+        return videoPath / (std::to_string(firstFrame) + separating_string_ + std::to_string(lastFrame) + separating_string_ + std::to_string(version));
     }
 
-    static std::experimental::filesystem::path temporaryTileFilename(const TiledEntry &entry, unsigned int tileNumber,
-                                                       unsigned int firstFrame,
-                                                       unsigned int lastFrame) {
-        auto tempName = directoryForTilesInFrames(entry, firstFrame, lastFrame) / (baseTileFilename(tileNumber) +
-                                                                          temporaryFilenameExtension());
-        return tempName;
+    // Tiles are written here and the directory is renamed to directoryForTilesInFrames() once it is complete.
+    // The version is only claimed at that point, so the name is made unique by the writer's identifier instead.
+    static std::experimental::filesystem::path stagingDirectoryForTilesInFrames(const std::experimental::filesystem::path &videoPath,
+                                                                  unsigned int firstFrame, unsigned int lastFrame,
+                                                                  const std::string &writerIdentifier) {
+        return videoPath / (staging_prefix_ + std::to_string(firstFrame) + separating_string_ + std::to_string(lastFrame) + separating_string_ + writerIdentifier);
+    }
+
+    static bool isStagingDirectory(const std::experimental::filesystem::path &directoryPath) {
+        return directoryPath.filename().string().rfind(staging_prefix_, 0) == 0;
     }
 
     static std::experimental::filesystem::path tileFilename(const std::experimental::filesystem::path &directoryPath, unsigned int tileNumber) {
@@ -63,18 +144,32 @@ public:
         return std::stoul(directoryName.substr(lastSeparator+1));
     }
 
-private:
-    static std::string temporaryFilenameExtension() {
-        return ".hevc";
+    static unsigned int tileNumberFromFilename(const std::experimental::filesystem::path &tilePath) {
+        return std::stoul(tilePath.stem().string().substr(std::string(tile_filename_prefix_).length()));
     }
 
+private:
     static std::string baseTileFilename(unsigned int tileNumber) {
-        return "orig-tile-" + std::to_string(tileNumber);
+        return tile_filename_prefix_ + std::to_string(tileNumber);
     }
 
+    static constexpr auto tile_filename_prefix_ = "orig-tile-";
     static constexpr auto tile_version_filename_ = "tile-version";
     static constexpr auto tile_metadata_filename_ = "tile-metadata.bin";
+    static constexpr auto regret_checkpoint_filename_ = "regret-state.bin";
+    static constexpr auto regret_log_filename_ = "regret-log.bin";
+    static constexpr auto cost_model_filename_ = "cost-model.bin";
+    static constexpr auto stitched_tiles_marker_filename_ = "stitched-tiles";
+    static constexpr auto catalog_lock_filename_ = "catalog.lock";
+    static constexpr auto snapshot_pin_prefix_ = "snapshot-";
+    static constexpr auto lock_extension_ = ".lock";
+    static constexpr auto tile_manifest_filename_ = "tile-manifest.bin";
+    static constexpr auto tile_manifest_log_filename_ = "tile-manifest-log.bin";
+    static constexpr auto tile_pack_filename_ = "tiles.pack";
+    static constexpr auto pack_tiles_marker_filename_ = "pack-tiles";
+    static constexpr auto tile_contents_filename_ = "tile-contents.bin";
     static constexpr auto separating_string_ = "-";
+    static constexpr auto staging_prefix_ = ".staging-";
 };
 
 } // namespace tasm
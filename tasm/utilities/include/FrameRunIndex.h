@@ -0,0 +1,89 @@
+#ifndef TASM_FRAMERUNINDEX_H
+#define TASM_FRAMERUNINDEX_H
+
+#include <algorithm>
+#include <optional>
+#include <queue>
+#include <vector>
+
+namespace tasm {
+
+// Maps each frame to the id of the interval that covers it. Where intervals overlap, the one with the largest id wins.
+// Overlaps are resolved when the index is built into sorted, non-overlapping runs, which lookups binary search.
+// The index is immutable, so reads don't lock.
+class FrameRunIndex {
+public:
+    struct Interval {
+        unsigned int firstFrame;
+        unsigned int lastFrame;
+        int id;
+    };
+
+    struct Run {
+        unsigned int firstFrame;
+        unsigned int lastFrame;
+        int id;
+    };
+
+    FrameRunIndex() = default;
+
+    explicit FrameRunIndex(std::vector<Interval> intervals) {
+        buildRuns(intervals);
+    }
+
+    std::optional<int> idForFrame(unsigned int frame) const {
+        // The last run that starts at or before the frame is the only one that can contain it.
+        auto run = std::upper_bound(runs_.begin(), runs_.end(), frame, [](unsigned int frame, const Run &run) {
+            return frame < run.firstFrame;
+        });
+        if (run == runs_.begin() || std::prev(run)->lastFrame < frame)
+            return {};
+        return std::prev(run)->id;
+    }
+
+    const std::vector<Run> &runs() const { return runs_; }
+
+private:
+    void buildRuns(std::vector<Interval> &intervals) {
+        std::sort(intervals.begin(), intervals.end(), [](const Interval &first, const Interval &second) {
+            return first.firstFrame < second.firstFrame;
+        });
+
+        // Every point where the covering interval can change.
+        std::vector<unsigned long long> boundaries;
+        boundaries.reserve(intervals.size() * 2);
+        for (const auto &interval : intervals) {
+            boundaries.push_back(interval.firstFrame);
+            boundaries.push_back(interval.lastFrame + 1ull);
+        }
+        std::sort(boundaries.begin(), boundaries.end());
+        boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+
+        // Sweep the boundaries, keeping the covering intervals ordered by id.
+        auto compareIds = [](const Interval &first, const Interval &second) { return first.id < second.id; };
+        std::priority_queue<Interval, std::vector<Interval>, decltype(compareIds)> covering(compareIds);
+        auto nextInterval = intervals.begin();
+        for (auto boundary = boundaries.begin(); boundary != boundaries.end() && std::next(boundary) != boundaries.end(); ++boundary) {
+            while (nextInterval != intervals.end() && nextInterval->firstFrame == *boundary)
+                covering.push(*nextInterval++);
+            while (!covering.empty() && covering.top().lastFrame < *boundary)
+                covering.pop();
+            if (covering.empty())
+                continue;
+
+            auto firstFrame = static_cast<unsigned int>(*boundary);
+            auto lastFrame = static_cast<unsigned int>(*std::next(boundary) - 1);
+            auto id = covering.top().id;
+            if (!runs_.empty() && runs_.back().id == id && runs_.back().lastFrame + 1 == firstFrame)
+                runs_.back().lastFrame = lastFrame;
+            else
+                runs_.push_back({firstFrame, lastFrame, id});
+        }
+    }
+
+    std::vector<Run> runs_;
+};
+
+} // namespace tasm
+
+#endif //TASM_FRAMERUNINDEX_H
@@ -0,0 +1,58 @@
+#ifndef TASM_THREADPOOL_H
+#define TASM_THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace tasm {
+
+// Fixed-size pool of worker threads that run tasks in the order they are submitted.
+// Tasks must not wait on other tasks submitted to the same pool.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int numberOfThreads = defaultNumberOfThreads());
+    ThreadPool(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    template <typename F>
+    auto submit(F &&task) -> std::future<decltype(task())> {
+        using ResultType = decltype(task());
+        auto packagedTask = std::make_shared<std::packaged_task<ResultType()>>(std::forward<F>(task));
+        auto future = packagedTask->get_future();
+        {
+            std::scoped_lock lock(mutex_);
+            tasks_.emplace([packagedTask]() { (*packagedTask)(); });
+        }
+        condition_.notify_one();
+        return future;
+    }
+
+    unsigned int numberOfThreads() const { return workers_.size(); }
+
+    // Pool shared by callers that don't need to control their own parallelism.
+    static std::shared_ptr<ThreadPool> shared();
+
+    static unsigned int defaultNumberOfThreads() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+private:
+    void runWorker();
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool isShuttingDown_;
+};
+
+} // namespace tasm
+
+#endif //TASM_THREADPOOL_H
@@ -1,39 +1,71 @@
 #ifndef TASM_TRANSACTION_H
 #define TASM_TRANSACTION_H
 
+#include "CatalogStorage.h"
 #include "Files.h"
+#include "MP4Writer.h"
+#include "ThreadPool.h"
+#include "TileContentIndex.h"
 #include "TileLayout.h"
+#include "TilePack.h"
 #include "Video.h"
+#include <functional>
 #include <mutex>
 
 class Transaction;
 class OutputStream {
 public:
+    // Tiles are muxed straight into the staging directory under their final names.
     OutputStream(const Transaction &transaction,
                  const tasm::TiledEntry &entry,
+                 const std::experimental::filesystem::path &stagingDirectory,
                  unsigned int tileNumber,
-                 unsigned int firstFrame,
-                 unsigned int lastFrame)
+                 unsigned int frameRate,
+                 bool packTile = false)
             : transaction_(transaction),
             entry_(entry),
-              filename_(tasm::TileFiles::temporaryTileFilename(entry, tileNumber, firstFrame, lastFrame)),
-              codec_(Codec::HEVC),
-              stream_(filename_)
-    { }
+              filename_(tasm::TileFiles::tileFilename(stagingDirectory, tileNumber)),
+              codec_(Codec::HEVC)
+    {
+        if (packTile)
+            packedTile_ = std::make_unique<tasm::PackedTileBuffer>(tileNumber);
+        else
+            writer_ = std::make_unique<MP4Writer>(filename_, frameRate);
+    }
 
     OutputStream(const OutputStream&) = delete;
     OutputStream(OutputStream&&) = default;
 
-    std::ofstream& stream() { return stream_; }
+    // Takes Annex B data, which is muxed into the tile's mp4 as it is written.
+    // Packed tiles are buffered until the transaction writes its pack.
+    void write(const char *data, size_t size) {
+        if (packedTile_)
+            packedTile_->write(data, size);
+        else {
+            writer_->write(data, size);
+            hasher_.update(data, size);
+        }
+    }
+    void close() {
+        if (packedTile_)
+            packedTile_->close();
+        else
+            writer_->close();
+    }
     const std::experimental::filesystem::path &filename() const { return filename_; }
     const auto &codec() const { return codec_; }
+    const tasm::PackedTileBuffer *packedTile() const { return packedTile_.get(); }
+    // Only for tiles that aren't packed, once they are closed.
+    tasm::TileContentIndex::Content content() const { return {hasher_.hash(), std::experimental::filesystem::file_size(filename_)}; }
 
 protected:
     const Transaction &transaction_;
     const tasm::TiledEntry &entry_;
     const std::experimental::filesystem::path filename_;
     const Codec codec_;
-    std::ofstream stream_;
+    std::unique_ptr<MP4Writer> writer_;
+    std::unique_ptr<tasm::PackedTileBuffer> packedTile_;
+    tasm::TileContentIndex::Hasher hasher_;
 };
 
 class Transaction {
@@ -72,13 +104,22 @@ private:
 
 class TileCrackingTransaction: public Transaction {
 public:
-    TileCrackingTransaction(std::shared_ptr<tasm::TiledEntry> entry, const tasm::TileLayout &tileLayout, int firstFrame = -1, int lastFrame = -1)
+    // The tiles are timed at frameRate, which should be the frame rate of the video they were encoded from.
+    TileCrackingTransaction(std::shared_ptr<tasm::TiledEntry> entry, const tasm::TileLayout &tileLayout, int firstFrame = -1, int lastFrame = -1,
+                            unsigned int frameRate = MP4Writer::DefaultFrameRate)
             : Transaction(0u),
               entry_(entry),
               tileLayout_(tileLayout),
               firstFrame_(firstFrame),
               lastFrame_(lastFrame),
-              complete_(false)
+              frameRate_(frameRate),
+              stagingDirectory_(tasm::TileFiles::stagingDirectoryForTilesInFrames(entry_->path(), firstFrame_, lastFrame_, uniqueWriterIdentifier())),
+              storage_(tasm::CatalogStorage::forPath(entry_->path())),
+              threadPool_(tasm::ThreadPool::shared()),
+              packTiles_(storage_->shouldPackTiles(entry_->path())),
+              tilesAreStitched_(false),
+              complete_(false),
+              published_(false)
     {
         prepareTileDirectory();
     }
@@ -91,26 +132,57 @@ public:
     virtual OutputStream& write(unsigned int tileNumber) {
         return outputs_.emplace_back(*this,
                                      *entry_,
+                                     stagingDirectory_,
                                      tileNumber,
-                                     firstFrame_,
-                                     lastFrame_);
+                                     frameRate_,
+                                     packTiles_);
     }
 
+    // Writes the tiles concurrently. The outputs are created up front, so each call only touches its own output.
+    // If any tile fails, the transaction is aborted and the first error is rethrown.
+    void writeTiles(const std::vector<unsigned int> &tileNumbers,
+                    const std::function<void(unsigned int tileNumber, OutputStream &output)> &writeTile);
+
+    // Records that the tiles were merged by stitching, so readers don't try to stitch them again.
+    void markTilesAsStitched() { tilesAreStitched_ = true; }
+
+    // The tiles are only published if canPublish accepts the video's other directories when the commit records them.
+    // Otherwise the commit discards them.
+    void publishOnlyIf(tasm::CatalogStorage::PublishCondition canPublish) { canPublish_ = std::move(canPublish); }
+    bool isPublished() const { return published_; }
+
     void commit() override;
 
     void abort() override;
 
 private:
+    // Distinct for every transaction on the host, so concurrent writers never stage into the same directory.
+    static std::string uniqueWriterIdentifier();
     void prepareTileDirectory();
-    void writeTileMetadata();
+    void writeTilePack();
+    // Replaces staged tiles that are identical to published ones with hard links to the published files.
+    void linkIdenticalTiles(const tasm::TileContentIndex &contentIndex, const std::vector<tasm::TileContentIndex::Content> &contents);
+    // Runs task(0), ..., task(count - 1) on the thread pool and aborts if any of them throws.
+    void runConcurrently(unsigned int count, const std::function<void(unsigned int)> &task);
 
     std::shared_ptr<tasm::TiledEntry> entry_;
     const tasm::TileLayout tileLayout_;
 
     int firstFrame_;
     int lastFrame_;
-
+    const unsigned int frameRate_;
+    const std::experimental::filesystem::path stagingDirectory_;
+    // Set when the commit claims a version.
+    std::experimental::filesystem::path directory_;
+
+    std::shared_ptr<tasm::CatalogStorage> storage_;
+    std::shared_ptr<tasm::ThreadPool> threadPool_;
+    // Whether the tiles go into a single pack rather than a file each.
+    const bool packTiles_;
+    bool tilesAreStitched_;
+    tasm::CatalogStorage::PublishCondition canPublish_;
     bool complete_;
+    bool published_;
 };
 
 #endif //TASM_TRANSACTION_H
@@ -0,0 +1,62 @@
+#include "FileLock.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tasm {
+
+FileLock::FileLock(const std::experimental::filesystem::path &lockPath, Mode mode)
+    : FileLock(lockPath, mode, true)
+{ }
+
+FileLock::FileLock(const std::experimental::filesystem::path &lockPath, Mode mode, bool wait)
+    : fileDescriptor_(open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644))
+{
+    if (fileDescriptor_ < 0)
+        throw std::runtime_error("Failed to open lock file " + lockPath.string());
+
+    int result;
+    do {
+        result = flock(fileDescriptor_, (mode == Mode::Shared ? LOCK_SH : LOCK_EX) | (wait ? 0 : LOCK_NB));
+    } while (result && errno == EINTR);
+
+    if (result) {
+        auto error = errno;
+        ::close(fileDescriptor_);
+        fileDescriptor_ = -1;
+        if (!wait && error == EWOULDBLOCK)
+            return;
+        throw std::runtime_error("Failed to lock " + lockPath.string());
+    }
+}
+
+FileLock::~FileLock() {
+    // Closing the descriptor releases the lock.
+    if (fileDescriptor_ >= 0)
+        ::close(fileDescriptor_);
+}
+
+std::unique_ptr<FileLock> FileLock::tryToLock(const std::experimental::filesystem::path &lockPath, Mode mode) {
+    std::unique_ptr<FileLock> lock(new FileLock(lockPath, mode, false));
+    if (lock->fileDescriptor_ < 0)
+        return nullptr;
+    return lock;
+}
+
+std::unique_ptr<FileLock> FileLock::lockLinkedFile(const std::experimental::filesystem::path &lockPath, Mode mode) {
+    while (true) {
+        std::unique_ptr<FileLock> lock(new FileLock(lockPath, mode, true));
+        struct stat lockedFile;
+        struct stat linkedFile;
+        if (fstat(lock->fileDescriptor_, &lockedFile))
+            throw std::runtime_error("Failed to stat lock file " + lockPath.string());
+        if (!stat(lockPath.c_str(), &linkedFile) && lockedFile.st_dev == linkedFile.st_dev && lockedFile.st_ino == linkedFile.st_ino)
+            return lock;
+    }
+}
+
+} // namespace tasm
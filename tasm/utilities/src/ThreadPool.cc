@@ -0,0 +1,46 @@
+#include "ThreadPool.h"
+
+namespace tasm {
+
+ThreadPool::ThreadPool(unsigned int numberOfThreads)
+        : isShuttingDown_(false) {
+    workers_.reserve(numberOfThreads);
+    for (auto i = 0u; i < numberOfThreads; ++i)
+        workers_.emplace_back(&ThreadPool::runWorker, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::scoped_lock lock(mutex_);
+        isShuttingDown_ = true;
+    }
+    condition_.notify_all();
+
+    for (auto &worker : workers_)
+        worker.join();
+}
+
+std::shared_ptr<ThreadPool> ThreadPool::shared() {
+    static auto pool = std::make_shared<ThreadPool>();
+    return pool;
+}
+
+void ThreadPool::runWorker() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return isShuttingDown_ || !tasks_.empty(); });
+
+            // Finish any queued work before shutting down.
+            if (tasks_.empty())
+                return;
+
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+    }
+}
+
+} // namespace tasm
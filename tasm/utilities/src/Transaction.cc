@@ -1,39 +1,135 @@
 #include "Transaction.h"
 
-#include "Gpac.h"
+#include "TileContentIndex.h"
+#include "TiledVideoManager.h"
+#include <atomic>
 #include <iostream>
+#include <unistd.h>
+
+std::string TileCrackingTransaction::uniqueWriterIdentifier() {
+    static std::atomic<unsigned long> numberOfTransactions(0);
+    return std::to_string(getpid()) + "." + std::to_string(numberOfTransactions++);
+}
 
 void TileCrackingTransaction::prepareTileDirectory() {
-    auto directory = tasm::TileFiles::directoryForTilesInFrames(*entry_, firstFrame_, lastFrame_);
-    std::error_code error;
-    if (!std::experimental::filesystem::create_directory(directory, error))
-        std::cerr << "Failed to create tile directory: " << error.message() << std::endl;
+    storage_->stageDirectory(stagingDirectory_);
 }
 
 void TileCrackingTransaction::abort() {
     complete_ = true;
-    for(const auto &output: outputs())
-        std::experimental::filesystem::remove(output.filename());
+    storage_->discard(stagingDirectory_);
 }
 
 void TileCrackingTransaction::commit() {
     complete_ = true;
 
-    for (auto &output : outputs()) {
-        output.stream().close();
+    // Finishing a tile writes its sample table, and no tile is published unless all of them are finished.
+    std::vector<OutputStream*> outputsToClose;
+    for (auto &output : outputs())
+        outputsToClose.push_back(&output);
+    std::vector<tasm::TileContentIndex::Content> contents(outputsToClose.size());
+    runConcurrently(outputsToClose.size(), [&](unsigned int i) {
+        outputsToClose[i]->close();
+        if (!packTiles_)
+            contents[i] = outputsToClose[i]->content();
+    });
 
-        // Mux the outputs to mp4.
-        auto muxedFile = output.filename();
-        muxedFile.replace_extension(tasm::TileFiles::muxedFilenameExtension());
-        tasm::gpac::mux_media(output.filename(), muxedFile);
+    std::shared_ptr<tasm::TileContentIndex> contentIndex;
+    try {
+        if (packTiles_)
+            writeTilePack();
+        else {
+            contentIndex = tasm::TileContentIndex::forVideo(entry_->path());
+            linkIdenticalTiles(*contentIndex, contents);
+        }
+    } catch (...) {
+        abort();
+        throw;
     }
 
-    writeTileMetadata();
+    try {
+        // Claim the version before publishing so that an interrupted commit can't leave a directory whose version is reused.
+        // The claim is shared with other processes, so concurrent writers always publish to different directories.
+        // If it fails, the staged tiles are discarded like any other failed commit.
+        directory_ = tasm::TileFiles::directoryForTilesInFrames(entry_->path(), firstFrame_, lastFrame_, entry_->allocateTileVersion());
+        published_ = storage_->publish(stagingDirectory_, directory_, tileLayout_, tilesAreStitched_, canPublish_);
+    } catch (...) {
+        abort();
+        throw;
+    }
+    if (!published_)
+        return;
+    tasm::TiledVideoManagerCache::instance().invalidate(entry_->path());
 
-    entry_->incrementTileVersion();
+    if (contentIndex) {
+        std::vector<std::pair<tasm::TileContentIndex::Content, std::experimental::filesystem::path>> publishedTiles;
+        for (auto i = 0u; i < outputsToClose.size(); ++i)
+            publishedTiles.emplace_back(contents[i], directory_ / outputsToClose[i]->filename().filename());
+        // The tiles are already published, so failing to index them only means later copies aren't shared.
+        try {
+            contentIndex->add(publishedTiles);
+        } catch (const std::exception &exception) {
+            std::cerr << "Failed to index tile contents: " << exception.what() << std::endl;
+        }
+    }
+}
+
+void TileCrackingTransaction::linkIdenticalTiles(const tasm::TileContentIndex &contentIndex, const std::vector<tasm::TileContentIndex::Content> &contents) {
+    auto i = 0u;
+    for (const auto &output : outputs()) {
+        auto &content = contents[i++];
+        auto identicalFile = contentIndex.findIdenticalFile(content, output.filename());
+        if (!identicalFile)
+            continue;
+
+        // Link next to the staged tile and rename over it, so the tile is never missing.
+        auto link = output.filename();
+        link += ".link";
+        std::error_code error;
+        std::experimental::filesystem::create_hard_link(*identicalFile, link, error);
+        if (!error)
+            std::experimental::filesystem::rename(link, output.filename(), error);
+        // The copy that was written is just as good if the file was deleted or can't be linked.
+        if (error)
+            std::experimental::filesystem::remove(link, error);
+    }
+}
+
+void TileCrackingTransaction::writeTiles(const std::vector<unsigned int> &tileNumbers,
+                                         const std::function<void(unsigned int, OutputStream&)> &writeTile) {
+    std::vector<OutputStream*> tileOutputs;
+    for (auto tileNumber : tileNumbers)
+        tileOutputs.push_back(&write(tileNumber));
+
+    runConcurrently(tileNumbers.size(), [&](unsigned int i) { writeTile(tileNumbers[i], *tileOutputs[i]); });
+}
+
+void TileCrackingTransaction::runConcurrently(unsigned int count, const std::function<void(unsigned int)> &task) {
+    std::vector<std::future<void>> results;
+    results.reserve(count);
+    for (auto i = 0u; i < count; ++i)
+        results.push_back(threadPool_->submit([&task, i]() { task(i); }));
+
+    // Wait for every task before aborting so that none of them is still writing to the staging directory.
+    std::exception_ptr failure;
+    for (auto &result : results) {
+        try {
+            result.get();
+        } catch (...) {
+            if (!failure)
+                failure = std::current_exception();
+        }
+    }
+
+    if (failure) {
+        abort();
+        std::rethrow_exception(failure);
+    }
 }
 
-void TileCrackingTransaction::writeTileMetadata() {
-    auto metadataFilename = tasm::TileFiles::tileMetadataFilename(*entry_, firstFrame_, lastFrame_);
-    tasm::gpac::write_tile_configuration(metadataFilename, tileLayout_);
+void TileCrackingTransaction::writeTilePack() {
+    std::vector<const tasm::PackedTileBuffer*> packedTiles;
+    for (const auto &output : outputs())
+        packedTiles.push_back(output.packedTile());
+    storage_->writeTilePack(stagingDirectory_, packedTiles, frameRate_);
 }
\ No newline at end of file
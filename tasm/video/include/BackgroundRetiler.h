@@ -0,0 +1,42 @@
+#ifndef TASM_BACKGROUNDRETILER_H
+#define TASM_BACKGROUNDRETILER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+namespace tasm {
+
+// Retiles videos on a worker thread so that callers don't wait for decoding and re-encoding.
+// A video that is scheduled several times before the worker gets to it is only retiled once.
+class BackgroundRetiler {
+public:
+    explicit BackgroundRetiler(std::function<void(const std::string&)> retileVideo);
+    BackgroundRetiler(const BackgroundRetiler&) = delete;
+    ~BackgroundRetiler();
+
+    void schedule(const std::string &video);
+    // Blocks until every scheduled video has been retiled.
+    void waitUntilIdle();
+
+private:
+    void run();
+
+    std::function<void(const std::string&)> retileVideo_;
+    std::deque<std::string> pendingVideos_;
+    std::unordered_set<std::string> scheduledVideos_;
+    bool isRetiling_;
+    bool isShuttingDown_;
+    std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable idle_;
+    std::thread worker_;
+};
+
+} // namespace tasm
+
+#endif //TASM_BACKGROUNDRETILER_H
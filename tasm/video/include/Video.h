@@ -17,7 +17,7 @@ public:
 
 namespace files {
 static std::experimental::filesystem::path PathForVideo(const std::string &video) {
-    return CatalogConfiguration::CatalogPath() / video;
+    return EnvironmentConfiguration::instance().pathForVideo(video);
 }
 } // namespace tasm::files
 
@@ -48,8 +48,7 @@ public:
         path_(path),
         version_(loadVersion())
     {
-        if (!std::experimental::filesystem::exists(path_))
-            std::experimental::filesystem::create_directory(path_);
+        createInStorage();
     }
 
     unsigned int tile_version() const { return version_; }
@@ -57,19 +56,13 @@ public:
     const std::string &name() const { return name_; }
     const std::string &metadataIdentifier() const { return metadataIdentifier_; }
 
-    void incrementTileVersion();
+    // Claims the next version for a tile directory of the video. tile_version() is then the version after it.
+    unsigned int allocateTileVersion();
 
 private:
-    unsigned int loadVersion() {
-        auto versionPath = path_ / "tile-version";
-
-        if (std::experimental::filesystem::exists(versionPath)) {
-            std::ifstream f(versionPath);
-            return static_cast<unsigned int>(stoul(std::string(std::istreambuf_iterator<char>(f),
-                                                               std::istreambuf_iterator<char>())));
-        } else
-            return 0u;
-    }
+    // The version and the video's tiles are kept by the catalog storage that holds path_.
+    unsigned int loadVersion() const;
+    void createInStorage();
 
     const std::string name_;
     const std::string metadataIdentifier_;
@@ -1,16 +1,25 @@
 #ifndef TASM_VIDEOMANAGER_H
 #define TASM_VIDEOMANAGER_H
 
+#include "BackgroundRetiler.h"
+#include "CompactTiles.h"
+#include "EnvironmentConfiguration.h"
 #include "GPUContext.h"
 #include "ImageUtilities.h"
+#include "QueryPlan.h"
 #include "RegretAccumulator.h"
+#include "RetilingScheduler.h"
 #include "VideoLock.h"
 #include <experimental/filesystem>
+#include <mutex>
+#include <unordered_set>
 #include <TileConfigurationProvider.h>
 
 namespace tasm {
 class SemanticIndex;
 class MetadataSelection;
+class TiledEntry;
+class TileLocationProvider;
 class TemporalSelection;
 class Video;
 
@@ -22,9 +31,11 @@ enum class SelectStrategy{
 
 class VideoManager {
 public:
-    VideoManager()
-        : gpuContext_(new GPUContext(0)),
-        lock_(new VideoLock(gpuContext_)) {
+    explicit VideoManager(const EnvironmentConfiguration &configuration = EnvironmentConfiguration::instance())
+        : configuration_(configuration),
+        gpuContext_(new GPUContext(0)),
+        lock_(new VideoLock(gpuContext_)),
+        backgroundRetiler_(new BackgroundRetiler([this](const std::string &video) { retileVideoBasedOnRegret(video); })) {
         createCatalogIfNecessary();
     }
 
@@ -36,6 +47,8 @@ public:
                                     std::shared_ptr<MetadataSelection> metadataSelection,
                                     std::shared_ptr<SemanticIndex> semanticIndex,
                                     bool force);
+    // Removes the video's tiles and regret state, waiting for any retile that is in progress.
+    void deleteVideo(const std::string &video);
 
     std::unique_ptr<ImageIterator> select(const std::string &video,
                                           const std::string &metadataIdentifier,
@@ -44,22 +57,71 @@ public:
                                           std::shared_ptr<SemanticIndex> semanticIndex,
                                           SelectStrategy selectStrategy=SelectStrategy::Objects);
 
+    // Describes what select() would read and estimates its cost without decoding anything.
+    std::unique_ptr<QueryPlan> explain(const std::string &video,
+                                       const std::string &metadataIdentifier,
+                                       std::shared_ptr<MetadataSelection> metadataSelection,
+                                       std::shared_ptr<TemporalSelection> temporalSelection,
+                                       std::shared_ptr<SemanticIndex> semanticIndex,
+                                       SelectStrategy selectStrategy=SelectStrategy::Objects);
+
     void retileVideoBasedOnRegret(const std::string &video);
+    // Retiles on a worker thread. Each retiled GOP becomes visible to select() once all of its tiles are written.
+    void retileVideoBasedOnRegretInBackground(const std::string &video);
+    void waitForBackgroundRetiling();
 
-    void activateRegretBasedRetilingForVideo(const std::string &video, const std::string &metadataIdentifier, std::shared_ptr<SemanticIndex> semanticIndex, double threshold = 1.0);
+    // When retileInBackground is set, every select() on the video schedules a background retile.
+    void activateRegretBasedRetilingForVideo(const std::string &video, const std::string &metadataIdentifier, std::shared_ptr<SemanticIndex> semanticIndex, double threshold = 1.0, bool retileInBackground = false);
     void deactivateRegretBasedRetilingForVideo(const std::string &video);
+    // Limits the work done by each retiling pass. GOPs with the most regret per unit of encode cost are retiled first.
+    void setRetilingBudgetForVideo(const std::string &video, RetilingBudget budget);
+    // These settings throw unless the video has regret-based retiling activated.
+    void setRegretCostModelForVideo(const std::string &video, RegretCostModel costModel);
+    // Existing regret is multiplied by decay before each query, so regret from old queries fades. 1.0 disables decay.
+    void setRegretDecayForVideo(const std::string &video, double decay);
+    // Limits how many past queries are kept to evaluate layouts for newly queried objects.
+    void setRegretHistoryLengthForVideo(const std::string &video, unsigned int historyLength);
+    // When a GOP's new layout only merges its stored tiles, the merged tiles are stitched rather than re-encoded.
+    // SelectStrategy::Frames and retiling read those GOPs from the tiles they were stitched from, which compaction keeps.
+    void setRetileByStitchingForVideo(const std::string &video, bool retileByStitching);
+
+    // Merges consecutive tile directories with the same layout and removes versions that newer retiles fully replace.
+    // By default, older layouts that tiled queries may read because they are cheaper are kept.
+    // Queries that are already running keep reading the versions they started with.
+    void compactVideo(const std::string &video, CompactionPolicy policy = CompactionPolicy::KeepAlternativeLayouts);
+    // Compacts after each retiling pass, so with background retiling compaction also happens in the background.
+    void setCompactAfterRetilingForVideo(const std::string &video, bool compactAfterRetiling);
+    // Tile directories written from now on store all of their tiles in a single file with one sample index.
+    // Directories that are already stored keep their format.
+    void setPackTilesForVideo(const std::string &video, bool packTiles);
 
 private:
     void createCatalogIfNecessary();
+    std::shared_ptr<TiledEntry> entryForVideo(const std::string &video, const std::string &metadataIdentifier = "") const;
     void storeTiledVideo(std::shared_ptr<Video>, std::shared_ptr<TileLayoutProvider>, const std::string &savedName);
     void setUpRegretBasedRetiling(const std::string &video, std::shared_ptr<SemanticDataManager> selection, std::shared_ptr<TileLayoutProvider> currentLayout);
-    void accumulateRegret(const std::string &video, std::shared_ptr<SemanticDataManager> selection, std::shared_ptr<TileLayoutProvider> currentLayout);
-    void retileVideo(std::shared_ptr<Video> video, std::shared_ptr<std::vector<int>> framesToRead, std::shared_ptr<TileLayoutProvider> newLayoutProvider, const std::string &savedName);
+    // Throws if regret-based retiling isn't activated for the video. Called with regretMutex_ held.
+    RegretAccumulator &regretAccumulatorForVideo(const std::string &video);
+    void accumulateRegret(RegretAccumulator &regretAccumulator, std::shared_ptr<SemanticDataManager> selection, std::shared_ptr<TileLayoutProvider> currentLayout);
+    void compactVideoWithoutLocking(const std::string &video, CompactionPolicy policy = CompactionPolicy::KeepAlternativeLayouts);
+    void retileVideo(std::shared_ptr<TiledEntry> entry, std::shared_ptr<TileLocationProvider> tileLocationProvider, std::shared_ptr<std::vector<int>> framesToRead, unsigned int numberOfGOPs, std::shared_ptr<TileLayoutProvider> newLayoutProvider, const std::string &savedName);
 
+    const EnvironmentConfiguration configuration_;
     std::shared_ptr<GPUContext> gpuContext_;
     std::shared_ptr<VideoLock> lock_;
 
+    // Guards the regret accumulators, which are used by both select() and the background retiler.
+    std::mutex regretMutex_;
     std::unordered_map<std::string, std::shared_ptr<RegretAccumulator>> videoToRegretAccumulator_;
+    std::unordered_set<std::string> videosToRetileInBackground_;
+    std::unordered_set<std::string> videosToRetileByStitching_;
+    std::unordered_set<std::string> videosToCompactAfterRetiling_;
+    std::unordered_map<std::string, RetilingScheduler> videoToRetilingScheduler_;
+    // Retiles allocate tile versions, so only one runs at a time.
+    std::mutex retileMutex_;
+
+    // Declared last so the worker stops before anything it uses is destroyed.
+    std::unique_ptr<BackgroundRetiler> backgroundRetiler_;
 };
 
 } // namespace tasm
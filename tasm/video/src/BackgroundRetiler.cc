@@ -0,0 +1,69 @@
+#include "BackgroundRetiler.h"
+
+#include <iostream>
+
+namespace tasm {
+
+BackgroundRetiler::BackgroundRetiler(std::function<void(const std::string&)> retileVideo)
+    : retileVideo_(std::move(retileVideo)),
+    isRetiling_(false),
+    isShuttingDown_(false),
+    worker_(&BackgroundRetiler::run, this)
+{ }
+
+BackgroundRetiler::~BackgroundRetiler() {
+    {
+        std::scoped_lock lock(mutex_);
+        isShuttingDown_ = true;
+    }
+    workAvailable_.notify_all();
+    worker_.join();
+}
+
+void BackgroundRetiler::schedule(const std::string &video) {
+    {
+        std::scoped_lock lock(mutex_);
+        if (!scheduledVideos_.insert(video).second)
+            return;
+        pendingVideos_.push_back(video);
+    }
+    workAvailable_.notify_one();
+}
+
+void BackgroundRetiler::waitUntilIdle() {
+    std::unique_lock lock(mutex_);
+    idle_.wait(lock, [this] { return pendingVideos_.empty() && !isRetiling_; });
+}
+
+void BackgroundRetiler::run() {
+    while (true) {
+        std::string video;
+        {
+            std::unique_lock lock(mutex_);
+            workAvailable_.wait(lock, [this] { return isShuttingDown_ || !pendingVideos_.empty(); });
+            // Videos that are still pending at shutdown keep their regret, so they will be retiled later.
+            if (isShuttingDown_)
+                return;
+
+            video = pendingVideos_.front();
+            pendingVideos_.pop_front();
+            // Remove the video now so that regret accumulated while it is being retiled schedules it again.
+            scheduledVideos_.erase(video);
+            isRetiling_ = true;
+        }
+
+        try {
+            retileVideo_(video);
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to retile " << video << " in the background: " << e.what() << std::endl;
+        }
+
+        {
+            std::scoped_lock lock(mutex_);
+            isRetiling_ = false;
+        }
+        idle_.notify_all();
+    }
+}
+
+} // namespace tasm
@@ -1,14 +1,21 @@
 #include "Video.h"
 
+#include "CatalogStorage.h"
 #include "Files.h"
 
 namespace tasm {
 
-void TiledEntry::incrementTileVersion() {
-    std::ofstream output(TileFiles::tileVersionFilename(path_));
+unsigned int TiledEntry::loadVersion() const {
+    return CatalogStorage::forPath(path_)->tileVersion(path_);
+}
+
+void TiledEntry::createInStorage() {
+    CatalogStorage::forPath(path_)->createVideo(path_);
+}
 
-    ++version_;
-    auto newVersionAsString = std::to_string( version_);
-    std::copy(newVersionAsString.begin(), newVersionAsString.end(), std::ostreambuf_iterator<char>(output));
+unsigned int TiledEntry::allocateTileVersion() {
+    auto version = CatalogStorage::forPath(path_)->allocateTileVersion(path_);
+    version_ = version + 1;
+    return version;
 }
-} // namespace tasm
\ No newline at end of file
+} // namespace tasm
@@ -1,5 +1,7 @@
 #include "VideoConfiguration.h"
 
+#include "Files.h"
+#include "TilePack.h"
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
@@ -20,7 +22,27 @@ Codec CodecFromAVCodec(AVCodecID codecId) {
     }
 }
 
+static std::unique_ptr<Configuration> GetPackedTileConfiguration(const TilePack &pack, const std::experimental::filesystem::path &path) {
+    const auto &tile = pack.tile(TileFiles::tileNumberFromFilename(path));
+    unsigned long long bytes = 0;
+    for (auto size : tile.sampleSizes)
+        bytes += size;
+    auto bitrate = tile.sampleSizes.empty() ? 0 : bytes * 8 * pack.frameRate() / tile.sampleSizes.size();
+
+    return std::make_unique<Configuration>(
+            tile.width, tile.height,
+            tile.codedWidth, tile.codedHeight,
+            tile.codedWidth, tile.codedHeight,
+            pack.frameRate(), Codec::HEVC, static_cast<unsigned int>(bitrate));
+}
+
 std::unique_ptr<Configuration> GetConfiguration(const std::experimental::filesystem::path &path) {
+    // Packed tiles don't have a file of their own for libavformat to open.
+    if (!std::experimental::filesystem::exists(path)) {
+        if (auto pack = TilePack::packContainingTile(path))
+            return GetPackedTileConfiguration(*pack, path);
+    }
+
     int result;
     char error[AV_ERROR_MAX_STRING_SIZE];
     auto context = avformat_alloc_context();
@@ -1,7 +1,12 @@
 #include "VideoManager.h"
 
+#include "CatalogStorage.h"
+#include "CoarsenTiles.h"
+#include "CompactTiles.h"
+#include "Files.h"
 #include "ImageUtilities.h"
 #include "MergeTiles.h"
+#include "OnlineCostModel.h"
 #include "TileLocationProvider.h"
 #include "TiledVideoManager.h"
 #include "ScanOperators.h"
@@ -10,6 +15,7 @@
 #include "SemanticIndex.h"
 #include "SemanticSelection.h"
 #include "SmartTileConfigurationProvider.h"
+#include "StoredTileSizes.h"
 #include "TemporalSelection.h"
 #include "TileOperators.h"
 #include "TransformToImage.h"
@@ -21,8 +27,11 @@
 namespace tasm {
 
 void VideoManager::createCatalogIfNecessary() {
-    if (!std::experimental::filesystem::exists(CatalogConfiguration::CatalogPath()))
-        std::experimental::filesystem::create_directory(CatalogConfiguration::CatalogPath());
+    CatalogStorage::forPath(configuration_.catalogPath())->createCatalog(configuration_.catalogPath());
+}
+
+std::shared_ptr<TiledEntry> VideoManager::entryForVideo(const std::string &video, const std::string &metadataIdentifier) const {
+    return std::make_shared<TiledEntry>(video, configuration_.pathForVideo(video), metadataIdentifier);
 }
 
 void VideoManager::store(const std::experimental::filesystem::path &path, const std::string &name) {
@@ -72,42 +81,176 @@ void VideoManager::storeTiledVideo(std::shared_ptr<Video> video, std::shared_ptr
     std::shared_ptr<ScanFileDecodeReader> scan(new ScanFileDecodeReader(video));
     std::shared_ptr<GPUDecodeFromCPU> decode(new GPUDecodeFromCPU(scan, video->configuration(), gpuContext_, lock_));
 
-    TileOperator tile(video, decode, tileLayoutProvider, savedName, video->configuration().frameRate, gpuContext_, lock_);
+    TileOperator tile(video, decode, tileLayoutProvider, entryForVideo(savedName), video->configuration().frameRate, gpuContext_, lock_);
     while (!tile.isComplete()) {
         tile.next();
     }
 }
 
+void VideoManager::deleteVideo(const std::string &video) {
+    std::scoped_lock retileLock(retileMutex_);
+    {
+        std::scoped_lock regretLock(regretMutex_);
+        videoToRegretAccumulator_.erase(video);
+        videosToRetileInBackground_.erase(video);
+        videosToRetileByStitching_.erase(video);
+        videosToCompactAfterRetiling_.erase(video);
+        videoToRetilingScheduler_.erase(video);
+    }
+
+    auto path = configuration_.pathForVideo(video);
+    CatalogStorage::forPath(path)->deleteVideo(path);
+    TiledVideoManagerCache::instance().invalidate(path);
+}
+
+// Retiling a GOP writes about as many bytes as the tiles that currently store it. Once it is retiled, this is what it wrote.
+static unsigned long long estimateBytesToRetileGOP(const TiledVideoManager &tiledVideoManager, unsigned int gop, unsigned int gopLength) {
+    auto layoutId = tiledVideoManager.tileLayoutIdForFrame(gop * gopLength);
+    auto &tileSizes = tiledVideoManager.tileSizesForId(layoutId);
+    auto bytes = std::accumulate(tileSizes.begin(), tileSizes.end(), 0ull);
+
+    // A tile directory can span multiple GOPs.
+    auto frames = TileFiles::firstAndLastFramesFromPath(tiledVideoManager.directoryIdToTileDirectory_.at(layoutId));
+    auto framesInDirectory = frames.second - frames.first + 1;
+    return bytes * std::min(gopLength, framesInDirectory) / framesInDirectory;
+}
+
 void VideoManager::retileVideoBasedOnRegret(const std::string &videoName) {
-    assert(videoToRegretAccumulator_.count(videoName));
+    std::scoped_lock retileLock(retileMutex_);
+    {
+        // Check before opening the entry, which would recreate the directory of a deleted video.
+        std::scoped_lock regretLock(regretMutex_);
+        if (!videoToRegretAccumulator_.count(videoName))
+            return;
+    }
 
-    auto tiledEntry = std::make_shared<TiledEntry>(videoName);
-    auto tiledVideoManager = std::make_shared<TiledVideoManager>(tiledEntry);
-    auto video = std::make_shared<Video>(tiledVideoManager->locationOfTileForId(0, 0));
-    auto gopLength = video->configuration().frameRate;
+    auto tiledEntry = entryForVideo(videoName);
+    auto tiledVideoManager = TiledVideoManagerCache::instance().tiledVideoManager(tiledEntry);
+    // GOPs are retiled from full frames.
+    auto tileLocationProvider = std::make_shared<FullFrameTileLocationProvider>(tiledVideoManager);
+    auto gopLength = video::GetConfiguration(tileLocationProvider->locationOfTileForFrame(0, 0))->frameRate;
+
+    std::shared_ptr<RegretAccumulator> regretAccumulator;
+    bool shouldRetileByStitching = false;
+    bool shouldCompact = false;
+    {
+        std::scoped_lock regretLock(regretMutex_);
+        // The video may have been deactivated after it was scheduled for background retiling.
+        if (!videoToRegretAccumulator_.count(videoName))
+            return;
+
+        regretAccumulator = videoToRegretAccumulator_.at(videoName);
+        shouldRetileByStitching = videosToRetileByStitching_.count(videoName);
+        shouldCompact = videosToCompactAfterRetiling_.count(videoName);
+    }
+
+    auto candidates = regretAccumulator->retilingCandidates();
+    // GOPs that are only stored as stitched tiles can't be read as full frames, so they keep their layout and
+    // their regret.
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](const RetilingCandidate &candidate) {
+        auto directory = tileLocationProvider->locationOfTileForFrame(0, candidate.gop * gopLength).parent_path();
+        if (!CatalogStorage::forPath(directory)->containsStitchedTiles(directory))
+            return false;
+        std::cout << "Not retiling GOP " << candidate.gop << " because its tiles were merged by stitching" << std::endl;
+        return true;
+    }), candidates.end());
+    {
+        std::scoped_lock regretLock(regretMutex_);
+        if (videoToRetilingScheduler_.count(videoName)) {
+            auto candidatesForPass = videoToRetilingScheduler_.at(videoName).candidatesForPass(candidates, [&](unsigned int gop) {
+                return estimateBytesToRetileGOP(*tiledVideoManager, gop, gopLength);
+            });
+            if (candidatesForPass.size() < candidates.size())
+                std::cout << "Deferring " << candidates.size() - candidatesForPass.size() << " GOPs to a later retiling pass" << std::endl;
+            candidates = std::move(candidatesForPass);
+        }
+    }
+    // Regret is only reset once each GOP's new layout is committed, so GOPs whose retile fails are tried again.
+    auto gopToLayouts = regretAccumulator->newGOPLayoutsForCandidates(candidates);
+    std::vector<unsigned int> retiledGOPs;
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto it = gopToLayouts->begin(); it != gopToLayouts->end();) {
+        auto firstFrame = it->first * gopLength;
+        auto lastFrame = std::min((it->first + 1) * gopLength - 1, tiledVideoManager->maximumFrame());
+        auto newLayout = it->second->tileLayoutForFrame(firstFrame);
+        if (shouldRetileByStitching && newLayout->isCoarseningOf(*tileLocationProvider->tileLayoutForFrame(firstFrame))) {
+            // Merging whole tiles only needs I/O.
+            coarsenTilesByStitching(tiledEntry, tileLocationProvider, *newLayout, firstFrame, lastFrame);
+            regretAccumulator->markGOPsAsRetiled({it->first});
+            retiledGOPs.push_back(it->first);
+            it = gopToLayouts->erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (!gopToLayouts->empty()) {
+        // Sort the GOPs because currently the way we scan goes in order of keyframes.
+        std::vector<unsigned int> gops;
+        for (auto it = gopToLayouts->begin(); it != gopToLayouts->end(); ++it)
+            gops.push_back(it->first);
+        std::sort(gops.begin(), gops.end());
+
+        // Read every frame of the GOPs being retiled, and nothing else.
+        auto frames = std::make_shared<std::vector<int>>();
+        for (auto gop : gops) {
+            for (auto frame = gop * gopLength; frame < (gop + 1) * gopLength && frame <= tiledVideoManager->maximumFrame(); ++frame)
+                frames->push_back(frame);
+        }
+
+        retileVideo(tiledEntry, tileLocationProvider, frames, gops.size(), std::make_shared<ConglomerationTileConfigurationProvider>(std::move(gopToLayouts), gopLength), videoName);
+        regretAccumulator->markGOPsAsRetiled(gops);
+        retiledGOPs.insert(retiledGOPs.end(), gops.begin(), gops.end());
+    }
 
-    auto gopToLayouts = videoToRegretAccumulator_.at(videoName)->getNewGOPLayouts();
-    // Because we re-tile the entire GOP, we only need to specify the first frame for each GOP.
-    auto frames = std::make_shared<std::vector<int>>();
-    for (auto it = gopToLayouts->begin(); it != gopToLayouts->end(); ++it)
-        frames->push_back(it->first * gopLength);
+    if (!retiledGOPs.empty()) {
+        // The budget is charged what the pass spent, measured by the time it took and the tiles it committed.
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        auto retiledVideoManager = TiledVideoManagerCache::instance().tiledVideoManager(tiledEntry);
+        unsigned long long bytesWritten = 0;
+        for (auto gop : retiledGOPs)
+            bytesWritten += estimateBytesToRetileGOP(*retiledVideoManager, gop, gopLength);
+
+        std::scoped_lock regretLock(regretMutex_);
+        if (videoToRetilingScheduler_.count(videoName))
+            videoToRetilingScheduler_.at(videoName).charge(elapsed.count(), bytesWritten);
+    }
 
-    // Sort the frames because currently the way we scan goes in order of keyframes.
-    // That should probably get more flexible, but for now sorting is easy.
-    std::sort(frames->begin(), frames->end());
+    if (shouldCompact)
+        compactVideoWithoutLocking(videoName);
+}
 
-    retileVideo(video, frames, std::make_shared<ConglomerationTileConfigurationProvider>(std::move(gopToLayouts), gopLength), videoName);
+void VideoManager::retileVideoBasedOnRegretInBackground(const std::string &video) {
+    backgroundRetiler_->schedule(video);
 }
 
-void VideoManager::retileVideo(std::shared_ptr<Video> video, std::shared_ptr<std::vector<int>> framesToRead, std::shared_ptr<TileLayoutProvider> newLayoutProvider, const std::string &savedName) {
-    // Set up scan of original video using specified frames. Re-tile entire GOPs, even if not every frame is specified.
-    auto scan = std::make_shared<ScanFramesFromFileDecodeReader>(video, framesToRead, true);
-    auto decode = std::make_shared<GPUDecodeFromCPU>(scan, video->configuration(), gpuContext_, lock_);
+void VideoManager::waitForBackgroundRetiling() {
+    backgroundRetiler_->waitUntilIdle();
+}
 
-    TileOperator tile(video, decode, newLayoutProvider, savedName, video->configuration().frameRate, gpuContext_, lock_);
+void VideoManager::retileVideo(std::shared_ptr<TiledEntry> entry,
+                               std::shared_ptr<TileLocationProvider> tileLocationProvider,
+                               std::shared_ptr<std::vector<int>> framesToRead,
+                               unsigned int numberOfGOPs,
+                               std::shared_ptr<TileLayoutProvider> newLayoutProvider,
+                               const std::string &savedName) {
+    // Stitch all of the stored tiles of each frame back into full frames, so GOPs can be retiled from any layout
+    // without going back to the original video.
+    auto scan = std::make_shared<ScanFullFramesFromTiledVideoOperator>(entry, framesToRead, tileLocationProvider);
+    auto configuration = scan->configuration();
+    auto decode = std::make_shared<GPUDecodeFromCPU>(scan, configuration, gpuContext_, lock_, configuration.maxWidth, configuration.maxHeight);
+
+    auto start = std::chrono::steady_clock::now();
+    auto video = std::make_shared<Video>(tileLocationProvider->locationOfTileForFrame(0, framesToRead->front()));
+    TileOperator tile(video, decode, newLayoutProvider, entryForVideo(savedName), configuration.frameRate, gpuContext_, lock_);
+    tile.reuseUnchangedTilesFrom(tileLocationProvider);
     while (!tile.isComplete()) {
         tile.next();
     }
+
+    auto pixelsPerFrame = static_cast<unsigned long long>(configuration.displayWidth) * configuration.displayHeight;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    OnlineCostModel::forCatalog(configuration_.catalogPath()).addEncodeObservation(pixelsPerFrame * framesToRead->size(), numberOfGOPs, elapsed.count());
 }
 
 std::unique_ptr<ImageIterator> VideoManager::select(const std::string &video,
@@ -116,15 +259,16 @@ std::unique_ptr<ImageIterator> VideoManager::select(const std::string &video,
                                                     std::shared_ptr<TemporalSelection> temporalSelection,
                                                     std::shared_ptr<SemanticIndex> semanticIndex,
                                                     SelectStrategy selectStrategy) {
-    std::shared_ptr<TiledEntry> entry(new TiledEntry(video, metadataIdentifier));
+    auto entry = entryForVideo(video, metadataIdentifier);
 
     // Set up scan of a tiled video.
-    std::shared_ptr<TiledVideoManager> tiledVideoManager(new TiledVideoManager(entry));
-    auto tileLocationProvider = std::make_shared<SingleTileLocationProvider>(tiledVideoManager);
+    auto tiledVideoManager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    std::shared_ptr<TileLocationProvider> tileLocationProvider = std::make_shared<SingleTileLocationProvider>(tiledVideoManager);
     auto semanticDataManager = std::make_shared<SemanticDataManager>(semanticIndex, metadataIdentifier, metadataSelection, temporalSelection, tiledVideoManager->totalWidth(), tiledVideoManager->totalHeight());
 
     std::shared_ptr<Operator<CPUEncodedFrameDataPtr>> scan;
     std::shared_ptr<TileLayoutProvider> tileLayoutProvider = tileLocationProvider;
+    std::shared_ptr<QueryTelemetry> telemetry;
 
     // Set up default configuration info.
     auto maxWidth = tiledVideoManager->largestWidth();
@@ -142,6 +286,7 @@ std::unique_ptr<ImageIterator> VideoManager::select(const std::string &video,
     configuration.maxHeight = maxHeight;
 
     if (selectStrategy == SelectStrategy::Frames) {
+        tileLocationProvider = std::make_shared<FullFrameTileLocationProvider>(tiledVideoManager);
         auto scanFullFrames = std::make_shared<ScanFullFramesFromTiledVideoOperator>(entry, semanticDataManager, tileLocationProvider);
         scan = scanFullFrames;
 
@@ -154,10 +299,16 @@ std::unique_ptr<ImageIterator> VideoManager::select(const std::string &video,
         maxWidth = configuration.maxWidth;
         maxHeight = configuration.maxHeight;
     } else {
-        scan = std::make_shared<ScanTiledVideoOperator>(entry, semanticDataManager, tileLocationProvider);
+        // Each GOP is read from whichever stored version of it is cheapest for this query.
+        tileLocationProvider = std::make_shared<CostBasedTileLocationProvider>(tiledVideoManager, semanticDataManager, configuration.frameRate);
+        tileLayoutProvider = tileLocationProvider;
+
+        // Decode times for tiled reads are used to keep the cost model's weights current.
+        telemetry = std::make_shared<QueryTelemetry>(OnlineCostModel::forCatalog(configuration_.catalogPath()));
+        scan = std::make_shared<ScanTiledVideoOperator>(entry, semanticDataManager, tileLocationProvider, false, telemetry);
     }
 
-    std::shared_ptr<GPUDecodeFromCPU> decode(new GPUDecodeFromCPU(scan, configuration, gpuContext_, lock_, maxWidth, maxHeight));
+    std::shared_ptr<GPUDecodeFromCPU> decode(new GPUDecodeFromCPU(scan, configuration, gpuContext_, lock_, maxWidth, maxHeight, telemetry));
     auto toRGB = std::make_shared<TransformToRGB>(decode);
 
     // Transform tiles to pixel blobs.
@@ -173,39 +324,179 @@ std::unique_ptr<ImageIterator> VideoManager::select(const std::string &video,
     // Transform pixels to RGB images.
     std::shared_ptr<TransformToImage> transform(new TransformToImage(mergeOperator, maxWidth, maxHeight));
 
-    // Accumulate regret for this query.
-    if (videoToRegretAccumulator_.count(video))
-        accumulateRegret(video, semanticDataManager, tileLocationProvider);
+    // Accumulate regret for this query. Estimating its cost only locks the video's accumulator, so queries of other
+    // videos aren't held up.
+    std::shared_ptr<RegretAccumulator> regretAccumulator;
+    bool shouldRetileInBackground = false;
+    {
+        std::scoped_lock regretLock(regretMutex_);
+        if (videoToRegretAccumulator_.count(video)) {
+            regretAccumulator = videoToRegretAccumulator_.at(video);
+            shouldRetileInBackground = videosToRetileInBackground_.count(video);
+        }
+    }
+    if (regretAccumulator)
+        accumulateRegret(*regretAccumulator, semanticDataManager, tileLocationProvider);
+    if (shouldRetileInBackground)
+        backgroundRetiler_->schedule(video);
 
     return std::make_unique<ImageIterator>(transform);
 }
 
-void VideoManager::accumulateRegret(const std::string &video, std::shared_ptr<SemanticDataManager> selection, std::shared_ptr<TileLayoutProvider> currentLayout) {
-    auto regretAccumulator = videoToRegretAccumulator_.at(video);
-
+void VideoManager::accumulateRegret(RegretAccumulator &regretAccumulator, std::shared_ptr<SemanticDataManager> selection, std::shared_ptr<TileLayoutProvider> currentLayout) {
     // Create a workload.
     auto workload = std::make_shared<Workload>(selection);
 
     // Add regret for this query and get GOPs that have accumulated enough regret to be re-tiled.
-    regretAccumulator->addRegretForQuery(workload, currentLayout);
+    regretAccumulator.addRegretForQuery(workload, currentLayout);
 }
 
-void VideoManager::activateRegretBasedRetilingForVideo(const std::string &video, const std::string &metadataIdentifier, std::shared_ptr<SemanticIndex> semanticIndex, double threshold) {
-    std::shared_ptr<TiledEntry> entry(new TiledEntry(video, metadataIdentifier));
-    std::shared_ptr<TiledVideoManager> tiledVideoManager(new TiledVideoManager(entry));
-    Video originalVideo(tiledVideoManager->locationOfTileForId(0, 0));
+void VideoManager::activateRegretBasedRetilingForVideo(const std::string &video, const std::string &metadataIdentifier, std::shared_ptr<SemanticIndex> semanticIndex, double threshold, bool retileInBackground) {
+    auto entry = entryForVideo(video, metadataIdentifier);
+    auto tiledVideoManager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    // The first version may have been compacted away, so the tile is found through the frame.
+    Video originalVideo(SingleTileLocationProvider(tiledVideoManager).locationOfTileForFrame(0, 0));
 
-    videoToRegretAccumulator_[video] = std::make_shared<RegretAccumulator>(
+    auto regretAccumulator = std::make_shared<RegretAccumulator>(
             semanticIndex,
             metadataIdentifier,
             tiledVideoManager->totalWidth(),
             tiledVideoManager->totalHeight(),
             originalVideo.configuration().frameRate,
-            threshold);
+            threshold,
+            OnlineCostModel::forCatalog(configuration_.catalogPath()));
+    // Pick up the regret accumulated before the last restart, and keep saving it alongside the video's tiles.
+    // Videos kept in memory don't outlive the process, so neither does their regret.
+    if (CatalogStorage::forPath(entry->path())->isPersistent())
+        regretAccumulator->persistTo(entry->path());
+
+    std::scoped_lock regretLock(regretMutex_);
+    videoToRegretAccumulator_[video] = regretAccumulator;
+    if (retileInBackground)
+        videosToRetileInBackground_.insert(video);
+    else
+        videosToRetileInBackground_.erase(video);
 }
 
 void VideoManager::deactivateRegretBasedRetilingForVideo(const std::string &video) {
+    std::scoped_lock regretLock(regretMutex_);
     videoToRegretAccumulator_.erase(video);
+    videosToRetileInBackground_.erase(video);
+}
+
+std::unique_ptr<QueryPlan> VideoManager::explain(const std::string &video,
+                                                 const std::string &metadataIdentifier,
+                                                 std::shared_ptr<MetadataSelection> metadataSelection,
+                                                 std::shared_ptr<TemporalSelection> temporalSelection,
+                                                 std::shared_ptr<SemanticIndex> semanticIndex,
+                                                 SelectStrategy selectStrategy) {
+    auto entry = entryForVideo(video, metadataIdentifier);
+    auto tiledVideoManager = TiledVideoManagerCache::instance().tiledVideoManager(entry);
+    std::shared_ptr<TileLocationProvider> tileLocationProvider = std::make_shared<SingleTileLocationProvider>(tiledVideoManager);
+    auto semanticDataManager = std::make_shared<SemanticDataManager>(semanticIndex, metadataIdentifier, metadataSelection, temporalSelection, tiledVideoManager->totalWidth(), tiledVideoManager->totalHeight());
+    auto gopLength = video::GetConfiguration(tileLocationProvider->locationOfTileForFrame(0, 0))->frameRate;
+    auto untiledLayout = std::make_shared<SingleTileConfigurationProvider>(tiledVideoManager->totalWidth(), tiledVideoManager->totalHeight());
+
+    // Build the same scan that select() would, but only ask it what it will read.
+    auto plan = std::make_unique<QueryPlan>();
+    std::shared_ptr<TileLayoutProvider> decodedLayout = tileLocationProvider;
+    if (selectStrategy == SelectStrategy::Frames) {
+        tileLocationProvider = std::make_shared<FullFrameTileLocationProvider>(tiledVideoManager);
+        ScanFullFramesFromTiledVideoOperator scan(entry, semanticDataManager, tileLocationProvider);
+        plan->tileReads = scan.plannedTileReads();
+
+        // The tiles are stitched, so the decoder only sees full frames.
+        plan->tileResolutions.emplace_back(tiledVideoManager->totalWidth(), tiledVideoManager->totalHeight());
+        decodedLayout = untiledLayout;
+    } else {
+        tileLocationProvider = std::make_shared<CostBasedTileLocationProvider>(tiledVideoManager, semanticDataManager, gopLength);
+        decodedLayout = tileLocationProvider;
+        ScanTiledVideoOperator scan(entry, semanticDataManager, tileLocationProvider);
+        plan->tileReads = scan.plannedTileReads();
+        plan->setTileResolutionsFromReads();
+    }
+
+    auto workload = std::make_shared<Workload>(semanticDataManager);
+    auto storedTileSizes = std::make_shared<StoredTileSizes>(tileLocationProvider);
+    plan->estimatedCost = WorkloadCostEstimator(decodedLayout, workload, gopLength, ThreadPool::shared(), storedTileSizes).estimateCostForQuery(0);
+    plan->untiledCost = WorkloadCostEstimator(untiledLayout, workload, gopLength, ThreadPool::shared(), storedTileSizes).estimateCostForQuery(0);
+
+    auto &costModel = OnlineCostModel::forCatalog(configuration_.catalogPath());
+    auto decodeSeconds = [&](const CostElements &cost) {
+        return costModel.decodeSecondsPerPixel() * cost.numPixels + costModel.decodeSecondsPerTile() * cost.numTiles;
+    };
+    plan->estimatedDecodeSeconds = decodeSeconds(plan->estimatedCost);
+    plan->untiledDecodeSeconds = decodeSeconds(plan->untiledCost);
+    return plan;
+}
+
+void VideoManager::setRetilingBudgetForVideo(const std::string &video, RetilingBudget budget) {
+    std::scoped_lock regretLock(regretMutex_);
+    videoToRetilingScheduler_[video].setBudget(budget);
+}
+
+RegretAccumulator &VideoManager::regretAccumulatorForVideo(const std::string &video) {
+    auto regretAccumulator = videoToRegretAccumulator_.find(video);
+    if (regretAccumulator == videoToRegretAccumulator_.end())
+        throw std::runtime_error("Regret-based retiling is not activated for video " + video);
+    return *regretAccumulator->second;
+}
+
+void VideoManager::setRegretCostModelForVideo(const std::string &video, RegretCostModel costModel) {
+    std::scoped_lock regretLock(regretMutex_);
+    regretAccumulatorForVideo(video).setCostModel(costModel);
+}
+
+void VideoManager::setRegretDecayForVideo(const std::string &video, double decay) {
+    std::scoped_lock regretLock(regretMutex_);
+    regretAccumulatorForVideo(video).setRegretDecay(decay);
+}
+
+void VideoManager::compactVideo(const std::string &video, CompactionPolicy policy) {
+    std::scoped_lock retileLock(retileMutex_);
+    compactVideoWithoutLocking(video, policy);
+}
+
+void VideoManager::compactVideoWithoutLocking(const std::string &video, CompactionPolicy policy) {
+    // Opening the entry would create the directory of a deleted video.
+    if (!std::experimental::filesystem::exists(configuration_.pathForVideo(video)))
+        return;
+
+    auto statistics = compactTiles(entryForVideo(video), policy);
+    std::cout << "Compacted " << video << ": merged " << statistics.numberOfMergedDirectories
+              << " directories, removed " << statistics.numberOfRemovedDirectories
+              << ", deleted " << statistics.numberOfDeletedDirectories << std::endl;
+}
+
+void VideoManager::setCompactAfterRetilingForVideo(const std::string &video, bool compactAfterRetiling) {
+    std::scoped_lock regretLock(regretMutex_);
+    if (compactAfterRetiling)
+        videosToCompactAfterRetiling_.insert(video);
+    else
+        videosToCompactAfterRetiling_.erase(video);
+}
+
+void VideoManager::setPackTilesForVideo(const std::string &video, bool packTiles) {
+    // Unlike the other settings, this is stored with the video, so it applies to every writer of its tiles.
+    auto path = configuration_.pathForVideo(video);
+    std::experimental::filesystem::create_directories(path);
+    if (packTiles)
+        std::ofstream marker(TileFiles::packTilesMarkerFilename(path));
+    else
+        std::experimental::filesystem::remove(TileFiles::packTilesMarkerFilename(path));
+}
+
+void VideoManager::setRetileByStitchingForVideo(const std::string &video, bool retileByStitching) {
+    std::scoped_lock regretLock(regretMutex_);
+    if (retileByStitching)
+        videosToRetileByStitching_.insert(video);
+    else
+        videosToRetileByStitching_.erase(video);
+}
+
+void VideoManager::setRegretHistoryLengthForVideo(const std::string &video, unsigned int historyLength) {
+    std::scoped_lock regretLock(regretMutex_);
+    regretAccumulatorForVideo(video).setHistoryLength(historyLength);
 }
 
 } // namespace tasm
\ No newline at end of file